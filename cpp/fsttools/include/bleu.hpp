@@ -7,6 +7,7 @@
 #include <boost/thread/mutex.hpp>
 #include <unordered_map>
 #include <boost/functional/hash.hpp>
+#include <algorithm>
 
 typedef boost::iostreams::stream_buffer<boost::iostreams::file_descriptor_sink> pipe_out;
 typedef boost::iostreams::stream_buffer<boost::iostreams::file_descriptor_source> pipe_in;
@@ -133,11 +134,9 @@ public:
     if (it == cacheMap.end()) {
       return false;
     }
-    EntryPair entry = *(it->second);
-    cacheList.erase(it->second);
-    cacheList.push_front(entry);
-    cacheMap[hyp] = cacheList.begin();
-    bs = entry.second;
+    // move to the front; list iterators stay valid
+    cacheList.splice(cacheList.begin(), cacheList, it->second);
+    bs = it->second->second;
     return true;
   }
 
@@ -147,11 +146,8 @@ public:
       BleuStats zero;
       return zero;
     }
-    EntryPair entry = *(it->second);
-    cacheList.erase(it->second);
-    cacheList.push_front(entry);
-    cacheMap[hyp] = cacheList.begin();
-    return entry.second;
+    cacheList.splice(cacheList.begin(), cacheList, it->second);
+    return it->second->second;
   }
 
 private:
@@ -162,6 +158,136 @@ private:
 };
 
 
+/**
+ * \brief Reference n-grams of one sentence, compiled into a flat table
+ * sorted by n-gram hash. Words of each n-gram are kept to check hash matches.
+ * Read-only once built.
+ */
+class RefNGramTable {
+ public:
+  RefNGramTable() {};
+
+  ///Hash of an n-gram of order (length) n
+  static inline uint64_t Hash ( const Wid *ngram, unsigned n ) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ n;
+    for ( unsigned k = 0; k < n; ++k )
+      h = ( h ^ ( uint64_t ) ngram[k] ) * 0x100000001b3ULL;
+    return h ^ ( h >> 29 );
+  }
+
+  ///Builds the table from n-gram counts
+  template<class NGramToCountMapT>
+  void Build ( NGramToCountMapT const& counts ) {
+    entries_.clear();
+    words_.clear();
+    entries_.reserve ( counts.size() );
+    for ( typename NGramToCountMapT::const_iterator it = counts.begin();
+          it != counts.end(); ++it ) {
+      Entry e;
+      e.hash = Hash ( &it->first[0], it->first.size() );
+      e.count = it->second;
+      e.offset = words_.size();
+      e.order = it->first.size();
+      words_.insert ( words_.end(), it->first.begin(), it->first.end() );
+      entries_.push_back ( e );
+    }
+    std::sort ( entries_.begin(), entries_.end() );
+  }
+
+  ///Index of the n-gram of order n, or -1 if not in the references
+  inline int Find ( const Wid *ngram, unsigned n ) const {
+    uint64_t h = Hash ( ngram, n );
+    Entry e;
+    e.hash = h;
+    for ( std::vector<Entry>::const_iterator it = std::lower_bound ( entries_.begin()
+          , entries_.end(), e ); it != entries_.end() && it->hash == h; ++it ) {
+      if ( it->order == n
+           && std::equal ( ngram, ngram + n, words_.begin() + it->offset ) )
+        return it - entries_.begin();
+    }
+    return -1;
+  }
+
+  ///Clipping count of entry k
+  inline unsigned Count ( int k ) const {
+    return entries_[k].count;
+  }
+
+  inline std::size_t size() const {
+    return entries_.size();
+  }
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    unsigned count;
+    unsigned offset;
+    unsigned order;
+    bool operator< ( Entry const& e ) const {
+      return hash < e.hash;
+    }
+  };
+  std::vector<Entry> entries_;
+  std::vector<Wid> words_;
+};
+
+/**
+ * \brief Clipped n-gram hits of a hypothesis against a RefNGramTable.
+ * Keeps the counts of the last hypothesis, so that only words after
+ * the prefix shared with the next one are (un)counted.
+ * Not thread-safe: use one object per thread.
+ */
+class IncrementalBleuHits {
+ public:
+  explicit IncrementalBleuHits ( RefNGramTable const& refs )
+    : refs_ ( refs )
+    , counts_ ( refs.size(), 0 ) {
+    std::fill ( hits_, hits_ + BleuStats::MAX_BLEU_ORDER, 0 );
+  }
+
+  ///Sets a new hypothesis
+  void Set ( SentenceIdx const& hyp ) {
+    std::size_t prefix = 0;
+    while ( prefix < hyp.size() && prefix < hyp_.size()
+            && hyp[prefix] == hyp_[prefix] ) ++prefix;
+    while ( hyp_.size() > prefix ) {
+      for ( unsigned n = 0; n < BleuStats::MAX_BLEU_ORDER; ++n ) {
+        int k = matches_.back();
+        matches_.pop_back();
+        if ( k < 0 ) continue;
+        if ( counts_[k]-- <= refs_.Count ( k ) ) --hits_[n];
+      }
+      hyp_.pop_back();
+    }
+    for ( std::size_t e = prefix; e < hyp.size(); ++e ) {
+      hyp_.push_back ( hyp[e] );
+      // n-grams ending at e, in decreasing order so they are popped in increasing order
+      for ( int n = BleuStats::MAX_BLEU_ORDER - 1; n >= 0; --n ) {
+        int k = ( ( std::size_t ) n <= e ) ? refs_.Find ( &hyp_[e - n], n + 1 ) : -1;
+        matches_.push_back ( k );
+        if ( k >= 0 && ++counts_[k] <= refs_.Count ( k ) ) ++hits_[n];
+      }
+    }
+  }
+
+  ///Clipped hits of order n+1
+  inline int Hits ( unsigned n ) const {
+    return hits_[n];
+  }
+
+  inline std::size_t size() const {
+    return hyp_.size();
+  }
+
+ private:
+  RefNGramTable const& refs_;
+  std::vector<unsigned> counts_;
+  SentenceIdx hyp_;
+  ///For each word, the table entries of the n-grams ending there (-1 if none)
+  std::vector<int> matches_;
+  int hits_[BleuStats::MAX_BLEU_ORDER];
+};
+
 class BleuScorer {
 public:
   typedef std::vector<Wid> NGram;
@@ -174,7 +300,7 @@ public:
   BleuScorer(std::string const & refFiles, std::string const & extTokCmd,
 	     unsigned int const & cacheSize, bool const & intRefs,
 	     std::string const & wordMapFile) : 
-    chits_(0), cmisses_(0), intRefs_(intRefs){
+    intRefs_(intRefs){
     useCache_ = (cacheSize > 0);
     externalTokenizer_ = (extTokCmd.size() > 0);
     useWidMap_ = false;
@@ -216,6 +342,11 @@ public:
       intOut = new std::ostream(pOut);
     }
     LoadReferences(refFiles);
+    refTables_.resize( refCounts.size() );
+    for (unsigned k = 0; k < refCounts.size(); ++k)
+      refTables_[k].Build( refCounts[k] );
+    chits_.resize( refCounts.size(), 0 );
+    cmisses_.resize( refCounts.size(), 0 );
     if (useCache_) {
       bleuStatsCache.resize( refCounts.size()  );
       FORCELINFO("bleu stats cache size: " << cacheSize << " x " << refCounts.size());
@@ -246,7 +377,7 @@ public:
 	  refLengths[nrk].push_back( sidx.size() );
 	  for (NGramToCountMap::const_iterator it = ngc.begin(); it != ngc.end(); it++) {
 	    NGramToCountMap::const_iterator it2 = refCounts[nrk].find(it->first);
-	    if (it2 == refCounts[k].end()) {
+	    if (it2 == refCounts[nrk].end()) {
 	      refCounts[nrk][it->first] = it->second;
 	    } else {
 	      refCounts[nrk][it->first] = std::max(refCounts[nrk][it->first], it->second);
@@ -273,9 +404,14 @@ public:
 
   string CacheStats() {
     std::ostringstream os;
-    os << "BleuStats Cache Stats: Cache Hits=" << chits_ << "; Cache Misses=" << cmisses_ << "; Rate=";
+    unsigned long chits = 0, cmisses = 0;
+    for (unsigned k = 0; k < chits_.size(); ++k) {
+      chits += chits_[k];
+      cmisses += cmisses_[k];
+    }
+    os << "BleuStats Cache Stats: Cache Hits=" << chits << "; Cache Misses=" << cmisses << "; Rate=";
     os.precision(3);
-    os << (float) chits_ / (float) (chits_ + cmisses_);
+    os << (float) chits / (float) (chits + cmisses);
     return os.str();
   }
 
@@ -293,30 +429,39 @@ public:
     return rL;
   }
 
+  ///Reference n-grams of sentence sid
+  RefNGramTable const& RefNGrams ( const Sid sid ) const {
+    return refTables_[sid];
+  }
+
   BleuStats SentenceBleuStats ( const Sid sid, const SentenceIdx& hypIdx ) {
+    IncrementalBleuHits hits ( refTables_[sid] );
+    return SentenceBleuStats ( sid, hypIdx, hits );
+  }
+
+  /**
+   * \brief Bleu stats of a hypothesis, counting n-grams with hits,
+   * which must have been created for the references of sid.
+   * Calls for different sentences may run concurrently, with one hits object
+   * per thread. Calls for the same sentence may not.
+   */
+  BleuStats SentenceBleuStats ( const Sid sid, const SentenceIdx& hypIdx
+                                , IncrementalBleuHits& hits ) {
     BleuStats bs;
     if (useCache_ && bleuStatsCache[sid].get(hypIdx, bs)) {
-      chits_++;
+      chits_[sid]++;
       return bs;
     }
-    cmisses_++;
-    SentenceIdx hyp = (externalTokenizer_) ? HypExternalTokenizer(hypIdx) : hypIdx;
-    bs.refLength_ = ClosestReferenceLength ( sid, hyp.size() );
+    cmisses_[sid]++;
+    if (externalTokenizer_)
+      hits.Set ( HypExternalTokenizer(hypIdx) );
+    else
+      hits.Set ( hypIdx );
+    bs.refLength_ = ClosestReferenceLength ( sid, hits.size() );
     for ( unsigned int n = 0; n < BleuStats::MAX_BLEU_ORDER
-	    && n < hyp.size(); ++n ) {
-      NGramToCountMap hypCounts;
-      if ( hyp.size() > n ) {
-        bs.tots_[n] = hyp.size() - n;
-      }
-      for ( unsigned int i = 0; i < hyp.size() - n; ++i ) {
-        hypCounts[SubStr ( hyp, i, n )]++;
-      }
-      for ( NGramToCountMap::const_iterator hit = hypCounts.begin();
-            hit != hypCounts.end(); ++hit ) {
-        NGramToCountMap::const_iterator rit = refCounts[sid].find ( hit->first );
-        bs.hits_[n] += std::min ( rit == refCounts[sid].end() ? 0 : rit->second,
-                                  hit->second ); // Sum clipped counts
-      }
+	    && n < hits.size(); ++n ) {
+      bs.tots_[n] = hits.size() - n;
+      bs.hits_[n] = hits.Hits ( n );
     }
     if (useCache_)
       bleuStatsCache[sid].insert(hypIdx, bs);
@@ -377,8 +522,10 @@ private:
   bool intRefs_;
   boost::mutex mutex;
   std::vector< LRUCache > bleuStatsCache;
-  unsigned int chits_;
-  unsigned int cmisses_;
+  std::vector< RefNGramTable > refTables_;
+  // per sentence, so that sentences can be scored concurrently
+  std::vector< unsigned int > chits_;
+  std::vector< unsigned int > cmisses_;
   bool useCache_;
 
   // n.b. not to be multithreaded - references are loaded only once by main
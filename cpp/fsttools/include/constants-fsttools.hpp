@@ -24,6 +24,9 @@ std::string const kLmLoad = "lm.load";
 std::string const kLmWordmap = "lm.wordmap";
 std::string const kLmWordPenalty = "lm.wps";
 std::string const kLmLogTen = "lm.log10";
+std::string const kLmCacheSize = "lm.cachesize";
+std::string const kLmMaxMemory = "lm.maxmemory";
+std::string const kLmPrefetch = "lm.prefetch";
 
 std::string const kLatticeLoad = "lattice.load";
 std::string const kLatticeLoadDeleteLmCost = "lattice.load.deletelmcost";
@@ -43,6 +46,7 @@ std::string const kRecaserLmFeatureweight = "recaser.lm.scale";
 std::string const kRecaserUnimapLoad = "recaser.unimap.load";
 std::string const kRecaserUnimapWeight = "recaser.unimap.scale";
 std::string const kRecaserPrune = "recaser.prune";
+std::string const kRecaserLmCacheSize = "recaser.lm.cachesize";
 std::string const kRecaserInput = "recaser.input";
 std::string const kRecaserInputExtended = kRecaserInput + ",i";
 std::string const kRecaserOutput = "recaser.output";
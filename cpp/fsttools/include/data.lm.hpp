@@ -24,10 +24,19 @@
 
 #include <wordmapper.hpp>
 #include <idbridge.hpp>
+#include <fstutils.applylmonthefly.cache.hpp>
 
 namespace ucam {
 namespace fsttools {
 
+/// Returns a different id each time a language model is loaded in this process.
+inline uint64_t newLanguageModelId() {
+  static boost::mutex mutex;
+  static uint64_t id = 0;
+  boost::mutex::scoped_lock lock ( mutex );
+  return ++id;
+};
+
 /**
  * \brief Language Model data structure
  */
@@ -35,6 +44,7 @@ namespace fsttools {
 struct KenLMData {
   KenLMData() :
     model ( NULL ),
+    id ( 0 ),
     lmscale ( 1.0f ),
     lmwp (0.0f),
     wm (NULL) {
@@ -42,10 +52,15 @@ struct KenLMData {
 
   ///KenLM
   lm::base::Model * model;
+  ///Identifies the model currently loaded, so that users
+  ///can tell whether it has been replaced (e.g. sentence-specific models).
+  uint64_t id;
   // Pointer to target grammar wordmap, if provided.
   ucam::util::WordMapper *wm;
   // map from target grammar ids to kenlm ids.
   IdBridge idb;
+  ///Score cache shared by all threads using this model, if enabled
+  boost::shared_ptr<fst::LmScoreCacheInterface> cache;
   ///Scales applied to each model
   float lmscale;
   float lmwp;
@@ -0,0 +1,216 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use these files except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copyright 2012 - Gonzalo Iglesias, Adrià de Gispert, William Byrne
+
+#ifndef DATA_LM_REGISTRY_HPP
+#define DATA_LM_REGISTRY_HPP
+
+/**
+ * \file
+ * \brief Language models shared by several threads, e.g. sentence-specific
+ * models in multithreaded translation.
+ */
+
+namespace ucam {
+namespace fsttools {
+
+/**
+ * \brief Thread-safe registry of loaded language models.
+ * Each model is loaded once per key and shared by all threads asking for it.
+ * Models are reference counted: one is only released once no thread holds it and
+ * either the memory cap is exceeded (least recently used first) or the registry
+ * is deleted. Models in use are never released, so the cap may be temporarily exceeded.
+ * Optionally, models can be loaded in the background before they are needed.
+ */
+class LanguageModelRegistry {
+ public:
+  typedef boost::shared_ptr<KenLMData const> KenLMDataPtr;
+
+ private:
+  struct Entry {
+    KenLMDataPtr data;
+    std::size_t bytes;
+    uint64_t lastused;
+    bool loading;
+  };
+
+  boost::mutex mutex_;
+  ///Notifies that a model has been loaded
+  boost::condition_variable loaded_;
+  unordered_map<std::string, Entry> entries_;
+  ///Memory cap in bytes. 0 means no limit
+  std::size_t capacity_;
+  ///Memory used by the models kept
+  std::size_t size_;
+  uint64_t tick_;
+  ///Number of models loaded so far
+  std::size_t numloads_;
+
+  ///Background loader. Declared last, so pending loads finish before anything else is deleted.
+  boost::scoped_ptr<ucam::util::TrivialThreadPool> prefetcher_;
+
+  static void release ( KenLMData *kld ) {
+    delete kld->model;
+    delete kld;
+  };
+
+  template<class LoaderT>
+  struct PrefetchFunctor {
+    LanguageModelRegistry *registry_;
+    std::string key_;
+    std::size_t bytes_;
+    LoaderT loader_;
+    PrefetchFunctor ( LanguageModelRegistry *registry, std::string const& key
+                      , std::size_t bytes, LoaderT const& loader )
+      : registry_ ( registry )
+      , key_ ( key )
+      , bytes_ ( bytes )
+      , loader_ ( loader ) {
+    };
+    /// Failures are only reported: the model is loaded again if it is actually needed.
+    void operator() () {
+      try {
+        registry_->get ( key_, bytes_, loader_ );
+      } catch ( std::exception const& e ) {
+        LWARN ( "Could not prefetch language model " << key_ << ": " << e.what() );
+      } catch ( ... ) {
+        LWARN ( "Could not prefetch language model " << key_ );
+      }
+    };
+  };
+
+  /**
+   * \brief Drops least recently used models nobody holds until memory fits in the cap.
+   * Must be called with the lock held. Models are handed over to released, so that
+   * they are actually deleted once the lock is released.
+   */
+  void evict ( std::vector<KenLMDataPtr>& released ) {
+    while ( capacity_ && size_ > capacity_ ) {
+      unordered_map<std::string, Entry>::iterator victim = entries_.end();
+      for ( unordered_map<std::string, Entry>::iterator itx = entries_.begin();
+            itx != entries_.end(); ++itx ) {
+        if ( itx->second.loading || !itx->second.data.unique() ) continue;
+        if ( victim == entries_.end()
+             || itx->second.lastused < victim->second.lastused )
+          victim = itx;
+      }
+      if ( victim == entries_.end() ) return; // All in use
+      LINFO ( "Releasing language model " << victim->first );
+      size_ -= victim->second.bytes;
+      released.push_back ( victim->second.data );
+      entries_.erase ( victim );
+    }
+  };
+
+ public:
+  /**
+   * \param capacity         Memory cap, in bytes (0 for no limit).
+   * \param prefetchthreads  Number of threads loading models in the background.
+   */
+  explicit LanguageModelRegistry ( std::size_t capacity = 0
+                                   , unsigned prefetchthreads = 0 )
+    : capacity_ ( capacity )
+    , size_ ( 0 )
+    , tick_ ( 0 )
+    , numloads_ ( 0 ) {
+    if ( prefetchthreads )
+      prefetcher_.reset ( new ucam::util::TrivialThreadPool ( prefetchthreads ) );
+  };
+
+  /**
+   * \brief Returns the model for key, calling loader if not available.
+   * If another thread is already loading it, waits for it.
+   * If the loader throws, the exception is passed on and waiting threads try to load it themselves.
+   * \param bytes   Estimated memory of the model
+   * \param loader  Functor returning a new KenLMData object; the registry takes ownership.
+   */
+  template<class LoaderT>
+  KenLMDataPtr get ( std::string const& key, std::size_t bytes
+                     , LoaderT const& loader ) {
+    boost::unique_lock<boost::mutex> lock ( mutex_ );
+    unordered_map<std::string, Entry>::iterator itx;
+    while ( ( itx = entries_.find ( key ) ) != entries_.end() ) {
+      if ( !itx->second.loading ) {
+        itx->second.lastused = ++tick_;
+        return itx->second.data;
+      }
+      loaded_.wait ( lock );
+    }
+    Entry& e = entries_[key];
+    e.loading = true;
+    e.bytes = bytes;
+    lock.unlock();
+    KenLMDataPtr p;
+    try {
+      p = KenLMDataPtr ( loader(), &LanguageModelRegistry::release );
+    } catch ( ... ) {
+      lock.lock();
+      entries_.erase ( key );
+      loaded_.notify_all();
+      throw;
+    }
+    std::vector<KenLMDataPtr> released;
+    lock.lock();
+    Entry& f = entries_[key];
+    f.data = p;
+    f.loading = false;
+    f.lastused = ++tick_;
+    size_ += f.bytes;
+    ++numloads_;
+    evict ( released );
+    loaded_.notify_all();
+    lock.unlock();
+    return p;
+  };
+
+  /**
+   * \brief Loads the model for key in the background, unless it is available already.
+   * Does nothing if the registry has no prefetching threads.
+   */
+  template<class LoaderT>
+  void prefetch ( std::string const& key, std::size_t bytes
+                  , LoaderT const& loader ) {
+    if ( prefetcher_.get() == NULL ) return;
+    {
+      boost::lock_guard<boost::mutex> lock ( mutex_ );
+      if ( entries_.find ( key ) != entries_.end() ) return;
+    }
+    ( *prefetcher_ ) ( PrefetchFunctor<LoaderT> ( this, key, bytes, loader ) );
+  };
+
+  ///Number of models currently kept
+  std::size_t size() {
+    boost::lock_guard<boost::mutex> lock ( mutex_ );
+    return entries_.size();
+  };
+
+  ///Number of models loaded since the registry was created
+  std::size_t numLoads() {
+    boost::lock_guard<boost::mutex> lock ( mutex_ );
+    return numloads_;
+  };
+
+  ///Memory used by the models kept, as estimated by users
+  std::size_t memory() {
+    boost::lock_guard<boost::mutex> lock ( mutex_ );
+    return size_;
+  };
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN ( LanguageModelRegistry );
+};
+
+}
+} // end namespaces
+
+#endif
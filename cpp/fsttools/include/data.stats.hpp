@@ -112,6 +112,15 @@ struct StatsData {
   /// Any other general stuff appended here -- to be printed in stats file.
   std::string message;
 
+  /// Hits and misses of language model score caches, for each language model.
+  /// Caches are shared across sentences, so these are running totals.
+  unordered_map<std::string, std::pair<uint64_t, uint64_t> > lmcache;
+
+  inline void setLmCacheStats ( const std::string& key, uint64_t hits,
+                                uint64_t misses ) {
+    lmcache[key] = std::pair<uint64_t, uint64_t> ( hits, misses );
+  };
+
   ///Store absolute timing value last thing, just before executing
   inline void setTimeStart ( const std::string& key ) {
     timeb t;
@@ -155,6 +164,22 @@ struct StatsData {
       o << " ms  (" << itx->second.size() << " times )" << std::endl;
     }
   }
+
+  /**
+   * \brief Dumps hit rates of language model score caches, one per line:
+   * key:hits lookups (rate)
+   */
+  void writeLmCacheStats ( ucam::util::oszfstream& o ) {
+    for ( unordered_map<std::string, std::pair<uint64_t, uint64_t> >::iterator itx =
+            lmcache.begin(); itx != lmcache.end(); ++itx ) {
+      uint64_t lookups = itx->second.first + itx->second.second;
+      o << std::setw ( 30 ) << setiosflags ( std::ios::right ) << itx->first << ":";
+      o << std::setw ( 12 ) << itx->second.first;
+      o << std::setw ( 12 ) << lookups;
+      o << " (" << ( lookups ? 100.0 * itx->second.first / lookups : 0.0 )
+        << "% hits)" << std::endl;
+    }
+  }
 };
 
 }
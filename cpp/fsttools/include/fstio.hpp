@@ -159,40 +159,62 @@ struct Hyp {
 };
 
 /**
- * \brief Traverses an fst and stores the hypotheses
- * in a vector. Typically the fst is the result of ShortestPath.
+ * \brief Traverses an fst and hands over each hypothesis to f as soon as it is read,
+ * so that hypotheses do not need to be stored. Typically the fst is the result of ShortestPath,
+ * in which case hypotheses are read in the order ShortestPath found them.
  * The fst should not have cycles.
  * \param fst The input fst, typically a lattice resulting from ShortestPath,
  * without cycle.
- * \param hyps The resulting hypotheses.
+ * \param f Functor called with each hypothesis (HypT const&).
  */
-template <class Arc, class HypT>
-void printStrings (const VectorFst<Arc>& fst, std::vector<HypT>* hyps) {
-
+template <class Arc, class HypT, class FunctorT>
+void streamStrings (const VectorFst<Arc>& fst, FunctorT& f) {
   typename Arc::StateId start = fst.Start();
+  if (start == kNoStateId) return;
+  std::basic_string<unsigned> hyp, ohyp;
   for (ArcIterator<VectorFst<Arc> > ai (fst, start); !ai.Done(); ai.Next() ) {
-    std::basic_string<unsigned> hyp, ohyp;
-    Arc a = ai.Value();
-    hyp.push_back (a.ilabel);
-    ohyp.push_back (a.olabel);
+    Arc const& a = ai.Value();
+    hyp.assign (1, a.ilabel);
+    ohyp.assign (1, a.olabel);
     typename Arc::Weight w = a.weight;
     typename Arc::StateId nextState = a.nextstate;
-    ArcIterator<VectorFst<Arc> >* ai2 =
-      new ArcIterator<VectorFst<Arc> > (fst, nextState);
-    while (!ai2->Done() ) {
-      Arc a2 = ai2->Value();
+    for (;;) {
+      ArcIterator<VectorFst<Arc> > ai2 (fst, nextState);
+      if (ai2.Done() ) break;
+      Arc const& a2 = ai2.Value();
       hyp.push_back (a2.ilabel);
       ohyp.push_back (a2.olabel);
       w = Times (w, a2.weight);
       nextState = a2.nextstate;
-      delete ai2;
-      ai2 = new ArcIterator<VectorFst<Arc> > (fst, nextState);
     }
-    delete ai2;
-    hyps->push_back (HypT (hyp, ohyp, w) );
+    f (HypT (hyp, ohyp, w) );
   }
 }
 
+///Functor for streamStrings that stores the hypotheses in a vector.
+template <class HypT>
+struct StoreStrings {
+  std::vector<HypT>* hyps_;
+  explicit StoreStrings (std::vector<HypT>* hyps) : hyps_ (hyps) {}
+  inline void operator() (HypT const& h) {
+    hyps_->push_back (h);
+  }
+};
+
+/**
+ * \brief Traverses an fst and stores the hypotheses
+ * in a vector. Typically the fst is the result of ShortestPath.
+ * The fst should not have cycles.
+ * \param fst The input fst, typically a lattice resulting from ShortestPath,
+ * without cycle.
+ * \param hyps The resulting hypotheses.
+ */
+template <class Arc, class HypT>
+void printStrings (const VectorFst<Arc>& fst, std::vector<HypT>* hyps) {
+  StoreStrings<HypT> store (hyps);
+  streamStrings<Arc, HypT> (fst, store);
+}
+
 } // end namespace
 
 #endif // FSTIO_HPP
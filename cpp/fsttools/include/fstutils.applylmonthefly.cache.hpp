@@ -0,0 +1,210 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use these files except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copyright 2012 - Gonzalo Iglesias, Adrià de Gispert, William Byrne
+
+#ifndef FSTUTILS_APPLYLMONTHEFLY_CACHE_HPP
+#define FSTUTILS_APPLYLMONTHEFLY_CACHE_HPP
+
+/**
+ * \file
+ * \brief Language model score cache shared across threads and sentences
+ * \remarks The cache sits between on-the-fly composition and a kenlm model.
+ * Slots are direct-mapped, i.e. a new entry simply overwrites the previous one,
+ * so memory is fixed at construction time. Slots are split in stripes, each
+ * one with its own lock, so that concurrent compositions rarely contend.
+ */
+
+#include <fstutils.applylmonthefly.statetable.hpp>
+
+namespace fst {
+
+/**
+ * \brief Type independent handle to a score cache,
+ * so that it can be stored next to the model it belongs to.
+ */
+class LmScoreCacheInterface {
+ public:
+  virtual uint64_t hits() const = 0;
+  virtual uint64_t misses() const = 0;
+  /// Empties the cache, e.g. if the language model changes
+  virtual void clear() = 0;
+  virtual ~LmScoreCacheInterface() {};
+};
+
+/// Number of words of a kenlm state that identify it.
+template<class StateT>
+struct LmCacheKey {
+  static inline unsigned size ( StateT const& state ) {
+    return state.length;
+  };
+};
+
+// nplm states have a fixed size. For bilingual models
+// this includes the source window.
+template<>
+struct LmCacheKey<lm::np::State> {
+  static inline unsigned size ( lm::np::State const& ) {
+    return NPLM_MAX_ORDER - 1;
+  };
+};
+
+/**
+ * \brief Caches lm scores, i.e. (state, word) -> (score, next state).
+ * Memory is bounded by the number of bytes requested at construction.
+ */
+template<class StateT>
+class LmScoreCache : public LmScoreCacheInterface {
+ private:
+  struct Entry {
+    StateT current;
+    StateT next;
+    lm::WordIndex word;
+    float score;
+    bool used;
+  };
+  struct Stripe {
+    boost::mutex mutex;
+    std::vector<Entry> entries;
+    uint64_t hits;
+    uint64_t misses;
+  };
+  boost::scoped_array<Stripe> stripes_;
+  unsigned numstripes_;
+  std::size_t mask_;
+
+  inline uint64_t hash ( StateT const& state, lm::WordIndex word ) const {
+    unsigned size = LmCacheKey<StateT>::size ( state );
+    uint64_t h = ( ( uint64_t ) size << 32 ) | word;
+    for ( unsigned k = 0; k < size; ++k )
+      h = ( h ^ state.words[k] ) * 0x100000001b3ULL;
+    return mixHash ( h );
+  };
+
+  inline bool equal ( Entry const& e, StateT const& state
+                      , lm::WordIndex word ) const {
+    if ( !e.used || e.word != word ) return false;
+    unsigned size = LmCacheKey<StateT>::size ( state );
+    if ( LmCacheKey<StateT>::size ( e.current ) != size ) return false;
+    return !memcmp ( e.current.words, state.words
+                     , size * sizeof ( lm::WordIndex ) );
+  };
+
+ public:
+  /**
+   * \param bytes       Memory budget for the entries
+   * \param numstripes  Number of locks, rounded up to a power of 2
+   */
+  explicit LmScoreCache ( std::size_t bytes, unsigned numstripes = 64 )
+    : numstripes_ ( 1 ) {
+    while ( numstripes_ < numstripes ) numstripes_ <<= 1;
+    std::size_t slots = 1;
+    while ( ( slots << 1 ) * numstripes_ * sizeof ( Entry ) <= bytes ) slots <<= 1;
+    mask_ = slots - 1;
+    stripes_.reset ( new Stripe[numstripes_] );
+    Entry empty;
+    memset ( &empty, 0, sizeof ( Entry ) );
+    for ( unsigned k = 0; k < numstripes_; ++k ) {
+      stripes_[k].entries.assign ( slots, empty );
+      stripes_[k].hits = stripes_[k].misses = 0;
+    }
+  };
+
+  /**
+   * \brief Returns the score of word after state current, as model.Score would.
+   * Only calls the model if not cached.
+   */
+  template<class KenLMModelT>
+  float score ( KenLMModelT const& model, StateT const& current
+                , lm::WordIndex word, StateT& next ) {
+    uint64_t h = hash ( current, word );
+    Stripe& s = stripes_[h & ( numstripes_ - 1 )];
+    std::size_t slot = ( h >> 32 ) & mask_;
+    {
+      boost::mutex::scoped_lock lock ( s.mutex );
+      Entry const& e = s.entries[slot];
+      if ( equal ( e, current, word ) ) {
+        ++s.hits;
+        next = e.next;
+        return e.score;
+      }
+      ++s.misses;
+    }
+    float w = model.Score ( current, word, next );
+    boost::mutex::scoped_lock lock ( s.mutex );
+    Entry& e = s.entries[slot];
+    e.current = current;
+    e.next = next;
+    e.word = word;
+    e.score = w;
+    e.used = true;
+    return w;
+  };
+
+  uint64_t hits() const {
+    uint64_t n = 0;
+    for ( unsigned k = 0; k < numstripes_; ++k ) {
+      boost::mutex::scoped_lock lock ( stripes_[k].mutex );
+      n += stripes_[k].hits;
+    }
+    return n;
+  };
+
+  uint64_t misses() const {
+    uint64_t n = 0;
+    for ( unsigned k = 0; k < numstripes_; ++k ) {
+      boost::mutex::scoped_lock lock ( stripes_[k].mutex );
+      n += stripes_[k].misses;
+    }
+    return n;
+  };
+
+  void clear() {
+    for ( unsigned k = 0; k < numstripes_; ++k ) {
+      boost::mutex::scoped_lock lock ( stripes_[k].mutex );
+      for ( std::size_t j = 0; j < stripes_[k].entries.size(); ++j )
+        stripes_[k].entries[j].used = false;
+    }
+  };
+
+  /// Number of entries the cache can hold
+  inline std::size_t capacity() const {
+    return numstripes_ * ( mask_ + 1 );
+  };
+};
+
+/// Scores with the model, through the cache if any.
+template<class StateT, class KenLMModelT>
+inline float lmScore ( KenLMModelT const& model, LmScoreCache<StateT> *cache
+                       , StateT const& current, lm::WordIndex word
+                       , StateT& next ) {
+  if ( cache == NULL ) return model.Score ( current, word, next );
+  return cache->score ( model, current, word, next );
+};
+
+/**
+ * \brief Creates a cache suitable for the state type of model.
+ * \param bytes       Memory budget
+ * \param numstripes  Number of locks, e.g. 1 if only one thread uses it
+ */
+inline LmScoreCacheInterface *newLmScoreCache ( lm::base::Model const *model
+    , std::size_t bytes, unsigned numstripes = 64 ) {
+#ifdef WITH_NPLM
+  if ( dynamic_cast<lm::np::Model const *> ( model ) != NULL )
+    return new LmScoreCache<lm::np::State> ( bytes, numstripes );
+#endif
+  return new LmScoreCache<lm::ngram::State> ( bytes, numstripes );
+};
+
+} // end namespaces
+
+#endif
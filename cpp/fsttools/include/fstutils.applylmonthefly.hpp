@@ -24,6 +24,8 @@
 
 #include <idbridge.hpp>
 #include <lm/wrappers/nplm.hh>
+#include <fstutils.applylmonthefly.statetable.hpp>
+#include <fstutils.applylmonthefly.cache.hpp>
 namespace fst {
 
 
@@ -137,22 +139,25 @@ struct Scorer {
   KenLMModelT& lmmodel_;
   HackScoreT<StateT> hs_;
   Scale<StateT> &natlog10_;
+  LmScoreCache<StateT> *cache_;
   explicit Scorer(KenLMModelT &lmmodel
                   , IdBridgeT const &idbridge
                   , Scale<StateT> &nl
                   , unsigned
                   , std::vector<std::vector<unsigned> > const &
+                  , LmScoreCache<StateT> *cache = NULL
                   )
       : idbridge_(idbridge)
       , lmmodel_(lmmodel)
       , natlog10_(nl)
+      , cache_(cache)
   {
     //    LERROR("Bilingual model scorer only works with nplm models");
     //    exit(EXIT_FAILURE);
   }
 
   void operator()(StateT const &current, float &w, float &wp, int ilabel, int olabel, StateT& next) {
-    w = lmmodel_.Score ( current, idbridge_.map(olabel), next ) * natlog10_();
+    w = lmScore ( lmmodel_, cache_, current, idbridge_.map(olabel), next ) * natlog10_();
     hs_(w, wp, olabel, next); //hack to make it srilm/nplm compliant
   }
 };
@@ -170,6 +175,7 @@ struct Scorer<lm::np::State, lm::np::Model
   KenLMModelT & lmmodel_;
   HackScoreT<StateT> hs_;
   Scale<StateT> &natlog10_;
+  LmScoreCache<StateT> *cache_;
   unsigned srcSize_;
 
   std::vector< std::vector<unsigned> > srcWindows_;
@@ -179,10 +185,12 @@ struct Scorer<lm::np::State, lm::np::Model
          , Scale<StateT> &nl
          , unsigned srcSize
          , std::vector<std::vector<unsigned> > const &srcWindows
+         , LmScoreCache<StateT> *cache = NULL
          )
       : idbridge_(idbridge)
       , lmmodel_(lmmodel)
       , natlog10_(nl)
+      , cache_(cache)
       , srcSize_(srcSize)
   {
     srcWindows_.clear();
@@ -236,7 +244,8 @@ struct Scorer<lm::np::State, lm::np::Model
     }
 
     unsigned ol = idbridge_.mapOutput(olabel);
-    w = lmmodel_.Score ( c2, ol, next ) * natlog10_();
+    // the source window is part of c2, so it is part of the cache key too
+    w = lmScore ( lmmodel_, cache_, c2, ol, next ) * natlog10_();
     LDEBUG("Mapped olabel=" << olabel  << " to "
            << ol
            << ", score=" << w);
@@ -294,6 +303,18 @@ struct ApplyLanguageModelOnTheFlyInterface {
   virtual VectorFst<ArcT> *run(const VectorFst<ArcT>& fst
                                , unsigned srcSize
                                , std::vector< std::vector<unsigned> >  &srcWindows) =0;
+  /**
+   * \brief Enables pruning during composition.
+   * \param beam       Likelihood beam, relative to the best path
+   * \param maxstates  Maximum number of states kept per layer (0 means no limit, otherwise inexact)
+   * \param heuristic  Scale applied to the lower bound of the future cost (1 for exact pruning)
+   */
+  virtual void setPruning(float beam, unsigned maxstates, float heuristic) = 0;
+  /**
+   * \brief Scores through a cache shared with other instances (no ownership).
+   * Pass NULL to disable.
+   */
+  virtual void setScoreCache(LmScoreCacheInterface *cache) = 0;
   virtual ~ApplyLanguageModelOnTheFlyInterface(){}
 };
 
@@ -314,20 +335,15 @@ class ApplyLanguageModelOnTheFly : public ApplyLanguageModelOnTheFlyInterface<Ar
   typedef typename Arc::StateId StateId;
   typedef typename Arc::Label Label;
   typedef typename Arc::Weight Weight;
-  typedef unsigned long long ull;
 
-  unordered_map< ull, StateId > stateexistence_;
+  /// <m1state,lm history id> -> composed state
+  CompactIdTable stateexistence_;
 
-  static const ull sid = 1000000000;
-  /// m12state=<m1state,m2state>
-  unordered_map<uint64_t
-                , std::pair<StateId, typename KenLMModelT::State > > statemap_;
-  /// history, lmstate
+  /// composed state -> <m1state,m2state>
+  std::vector<std::pair<StateId, typename KenLMModelT::State > > statemap_;
 
-  unordered_map<basic_string<unsigned>
-		, StateId
-		, ucam::util::hashfvecuint
-		, ucam::util::hasheqvecuint> seenlmstates_;
+  /// lm history -> lm history id
+  LmHistoryTable seenlmstates_;
 
   /// Queue of states of the new machine to process.
   queue<StateId> qc_;
@@ -344,9 +360,8 @@ class ApplyLanguageModelOnTheFly : public ApplyLanguageModelOnTheFlyInterface<Ar
   ///Templated functor that creates weights.
   MakeWeightT mw_;
 
-  basic_string<unsigned> history;
-  unsigned *buffer;
-  unsigned buffersize;
+  /// Scratch buffer for lm histories
+  std::vector<unsigned> history_;
 
   //Word Penalty.
   float wp_;
@@ -358,6 +373,15 @@ class ApplyLanguageModelOnTheFly : public ApplyLanguageModelOnTheFlyInterface<Ar
   // transparent score quirks handling for srilm/nplm compliance
   HackScoreT<typename KenLMModelT::State> hs_;
 
+  /// Pruning during composition. Disabled if beam_ is max float and maxstates_ is 0
+  float beam_;
+  unsigned maxstates_;
+  float heuristic_;
+  GetWeight<Arc> gw_;
+
+  /// Optional score cache, shared across threads
+  LmScoreCache<typename KenLMModelT::State> *cache_;
+
   ///Public methods
  public:
 
@@ -389,7 +413,7 @@ class ApplyLanguageModelOnTheFly : public ApplyLanguageModelOnTheFlyInterface<Ar
     , vocab_ ( model.GetVocabulary() )
     , wp_ ( lmwp )
     , epsilons_ ( epsilons )
-    , history ( model.Order(), 0)
+    , history_ ( model.Order() - 1, 0)
     , idbridge_ (idbridge)
     , mw_(mw)
   {
@@ -407,7 +431,7 @@ class ApplyLanguageModelOnTheFly : public ApplyLanguageModelOnTheFlyInterface<Ar
     , lmmodel_ ( model )
     , vocab_ ( model.GetVocabulary() )
     , wp_ ( lmwp )
-    , history ( model.Order(), 0)
+    , history_ ( model.Order() - 1, 0)
     , idbridge_ (idbridge)
     , mw_(mw)
   {
@@ -417,8 +441,30 @@ class ApplyLanguageModelOnTheFly : public ApplyLanguageModelOnTheFlyInterface<Ar
   void init() {
     LDEBUG("Model order=" << (int) lmmodel_.Order());
     sh_.setLength(lmmodel_.Order() );
-    buffersize = (lmmodel_.Order() - 1 ) * sizeof (unsigned);
-    buffer = const_cast<unsigned *> ( history.c_str() );
+    seenlmstates_.setWidth ( history_.size() );
+    beam_ = std::numeric_limits<float>::max();
+    maxstates_ = 0;
+    heuristic_ = 1.0f;
+    cache_ = NULL;
+  }
+
+  /**
+   * \brief Composition will explore states layer by layer in topological order
+   * and only expand those within beam of the best estimate of the layer.
+   * Estimates are forward scores plus heuristic times a lower bound
+   * of the cost to the final states. With heuristic 1 and no maxstates,
+   * the result is the same as composition followed by pruning with beam.
+   */
+  void setPruning(float beam, unsigned maxstates, float heuristic) {
+    beam_ = beam;
+    maxstates_ = maxstates;
+    heuristic_ = heuristic;
+  }
+
+  void setScoreCache(LmScoreCacheInterface *cache) {
+    cache_ = dynamic_cast<LmScoreCache<typename KenLMModelT::State> *>(cache);
+    if (cache != NULL && cache_ == NULL)
+      LWARN("Score cache does not match the language model state. Not using it.");
   }
 
   ///Destructor
@@ -446,7 +492,7 @@ class ApplyLanguageModelOnTheFly : public ApplyLanguageModelOnTheFlyInterface<Ar
     unsigned ign = 0;
     std::vector<std::vector<unsigned> > empty;
     Scorer<typename KenLMModelT::State, KenLMModelT, IdBridgeT, HackScoreT>
-      sc(lmmodel_, idbridge_, natlog10_, ign, empty );
+      sc(lmmodel_, idbridge_, natlog10_, ign, empty, cache_ );
     return doComposition(fst, sc);
   }
 
@@ -458,7 +504,7 @@ class ApplyLanguageModelOnTheFly : public ApplyLanguageModelOnTheFlyInterface<Ar
     // the scorer will help compute the correct score regardless of whether it is a
     // bilingual model or not, etc.
     Scorer<typename KenLMModelT::State, KenLMModelT, IdBridgeT, HackScoreT>
-      sc(lmmodel_, idbridge_, natlog10_ , srcSize, srcw);
+      sc(lmmodel_, idbridge_, natlog10_ , srcSize, srcw, cache_);
     return doComposition(fst, sc);
   }
 
@@ -475,6 +521,10 @@ class ApplyLanguageModelOnTheFly : public ApplyLanguageModelOnTheFlyInterface<Ar
       LWARN ("Empty lattice. ... Skipping LM application!");
       return NULL;
     }
+    if ( beam_ < std::numeric_limits<float>::max() || maxstates_ ) {
+      if ( fst.Properties ( kAcyclic, true ) ) return doPrunedComposition ( fst, sc );
+      LWARN ( "Cyclic lattice. ... Composing without pruning!" );
+    }
     VectorFst<Arc> *composed = new VectorFst<Arc>;
     ///Initialize and push with first state
     typename KenLMModelT::State bs = lmmodel_.NullContextState();
@@ -517,11 +567,216 @@ class ApplyLanguageModelOnTheFly : public ApplyLanguageModelOnTheFlyInterface<Ar
       }
     }
     LINFO ( "Done! Number of states=" << composed->NumStates() );
+    reset();
+    return composed;
+  };
+
+  /**
+   * \brief Runs composition with pruning. The input lattice must be acyclic.
+   * The result is the same as composing and then pruning with beam_, i.e. only
+   * arcs and final states on paths within beam_ of the best path are kept.
+   * Composed states are grouped into layers by the longest distance (in arcs)
+   * of their lattice state from the start state, so by the time a layer is
+   * reached every incoming arc has been added and forward scores are final.
+   * A state is not expanded if its forward score plus a lower bound of the cost
+   * to a final state is over beam_ from the cost of a complete path, found first
+   * by greedy search. The lower bound is the cost in the input lattice plus
+   * word penalties: language model costs are never negative (probabilities are at most 1).
+   * Finally, arcs out of the beam are removed from what has been composed.
+   * \remarks The result is only exact if heuristic_ is 1 and maxstates_ is 0; with
+   * a lexicographic weight, the beam applies to the first component.
+   * \return NULL pointer if no composition, a pointer to the resulting FST otherwise
+   */
+  VectorFst<Arc> * doPrunedComposition(const VectorFst<Arc>& fst
+                                       , Scorer<typename KenLMModelT::State, KenLMModelT, IdBridgeT, HackScoreT> &sc) {
+    // Topological order, layers and lower bounds of the cost to a final state
+    std::vector<StateId> order;
+    bool acyclic;
+    TopOrderVisitor<Arc> tov ( &order, &acyclic );
+    DfsVisit ( fst, &tov );
+    std::vector<StateId> topsorted ( order.size() );
+    for ( StateId s = 0; s < (StateId) order.size(); ++s ) topsorted[order[s]] = s;
+    std::vector<unsigned> depth ( order.size(), 0 );
+    for ( unsigned k = 0; k < topsorted.size(); ++k ) {
+      for ( ArcIterator< VectorFst<Arc> > ai ( fst, topsorted[k] ); !ai.Done(); ai.Next() ) {
+        unsigned &d = depth[ai.Value().nextstate];
+        d = std::max ( d, depth[topsorted[k]] + 1 );
+      }
+    }
+    // With a negative scale, lm costs can be negative: prune only at the end
+    bool admissible = natlog10_() <= 0;
+    std::vector<float> backward ( order.size(), admissible
+                                  ? std::numeric_limits<float>::infinity()
+                                  : -std::numeric_limits<float>::infinity() );
+    for ( unsigned k = topsorted.size(); admissible && k > 0; --k ) {
+      StateId s = topsorted[k - 1];
+      float &b = backward[s];
+      if ( fst.Final ( s ) != Weight::Zero() ) b = gw_ ( fst.Final ( s ) );
+      for ( ArcIterator< VectorFst<Arc> > ai ( fst, s ); !ai.Done(); ai.Next() )
+        b = std::min ( b, gw_ ( ai.Value().weight ) + minimumPenalty ( ai.Value().olabel )
+                       + backward[ai.Value().nextstate] );
+    }
+    float threshold = beam_ < std::numeric_limits<float>::max()
+                      ? greedyPathCost ( fst, sc, backward ) + beam_
+                      : std::numeric_limits<float>::infinity();
+    unsigned numlayers = *std::max_element ( depth.begin(), depth.end() ) + 1;
+    std::vector<std::vector<StateId> > layers ( numlayers );
+    std::vector<float> forward;
+    // Composed states in topological order
+    std::vector<StateId> visited;
+
+    VectorFst<Arc> *composed = new VectorFst<Arc>;
+    typename KenLMModelT::State bs = lmmodel_.NullContextState();
+    std::pair<StateId, bool> nextp = add ( composed, bs, fst.Start(), fst.Final ( fst.Start() ) );
+    composed->SetStart ( nextp.first );
+    layers[depth[fst.Start()]].push_back ( nextp.first );
+    forward.push_back ( 0 );
+    unsigned numpruned = 0;
+    std::vector<std::pair<float, StateId> > scores;
+    for ( unsigned l = 0; l < numlayers; ++l ) {
+      if ( layers[l].empty() ) continue;
+      scores.clear();
+      for ( unsigned k = 0; k < layers[l].size(); ++k ) {
+        StateId s = layers[l][k];
+        float h = heuristic_ ? heuristic_ * backward[get ( s ).first] : 0;
+        scores.push_back ( std::pair<float, StateId> ( forward[s] + h, s ) );
+      }
+      std::sort ( scores.begin(), scores.end() );
+      unsigned keep = ( maxstates_ && maxstates_ < scores.size() ) ? maxstates_ : scores.size();
+      LDEBUG ( "layer=" << l << ", states=" << scores.size() << ", best=" << scores[0].first );
+      for ( unsigned k = 0; k < scores.size(); ++k ) {
+        StateId s = scores[k].second;
+        visited.push_back ( s );
+        if ( k >= keep || scores[k].first > threshold ) {
+          composed->SetFinal ( s, Weight::Zero() );
+          ++numpruned;
+          continue;
+        }
+        std::pair<StateId, const typename KenLMModelT::State> p = get ( s );
+        StateId& s1 = p.first;
+        const typename KenLMModelT::State s2 = p.second;
+        for ( ArcIterator< VectorFst<Arc> > arc1 ( fst, s1 ); !arc1.Done();
+              arc1.Next() ) {
+          const Arc& a1 = arc1.Value();
+          typename KenLMModelT::State nextlmstate;
+          Weight aw = score ( sc, s2, a1, nextlmstate );
+          std::pair<StateId, bool> nextp = add ( composed, nextlmstate
+                                                 , a1.nextstate
+                                                 , fst.Final ( a1.nextstate ) );
+          StateId& newstate = nextp.first;
+          composed->AddArc ( s, Arc ( a1.ilabel, a1.olabel, aw, newstate ) );
+          float f = forward[s] + gw_ ( aw );
+          if ( !nextp.second ) {
+            layers[depth[a1.nextstate]].push_back ( newstate );
+            forward.push_back ( f );
+          } else if ( f < forward[newstate] ) forward[newstate] = f;
+        }
+      }
+      std::vector<StateId>().swap ( layers[l] );
+    }
+    LINFO ( "Done! Number of states=" << composed->NumStates()
+            << ", pruned=" << numpruned );
+    if ( beam_ < std::numeric_limits<float>::max() )
+      pruneOutOfBeam ( composed, forward, visited );
+    else if ( numpruned ) Connect ( composed );
+    reset();
+    return composed;
+  };
+
+  /// Word penalty always paid for a word, whatever the lm state
+  inline float minimumPenalty ( Label olabel ) {
+    if ( epsilons_.find ( olabel ) != epsilons_.end() || olabel <= 2 ) return 0;
+    return wp_;
+  };
+
+  /// Weight of a composed arc, as doComposition computes it
+  inline Weight score ( Scorer<typename KenLMModelT::State, KenLMModelT, IdBridgeT, HackScoreT> &sc
+                        , typename KenLMModelT::State const& s2, Arc const& a1
+                        , typename KenLMModelT::State& nextlmstate ) {
+    float w = 0;
+    float wp = wp_;
+    if ( epsilons_.find ( a1.olabel ) == epsilons_.end() ) {
+      sc(s2, w, wp, a1.ilabel, a1.olabel, nextlmstate);
+    } else {
+      nextlmstate = s2;
+      wp = 0;
+    }
+    return Times ( a1.weight, Times ( mw_ ( w ) , mw_ ( wp ) ) );
+  };
+
+  /**
+   * \brief Cost of a complete path of the composition, following at each state
+   * the arc with the best cost plus lower bound to a final state.
+   * \return infinity if no final state is reachable.
+   */
+  float greedyPathCost ( const VectorFst<Arc>& fst
+                         , Scorer<typename KenLMModelT::State, KenLMModelT, IdBridgeT, HackScoreT> &sc
+                         , std::vector<float> const& lowerbound ) {
+    StateId s1 = fst.Start();
+    typename KenLMModelT::State s2 = lmmodel_.NullContextState();
+    float cost = 0;
+    while ( true ) {
+      float best = fst.Final ( s1 ) != Weight::Zero()
+                   ? gw_ ( fst.Final ( s1 ) ) : std::numeric_limits<float>::infinity();
+      float bestarc = 0;
+      StateId next = kNoStateId;
+      typename KenLMModelT::State nextlmstate, bestlmstate;
+      for ( ArcIterator< VectorFst<Arc> > ai ( fst, s1 ); !ai.Done(); ai.Next() ) {
+        float a = gw_ ( score ( sc, s2, ai.Value(), nextlmstate ) );
+        if ( a + lowerbound[ai.Value().nextstate] >= best ) continue;
+        best = a + lowerbound[ai.Value().nextstate];
+        bestarc = a;
+        next = ai.Value().nextstate;
+        bestlmstate = nextlmstate;
+      }
+      if ( next == kNoStateId )
+        return fst.Final ( s1 ) != Weight::Zero() ? cost + gw_ ( fst.Final ( s1 ) )
+               : std::numeric_limits<float>::infinity();
+      cost += bestarc;
+      s1 = next;
+      s2 = bestlmstate;
+    }
+  };
+
+  /**
+   * \brief Removes arcs and final weights not on a path within beam_ of the best one.
+   * \param forward: shortest distance from the start state to each state
+   * \param visited: states in topological order
+   */
+  void pruneOutOfBeam ( VectorFst<Arc> *composed, std::vector<float> const& forward
+                        , std::vector<StateId> const& visited ) {
+    std::vector<float> backward ( composed->NumStates()
+                                  , std::numeric_limits<float>::infinity() );
+    for ( std::size_t k = visited.size(); k > 0; --k ) {
+      StateId s = visited[k - 1];
+      if ( composed->Final ( s ) != Weight::Zero() ) backward[s] = gw_ ( composed->Final ( s ) );
+      for ( ArcIterator< VectorFst<Arc> > ai ( *composed, s ); !ai.Done(); ai.Next() )
+        backward[s] = std::min ( backward[s], gw_ ( ai.Value().weight )
+                                 + backward[ai.Value().nextstate] );
+    }
+    float threshold = backward[composed->Start()] + beam_;
+    std::vector<Arc> arcs;
+    for ( std::size_t k = 0; k < visited.size(); ++k ) {
+      StateId s = visited[k];
+      if ( composed->Final ( s ) != Weight::Zero()
+           && forward[s] + gw_ ( composed->Final ( s ) ) > threshold )
+        composed->SetFinal ( s, Weight::Zero() );
+      arcs.clear();
+      for ( ArcIterator< VectorFst<Arc> > ai ( *composed, s ); !ai.Done(); ai.Next() )
+        if ( forward[s] + gw_ ( ai.Value().weight ) + backward[ai.Value().nextstate]
+             <= threshold ) arcs.push_back ( ai.Value() );
+      if ( arcs.size() == composed->NumArcs ( s ) ) continue;
+      composed->DeleteArcs ( s );
+      for ( std::size_t j = 0; j < arcs.size(); ++j ) composed->AddArc ( s, arcs[j] );
+    }
+    Connect ( composed );
+  };
+
+  /// Clears state tables after composition. Memory is kept for the next one.
+  inline void reset() {
     stateexistence_.clear();
     statemap_.clear();
     seenlmstates_.clear();
-    history.resize( lmmodel_.Order(), 0);
-    return composed;
   };
 
   /**
@@ -530,42 +785,35 @@ class ApplyLanguageModelOnTheFly : public ApplyLanguageModelOnTheFlyInterface<Ar
    */
   inline std::pair <StateId, bool> add ( fst::VectorFst<Arc> *composed, typename KenLMModelT::State& m2nextstate,
                                     StateId m1nextstate, Weight m1stateweight ) {
-    static StateId lm = 0;
     getIdx ( m2nextstate );
-    ///New history:
-    if ( seenlmstates_.find ( history ) == seenlmstates_.end() ) {
-      seenlmstates_[history] = ++lm;
-    }
-    uint64_t compound = m1nextstate * sid + seenlmstates_[history];
+    uint64_t compound = ( ( uint64_t ) m1nextstate << 32 ) | seenlmstates_ ( history_.data() );
     LDEBUG ( "compound id=" << compound );
-    if ( stateexistence_.find ( compound ) == stateexistence_.end() ) {
-      LDEBUG ( "New State!" );
-      statemap_[composed->NumStates()] =
-        std::pair<StateId, const typename KenLMModelT::State > ( m1nextstate, m2nextstate );
-      composed->AddState();
-      LDEBUG("Added..." << composed->NumStates() << "," << m1nextstate << "," << printDebug(m2nextstate));
-      if ( m1stateweight != mw_ ( ZPosInfinity() ) ) composed->SetFinal (
-          composed->NumStates() - 1, m1stateweight );
-      stateexistence_[compound] = composed->NumStates() - 1;
-      return std::pair<StateId, bool> ( composed->NumStates() - 1, false );
-    }
-    return std::pair<StateId, bool> ( stateexistence_[compound], true );
+    std::pair<unsigned, bool> existing = stateexistence_.insert ( compound, composed->NumStates() );
+    if ( existing.second )
+      return std::pair<StateId, bool> ( existing.first, true );
+    LDEBUG ( "New State!" );
+    statemap_.push_back (
+      std::pair<StateId, typename KenLMModelT::State > ( m1nextstate, m2nextstate ) );
+    composed->AddState();
+    LDEBUG("Added..." << composed->NumStates() << "," << m1nextstate << "," << printDebug(m2nextstate));
+    if ( m1stateweight != mw_ ( ZPosInfinity() ) ) composed->SetFinal (
+        composed->NumStates() - 1, m1stateweight );
+    return std::pair<StateId, bool> ( composed->NumStates() - 1, false );
   };
 
   /**
-   * \brief Get an id string representing the history, given a kenlm state.
+   * \brief Copies into history_ the words of a kenlm state, padded with 0s.
    *
    */
-  inline void getIdx ( const typename KenLMModelT::State& state,
-                       uint order = 4 ) {
+  inline void getIdx ( const typename KenLMModelT::State& state ) {
     LDEBUG("getting Idx");
-    memcpy ( buffer, state.words, buffersize );
-    //    for ( uint k = state.length; k < history.size(); ++k ) history[k] = 0;
-        for ( unsigned k = sh_.getLength(state); k < history.size(); ++k ) history[k] = 0;
-
+    if ( history_.empty() ) return;
+    memcpy ( history_.data(), state.words, history_.size() * sizeof ( unsigned ) );
+    for ( unsigned k = sh_.getLength(state); k < history_.size(); ++k ) history_[k] = 0;
   };
 
-  ///Map from output state to input lattice + language model state
+  ///Map from output state to input lattice + language model state.
+  ///Returns a copy, as adding states may reallocate the table.
   inline std::pair<StateId, typename KenLMModelT::State > get ( StateId state ) {
     LDEBUG("get");
     return statemap_[state];
@@ -0,0 +1,204 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use these files except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copyright 2012 - Gonzalo Iglesias, Adrià de Gispert, William Byrne
+
+#ifndef FSTUTILS_APPLYLMONTHEFLY_STATETABLE_HPP
+#define FSTUTILS_APPLYLMONTHEFLY_STATETABLE_HPP
+
+/**
+ * \file
+ * \brief State tables for on-the-fly language model composition
+ * \remarks Both tables use open addressing over flat arrays. Slots are
+ * tagged with a generation number, so clearing is constant time and
+ * memory is kept for the next composition.
+ * None of them uses static data: an instance must not be shared across threads.
+ */
+
+namespace fst {
+
+inline uint64_t mixHash ( uint64_t h ) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+};
+
+/**
+ * \brief Maps 64-bit keys to 32-bit ids.
+ */
+class CompactIdTable {
+ private:
+  struct Slot {
+    uint64_t key;
+    unsigned value;
+    unsigned generation;
+  };
+  std::vector<Slot> slots_;
+  std::size_t mask_;
+  std::size_t size_;
+  unsigned generation_;
+
+ public:
+  explicit CompactIdTable ( std::size_t capacity = 1024 )
+    : size_ ( 0 )
+    , generation_ ( 1 ) {
+    std::size_t n = 16;
+    while ( n < capacity ) n <<= 1;
+    Slot empty = {0, 0, 0};
+    slots_.assign ( n, empty );
+    mask_ = n - 1;
+  };
+
+  /// Empties the table, keeping its memory
+  inline void clear() {
+    size_ = 0;
+    if ( ++generation_ ) return;
+    for ( std::size_t k = 0; k < slots_.size(); ++k ) slots_[k].generation = 0;
+    generation_ = 1;
+  };
+
+  inline std::size_t size() const {
+    return size_;
+  };
+
+  /**
+   * \brief Inserts key with value unless the key already exists.
+   * \return The value stored for key, and true if it existed already
+   */
+  inline std::pair<unsigned, bool> insert ( uint64_t key, unsigned value ) {
+    if ( ( size_ + 1 ) * 2 > slots_.size() ) grow();
+    std::size_t k = mixHash ( key ) & mask_;
+    while ( slots_[k].generation == generation_ ) {
+      if ( slots_[k].key == key )
+        return std::pair<unsigned, bool> ( slots_[k].value, true );
+      k = ( k + 1 ) & mask_;
+    }
+    Slot &slot = slots_[k];
+    slot.key = key;
+    slot.value = value;
+    slot.generation = generation_;
+    ++size_;
+    return std::pair<unsigned, bool> ( value, false );
+  };
+
+ private:
+  void grow() {
+    std::vector<Slot> old;
+    old.swap ( slots_ );
+    Slot empty = {0, 0, 0};
+    slots_.assign ( old.size() * 2, empty );
+    mask_ = slots_.size() - 1;
+    for ( std::size_t j = 0; j < old.size(); ++j ) {
+      if ( old[j].generation != generation_ ) continue;
+      std::size_t k = mixHash ( old[j].key ) & mask_;
+      while ( slots_[k].generation == generation_ ) k = ( k + 1 ) & mask_;
+      slots_[k] = old[j];
+    }
+  };
+};
+
+/**
+ * \brief Interns language model histories of fixed width into consecutive ids.
+ * Histories are stored back to back in a single array.
+ */
+class LmHistoryTable {
+ private:
+  struct Slot {
+    unsigned id;
+    unsigned generation;
+  };
+  std::vector<Slot> slots_;
+  std::vector<unsigned> histories_;
+  std::size_t mask_;
+  unsigned width_;
+  unsigned size_;
+  unsigned generation_;
+
+  inline uint64_t hash ( unsigned const *words ) const {
+    uint64_t h = width_;
+    for ( unsigned k = 0; k < width_; ++k )
+      h = ( h ^ words[k] ) * 0x100000001b3ULL;
+    return mixHash ( h );
+  };
+
+  inline bool equal ( unsigned id, unsigned const *words ) const {
+    unsigned const *h = histories_.data() + ( std::size_t ) id * width_;
+    for ( unsigned k = 0; k < width_; ++k )
+      if ( h[k] != words[k] ) return false;
+    return true;
+  };
+
+ public:
+  explicit LmHistoryTable ( unsigned width = 0, std::size_t capacity = 1024 )
+    : width_ ( width )
+    , size_ ( 0 )
+    , generation_ ( 1 ) {
+    std::size_t n = 16;
+    while ( n < capacity ) n <<= 1;
+    Slot empty = {0, 0};
+    slots_.assign ( n, empty );
+    mask_ = n - 1;
+  };
+
+  /// Sets history width. Empties the table.
+  inline void setWidth ( unsigned width ) {
+    width_ = width;
+    clear();
+  };
+
+  /// Empties the table, keeping its memory
+  inline void clear() {
+    size_ = 0;
+    histories_.clear();
+    if ( ++generation_ ) return;
+    for ( std::size_t k = 0; k < slots_.size(); ++k ) slots_[k].generation = 0;
+    generation_ = 1;
+  };
+
+  inline unsigned size() const {
+    return size_;
+  };
+
+  /// Returns the id of the history, adding it if new
+  inline unsigned operator() ( unsigned const *words ) {
+    if ( ( size_ + 1 ) * 2 > slots_.size() ) grow();
+    std::size_t k = hash ( words ) & mask_;
+    while ( slots_[k].generation == generation_ ) {
+      if ( equal ( slots_[k].id, words ) ) return slots_[k].id;
+      k = ( k + 1 ) & mask_;
+    }
+    slots_[k].id = size_;
+    slots_[k].generation = generation_;
+    histories_.insert ( histories_.end(), words, words + width_ );
+    return size_++;
+  };
+
+ private:
+  void grow() {
+    Slot empty = {0, 0};
+    slots_.assign ( slots_.size() * 2, empty );
+    mask_ = slots_.size() - 1;
+    for ( unsigned id = 0; id < size_; ++id ) {
+      std::size_t k = hash ( histories_.data() + ( std::size_t ) id * width_ ) & mask_;
+      while ( slots_[k].generation == generation_ ) k = ( k + 1 ) & mask_;
+      slots_[k].id = id;
+      slots_[k].generation = generation_;
+    }
+  };
+};
+
+} // end namespaces
+
+#endif
@@ -32,22 +32,18 @@ namespace fsttools {
 // Use this struct in fst::Map to merge them.
 struct MergeFeatures {
   typedef TupleArc32 Arc;
+  mutable fst::SparseFeatureMerger<float> merger_;
   Arc operator()(Arc const &arc) const {
     if ( arc.weight == Arc::Weight::Zero() ) //irrelevant labels
       return Arc ( arc.ilabel, arc.olabel, Arc::Weight::Zero(), arc.nextstate );
-    int index = 0;
-    std::map<int, float> ws;
+    merger_.Clear();
     for (fst::SparseTupleWeightIterator<FeatureWeight32, int> it ( arc.weight )
              ; !it.Done()
              ; it.Next() ) {
-      ws[it.Value().first] += it.Value().second.Value();
+      merger_.Add(it.Value().first, it.Value().second.Value());
     }
     Arc::Weight w;
-    for (std::map<int,float>::const_iterator itx = ws.begin()
-             ; itx != ws.end()
-             ; ++itx) {
-      w.Push(itx->first, itx->second);
-    }
+    merger_.Flush(&w);
     return Arc(arc.ilabel,arc.olabel, w, arc.nextstate);
   }
 };
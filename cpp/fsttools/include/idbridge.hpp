@@ -28,22 +28,63 @@
 namespace ucam {
 namespace fsttools {
 
+/**
+ * \brief Maps unsigned ids to unsigned ids, 0 if not found.
+ * Vocabularies are typically dense ranges of integers, so ids below
+ * kMaxDense are stored directly in a vector; any other id goes to a hash.
+ */
+class DenseIdMap {
+ private:
+  typedef std::unordered_map<unsigned, unsigned> SparseType;
+  std::vector<unsigned> dense_;
+  SparseType sparse_;
+
+ public:
+  ///Ids at or above this value are considered outliers
+  static const unsigned kMaxDense = 1 << 24;
+
+  inline unsigned operator() ( unsigned idx ) const {
+    if ( idx < dense_.size() ) return dense_[idx];
+    if ( sparse_.empty() ) return 0;
+    SparseType::const_iterator itx = sparse_.find ( idx );
+    if ( itx != sparse_.end() ) return itx->second;
+    return 0;
+  };
+
+  inline void add ( unsigned idx, unsigned value ) {
+    if ( idx >= kMaxDense ) {
+      sparse_[idx] = value;
+      return;
+    }
+    if ( idx >= dense_.size() ) {
+      std::size_t n = dense_.size() ? dense_.size() : 1024;
+      while ( n <= idx ) n <<= 1;
+      if ( n > kMaxDense ) n = kMaxDense;
+      dense_.resize ( n, 0 );
+    }
+    dense_[idx] = value;
+  };
+
+  inline std::size_t sparseSize() const {
+    return sparse_.size();
+  };
+};
+
 class IdBridge {
  private:
   typedef std::unordered_map<unsigned,unsigned> MapType;
+  // grammar to lm ids, used for every arc during composition
+  DenseIdMap mapper;
   // rmapper (reverse) for debugging purposes only
-  MapType mapper, rmapper;
+  MapType rmapper;
   // output mapper for nplm with two vocabularies
-  MapType omapper, romapper;
+  DenseIdMap omapper;
+  MapType romapper;
  public:
   IdBridge() {}
 
   inline unsigned const map (unsigned idx) const {
-    MapType::const_iterator itx = mapper.find (idx);
-    if (itx != mapper.end() ) {
-      return itx->second;
-    }
-    return 0;
+    return mapper (idx);
   };
 
   inline unsigned const rmap (unsigned idx) const {
@@ -55,11 +96,7 @@ class IdBridge {
 
 
   inline unsigned const mapOutput (unsigned idx) const {
-    MapType::const_iterator itx = omapper.find (idx);
-    if (itx != omapper.end() ) {
-      return itx->second;
-    }
-    return 0;
+    return omapper (idx);
   };
 
   inline unsigned const rmapOutput (unsigned idx) const {
@@ -72,7 +109,7 @@ class IdBridge {
 
   inline void add (unsigned grammar_idx, unsigned lm_idx) {
     LDEBUG ("grammar idx=" << grammar_idx << ", lm_idx=" << lm_idx);
-    mapper[grammar_idx] = lm_idx;
+    mapper.add (grammar_idx, lm_idx);
 #ifdef PRINTDEBUG1
     rmapper[lm_idx] = grammar_idx;
 #endif
@@ -81,7 +118,7 @@ class IdBridge {
 
   inline void addOutput (unsigned grammar_idx, unsigned lm_idx) {
     LDEBUG ("ovocab: grammar idx=" << grammar_idx << ", lm_idx=" << lm_idx);
-    omapper[grammar_idx] = lm_idx;
+    omapper.add (grammar_idx, lm_idx);
 #ifdef PRINTDEBUG1
     romapper[lm_idx] = grammar_idx;
 #endif
@@ -272,17 +272,25 @@ class MultiThreadedApplyLanguageModelTask
    * Runs only if option --nthreads defined >0
    * \remarks Now a threadpool is defined, each
    * language model application is submitted as a thread.
-   * Important note: in contrast to single-threading,
-   * sentence specific language model loading
-   * does not work with multithreading.
-   * You have to load once your full language model.
+   * Sentence-specific language models (e.g. --lm.load=lm.?.gz) are
+   * loaded by each thread as needed, and shared through a registry.
+   * Otherwise, language models are loaded only once.
    */
   bool run ( Data& original_data ) {
     using namespace HifstConstants;
+    bool sentencespecific = rg_.get<std::string> ( kLmLoad ).find ( "?" )
+                            != std::string::npos;
     boost::scoped_ptr< LoadWordMap > mylm
         (new LoadWordMap (rg_, kLmWordmap, true) );
-    mylm->appendTask ( new LoadLanguageModel ( rg_ ) );
+    if ( !sentencespecific )
+      mylm->appendTask ( new LoadLanguageModel ( rg_ ) );
     mylm->chainrun ( original_data ); //Loading language model only once
+    // Deleted after the threadpool, i.e. once no thread uses its models
+    boost::scoped_ptr<LanguageModelRegistry> registry;
+    if ( sentencespecific )
+      registry.reset ( new LanguageModelRegistry
+                       ( ( std::size_t ) rg_.get<unsigned> ( kLmMaxMemory ) << 20
+                         , rg_.get<unsigned> ( kLmPrefetch ) ? 1 : 0 ) );
     {
       using namespace ucam::util;
       TrivialThreadPool tp ( threadcount_ );
@@ -291,6 +299,11 @@ class MultiThreadedApplyLanguageModelTask
                 ; !ir->done(); ir->next() ) {
         ReadFst *applylm =  new ReadFst ( rg_ , kLatticeLoad ) ;
         applylm->appendTask
+            ( sentencespecific
+              ? new LoadLanguageModel ( rg_, kLmLoad, kLmFeatureweights
+                                        , kLmWordPenalty, kLmWordmap
+                                        , false, registry.get() )
+              : NULL )
             ( addApplyLM<ArcT,DataT>(bilm_, rg_ ) )
             ( WriteFst::init( rg_ , kLatticeStore ) )
             ( TuneWpWriteFst::init( rg_, kTuneWrite, kLatticeStore) )
@@ -298,6 +311,7 @@ class MultiThreadedApplyLanguageModelTask
             ;
         Data *d = new Data; //( original_data );
         d->klm = original_data.klm;
+        d->wm = original_data.wm;
         d->sidx = ir->get();
         if (bilm_) {
           finished = (*fastForwardRead_) ( d->sidx , &d->integerMappedSentence);
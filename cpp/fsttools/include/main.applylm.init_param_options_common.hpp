@@ -39,6 +39,17 @@ inline void initCommonApplylmOptions (po::options_description& desc) {
     "Use external integer-map file for the language model" )
   ( HifstConstants::kLmLogTen.c_str(),
     "Does not convert lm scores to natural log" )
+  ( HifstConstants::kLmCacheSize.c_str(),
+    po::value<unsigned>()->default_value ( 0 ),
+    "Memory (MB) for a score cache per language model, shared across threads and sentences. 0 disables it" )
+  ( HifstConstants::kLmMaxMemory.c_str(),
+    po::value<unsigned>()->default_value ( 0 ),
+    "Multithreading with sentence-specific language models: memory (MB, estimated by file size) "
+    "for models kept loaded. Least recently used models not in use are released first. 0 means no limit" )
+  ( HifstConstants::kLmPrefetch.c_str(),
+    po::value<unsigned>()->default_value ( 0 ),
+    "Multithreading with sentence-specific language models: number of following sentences "
+    "whose models are loaded in the background" )
   ;
 }
 
@@ -55,6 +55,9 @@ inline void init_param_options ( int argc, const char* argv[],
     ( HifstConstants::kRecaserPrune.c_str(),
       po::value<std::string>()->default_value ( "byshortestpath,1" ),
       "Choose between byshortestpath,numpaths or byweight,weight" )
+    ( HifstConstants::kRecaserLmCacheSize.c_str(),
+      po::value<unsigned>()->default_value ( 4 ),
+      "Memory (MB) for a score cache owned by each recasing task. 0 disables it" )
     ( HifstConstants::kRecaserInputExtended.c_str(), po::value<std::string>(),
       "Input lattice" )
     ( HifstConstants::kRecaserOutputExtended.c_str(), po::value<std::string>(),
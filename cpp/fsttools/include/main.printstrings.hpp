@@ -26,6 +26,8 @@
 #include <taskinterface.hpp>
 #include <range.hpp>
 #include <addresshandler.hpp>
+#include <multithreading.hpp>
+#include <multithreading.helpers.hpp>
 
 #include <fstio.hpp>
 
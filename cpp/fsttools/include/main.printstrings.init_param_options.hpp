@@ -44,6 +44,9 @@ inline void init_param_options ( int argc, const char* argv[],
       "Write result" )
     ( kNbestExtended.c_str(),
       po::value<unsigned>()->default_value (1), "Number of hypotheses" )
+    ( kNThreads.c_str(), po::value<unsigned>()->default_value (1),
+      "Number of threads printing lattices concurrently (trimmed to number of cpus in the machine). "
+      "Output is written in the same order as with one thread" )
     ( kUniqueExtended.c_str(), "Unique strings" )
     ( kWeightExtended.c_str(), "Print weight" )
     ( kWeightPrecision.c_str(), po::value<unsigned>()->default_value(6), "Weight precision ")
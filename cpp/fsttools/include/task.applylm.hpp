@@ -52,6 +52,8 @@ class ApplyLanguageModelTask: public ucam::util::TaskInterface<Data> {
   typedef fst::ApplyLanguageModelOnTheFlyInterface<Arc> ApplyLanguageModelOnTheFlyInterfaceType;
   typedef boost::shared_ptr<ApplyLanguageModelOnTheFlyInterfaceType> ApplyLanguageModelOnTheFlyInterfacePtrType;
   std::vector<ApplyLanguageModelOnTheFlyInterfacePtrType> almotf_;
+  /// Ids of the models used by the handlers
+  std::vector<uint64_t> almotfIds_;
 
  public:
   ///Constructor with ucam::util::RegistryPO object
@@ -74,7 +76,11 @@ class ApplyLanguageModelTask: public ucam::util::TaskInterface<Data> {
    */
  void initializeLanguageModelHandlers(Data &d) {
 
-   if (almotf_.size()) return; // already done
+   // already done, unless models have changed (sentence-specific)
+   std::vector<uint64_t> ids = languageModelIds ( d.klm[lmkey_] );
+   if (almotf_.size() && almotfIds_ == ids) return;
+   almotfIds_ = ids;
+   almotf_.clear();
    almotf_.resize(d.klm[lmkey_].size());
    fst::MakeWeight<Arc> mw;
    std::unordered_set<Label> epsilons;
@@ -125,6 +131,10 @@ class ApplyLanguageModelTask: public ucam::util::TaskInterface<Data> {
       mylmfst_ = *p;
       p.reset();
       d.stats->setTimeEnd ("on-the-fly-composition " + ucam::util::toString ( k ) );
+      if ( d.klm[lmkey_][k]->cache.get() != NULL )
+        d.stats->setLmCacheStats ( lmkey_ + " " + ucam::util::toString ( k )
+                                   , d.klm[lmkey_][k]->cache->hits()
+                                   , d.klm[lmkey_][k]->cache->misses() );
       LDEBUG ( mylmfst_.NumStates() );
     }
     d.fsts[latticestorekey_] = &mylmfst_;
@@ -159,6 +169,8 @@ class ApplyBiLMTask: public ucam::util::TaskInterface<Data> {
   typedef fst::ApplyLanguageModelOnTheFlyInterface<Arc> ApplyLanguageModelOnTheFlyInterfaceType;
   typedef boost::shared_ptr<ApplyLanguageModelOnTheFlyInterfaceType> ApplyLanguageModelOnTheFlyInterfacePtrType;
   std::vector<ApplyLanguageModelOnTheFlyInterfacePtrType> almotf_;
+  /// Ids of the models used by the handlers
+  std::vector<uint64_t> almotfIds_;
 
 
   unsigned srcWindowsSize_;
@@ -184,7 +196,11 @@ class ApplyBiLMTask: public ucam::util::TaskInterface<Data> {
    * \brief Initializes appropriate templated handlers for kenlm language models
    */
   void initializeLanguageModelHandlers(Data &d) {
-    if (almotf_.size()) return; // already done
+    // already done, unless models have changed (sentence-specific)
+    std::vector<uint64_t> ids = languageModelIds ( d.klm[lmkey_] );
+    if (almotf_.size() && almotfIds_ == ids) return;
+    almotfIds_ = ids;
+    almotf_.clear();
     almotf_.resize(d.klm[lmkey_].size());
     fst::MakeWeight<Arc> mw;
     std::unordered_set<Label> epsilons;
@@ -235,6 +251,10 @@ class ApplyBiLMTask: public ucam::util::TaskInterface<Data> {
       mylmfst_ = *p;
       p.reset();
       d.stats->setTimeEnd ("on-the-fly-bilm-composition " + ucam::util::toString ( k ) );
+      if ( d.klm[lmkey_][k]->cache.get() != NULL )
+        d.stats->setLmCacheStats ( lmkey_ + " " + ucam::util::toString ( k )
+                                   , d.klm[lmkey_][k]->cache->hits()
+                                   , d.klm[lmkey_][k]->cache->misses() );
       LDEBUG ( mylmfst_.NumStates() );
     }
     d.fsts[latticestorekey_] = &mylmfst_;
@@ -25,6 +25,24 @@
 namespace ucam {
 namespace fsttools {
 
+/// Ids of the language models loaded for a key. Handlers keep references
+/// to the models, so they must be rebuilt if any of these changes.
+inline std::vector<uint64_t> languageModelIds ( std::vector<KenLMData const *> const &klm ) {
+  std::vector<uint64_t> ids ( klm.size(), 0 );
+  for ( unsigned k = 0; k < klm.size(); ++k )
+    if ( klm[k] != NULL ) ids[k] = klm[k]->id;
+  return ids;
+};
+
+/// Attaches the score cache of the language model, if any, to the handler.
+template<class Arc>
+inline fst::ApplyLanguageModelOnTheFlyInterface<Arc> *
+withScoreCache(KenLMData const &klm
+               , fst::ApplyLanguageModelOnTheFlyInterface<Arc> *almotf) {
+  almotf->setScoreCache(klm.cache.get());
+  return almotf;
+};
+
 template<class Arc, template<class> class MakeWeightT>
 inline fst::ApplyLanguageModelOnTheFlyInterface<Arc> *
 assignKenLmHandler(util::RegistryPO const &rg
@@ -42,27 +60,27 @@ assignKenLmHandler(util::RegistryPO const &rg
 
   switch (kenmt) {
   case PROBING:
-    return new  fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, ProbingModel>
-      (dynamic_cast<ProbingModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw);
+    return withScoreCache<Arc>(klm, new fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, ProbingModel>
+      (dynamic_cast<ProbingModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw));
   case REST_PROBING:
-    return new  fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, RestProbingModel >
-      (dynamic_cast<RestProbingModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw);
+    return withScoreCache<Arc>(klm, new fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, RestProbingModel >
+      (dynamic_cast<RestProbingModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw));
   case TRIE:
-    return new  fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, TrieModel >
-      (dynamic_cast<TrieModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw);
+    return withScoreCache<Arc>(klm, new fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, TrieModel >
+      (dynamic_cast<TrieModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw));
   case QUANT_TRIE:
-    return new  fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, QuantTrieModel >
-      (dynamic_cast<QuantTrieModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw);
+    return withScoreCache<Arc>(klm, new fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, QuantTrieModel >
+      (dynamic_cast<QuantTrieModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw));
   case ARRAY_TRIE:
-    return new  fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, ArrayTrieModel >
-      (dynamic_cast<ArrayTrieModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw);
+    return withScoreCache<Arc>(klm, new fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, ArrayTrieModel >
+      (dynamic_cast<ArrayTrieModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw));
   case QUANT_ARRAY_TRIE:
-    return new  fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, QuantArrayTrieModel >
-      (dynamic_cast<QuantArrayTrieModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw);
+    return withScoreCache<Arc>(klm, new fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, QuantArrayTrieModel >
+      (dynamic_cast<QuantArrayTrieModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw));
   case util::KENLM_NPLM:
  #ifdef WITH_NPLM
-    return new fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, NplmModel >
-      (dynamic_cast<NplmModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw);    
+    return withScoreCache<Arc>(klm, new fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, NplmModel >
+      (dynamic_cast<NplmModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw));    
 #endif
     LERROR("Unsuported format: KENLM_NPLM. Did you compile NPLM library?");
     exit(EXIT_FAILURE);
@@ -94,8 +112,8 @@ assignKenLmHandlerBilingual(util::RegistryPO const &rg
   switch (kenmt) {
   case util::KENLM_NPLM:
  #ifdef WITH_NPLM
-    return new fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, NplmModel >
-      (dynamic_cast<NplmModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw);    
+    return withScoreCache<Arc>(klm, new fst::ApplyLanguageModelOnTheFly<Arc, MakeWeightT<Arc>, NplmModel >
+      (dynamic_cast<NplmModel &>(*klm.model), epsilons,useNaturalLog, klm.lmscale, klm.lmwp, klm.idb, mw));    
 #endif
     LERROR("Unsuported format: KENLM_NPLM. Did you compile NPLM library?");
     exit(EXIT_FAILURE);
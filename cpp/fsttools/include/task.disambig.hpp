@@ -24,6 +24,7 @@
 
 #include "task.applylm.kenlmtype.hpp"
 #include "task.disambig.flowerfst.hpp"
+#include "task.disambig.unimapcache.hpp"
 
 namespace ucam {
 namespace fsttools {
@@ -67,6 +68,12 @@ private:
   ///Output lattice
   fst::VectorFst<Arc> olattice_;
 
+  ///Unimap expansion of each word seen so far
+  UnimapExpansionCache<Arc> expansions_;
+
+  ///Memory for the recasing score cache, in MB. 0 if disabled
+  std::size_t cachesize_;
+
  public:
   ///Constructor with registry objects and several keys to access either ucam::util::RegistryPO program options or the data object itself
   DisambigTask ( const ucam::util::RegistryPO& rg,
@@ -80,7 +87,9 @@ private:
     inputkey_ ( inputkey ),
     outputkey_ ( outputkey ),
     unimapkey_ ( unimapkey ),
-    unimap_ ( NULL ) {
+    unimap_ ( NULL ),
+    cachesize_ ( rg.exists ( HifstConstants::kRecaserLmCacheSize )
+                 ? rg.get<unsigned> ( HifstConstants::kRecaserLmCacheSize ) : 0 ) {
     using ucam::util::toNumber;
     // Prune or shortest path...
     std::vector<std::string> pstrat = rg_.getVectorString (
@@ -115,7 +124,7 @@ private:
     fst::ShortestPath<Arc> ( * ( static_cast< fst::VectorFst<Arc> * >
                                  (d.fsts[inputkey_] ) ), &olattice_, 1 );
     fst::Map<Arc> ( &olattice_, fst::RmWeightMapper<Arc>() );
-    run ( &olattice_ );
+    if ( initialize() ) run ( &olattice_ );
     LINFO ( "(Recased) lattice available at key=" << outputkey_ );
     d.fsts[outputkey_] = &olattice_;
     return false;
@@ -127,15 +136,22 @@ private:
   typedef fst::ApplyLanguageModelOnTheFlyInterface<Arc> ApplyLanguageModelOnTheFlyInterfaceType;
   typedef boost::shared_ptr<ApplyLanguageModelOnTheFlyInterfaceType> ApplyLanguageModelOnTheFlyInterfacePtrType;
   ApplyLanguageModelOnTheFlyInterfacePtrType almotf_;
+  /// Id of the model used by the handler
+  uint64_t almotfId_;
+  /// Recasing lm scores, private to this task so that it does not compete
+  /// with translation lm scores, nor with other threads
+  boost::scoped_ptr<fst::LmScoreCacheInterface> cache_;
 
 
   // Initializes appropriate templated kenlm handler for composition
   // TODO: this code can be merged with task.applylm and task.hifst
   void initializeLanguageModelHandler() {
-    if (almotf_.get() )  return; // already initialized
     USER_CHECK ( d_->klm.find ( lmkey_ ) != d_->klm.end() 
 		 && d_->klm[lmkey_].size() == 1
                  , "You need to load ONE recasing Language Model!" );
+    // already initialized, unless the model has changed (sentence-specific)
+    if (almotf_.get() && almotfId_ == d_->klm[lmkey_][0]->id)  return;
+    almotfId_ = d_->klm[lmkey_][0]->id;
     fst::MakeWeight<Arc> mw;
     std::unordered_set<Label> epsilons;
     ///We want the language model to ignore these guys:
@@ -146,23 +162,39 @@ private:
     bool a = true;
     almotf_.reset(assignKenLmHandler<Arc>
 		  ( rg_, lmkey_, epsilons, *(d_->klm[lmkey_][0]), mw, a));
+    if ( !cachesize_ ) return;
+    // A new model invalidates any cached score
+    cache_.reset ( fst::newLmScoreCache ( d_->klm[lmkey_][0]->model
+                                          , cachesize_ << 20, 1 ) );
+    almotf_->setScoreCache ( cache_.get() );
   }
 
-  /// Actual disambiguation done here: first apply unimap model, then apply language model.
-  void run ( fst::VectorFst<Arc> *fst ) {
+  /// Prepares unimap and language model for the current data object. False if there is nothing to recase with.
+  bool initialize() {
     if ( d_->fsts.find ( unimapkey_ ) == d_->fsts.end() ) {
       LINFO ( "No recasing step (key=" << unimapkey_ << " not found)" );
-      return;
+      return false;
     } else if ( d_->fsts[unimapkey_] == NULL ) {
       LINFO ( "No recasing step (NULL) " );
-      return;
+      return false;
     }
     initializeLanguageModelHandler();
     unimap_ = static_cast<fst::VectorFst<Arc> *> ( d_->fsts[unimapkey_] );
-    LINFO ( "Apply Unigram Model to 1-best" );
-    fst::VectorFst<Arc> mappedinput ( fst::RRhoCompose<Arc> ( *fst, *unimap_ ) );
-    LINFO ( "Tag OOVs" );
-    tagOOVs<Arc> ( &mappedinput, *d_->recasingvcblm );
+    if ( !expansions_.reset ( *unimap_, *d_->recasingvcblm ) )
+      LINFO ( "Unimap is not a flower fst: recasing with full composition" );
+    return true;
+  }
+
+  /// Actual disambiguation done here: first apply unimap model, then apply language model.
+  void run ( fst::VectorFst<Arc> *fst ) {
+    LINFO ( "Apply Unigram Model to 1-best and tag OOVs" );
+    fst::VectorFst<Arc> mappedinput;
+    if ( expansions_.reset ( *unimap_, *d_->recasingvcblm ) )
+      expansions_.expand ( *fst, &mappedinput );
+    else {
+      mappedinput = fst::RRhoCompose<Arc> ( *fst, *unimap_ );
+      tagOOVs<Arc> ( &mappedinput, *d_->recasingvcblm );
+    }
     LDBG_EXECUTE ( mappedinput.Write ( "mappedinput.fst" ) );
     fst::VectorFst<Arc> *output = almotf_->run(mappedinput);
     LINFO ( "Recover OOVs" );
@@ -0,0 +1,177 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use these files except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copyright 2012 - Gonzalo Iglesias, Adrià de Gispert, William Byrne
+
+#ifndef TASK_DISAMBIG_UNIMAPCACHE_HPP
+#define TASK_DISAMBIG_UNIMAPCACHE_HPP
+
+/**
+ * \file
+ * \brief Cached unimap expansions for DisambigTask
+ */
+
+namespace ucam {
+namespace fsttools {
+
+/**
+ * \brief Applies a unimap flower fst (see loadflowerfst) to a string, word by word.
+ * The output is exactly what RRhoCompose with the unimap followed by tagOOVs
+ * would produce (same states, same arc order), but the alternatives of each
+ * word are only looked up and tagged the first time the word is seen.
+ * Expansions are kept until the unimap or the vocabulary change.
+ * Not thread-safe: each DisambigTask owns one.
+ */
+template<class Arc>
+class UnimapExpansionCache {
+ private:
+  typedef typename Arc::Label Label;
+  typedef typename Arc::Weight Weight;
+  typedef typename Arc::StateId StateId;
+
+  /// One output alternative for a word. OOVs are rewritten as tagOOVs does
+  struct Alternative {
+    Label olabel;
+    Weight weight;
+    bool oov;
+  };
+  typedef std::vector<Alternative> Expansion;
+
+  fst::VectorFst<Arc> const *unimap_;
+  std::unordered_set<std::string> const *vcb_;
+  /// False if the unimap is not a flower, i.e. needs a real composition
+  bool flower_;
+  /// First arc and number of arcs for each input label of the unimap
+  std::unordered_map<Label, std::pair<std::size_t, std::size_t> > ranges_;
+  std::unordered_map<Label, Expansion> expansions_;
+  fst::MakeWeight<Arc> mw_;
+
+  Expansion const& expansion ( Label label ) {
+    typename std::unordered_map<Label, Expansion>::iterator itx
+      = expansions_.find ( label );
+    if ( itx != expansions_.end() ) return itx->second;
+    Expansion& e = expansions_[label];
+    // Composition with an epsilon keeps the unimap state (implicit loop)
+    if ( label == 0 ) {
+      add ( e, 0, Weight::One() );
+      return e;
+    }
+    // Words without alternatives match rho, which is rewritten to the word itself
+    bool rho = false;
+    typename std::unordered_map<Label, std::pair<std::size_t, std::size_t> >::const_iterator
+    itr = ranges_.find ( label );
+    if ( itr == ranges_.end() ) {
+      itr = ranges_.find ( RHO );
+      if ( itr == ranges_.end() ) return e;
+      rho = true;
+    }
+    fst::ArcIterator<fst::VectorFst<Arc> > ai ( *unimap_, 0 );
+    for ( std::size_t k = 0; k < itr->second.second; ++k ) {
+      ai.Seek ( itr->second.first + k );
+      Arc const& arc = ai.Value();
+      add ( e, rho && arc.olabel == RHO ? label : arc.olabel, arc.weight );
+    }
+    return e;
+  };
+
+  inline void add ( Expansion& e, Label olabel, Weight const& weight ) {
+    Alternative a;
+    a.olabel = olabel;
+    a.weight = weight;
+    a.oov = vcb_->find ( ucam::util::toString<unsigned> ( olabel ) ) == vcb_->end();
+    e.push_back ( a );
+  };
+
+ public:
+  UnimapExpansionCache()
+    : unimap_ ( NULL )
+    , vcb_ ( NULL )
+    , flower_ ( false ) {
+  };
+
+  /**
+   * \brief Points to the unimap and vocabulary to use. Cached expansions are kept
+   * unless any of them changes.
+   * \returns false if the unimap is not a single-state ilabel-sorted fst without
+   * input epsilons, in which case expand can not be used.
+   */
+  bool reset ( fst::VectorFst<Arc> const& unimap
+               , std::unordered_set<std::string> const& vcb ) {
+    if ( unimap_ == &unimap && vcb_ == &vcb ) return flower_;
+    unimap_ = &unimap;
+    vcb_ = &vcb;
+    expansions_.clear();
+    ranges_.clear();
+    flower_ = unimap.NumStates() == 1 && unimap.Start() == 0
+              && unimap.Properties ( fst::kILabelSorted | fst::kNoIEpsilons, true )
+              == ( fst::kILabelSorted | fst::kNoIEpsilons );
+    if ( !flower_ ) return false;
+    std::size_t k = 0;
+    for ( fst::ArcIterator<fst::VectorFst<Arc> > ai ( unimap, 0 ); !ai.Done();
+          ai.Next(), ++k ) {
+      std::pair<std::size_t, std::size_t>& r = ranges_[ai.Value().ilabel];
+      if ( !r.second ) r.first = k;
+      ++r.second;
+    }
+    return true;
+  };
+
+  /**
+   * \brief Expands ifst, typically a 1-best string, with the unimap into ofst.
+   * States are numbered in the order the composition would find them.
+   * Requires a successful reset.
+   */
+  void expand ( fst::VectorFst<Arc> const& ifst, fst::VectorFst<Arc> *ofst ) {
+    ofst->DeleteStates();
+    if ( ifst.Start() == fst::kNoStateId ) return;
+    Weight ufinal = unimap_->Final ( 0 );
+    std::vector<StateId> ids ( ifst.NumStates(), fst::kNoStateId );
+    std::vector<StateId> queue;
+    queue.push_back ( ifst.Start() );
+    ids[ifst.Start()] = ofst->AddState();
+    ofst->SetStart ( 0 );
+    for ( std::size_t k = 0; k < queue.size(); ++k ) {
+      StateId s = queue[k];
+      Weight f = ifst.Final ( s );
+      if ( f != Weight::Zero() && ufinal != Weight::Zero() )
+        ofst->SetFinal ( k, Times ( f, ufinal ) );
+      for ( fst::ArcIterator<fst::VectorFst<Arc> > ai ( ifst, s ); !ai.Done();
+            ai.Next() ) {
+        Arc const& arc = ai.Value();
+        Expansion const& e = expansion ( arc.olabel );
+        if ( e.empty() ) continue;
+        StateId& next = ids[arc.nextstate];
+        if ( next == fst::kNoStateId ) {
+          next = ofst->AddState();
+          queue.push_back ( arc.nextstate );
+        }
+        for ( std::size_t j = 0; j < e.size(); ++j ) {
+          if ( e[j].oov )
+            ofst->AddArc ( k, Arc ( e[j].olabel, OOV, mw_ ( 0 ), next ) );
+          else
+            ofst->AddArc ( k, Arc ( arc.ilabel, e[j].olabel
+                                    , Times ( arc.weight, e[j].weight ), next ) );
+        }
+      }
+    }
+  };
+
+  ///Number of words expanded so far
+  inline std::size_t size() const {
+    return expansions_.size();
+  };
+};
+
+}
+} // end namespaces
+
+#endif
@@ -31,6 +31,7 @@
 #endif
 #include <idbridge.hpp>
 #include <hifst_enumerate_vocab.hpp>
+#include <data.lm.registry.hpp>
 
 namespace ucam {
 namespace fsttools {
@@ -135,6 +136,59 @@ lm::base::Model *loadKenLm(std::string const &file
   return NULL;
 };
 
+/**
+ * \brief Loads a language model into kld, which gets a new id.
+ * \param wm  Target wordmap, if the language model is not integer-mapped.
+ */
+inline void loadKenLMData ( KenLMData& kld
+                            , std::string const& file
+                            , ucam::util::WordMapper *wm
+                            , std::size_t cachesize
+                            , unsigned index = 0 ) {
+  lm::ngram::Config kenlm_config;
+  lm::HifstEnumerateVocab<ucam::util::WordMapper> hev (kld.idb, wm);
+  kenlm_config.enumerate_vocab = &hev;
+  kld.model = loadKenLm(file, kenlm_config, index);
+  kld.id = newLanguageModelId();
+  if ( cachesize ) {
+    // Language model handlers may already point to the cache,
+    // so empty it rather than creating a new one
+    if ( kld.cache.get() != NULL ) kld.cache->clear();
+    else kld.cache.reset ( fst::newLmScoreCache ( kld.model, cachesize << 20 ) );
+  }
+};
+
+/**
+ * \brief Loads a language model into a new KenLMData object.
+ * Holds copies of everything it needs, so it can run in any thread
+ * (see LanguageModelRegistry).
+ */
+struct KenLMDataLoader {
+  std::string file;
+  ucam::util::WordMapper *wm;
+  float lmscale;
+  float lmwp;
+  ///Score cache memory, in MB
+  std::size_t cachesize;
+  unsigned index;
+
+  KenLMData *operator() () const {
+    FORCELINFO ( "loading LM=" << file );
+    KenLMData *kld = new KenLMData;
+    kld->lmscale = lmscale;
+    kld->lmwp = lmwp;
+    loadKenLMData ( *kld, file, wm, cachesize, index );
+    return kld;
+  };
+
+  /// Estimated memory of the model: file size, plus its score cache.
+  std::size_t bytes() const {
+    boost::system::error_code e;
+    uintmax_t size = boost::filesystem::file_size ( file, e );
+    return ( e ? 0 : size ) + ( cachesize << 20 );
+  };
+};
+
 /**
  * \brief Language model loader task, loads a language model wrapping it in a class to provide.
  *
@@ -169,6 +223,20 @@ class LoadLanguageModelTask: public ucam::util::TaskInterface<Data> {
   const std::string wordmapkey_;
   bool isintegermapped_;
 
+  ///Memory for the score cache, in MB. 0 if disabled
+  std::size_t cachesize_;
+
+  ///Models shared across threads. If NULL, this task owns the model.
+  LanguageModelRegistry *registry_;
+  ///Model in use, if taken from the registry
+  LanguageModelRegistry::KenLMDataPtr current_;
+  ///Number of following sentences whose models are loaded in the background
+  unsigned prefetch_;
+  ///Sentences to translate, in order, if a range was given (only needed to prefetch)
+  std::vector<unsigned> range_;
+  ///First position of each sentence in range_
+  unordered_map<unsigned, std::size_t> rangepos_;
+
  public:
 
   /**
@@ -179,6 +247,8 @@ class LoadLanguageModelTask: public ucam::util::TaskInterface<Data> {
    * \param lmload    key word to access the registry object for language models
    * \param lmscale   key word to access the registry object for language model scales.
    * \param forceone  To force the loading of only one language model (i.e. lm1 with scale 0.25).
+   * \param registry  If not NULL, models are taken from this registry, which may be shared
+   * with other threads (e.g. for sentence-specific language models in multithreaded mode).
    */
   LoadLanguageModelTask ( const ucam::util::RegistryPO& rg
                           , const std::string& lmload = HifstConstants::kLmLoad
@@ -188,6 +258,7 @@ class LoadLanguageModelTask: public ucam::util::TaskInterface<Data> {
                           HifstConstants::kLmWordPenalty  //if rg.get(wps)=="" the scale will default to 0
                           , const std::string& wordmapkey = HifstConstants::kLmWordmap
                           , bool forceone = false
+                          , LanguageModelRegistry *registry = NULL
                           )
       : rg_ ( rg )
       , lmkey_ ( lmload )
@@ -198,18 +269,24 @@ class LoadLanguageModelTask: public ucam::util::TaskInterface<Data> {
                           || rg.get<std::string> (wordmapkey) == "")
       , wordmapkey_ (wordmapkey)
       , lmfile_ ( rg.getVectorString ( lmload , 0 ) )
+      , cachesize_ ( rg.exists ( HifstConstants::kLmCacheSize )
+                     ? rg.get<unsigned> ( HifstConstants::kLmCacheSize ) : 0 )
+      , registry_ ( registry )
+      , prefetch_ ( rg.exists ( HifstConstants::kLmPrefetch )
+                    ? rg.get<unsigned> ( HifstConstants::kLmPrefetch ) : 0 )
   {
     LDEBUG ( "LM loader using parameters " << lmload << "/" << lmscale << "/" << lmwp
             << ", and key " << lmkey_  << ",index=" << index_ << ",wordmap=" <<
             wordmapkey_);
     FORCELINFO("Language model loader for " << lmfile_() );
+    initPrefetchRange();
     setLanguageModelScale ( lmscale );
     setLanguageModelWordPenalty ( lmwp );
     if ( rg_.getVectorString ( lmload ).size() > 1 ) {
       if ( !forceone ) {
         LINFO ( "Appending Language model..." );
         this->appendTask ( new LoadLanguageModelTask ( rg_, 1, lmload, lmscale , lmwp ,
-                           wordmapkey ) );
+                           wordmapkey, registry ) );
       } else {
         LWARN ( "Only one loaded for " << lmload <<
                 ". Extra language models are being ignored" );
@@ -226,40 +303,23 @@ class LoadLanguageModelTask: public ucam::util::TaskInterface<Data> {
   bool run ( Data& d ) {
     LDEBUG ( "run!" );
     if ( lmfile_() == "" ) return false;
+    if ( registry_ != NULL ) return runFromRegistry ( d );
     // No need to build again...
     if ( built_ && previous_ == lmfile_ ( d.sidx ) ) return false;
     close();
     FORCELINFO ( "loading LM=" << lmfile_ ( d.sidx ) );
     d.stats->setTimeStart ("lm-load-" + index_ );
-    lm::ngram::Config kenlm_config;
-    // If lm is not integermapped, then we will need a proper grammar target wordmap.
-    // Make sure we have it.
-    ucam::util::WordMapper *wm = NULL;
-    if (!isintegermapped_) {
-      LINFO ("Using wordmap " << wordmapkey_);
-      LINFO ("There are " << d.wm.size() << " wordmaps");
-      USER_CHECK (d.wm.find (wordmapkey_) != d.wm.end()
-                  , "Language model provided over words instead of integers. A target wordmap is required! ");
-      wm = d.wm[wordmapkey_];
-    }
-    lm::HifstEnumerateVocab<ucam::util::WordMapper> hev (kld_.idb, wm);
-    kenlm_config.enumerate_vocab = &hev;
-    kld_.model = loadKenLm(lmfile_(d.sidx).c_str(), kenlm_config, index_);
+    loadKenLMData ( kld_, lmfile_ ( d.sidx ), getWordMap ( d ), cachesize_, index_ );
     d.stats->setTimeEnd ("lm-load-" + index_ );
     previous_ = lmfile_ ( d.sidx );
     built_ = true;
-    if ( d.klm.find ( lmkey_ ) == d.klm.end() ) d.klm[lmkey_].resize ( index_ + 1 );
-    else if ( d.klm[lmkey_].size() < index_ + 1 ) d.klm[lmkey_].resize
-        ( index_ + 1 );
-    d.klm[lmkey_][index_] = (const KenLMData*) &kld_;
-    LDEBUG ( "LM " << lmfile_ ( d.sidx ) << " loaded, key=" << lmkey_ <<
-	    ", position=" <<  ucam::util::toString<unsigned> ( d.klm[lmkey_].size() - 1 ) <<
-             ",total number of language models for this key is " << d.klm[lmkey_].size() );
+    store ( d, &kld_ );
     return false;
   };
 
   /// Free language model resources. Returns true if ok, false if otherwise.
   bool close() {
+    current_.reset();
     if ( kld_.model != NULL ) {
       LINFO ( "Releasing language model resources..." );
       delete kld_.model;
@@ -277,6 +337,97 @@ class LoadLanguageModelTask: public ucam::util::TaskInterface<Data> {
 
  private:
 
+  /**
+   * \brief Takes the model for this sentence from the registry,
+   * and requests the models of the following sentences.
+   * Data objects are not reused across sentences,
+   * so the model is stored even if it has not changed.
+   */
+  bool runFromRegistry ( Data& d ) {
+    KenLMDataLoader loader = getLoader ( d, lmfile_ ( d.sidx ) );
+    if ( !built_ || previous_ != loader.file ) {
+      d.stats->setTimeStart ("lm-load-" + index_ );
+      current_ = registry_->get ( getRegistryKey ( loader ), loader.bytes(), loader );
+      d.stats->setTimeEnd ("lm-load-" + index_ );
+      previous_ = loader.file;
+      built_ = true;
+    }
+    store ( d, current_.get() );
+    for ( unsigned k = 1; k <= prefetch_; ++k ) {
+      unsigned sidx;
+      if ( !nextSentence ( d.sidx, k, sidx ) ) break;
+      KenLMDataLoader next = getLoader ( d, lmfile_ ( sidx ) );
+      if ( next.file == loader.file ) continue;
+      // e.g. past the end of the input
+      if ( !boost::filesystem::exists ( next.file ) ) continue;
+      registry_->prefetch ( getRegistryKey ( next ), next.bytes(), next );
+    }
+    return false;
+  };
+
+  ///Reads the range of sentences to translate, so that only those are prefetched.
+  void initPrefetchRange() {
+    if ( !prefetch_ || !rg_.exists ( HifstConstants::kRange ) ) return;
+    ucam::util::getRange ( rg_.get<std::string> ( HifstConstants::kRange ), range_ );
+    for ( std::size_t k = range_.size(); k > 0; --k ) rangepos_[range_[k - 1]] = k - 1;
+  };
+
+  /**
+   * \brief Finds the sentence translated k positions after sidx.
+   * Without a range, sentences are translated consecutively until the input ends.
+   * \returns false if sidx is the last one, or too close to the end of the range.
+   */
+  bool nextSentence ( unsigned sidx, unsigned k, unsigned& next ) const {
+    if ( range_.empty() ) {
+      next = sidx + k;
+      return true;
+    }
+    unordered_map<unsigned, std::size_t>::const_iterator itx = rangepos_.find ( sidx );
+    if ( itx == rangepos_.end() || itx->second + k >= range_.size() ) return false;
+    next = range_[itx->second + k];
+    return true;
+  };
+
+  inline void store ( Data& d, KenLMData const *kld ) {
+    if ( d.klm.find ( lmkey_ ) == d.klm.end() ) d.klm[lmkey_].resize ( index_ + 1 );
+    else if ( d.klm[lmkey_].size() < index_ + 1 ) d.klm[lmkey_].resize
+        ( index_ + 1 );
+    d.klm[lmkey_][index_] = kld;
+    LDEBUG ( "LM " << previous_ << " loaded, key=" << lmkey_ <<
+	    ", position=" <<  ucam::util::toString<unsigned> ( d.klm[lmkey_].size() - 1 ) <<
+             ",total number of language models for this key is " << d.klm[lmkey_].size() );
+  };
+
+  /// If lm is not integermapped, then we will need a proper grammar target wordmap.
+  /// Make sure we have it.
+  ucam::util::WordMapper *getWordMap ( Data& d ) {
+    if ( isintegermapped_ ) return NULL;
+    LINFO ("Using wordmap " << wordmapkey_);
+    LINFO ("There are " << d.wm.size() << " wordmaps");
+    USER_CHECK (d.wm.find (wordmapkey_) != d.wm.end()
+                , "Language model provided over words instead of integers. A target wordmap is required! ");
+    return d.wm[wordmapkey_];
+  };
+
+  KenLMDataLoader getLoader ( Data& d, std::string const& file ) {
+    KenLMDataLoader loader;
+    loader.file = file;
+    loader.wm = getWordMap ( d );
+    loader.lmscale = kld_.lmscale;
+    loader.lmwp = kld_.lmwp;
+    loader.cachesize = cachesize_;
+    loader.index = index_;
+    return loader;
+  };
+
+  /// Models are shared only if loaded with the same parameters.
+  inline std::string getRegistryKey ( KenLMDataLoader const& loader ) const {
+    std::ostringstream key;
+    key << loader.file << "|" << wordmapkey_ << "|" << loader.lmscale << "|" << loader.lmwp
+        << "|" << loader.cachesize;
+    return key.str();
+  };
+
   /**
    * \brief Private constructor with ucam::util::RegistryPO object and index to a particular language model.
    * This constructor is only used when several language models are loaded.
@@ -294,7 +445,8 @@ class LoadLanguageModelTask: public ucam::util::TaskInterface<Data> {
                           const std::string& lmload = HifstConstants::kLmLoad,
                           const std::string& lmscale = HifstConstants::kLmFeatureweights ,
                           const std::string& lmwp = HifstConstants::kLmWordPenalty,
-                          const std::string& wordmapkey = HifstConstants::kLmWordmap
+                          const std::string& wordmapkey = HifstConstants::kLmWordmap,
+                          LanguageModelRegistry *registry = NULL
                         ) :
     rg_ ( rg ),
     lmkey_ ( lmload ),
@@ -304,16 +456,22 @@ class LoadLanguageModelTask: public ucam::util::TaskInterface<Data> {
     isintegermapped_ (!rg.exists (wordmapkey)
                       || rg.get<std::string> (wordmapkey) == ""),
     wordmapkey_ (wordmapkey),
-    lmfile_ ( rg.getVectorString ( lmload , index ) ) {
+    lmfile_ ( rg.getVectorString ( lmload , index ) ),
+    cachesize_ ( rg.exists ( HifstConstants::kLmCacheSize )
+                 ? rg.get<unsigned> ( HifstConstants::kLmCacheSize ) : 0 ),
+    registry_ ( registry ),
+    prefetch_ ( rg.exists ( HifstConstants::kLmPrefetch )
+                ? rg.get<unsigned> ( HifstConstants::kLmPrefetch ) : 0 ) {
     LDEBUG ( "LM loader using parameters " << lmload << "/" << lmscale <<
             ", and key " << lmkey_  << ",index=" << index_ << ",wordmapkey=" <<
             wordmapkey_);
+    initPrefetchRange();
     setLanguageModelScale ( lmscale );
     setLanguageModelWordPenalty ( lmwp );
     if ( rg.getVectorString ( lmload ).size() > index_ + 1 ) {
       LDEBUG ( "Appending Language model..." );
       this->appendTask ( new LoadLanguageModelTask ( rg, index_ + 1, lmload, lmscale ,
-                         lmwp , wordmapkey ) );
+                         lmwp , wordmapkey, registry ) );
     }
     LDEBUG ( "." );
   };
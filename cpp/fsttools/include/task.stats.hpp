@@ -59,6 +59,12 @@ class SpeedStatsTask: public ucam::util::TaskInterface<Data> {
     writeSpeedStats ( o );
     o << "-----------------------------------------------------------------" <<
       std::endl;
+    if ( d_->stats->lmcache.size() ) {
+      o << "LM score caches (hits, lookups):" << std::endl;
+      d_->stats->writeLmCacheStats ( o );
+      o << "-----------------------------------------------------------------" <<
+        std::endl;
+    }
     o << "Other:" << std::endl;
     o << d_->stats->message << std::endl;
     o << "=================================================================" <<
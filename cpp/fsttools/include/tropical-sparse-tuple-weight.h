@@ -27,9 +27,20 @@
 
 namespace fst {
 
+template<typename T> class TropicalSparseTupleWeight;
+
+template<typename T>
+T DotProduct ( const TropicalSparseTupleWeight<T>& w,
+               const std::vector<T>& vw );
+
 /**
  * \brief Implements Tropical Sparse tuple weight semiring, extending from openfst SparsePowerWeight class
  * \remark Main addition: The dot product of features with its scales is a tropical weight.
+ * Results of semiring operations keep this dot product (see Score), so that Plus
+ * does not need to recompute it. The cached value is stamped with the generation of the
+ * parameters it was computed with, and ignored once the parameters change (see SetParams).
+ * Weights built by pushing features do not cache it, as they could still be modified
+ * through the base class afterwards.
  */
 
 template<typename T>
@@ -38,12 +49,18 @@ class TropicalSparseTupleWeight: public
 
  public:
 
-  static std::vector<T>& Params() {
-    static ucam::util::ParamsInit<T> params;
-    return params.params;
+  typedef TropicalWeightTpl<T> W;
+
+  ///Current feature scales. Use SetParams to change them.
+  static const std::vector<T>& Params() {
+    return ParamsStore().params;
   }
 
-  typedef TropicalWeightTpl<T> W;
+  ///Sets feature scales, invalidating the scores cached by all existing weights.
+  static void SetParams ( const std::vector<T>& params ) {
+    ParamsStore().params = params;
+    if ( !++Generation() ) ++Generation();
+  }
 
   using SparsePowerWeight<W>::Zero;
   using SparsePowerWeight<W>::One;
@@ -55,18 +72,25 @@ class TropicalSparseTupleWeight: public
   typedef TropicalSparseTupleWeight<T> ReverseWeight;
 
   TropicalSparseTupleWeight() :
-    SparsePowerWeight<W>() {
+    SparsePowerWeight<W>()
+    , score_ ( 0 )
+    , generation_ ( 0 ) {
     this->SetDefaultValue ( W::One() );
   }
 
   TropicalSparseTupleWeight ( const SparsePowerWeight<W>& sw ) :
-    SparsePowerWeight<W> (sw ) {
-
+    SparsePowerWeight<W> (sw )
+    , score_ ( 0 )
+    , generation_ ( 0 ) {
+    UpdateScore();
   }
 
   TropicalSparseTupleWeight ( const W& w ) :
-    SparsePowerWeight<W>() {
+    SparsePowerWeight<W>()
+    , score_ ( 0 )
+    , generation_ ( 0 ) {
       this->SetDefaultValue(w);
+      UpdateScore();
   }
 
   inline static std::string GetPrecisionString() {
@@ -104,6 +128,7 @@ class TropicalSparseTupleWeight: public
   TropicalSparseTupleWeight<T> Quantize ( float delta = kDelta ) const {
     TropicalSparseTupleWeight<T> w = SparsePowerWeight<W>::Quantize ( delta );
     w.SetDefaultValue ( this->DefaultValue() );
+    w.UpdateScore();
     return w;
   }
 
@@ -111,45 +136,124 @@ class TropicalSparseTupleWeight: public
     return *this;
   }
 
+  // Modifiers hide those of the base class, so that the cached score is dropped.
+  inline void Push ( const int& k, const W& w, bool unique = false ) {
+    generation_ = 0;
+    SparsePowerWeight<W>::Push ( k, w, unique );
+  }
+
+  inline void Push ( const std::pair<int, W>& p, bool unique = false ) {
+    generation_ = 0;
+    SparsePowerWeight<W>::Push ( p, unique );
+  }
+
+  inline void SetDefaultValue ( const W& w ) {
+    generation_ = 0;
+    SparsePowerWeight<W>::SetDefaultValue ( w );
+  }
+
+  inline std::istream& Read ( std::istream& strm ) {
+    SparsePowerWeight<W>::Read ( strm );
+    UpdateScore();
+    return strm;
+  }
+
+  /**
+   * \brief Dot product with the current parameters (see DotProduct).
+   * Only computed if not cached.
+   */
+  inline T Score() const {
+    if ( generation_ == Generation() ) return score_;
+    return DotProduct ( *this, Params() );
+  }
+
+  /**
+   * \brief Caches the dot product with the current parameters.
+   * Call once the weight is complete, before it is shared with other threads.
+   * Nothing is cached if features exceed the dimension of the parameters.
+   */
+  inline void UpdateScore() {
+    generation_ = ComputeDotProduct ( Params(), &score_ ) ? Generation() : 0;
+  }
+
+  /**
+   * \brief Scale of feature k in vw, i.e. vw[k-1]. Negative indices are ignored,
+   * and all scales are 1 if vw is empty (flat params).
+   * \returns false if k exceeds the dimension of vw.
+   */
+  inline static bool Param ( int k, const std::vector<T>& vw, T *param ) {
+    if ( vw.empty() ) {
+      *param = 1;
+    } else if ( k > int ( vw.size() ) ) {
+      return false;
+    } else if ( k < 0 ) {
+      *param = 0;
+    } else {
+      *param = vw[k - 1];
+    }
+    return true;
+  }
+
+  ///Dot product of this weight with vw. Returns false if features exceed the dimension of vw.
+  inline bool ComputeDotProduct ( const std::vector<T>& vw, T *result ) const {
+    *result = this->DefaultValue().Value();
+    for ( SparseTupleWeightIterator<W, int> it ( *this ); !it.Done();
+          it.Next() ) {
+      T param;
+      if ( !Param ( it.Value().first, vw, &param ) ) return false;
+      *result += it.Value().second.Value() * param;
+    }
+    return true;
+  }
+
   template<typename TT>
   friend TropicalSparseTupleWeight<TT> Plus (
     const TropicalSparseTupleWeight<TT>&,
     const TropicalSparseTupleWeight<TT>&);
+
+ private:
+  ///Dot product with Params(), if generation_ is current
+  T score_;
+  ///Parameters generation score_ was computed with. 0 if none
+  unsigned generation_;
+
+  static ucam::util::ParamsInit<T>& ParamsStore() {
+    static ucam::util::ParamsInit<T> params;
+    return params;
+  }
+
+  ///Incremented each time the parameters are set. Never 0.
+  static unsigned& Generation() {
+    static unsigned generation = 1;
+    return generation;
+  }
 };
 
 ///Implements Dot product of two vector weights
 template<typename T>
 T DotProduct ( const TropicalSparseTupleWeight<T>& w,
                const std::vector<T>& vw ) {
-  T result = w.DefaultValue().Value();
+  T result;
+  if ( w.ComputeDotProduct ( vw, &result ) ) return result;
   for ( SparseTupleWeightIterator<TropicalWeightTpl<T>, int> it ( w ); !it.Done();
         it.Next() ) {
-    T param;
-    // Special case for flat params
-    if ( vw.empty() ) {
-      param = 1;
-    } else if ( it.Value().first > int ( vw.size() ) ) {
+    if ( it.Value().first > int ( vw.size() ) ) {
       std::cerr
           << "feature vector has a larger dimensionality than the parameters. "
           << "Params: " << vw.size() << " Features: "
           << it.Value().first << std::endl;
-      exit ( 1 );
-    } else if (it.Value().first <  0) // ignore negative indices
-      param = 0;
-    else {
-      param = vw[it.Value().first - 1];
+      break;
     }
-    result += it.Value().second.Value() * param;
   }
-  return result;
+  exit ( 1 );
 }
 
 template<class T>
 inline TropicalSparseTupleWeight<T> Plus (
   const TropicalSparseTupleWeight<T>& vw1,
   const TropicalSparseTupleWeight<T>& vw2 ) {
-  T w1 = DotProduct ( vw1, TropicalSparseTupleWeight<T>::Params() );
-  T w2 = DotProduct ( vw2, TropicalSparseTupleWeight<T>::Params() );
+  T w1 = vw1.Score();
+  T w2 = vw2.Score();
   return w1 < w2 ? vw1 : vw2;
 }
 
@@ -168,6 +272,7 @@ inline TropicalSparseTupleWeight<T> Times (
   TropicalSparseTupleWeight<T> ret;
   SparseTupleWeightTimesMapper<TropicalWeightTpl<T>, int> operator_mapper;
   SparseTupleWeightMap ( &ret, w1, w2, operator_mapper );
+  ret.UpdateScore();
   return ret;
 }
 
@@ -180,9 +285,67 @@ inline TropicalSparseTupleWeight<T> Divide (
   SparseTupleWeightDivideMapper<TropicalWeightTpl<T>, int> operator_mapper (
     type );
   SparseTupleWeightMap ( &ret, w1, w2, operator_mapper );
+  ret.UpdateScore();
   return ret;
 };
 
+/**
+ * \brief Adds up repeated features, as tuple weights may have several values for the same index.
+ * Same result as accumulating on a std::map<int, T>, but features are kept in a flat
+ * buffer, so no allocation is needed once it is large enough. Reuse one object across weights.
+ */
+template<typename T>
+class SparseFeatureMerger {
+ public:
+  inline void Clear() {
+    features_.clear();
+  }
+
+  inline void Add ( int k, T value ) {
+    features_.push_back ( std::make_pair ( k, value ) );
+  }
+
+  /**
+   * \brief Sorts features by index and adds up values of the same index,
+   * in the order they were added.
+   */
+  void Merge() {
+    // Insertion sort: stable, in place, and fast for the few features of an arc.
+    for ( std::size_t i = 1; i < features_.size(); ++i ) {
+      std::pair<int, T> f = features_[i];
+      std::size_t j = i;
+      for ( ; j > 0 && features_[j - 1].first > f.first; --j )
+        features_[j] = features_[j - 1];
+      features_[j] = f;
+    }
+    std::size_t n = 0;
+    for ( std::size_t i = 0; i < features_.size(); ++n ) {
+      int k = features_[i].first;
+      T value = 0;
+      for ( ; i < features_.size() && features_[i].first == k; ++i )
+        value += features_[i].second;
+      features_[n] = std::make_pair ( k, value );
+    }
+    features_.resize ( n );
+  }
+
+  ///Features added so far, merged once Merge has been called.
+  inline const std::vector<std::pair<int, T> >& Features() const {
+    return features_;
+  }
+
+  ///Pushes the merged features into w, and clears the buffer.
+  void Flush ( TropicalSparseTupleWeight<T> *w ) {
+    Merge();
+    for ( std::size_t i = 0; i < features_.size(); ++i )
+      w->Push ( features_[i].first, features_[i].second );
+    features_.clear();
+  }
+
+ private:
+  std::vector<std::pair<int, T> > features_;
+};
+
 ///Map functor used with generic weight mapper
 template<typename T>
 struct DotProductMap {
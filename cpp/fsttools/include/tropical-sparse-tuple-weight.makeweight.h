@@ -90,6 +90,14 @@ struct MakeWeight<TupleArc32> {
   int32_t k_;
 };
 
+///Template specialization of functor GetWeight for TupleArc32. Returns the dot product with the current parameters, cached by the weight if possible.
+template<>
+struct GetWeight<TupleArc32> {
+  inline float operator () ( const TupleArc32::Weight& weight ) {
+    return weight.Score();
+  };
+};
+
 } //namespace fst
 
 #endif /* TROPICALSPARSETUPLEWEIGHT_MAKEWEIGHT_H_ */
@@ -66,7 +66,7 @@ class TuneSet {
   Bleu ComputeBleu ( BleuScorer& bs, PARAMS32 const& vw ) {
     using namespace fst;
     PARAMS32 dval = TropicalSparseTupleWeight<float>::Params();
-    TropicalSparseTupleWeight<float>::Params() = vw;
+    TropicalSparseTupleWeight<float>::SetParams ( vw );
     BleuStats bstats;
 
     for ( int i = 0; i < sidMax; ++i ) {
@@ -80,7 +80,7 @@ class TuneSet {
       // \todo define += operator?
       bstats = bstats + bs.SentenceBleuStats ( i, h );
     }
-    TropicalSparseTupleWeight<float>::Params() = dval;
+    TropicalSparseTupleWeight<float>::SetParams ( dval );
     return bs.ComputeBleu ( bstats );
   }
 
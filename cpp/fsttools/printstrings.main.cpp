@@ -100,41 +100,40 @@ void printWeight<TupleArc32> (const TupleW32& weight
                               , std::ostream& os
                               , unsigned precision
                               ) {
-  std::map<int,float> costs;
-  std::string separator (",");
-
+  // One buffer per thread, as lattices are printed concurrently
+  static boost::thread_specific_ptr<fst::SparseFeatureMerger<float> > merger;
+  if (merger.get() == NULL) merger.reset (new fst::SparseFeatureMerger<float>);
+  merger->Clear();
   for (fst::SparseTupleWeightIterator<fst::TropicalWeight, int> it (weight);
        !it.Done(); it.Next() ) {
-    costs[it.Value().first] += it.Value().second.Value();
+    merger->Add (it.Value().first, it.Value().second.Value() );
   }
+  merger->Merge();
+  std::vector<std::pair<int, float> > const& costs = merger->Features();
+  std::string separator (",");
 
   if (liblinrankformat) {
-    for (std::map<int,float>::const_iterator itx=costs.begin();
-	 itx != costs.end(); ++itx) {
-      os << " " << itx->first << ":" << itx->second;
+    for (std::size_t k = 0; k < costs.size(); ++k) {
+      os << " " << costs[k].first << ":" << costs[k].second;
     }
     return;
   }
 
   if (sparseformat) {
     os << "0" << separator << costs.size();
-    for (std::map<int,float>::const_iterator itx=costs.begin()
-             ; itx != costs.end()
-             ; ++itx) {
-      os << separator << itx->first << separator << std::setprecision(precision) << itx->second;
+    for (std::size_t k = 0; k < costs.size(); ++k) {
+      os << separator << costs[k].first << separator << std::setprecision(precision) << costs[k].second;
     }
     return;
   } 
   if (dotProduct) {
     float w =0;
     std::vector<float> const &fws = TupleW32::Params();
-    for (std::map<int,float>::const_iterator itx=costs.begin()
-             ; itx != costs.end()
-             ; ++itx) {
-      if (itx->first < 1) continue;
+    for (std::size_t k = 0; k < costs.size(); ++k) {
+      if (costs[k].first < 1) continue;
 
-      float fw = fws[itx->first - 1];
-      w = w + fw * itx->second;
+      float fw = fws[costs[k].first - 1];
+      w = w + fw * costs[k].second;
     }
     os << std::setprecision(precision) << w;
     return;
@@ -142,18 +141,16 @@ void printWeight<TupleArc32> (const TupleW32& weight
   std::size_t nonSparseSize = TupleW32::Params().size();
   std::size_t counter = 1;
   separator = "";
-  for (std::map<int,float>::const_iterator itx=costs.begin()
-           ; itx != costs.end()
-           ; ++itx) {
-    if (itx->first < 1 ) continue;
-    std::size_t featureIndex = itx->first;
+  for (std::size_t k = 0; k < costs.size(); ++k) {
+    if (costs[k].first < 1 ) continue;
+    std::size_t featureIndex = costs[k].first;
     for (std::size_t featureMissingIndex = counter;
          featureMissingIndex < featureIndex; ++featureMissingIndex) {
       os << separator << "0";
       separator = ","; // @todo should be possible to avoid resetting every time.
     }
-    os << separator << itx->second;
-    counter = itx->first + 1;
+    os << separator << costs[k].second;
+    counter = costs[k].first + 1;
     separator = ",";
   }
   for (; counter <= nonSparseSize; ++counter) {
@@ -209,7 +206,7 @@ std::ostream& operator<< (std::ostream& os, const HypW<Arc>& obj) {
     if (obj.hyp[k] == SEP) continue;
     labelmap_iterator_t itx = vmap.find (obj.hyp[k]);
     if (itx != vmap.end() )
-      os << vmap[ obj.hyp[k] ] << " ";
+      os << itx->second << " ";
     else {
       os << "[" << obj.hyp[k] << "] ";
       std::cerr << "\nWARNING: word map does not contain word " << obj.hyp[k] <<
@@ -223,180 +220,307 @@ std::ostream& operator<< (std::ostream& os, const HypW<Arc>& obj) {
   return os;
 }
 
+/**
+ * \brief Prints n-best lists of a range of lattices.
+ * Lattices are printed concurrently by several threads. Output goes either to
+ * one file per lattice (--output with ?) or to a single stream, in which
+ * case lattices are written in the same order they were read.
+ * Hypotheses are formatted as they are read from the shortest paths,
+ * without storing the n-best list.
+ */
 template <class Arc, class HypT>
-int run ( ucam::util::RegistryPO const& rg) {
-  using namespace ucam::util;
-  using namespace HifstConstants;
-  PatternAddress<unsigned> input (rg.get<std::string>
-                                  (kInput.c_str() ) );
-  PatternAddress<unsigned> output (rg.get<std::string>
-                                   (kOutput.c_str() ) );
-  PatternAddress<unsigned> intersectionLattice (rg.get<std::string>
-                                   (kIntersectionWithHypothesesLoad.c_str() ) );
-  unsigned n = rg.get<unsigned> (kNbest.c_str() );
-  boost::scoped_ptr<oszfstream> out;
-  bool unique =  rg.exists (kUnique.c_str() );
-  bool printOutputLabels = rg.exists(kPrintOutputLabels.c_str());
-  bool printInputOutputLabels = rg.exists(kPrintInputOutputLabels.c_str());
-
-  if (printInputOutputLabels)
-    FORCELINFO("Printing input and output labels...");
-  std::string old;
-  std::string refFiles;
-  bool intRefs = false;
-  bool dobleu = false;
-  bool sentbleu = false;
-
-  if (rg.exists(HifstConstants::kWordRefs)) {
-    refFiles = rg.getString(HifstConstants::kWordRefs);
-    dobleu = true;
-  }
-  if (rg.exists(HifstConstants::kIntRefs)) {
-    refFiles = rg.getString(HifstConstants::kIntRefs);
-    intRefs = true;
-    dobleu = true;
-  }
-  if (rg.exists (HifstConstants::kSentBleu) ) {
-    if (!dobleu) {
-      LERROR("Must provide references to compute sentence level bleu");
-      exit(EXIT_FAILURE);
+class PrintStrings {
+ private:
+  typedef ucam::util::ReorderBuffer<ucam::util::oszfstream> ReorderBuffer;
+
+  ucam::util::RegistryPO const& rg_;
+  ucam::util::PatternAddress<unsigned> input_;
+  ucam::util::PatternAddress<unsigned> output_;
+  ucam::util::PatternAddress<unsigned> intersectionLattice_;
+  unsigned n_;
+  bool unique_;
+  bool printOutputLabels_;
+  bool printInputOutputLabels_;
+  bool dobleu_;
+  bool sentbleu_;
+  ///One output file per lattice
+  bool perfile_;
+  unsigned threadcount_;
+  ///Whether printing a hypothesis leaves the output stream with precision myPrecision
+  bool setsPrecision_;
+  boost::scoped_ptr<ucam::fsttools::BleuScorer> bleuScorer_;
+  ///Bleu stats of the 1-best hypotheses, added up by all threads
+  ucam::fsttools::BleuStats bStats_;
+  boost::mutex mutex_;
+
+  ///Prints a lattice and hands over the output to the reorder buffer
+  struct LatticeFunctor {
+    PrintStrings *p_;
+    unsigned id_;
+    std::size_t position_;
+    ReorderBuffer *rb_;
+    LatticeFunctor (PrintStrings *p, unsigned id, std::size_t position
+                    , ReorderBuffer *rb)
+      : p_ (p)
+      , id_ (id)
+      , position_ (position)
+      , rb_ (rb) {
     }
-    sentbleu = true;
-  }
+    void operator() () {
+      rb_->push (position_, p_->printLattice (id_, position_) );
+    }
+  };
 
-  if (rg.exists (HifstConstants::kWeight) ) {
-    printweight = true;
-  }
-  if (rg.exists (HifstConstants::kSparseFormat) ) {
-    sparseformat = true;
+  ///Prints each hypothesis as it is read from the shortest paths
+  struct HypothesisFunctor {
+    PrintStrings *p_;
+    unsigned id_;
+    std::ostream& o_;
+    HypothesisFunctor (PrintStrings *p, unsigned id, std::ostream& o)
+      : p_ (p)
+      , id_ (id)
+      , o_ (o) {
+    }
+    void operator() (HypT const& h) {
+      p_->printHypothesis (id_, h, o_);
+    }
+  };
+
+ public:
+  PrintStrings (ucam::util::RegistryPO const& rg)
+    : rg_ (rg)
+    , input_ (rg.get<std::string> (HifstConstants::kInput.c_str() ) )
+    , output_ (rg.get<std::string> (HifstConstants::kOutput.c_str() ) )
+    , intersectionLattice_ (rg.get<std::string>
+                            (HifstConstants::kIntersectionWithHypothesesLoad.c_str() ) )
+    , n_ (rg.get<unsigned> (HifstConstants::kNbest.c_str() ) )
+    , unique_ (rg.exists (HifstConstants::kUnique.c_str() ) )
+    , printOutputLabels_ (rg.exists (HifstConstants::kPrintOutputLabels.c_str() ) )
+    , printInputOutputLabels_ (rg.exists (HifstConstants::kPrintInputOutputLabels.c_str() ) )
+    , dobleu_ (false)
+    , sentbleu_ (false)
+    , perfile_ (rg.get<std::string> (HifstConstants::kOutput.c_str() ).find ("?")
+                != std::string::npos)
+    , threadcount_ (rg.get<unsigned> (HifstConstants::kNThreads.c_str() ) ) {
+    using namespace HifstConstants;
+    if (printInputOutputLabels_)
+      FORCELINFO("Printing input and output labels...");
+    USER_CHECK (threadcount_ > 0, "Number of threads has to be greater than 0!");
+    std::string refFiles;
+    bool intRefs = false;
+
+    if (rg.exists(HifstConstants::kWordRefs)) {
+      refFiles = rg.getString(HifstConstants::kWordRefs);
+      dobleu_ = true;
+    }
+    if (rg.exists(HifstConstants::kIntRefs)) {
+      refFiles = rg.getString(HifstConstants::kIntRefs);
+      intRefs = true;
+      dobleu_ = true;
+    }
+    if (rg.exists (HifstConstants::kSentBleu) ) {
+      if (!dobleu_) {
+        LERROR("Must provide references to compute sentence level bleu");
+        exit(EXIT_FAILURE);
+      }
+      sentbleu_ = true;
+    }
+
+    if (rg.exists (HifstConstants::kWeight) ) {
+      printweight = true;
+    }
+    if (rg.exists (HifstConstants::kSparseFormat) ) {
+      sparseformat = true;
+    }
+    if (rg.exists (HifstConstants::kSparseDotProduct) ) {
+      if (sparseformat == true) {
+        LERROR("Sparse format and dot product are not available at the same time.");
+        exit(EXIT_FAILURE);
+      }
+      dotProduct = true;
+    }
+
+    if (rg.exists (HifstConstants::kSuppress) ) {
+      nohyps = true;
+    }
+
+    // n.b. this should be last, to override any other settings
+    if (rg.exists (HifstConstants::kLibLinRankFormat) ) {
+      liblinrankformat = true;
+      if (!dobleu_) {
+        LERROR("Must provide references to compute features for liblinear rankings");
+        exit(EXIT_FAILURE);
+      }
+      sentbleu_ = true;
+    }
+
+    std::string extTok(rg.exists(HifstConstants::kExternalTokenizer) ?
+                       rg.getString(HifstConstants::kExternalTokenizer) : "");
+    if (dobleu_)
+      bleuScorer_.reset (new ucam::fsttools::BleuScorer(refFiles, extTok, 1, intRefs, vmapfile) );
+    setsPrecision_ = printingSetsPrecision();
   }
-  if (rg.exists (HifstConstants::kSparseDotProduct) ) {
-    if (sparseformat == true) {
-      LERROR("Sparse format and dot product are not available at the same time.");
-      exit(EXIT_FAILURE);
+
+  ///Prints all the lattices
+  void operator() () {
+    using namespace ucam::util;
+    boost::scoped_ptr<oszfstream> out;
+    if (!perfile_) out.reset (new oszfstream (output_() ) );
+    // Lattices in flight, so that memory does not grow with the range.
+    ReorderBuffer rb (out.get(), 4 * threadcount_, false);
+    int nlines = 0;
+    {
+      // Threads finish pending lattices before tp is deleted.
+      boost::scoped_ptr<TrivialThreadPool> tp;
+      if (threadcount_ > 1) tp.reset (new TrivialThreadPool (threadcount_) );
+      for ( IntRangePtr ir (IntRangeFactory ( rg_,
+                                              HifstConstants::kRangeOne ) );
+            !ir->done();
+            ir->next() ) {
+        nlines++;
+        LatticeFunctor f (this, ir->get(), rb.reserve(), &rb);
+        if (tp.get() != NULL) (*tp) (f);
+        else f();
+      }
     }
-    dotProduct = true;
+    rb.wait();
+    if (dobleu_)
+      FORCELINFO("BLEU STATS:" << bStats_ << "; BLEU: " << bleuScorer_->ComputeBleu(bStats_));
+    FORCELINFO("Processed " << nlines << " files");
   }
 
-  if (rg.exists (HifstConstants::kSuppress) ) {
-    nohyps = true;
+ private:
+  /**
+   * \brief Whether printing hypotheses sets the precision of the stream to myPrecision,
+   * which then applies to anything printed later on the same stream.
+   * Weights set it, except in some sparse tuple formats.
+   */
+  bool printingSetsPrecision() {
+    if (!printweight && !liblinrankformat) return false;
+    if (nohyps && !liblinrankformat) return false;
+    if (printweight && printInputOutputLabels_ && !nohyps) return true;
+    std::stringstream ss;
+    std::streamsize precision = ss.precision();
+    printWeight<Arc> (Arc::Weight::One(), ss, myPrecision);
+    return ss.precision() != precision;
   }
 
-  // n.b. this should be last, to override any other settings
-  if (rg.exists (HifstConstants::kLibLinRankFormat) ) {
-    liblinrankformat = true;
-    if (!dobleu) {
-      LERROR("Must provide references to compute features for liblinear rankings");
-      exit(EXIT_FAILURE);
+  /**
+   * \brief Prints lattice id, either to its own file or to the string returned.
+   * Can run concurrently for different lattices.
+   * \param position Position of the lattice in the output
+   */
+  std::string printLattice (unsigned id, std::size_t position) {
+    if (perfile_) {
+      ucam::util::oszfstream out (output_ (id) );
+      printLattice (id, *out.getStream() );
+      return "";
     }
-    sentbleu = true;
+    std::stringstream ss;
+    // As if written after the previous lattices on the same stream:
+    // the default precision applies until a weight is printed.
+    // Only differs if the lattices before are all empty.
+    if (position > 0 && setsPrecision_) ss << std::setprecision (myPrecision);
+    printLattice (id, ss);
+    return ss.str();
   }
 
-  std::string extTok(rg.exists(HifstConstants::kExternalTokenizer) ? 
-		     rg.getString(HifstConstants::kExternalTokenizer) : "");
-  ucam::fsttools::BleuStats bStats;
-  ucam::fsttools::BleuScorer *bleuScorer;
-  if (dobleu)
-    bleuScorer = new ucam::fsttools::BleuScorer(refFiles, extTok, 1, intRefs, vmapfile);
-
-  int nlines=0;
-  for ( IntRangePtr ir (IntRangeFactory ( rg,
-                                    kRangeOne ) );
-        !ir->done();
-        ir->next() ) {
-    nlines++;
-    boost::scoped_ptr<fst::VectorFst<Arc> > ifst (fst::VectorFstRead<Arc> (input (
-          ir->get() ) ) );
+  ///Prints the n-best list of lattice id to o
+  void printLattice (unsigned id, std::ostream& o) {
+    boost::scoped_ptr<fst::VectorFst<Arc> > ifst (fst::VectorFstRead<Arc> (input_ (
+          id ) ) );
     Connect (&*ifst);
-    if (old != output (ir->get() ) ) {
-      out.reset (new oszfstream (output (ir->get() ) ) );
-      old = output (ir->get() );
-    }
     if (!ifst->NumStates() ) {
-      *out << "[EMPTY]" << std::endl;
-      continue;
+      o << "[EMPTY]" << std::endl;
+      return;
     }
     // Projecting allows unique to work for all cases.
-    if (printOutputLabels)
+    if (printOutputLabels_)
       fst::Project(&*ifst, PROJECT_OUTPUT);
-    else if (!printInputOutputLabels) // what a mess
+    else if (!printInputOutputLabels_) // what a mess
       fst::Project(&*ifst, PROJECT_INPUT);
 
     fst::VectorFst<Arc> nfst;
     // find 1-best and compute bleu stats
-    if (dobleu) {
-      ShortestPath (*ifst, &nfst, 1, unique);
+    if (dobleu_) {
+      ShortestPath (*ifst, &nfst, 1, unique_);
       std::vector<HypT> hyps1;
       fst::printStrings<Arc> (nfst, &hyps1);
       ucam::fsttools::SentenceIdx h(hyps1[0].hyp.begin(), hyps1[0].hyp.end());
       // bleuscorer indexes references from 0; ir counts from 1
-      if (h.size() > 0)
-	bStats = bStats + bleuScorer->SentenceBleuStats(ir->get()-1, RemoveUnprintable(h));
+      if (h.size() > 0) {
+        ucam::fsttools::BleuStats bStats = bleuScorer_->SentenceBleuStats(id-1, RemoveUnprintable(h));
+        boost::lock_guard<boost::mutex> lock (mutex_);
+        bStats_ = bStats_ + bStats;
+      }
     }
 
     boost::scoped_ptr< VectorFst<Arc> > intersection
-        (createIntersectionSpace<Arc>( intersectionLattice( ir->get() ) ));
-
+        (createIntersectionSpace<Arc>( intersectionLattice_( id ) ));
 
     if (intersection.get()) {
-      VectorFst<Arc> cmps;
       *ifst = ComposeFst<Arc>(*intersection, *ifst);
     }
 
     if (!ifst->NumStates() ) {
-      *out << "[EMPTY]" << std::endl;
-      continue;
+      o << "[EMPTY]" << std::endl;
+      return;
     }
 
     // Otherwise determinization runs (both determinizefst or
     // inside shortestpath) doesn't produce the expected result:
     // epsilons are being treated as symbols
-    if (unique) {
+    if (unique_) {
       fst::RmEpsilon<Arc>(&*ifst);
     }
     // find nbest, compute stats, print
-    ShortestPath (*ifst, &nfst, n, unique );
-
-    std::vector<HypT> hyps;
-    fst::printStrings<Arc> (nfst, &hyps);
-    for (unsigned k = 0; k < hyps.size(); ++k) {
-      ucam::fsttools::SentenceIdx h(hyps[k].hyp.begin(), hyps[k].hyp.end());	
-      ucam::fsttools::BleuStats sbStats;
-      double sbleu;
-      if (sentbleu) {
-	// bleuscorer indexes references from 0; ir counts from 1
-	sbStats = bleuScorer->SentenceBleuStats(ir->get()-1, RemoveUnprintable(h));
-	sbleu = bleuScorer->ComputeSBleu(sbStats).m_bleu;
-      }
-      // output
-      if (liblinrankformat) {
-	*out->getStream() << sbleu << " qid:" << ir->get();
-	printWeight<Arc>(hyps[k].cost, *out->getStream());
-	*out->getStream() << std::endl;
-      }
-      if (nohyps == false) {
-        if (printInputOutputLabels) { // add the output labels.
-            for (unsigned j = 0; j < hyps[k].hyp.size(); ++j)
-              if (hyps[k].hyp[j] != 0)
-                *out->getStream() << hyps[k].hyp[j] << " ";
-            *out->getStream() << "\t";
-            for (unsigned j = 0; j < hyps[k].ohyp.size(); ++j)
-              if (hyps[k].ohyp[j] != 0)
-                *out->getStream() << hyps[k].ohyp[j] << " ";
-            if (printweight)
-              *out->getStream() << "\t" << std::setprecision(myPrecision) << hyps[k].cost;
-        } else {
-          *out->getStream() << hyps[k];
-        }
-	if (sentbleu)
-	  *out->getStream() << "\t" << sbStats << "\t" << sbleu;
-	*out->getStream() << std::endl;
-      }
+    ShortestPath (*ifst, &nfst, n_, unique_ );
+    HypothesisFunctor hf (this, id, o);
+    fst::streamStrings<Arc, HypT> (nfst, hf);
+  }
+
+  ///Prints a hypothesis of lattice id, with its sentence bleu if required
+  void printHypothesis (unsigned id, HypT const& h, std::ostream& o) {
+    ucam::fsttools::BleuStats sbStats;
+    double sbleu;
+    if (sentbleu_) {
+      ucam::fsttools::SentenceIdx s(h.hyp.begin(), h.hyp.end());
+      // bleuscorer indexes references from 0; ir counts from 1
+      sbStats = bleuScorer_->SentenceBleuStats(id-1, RemoveUnprintable(s));
+      sbleu = bleuScorer_->ComputeSBleu(sbStats).m_bleu;
     }
+    // output
+    if (liblinrankformat) {
+      o << sbleu << " qid:" << id;
+      printWeight<Arc>(h.cost, o);
+      o << std::endl;
+    }
+    if (nohyps) return;
+    if (printInputOutputLabels_) { // add the output labels.
+      for (unsigned j = 0; j < h.hyp.size(); ++j)
+        if (h.hyp[j] != 0)
+          o << h.hyp[j] << " ";
+      o << "\t";
+      for (unsigned j = 0; j < h.ohyp.size(); ++j)
+        if (h.ohyp[j] != 0)
+          o << h.ohyp[j] << " ";
+      if (printweight)
+        o << "\t" << std::setprecision(myPrecision) << h.cost;
+    } else {
+      o << h;
+    }
+    if (sentbleu_)
+      o << "\t" << sbStats << "\t" << sbleu;
+    o << std::endl;
   }
-  if (dobleu)
-    FORCELINFO("BLEU STATS:" << bStats << "; BLEU: " << bleuScorer->ComputeBleu(bStats));
-  FORCELINFO("Processed " << nlines << " files");
+
+  DISALLOW_COPY_AND_ASSIGN (PrintStrings);
+};
+
+template <class Arc, class HypT>
+void run ( ucam::util::RegistryPO const& rg) {
+  PrintStrings<Arc, HypT> p (rg);
+  p();
 };
 
 /*
@@ -441,7 +565,7 @@ int  main ( int argc, const char* argv[] ) {
               "(--semiring=tuplearc)");
       exit (EXIT_FAILURE);
     }
-    TupleW32::Params() = ParseParamString<float> (tuplearcWeights);
+    TupleW32::SetParams ( ParseParamString<float> (tuplearcWeights) );
   }
   std::string const& semiring = rg.get<std::string>
                                 (kHifstSemiring);
@@ -206,7 +206,7 @@ int  main ( int argc, const char* argv[] ) {
               "(--semiring=tuplearc)");
       exit (EXIT_FAILURE);
     }
-    TupleW32::Params() = ucam::util::ParseParamString<float> (tuplearcWeights);
+    TupleW32::SetParams ( ucam::util::ParseParamString<float> (tuplearcWeights) );
     SampleWFSAs<TupleArc32, Hyp<TupleArc32> > (rg);
   } else {
     LERROR ("Sorry, semiring option not correctly defined");
@@ -0,0 +1,38 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use these files except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copyright 2012 - Gonzalo Iglesias, Adrià de Gispert, William Byrne
+
+#define HIFST
+
+/**
+ * \file
+ * \brief Compiles a text grammar into the binary format memory-mapped by hifst.
+ */
+
+#include <main.compilegrammar.hpp>
+#include <main.custom_assert.hpp>
+#include <main.logger.hpp>
+#include <main.hpp>
+
+/**
+ * \brief Loads and sorts the text grammar exactly as hifst would,
+ * then dumps it as a compiled grammar.
+ */
+void ucam::util::MainClass::run() {
+  using namespace HifstConstants;
+  typedef ucam::hifst::HifstTaskData Data;
+  Data d;
+  ucam::hifst::GrammarTask<Data> grammartask ( *rg_ );
+  grammartask.run ( d );
+  grammartask.writeCompiled ( rg_->get<std::string> ( kOutput ) );
+}
@@ -25,6 +25,7 @@
 #include <main.hifst.hpp>
 #include <main.custom_assert.hpp>
 #include <main.logger.hpp>
+#include <main-run.hifst.translationcost.hpp>
 #include <main-run.hifst.hpp>
 #include <main-run.rules2weights.hpp>
 #include <common-helpers.hpp>
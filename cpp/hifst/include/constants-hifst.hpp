@@ -15,9 +15,11 @@ const std::string kGrammarLoad = "grammar.load";
 const std::string kGrammarFeatureweights = "grammar.featureweights";
 const std::string kGrammarStorepatterns = "grammar.storepatterns";
 const std::string kGrammarStorentorder = "grammar.storentorder";
+const std::string kGrammarLoadthreads = "grammar.loadthreads";
 
 const std::string kSourceLoad = "source.load";
 const std::string kTargetStore = "target.store";
+const std::string kTargetWindow = "target.window";
 
 const std::string kPreproTokenizeEnable = "prepro.tokenize.enable";
 const std::string kPreproTokenizeLanguage = "prepro.tokenize.language";
@@ -61,6 +63,7 @@ const std::string kHifstAlilatsmodeLinks = "hifst.alilatsmode.type";
 const std::string kHifstUsepdt = "hifst.usepdt";
 const std::string kHifstRtnopt = "hifst.rtnopt";
 const std::string kHifstOptimizecells = "hifst.optimizecells";
+const std::string kHifstCellthreads = "hifst.cellthreads";
 const std::string kHifstReplacefstbyarcNonterminals =
   "hifst.replacefstbyarc.nonterminals";
 const std::string kHifstReplacefstbyarcNumstates =
@@ -74,7 +77,15 @@ const std::string kHifstLocalpruneLmFeatureweights =
 const std::string kHifstLocalpruneLmWordpenalty = "hifst.localprune.lm.wps";
 const std::string kHifstLocalpruneConditions = "hifst.localprune.conditions";
 const std::string kHifstLocalpruneNumstates = "hifst.localprune.numstates";
+const std::string kHifstLocalpruneMemorybudget = "hifst.localprune.memorybudget";
+const std::string kHifstLocalpruneMemorybudgetWeight =
+  "hifst.localprune.memorybudget.weight";
 const std::string kHifstPrune = "hifst.prune";
+const std::string kHifstPruneComposition = "hifst.prune.composition";
+const std::string kHifstPruneCompositionNumstates =
+  "hifst.prune.composition.numstates";
+const std::string kHifstPruneCompositionHeuristic =
+  "hifst.prune.composition.heuristic";
 const std::string kHifstWritertn = "hifst.writertn";
 
 const std::string kHifstDisableRuleFeatures = "hifst.disablerulefeatures";
@@ -149,10 +160,12 @@ const std::string kLmbrP = "p";
 const std::string kLmbrR = "r";
 const std::string kLmbrT = "T";
 const std::string kLmbrPreprune = "preprune";
+const std::string kLmbrGridthreads = "gridthreads";
 
 // hifst-client
 const std::string kHifstHost = "host";
 const std::string kHifstPort = "port";
+const std::string kHifstClientBatch = "batch";
 
 }
 
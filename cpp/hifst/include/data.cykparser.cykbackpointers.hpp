@@ -24,47 +24,142 @@
 
 namespace ucam {
 namespace hifst {
+
+/**
+ * \brief Read-only view of the backpointers of one rule, i.e. a sequence of (cc,x,y) triplets.
+ */
+class CYKbpCoordinates {
+ private:
+  const unsigned *c_;
+  unsigned size_;
+ public:
+  CYKbpCoordinates ( const unsigned *c, unsigned size ) : c_ ( c ),
+    size_ ( size ) {};
+
+  inline unsigned size() const {
+    return size_;
+  };
+
+  inline unsigned operator[] ( unsigned j ) const {
+    return c_[j];
+  };
+
+  operator cykparser_rulebpcoordinates_t() const {
+    return cykparser_rulebpcoordinates_t ( c_, size_ );
+  };
+};
+
+/**
+ * \brief Read-only view of the backpointers of all the rules in a cell.
+ * \remarks The view is invalidated by adding new backpointers.
+ */
+class CYKbpCell {
+ private:
+  const unsigned *pool_;
+  const cykparser_rulebpoffsets_t *offsets_;
+ public:
+  CYKbpCell ( const unsigned *pool, const cykparser_rulebpoffsets_t *offsets ) :
+    pool_ ( pool ), offsets_ ( offsets ) {};
+
+  ///Number of rules with backpointers in this cell.
+  inline std::size_t size() const {
+    return offsets_ ? offsets_->size() : 0;
+  };
+
+  ///Backpointers of the i-th rule.
+  inline CYKbpCoordinates operator[] ( std::size_t i ) const {
+    const unsigned *c = pool_ + ( *offsets_ ) [i];
+    return CYKbpCoordinates ( c + 1, *c );
+  };
+
+  operator cykparser_ruledependencies_t() const {
+    cykparser_ruledependencies_t rd;
+    for ( std::size_t i = 0; i < size(); ++i ) rd.push_back ( ( *this ) [i] );
+    return rd;
+  };
+};
+
 /**
  * \brief functor that provides cyk backpointers
- *
+ * Backpointers of all cells are stored in a single pool of integers: each rule contributes
+ * its number of coordinates followed by the coordinates. Cells of the dense chart
+ * (see CYKchartIndex) keep the offsets of their rules into this pool.
  */
 class CYKbackpointers {
-  typedef unordered_map<unsigned, cykparser_ruledependencies_t  >
-  cykparser_backpointers_t;
-
  private:
-  ///Backpointer structure
-  cykparser_backpointers_t bp_;
+  CYKchartIndex index_;
+  ///Backpointer pool
+  std::vector<unsigned> pool_;
+  ///Offsets into the pool for each cell.
+  std::vector<cykparser_rulebpoffsets_t> bp_;
+  ///Number of non-empty cells.
+  std::size_t size_;
+
+  inline std::size_t position ( const unsigned cc, const unsigned x,
+                                const unsigned y ) const {
+    std::size_t pos = index_ ( cc, x, y );
+    if ( pos == CYKchartIndex::npos ) {
+      LERROR ( "Cell " << cc << "," << x << "," << y <<
+               " is out of the cyk backpointers" );
+      exit ( EXIT_FAILURE );
+    }
+    return pos;
+  };
+
+  template<class CoordinatesT>
+  inline void push ( cykparser_rulebpoffsets_t& offsets,
+                     const CoordinatesT& coords ) {
+    if ( offsets.empty() ) ++size_;
+    offsets.push_back ( pool_.size() );
+    pool_.push_back ( coords.size() );
+    for ( unsigned k = 0; k < coords.size(); ++k ) pool_.push_back ( coords[k] );
+  };
+
  public:
 
+  CYKbackpointers() : size_ ( 0 ) {};
+
+  ///Resize for a sentence with the given number of words. Clears all backpointers.
+  inline void resize ( unsigned nnt, unsigned length ) {
+    reset();
+    index_.resize ( nnt, length );
+    if ( bp_.size() < index_.numcells() ) bp_.resize ( index_.numcells() );
+  };
+
   //Get the set of backpointers for given coordinates (cc,x,y)
-  inline const cykparser_ruledependencies_t& operator() ( const unsigned cc,
-      const unsigned x, const unsigned y ) {
-    return bp_[APBASETAG + cc * APCCTAG + x * APXTAG + y * APYTAG];
+  inline CYKbpCell operator() ( const unsigned cc,
+                                const unsigned x, const unsigned y ) const {
+    std::size_t pos = index_ ( cc, x, y );
+    if ( pos == CYKchartIndex::npos ) return CYKbpCell ( NULL, NULL );
+    return CYKbpCell ( pool_.data(), &bp_[pos] );
   }
 
   ///Add all the set of backpointers to the grid
   inline void Add ( const unsigned cc, const unsigned x, const unsigned y,
                     const cykparser_ruledependencies_t& coords ) {
-    if ( coords.size() )
-      bp_[APBASETAG + cc * APCCTAG + x * APXTAG + y * APYTAG] = coords;
+    if ( !coords.size() ) return;
+    cykparser_rulebpoffsets_t& offsets = bp_[position ( cc, x, y )];
+    if ( !offsets.empty() ) --size_;
+    offsets.clear();
+    for ( unsigned k = 0; k < coords.size(); ++k ) push ( offsets, coords[k] );
   };
 
   ///Add set of backpointers to the grid
   inline void Add ( const unsigned cc, const unsigned x, const unsigned y,
                     const cykparser_rulebpcoordinates_t& coords ) {
-    if ( coords.size() )
-      bp_[APBASETAG + cc * APCCTAG + x * APXTAG + y * APYTAG].push_back ( coords );
+    if ( coords.size() ) push ( bp_[position ( cc, x, y )], coords );
   };
 
   ///Size of the backpointer structure (number of cc,x,y elements inserted).
-  inline std::size_t size() {
-    return bp_.size();
+  inline std::size_t size() const {
+    return size_;
   };
 
   ///Delete cyk backpointers
   inline void reset() {
-    bp_.clear();
+    for ( std::size_t k = 0; k < index_.numcells(); ++k ) bp_[k].clear();
+    pool_.clear();
+    size_ = 0;
   };
 
 };
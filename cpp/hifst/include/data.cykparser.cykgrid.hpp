@@ -25,43 +25,124 @@
 namespace ucam {
 namespace hifst {
 
+/**
+ * \brief Maps cyk coordinates (cc,x,y) to a position in a dense, triangular chart.
+ * Cells are laid out span by span, and all the categories of a span are contiguous.
+ * Words are categories too (see CYKParserTask), but they only live in the bottom row, so
+ * the bottom row holds every category [0,numnt+length] whereas rows y>=1 only hold
+ * non-terminals [0,numnt].
+ */
+class CYKchartIndex {
+ private:
+  unsigned nnt_;
+  unsigned length_;
+  std::size_t bottomwidth_;
+  std::size_t numcells_;
+
+ public:
+  ///Position returned for coordinates outside the chart.
+  static const std::size_t npos = static_cast<std::size_t> ( -1 );
+
+  CYKchartIndex() : nnt_ ( 0 ), length_ ( 0 ), bottomwidth_ ( 0 ),
+    numcells_ ( 0 ) {};
+
+  /**
+   * \brief Sets the dimensions of the chart.
+   * \param nnt Number of non-terminals.
+   * \param length Number of words in the sentence.
+   */
+  inline void resize ( unsigned nnt, unsigned length ) {
+    nnt_ = nnt;
+    length_ = length;
+    bottomwidth_ = nnt + length + 1;
+    std::size_t spans = length ? ( std::size_t ) length * ( length - 1 ) / 2 : 0;
+    numcells_ = length * bottomwidth_ + spans * ( nnt + 1 );
+  };
+
+  ///Returns the position of (cc,x,y) in the chart, or npos.
+  inline std::size_t operator() ( unsigned cc, unsigned x, unsigned y ) const {
+    if ( x + y >= length_ ) return npos;
+    if ( !y ) return cc < bottomwidth_ ? x * bottomwidth_ + cc : npos;
+    if ( cc > nnt_ ) return npos;
+    // Rows 1..y-1 hold (length-1) + ... + (length-y+1) spans.
+    std::size_t row = ( std::size_t ) ( y - 1 ) * length_ - ( std::size_t ) ( y - 1 ) * y / 2;
+    return length_ * bottomwidth_ + ( row + x ) * ( nnt_ + 1 ) + cc;
+  };
+
+  ///Number of cells in the chart.
+  inline std::size_t numcells() const {
+    return numcells_;
+  };
+
+  inline unsigned nnt() const {
+    return nnt_;
+  };
+
+  inline unsigned length() const {
+    return length_;
+  };
+};
+
 /**
  * \brief functor that provides cykgrid access methods
- *
+ * The grid is a dense chart (see CYKchartIndex) that has to be resized for
+ * each sentence before adding rules to it. Cells keep their capacity across sentences.
  */
 class CYKgrid {
-  typedef unordered_map< uint, ssgrammar_listofrules_t  >  cykparser_cykgrid_t;
  private:
+  CYKchartIndex index_;
+  std::vector<ssgrammar_listofrules_t> cykgrid_;
+  ///Number of non-empty cells.
+  std::size_t size_;
+  ssgrammar_listofrules_t empty_;
 
-  cykparser_cykgrid_t cykgrid_;
  public:
 
+  CYKgrid() : size_ ( 0 ) {};
+
+  ///Resize the grid for a sentence with the given number of words. Clears the grid.
+  inline void resize ( unsigned nnt, unsigned length ) {
+    reset();
+    index_.resize ( nnt, length );
+    if ( cykgrid_.size() < index_.numcells() )
+      cykgrid_.resize ( index_.numcells() );
+  };
+
   ///Get list of grammar rules assigned to (cc,x,y)
   inline const ssgrammar_listofrules_t& operator() ( const uint cc, const uint x,
-      const uint y ) {
-    return cykgrid_[APBASETAG + cc * APCCTAG + x * APXTAG + y * APYTAG];
+      const uint y ) const {
+    std::size_t pos = index_ ( cc, x, y );
+    return pos == CYKchartIndex::npos ? empty_ : cykgrid_[pos];
   };
 
   ///Get a specific rule at (cc,x,y) corresponding to index rulepos
   inline uint operator() ( const uint cc, const uint x, const uint y,
-                           const uint rulepos ) {
-    return cykgrid_[ APBASETAG + cc * APCCTAG + x * APXTAG + y * APYTAG ][rulepos];
+                           const uint rulepos ) const {
+    return cykgrid_[index_ ( cc, x, y )][rulepos];
   };
 
   ///Add a rule to the cyk grid at (cc,x,y)
   inline void Add ( const uint cc, const uint x, const uint y,
                     const uint ruleidx ) {
-    cykgrid_[ APBASETAG + cc * APCCTAG + x * APXTAG + y * APYTAG ].push_back (
-      ruleidx );
+    std::size_t pos = index_ ( cc, x, y );
+    if ( pos == CYKchartIndex::npos ) {
+      LERROR ( "Cell " << cc << "," << x << "," << y << " is out of the cyk grid" );
+      exit ( EXIT_FAILURE );
+    }
+    if ( cykgrid_[pos].empty() ) ++size_;
+    cykgrid_[pos].push_back ( ruleidx );
   };
 
   ///Clear cyk grid
   inline void reset() {
-    cykgrid_.clear();
+    for ( std::size_t k = 0; k < index_.numcells(); ++k )
+      cykgrid_[k].clear();
+    size_ = 0;
   };
-  ///Return actual size of the cyk grid
-  inline std::size_t size() {
-    return cykgrid_.size();
+
+  ///Return actual size of the cyk grid (number of non-empty cells)
+  inline std::size_t size() const {
+    return size_;
   };
 
 };
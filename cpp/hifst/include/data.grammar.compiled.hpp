@@ -0,0 +1,213 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use these files except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copyright 2012 - Gonzalo Iglesias, Adrià de Gispert, William Byrne
+
+#ifndef DATA_GRAMMAR_COMPILED_HPP
+#define DATA_GRAMMAR_COMPILED_HPP
+
+/**
+ * \file
+ * \brief Binary (compiled) grammar format, memory-mapped by GrammarData.
+ */
+
+namespace ucam {
+namespace hifst {
+
+/// Magic string identifying a compiled grammar file (8 bytes, including trailing zero).
+const char kCompiledGrammarMagic[8] = "UCAMGRB";
+/// Increase every time the layout below changes.
+const uint32_t kCompiledGrammarVersion = 1;
+
+/**
+ * \brief Header of a compiled grammar file.
+ * A compiled grammar is a pattern-sorted grammar dumped to disk with the following sections,
+ * each of them aligned to 8 bytes: sorted indices (posindex), pre-tokenized rules (CompiledRule),
+ * token pool, non-terminal mappings pool, metadata (symbols, patterns, ntorder, scales) and
+ * the rule text itself, with the weights already collapsed into a single dot product.
+ * \remark Integers are written in native byte order. A compiled grammar is meant to be
+ * generated and consumed on the same architecture.
+ */
+struct CompiledGrammarHeader {
+  char magic[8];
+  uint32_t version;
+  /// Guards against loading a file compiled with a different posindex layout.
+  uint32_t sizeofposindex;
+  uint64_t numrules;
+  uint64_t posoffset;
+  uint64_t ruleoffset;
+  uint64_t tokenoffset;
+  uint64_t numtokens;
+  uint64_t mappingoffset;
+  uint64_t nummappings;
+  uint64_t metaoffset;
+  uint64_t metasize;
+  uint64_t textoffset;
+  /// Size of the text, including a trailing '\0'.
+  uint64_t textsize;
+};
+
+/**
+ * \brief Pre-tokenized rule.
+ * Words are stored in the token pool as their (non-negative) integer ids.
+ * Any other element (non-terminals, \<dr\>, \<oov\>, ...) is stored as a negative
+ * index into the symbol table, see CompiledGrammar::symbol.
+ */
+struct CompiledRule {
+  /// First source element in the token pool.
+  uint64_t srcbegin;
+  /// First target element in the token pool.
+  uint64_t trgbegin;
+  /// First non-terminal mapping in the mapping pool.
+  uint64_t mapbegin;
+  /// Dot product of the rule features with the grammar scales.
+  float weight;
+  uint16_t srcsize;
+  uint16_t trgsize;
+  /// Number of non-terminals (i.e. of mappings).
+  uint8_t numnt;
+  uint8_t isphrase;
+  uint8_t padding[6];
+};
+
+/// Rounds up a file offset to the alignment used for compiled grammar sections.
+inline uint64_t alignCompiledGrammarOffset ( uint64_t offset ) {
+  return ( offset + 7 ) & ~ ( uint64_t ) 7;
+}
+
+/// Encodes a symbol index as a (negative) token.
+inline int compiledSymbolToken ( std::size_t symbolidx ) {
+  return - ( int ) symbolidx - 1;
+}
+
+/**
+ * \brief Read-only view of a compiled grammar.
+ * The file is memory-mapped, so pages are loaded lazily and shared across processes
+ * using the same grammar. All pointers point into the mapped region.
+ */
+class CompiledGrammar {
+ private:
+  boost::iostreams::mapped_file_source file_;
+  const CompiledGrammarHeader *header_;
+
+ public:
+  const posindex *vpos;
+  const CompiledRule *rules;
+  const int *tokens;
+  const unsigned char *mappings;
+  const char *text;
+
+  /// Any element of a rule that is not a word id, indexed by -token-1.
+  std::vector<std::string> symbols;
+  /// Patterns in this grammar.
+  std::vector<std::string> patterns;
+  /// Non-terminals in hierarchical order, comma-separated.
+  std::string ntorder;
+  /// Grammar feature scales used to compute the rule weights.
+  std::vector<float> scales;
+
+  /**
+   * \brief Maps and validates a compiled grammar file.
+   * \param filename Full pathname to the compiled grammar.
+   */
+  explicit CompiledGrammar ( const std::string& filename )
+    : header_ ( NULL )
+    , vpos ( NULL )
+    , rules ( NULL )
+    , tokens ( NULL )
+    , mappings ( NULL )
+    , text ( NULL ) {
+    file_.open ( filename );
+    USER_CHECK ( file_.is_open(), "Could not map compiled grammar" );
+    if ( file_.size() < sizeof ( CompiledGrammarHeader ) ) {
+      LERROR ( "Compiled grammar too short: " << filename );
+      exit ( EXIT_FAILURE );
+    }
+    const char *base = file_.data();
+    header_ = reinterpret_cast<const CompiledGrammarHeader *> ( base );
+    if ( memcmp ( header_->magic, kCompiledGrammarMagic, 8 )
+         || header_->version != kCompiledGrammarVersion
+         || header_->sizeofposindex != sizeof ( posindex )
+         || header_->textoffset + header_->textsize > file_.size() ) {
+      LERROR ( "Compiled grammar " << filename <<
+               " is not valid or was compiled with an incompatible version" );
+      exit ( EXIT_FAILURE );
+    }
+    vpos = reinterpret_cast<const posindex *> ( base + header_->posoffset );
+    rules = reinterpret_cast<const CompiledRule *> ( base + header_->ruleoffset );
+    tokens = reinterpret_cast<const int *> ( base + header_->tokenoffset );
+    mappings = reinterpret_cast<const unsigned char *> ( base +
+               header_->mappingoffset );
+    text = base + header_->textoffset;
+    readMeta ( base + header_->metaoffset,
+               base + header_->metaoffset + header_->metasize );
+  };
+
+  inline std::size_t numrules() const {
+    return header_->numrules;
+  };
+
+  inline std::size_t textsize() const {
+    return header_->textsize;
+  };
+
+  /// Returns the string for a token, either a word id or a symbol.
+  inline const std::string element ( int token ) const {
+    if ( token < 0 ) return symbols[-token - 1];
+    return ucam::util::toString<int> ( token );
+  };
+
+  /// Checks whether the file starts with the compiled grammar magic string.
+  static bool isCompiled ( const std::string& filename ) {
+    char magic[8];
+    std::ifstream f ( filename.c_str(), std::ios::in | std::ios::binary );
+    if ( !f.read ( magic, 8 ) ) return false;
+    return !memcmp ( magic, kCompiledGrammarMagic, 8 );
+  };
+
+ private:
+
+  /// Metadata is a sequence of lists, each one a count followed by '\0'-ended strings.
+  void readMeta ( const char *c, const char *end ) {
+    std::vector<std::string> aux;
+    readList ( c, end, symbols );
+    readList ( c, end, patterns );
+    readList ( c, end, aux );
+    if ( aux.size() ) ntorder = aux[0];
+    aux.clear();
+    readList ( c, end, aux );
+    for ( unsigned k = 0; k < aux.size(); ++k )
+      scales.push_back ( ucam::util::toNumber<float> ( aux[k] ) );
+  };
+
+  static void readList ( const char *& c, const char *end,
+                         std::vector<std::string>& list ) {
+    USER_CHECK ( c + sizeof ( uint64_t ) <= end,
+                 "Compiled grammar metadata is truncated" );
+    uint64_t n;
+    memcpy ( &n, c, sizeof ( uint64_t ) );
+    c += sizeof ( uint64_t );
+    list.reserve ( n );
+    for ( uint64_t k = 0; k < n && c < end; ++k ) {
+      list.push_back ( std::string ( c ) );
+      c += list.back().size() + 1;
+    }
+  };
+
+  ZDISALLOW_COPY_AND_ASSIGN ( CompiledGrammar );
+
+};
+
+}
+} // end namespaces
+
+#endif
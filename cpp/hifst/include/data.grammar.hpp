@@ -24,6 +24,9 @@
 
 #include "data.grammar.utilities.hpp"
 #include "data.grammar.comparetool.hpp"
+#include "data.grammar.compiled.hpp"
+#include "data.grammar.ruletargets.hpp"
+#include "data.grammar.sourceindex.hpp"
 
 namespace ucam {
 namespace hifst {
@@ -31,6 +34,8 @@ namespace hifst {
  *\brief Struct containing grammar rules.
  *
  * Contains the grammar in a string, along with a set of sorted indices telling where each rule can be found in the string.
+ * Alternatively, the grammar can be memory-mapped from a compiled (binary) grammar file, in which case
+ * most accessors are plain reads over pre-tokenized arrays (see CompiledGrammar).
  * This struct is typically generated by a GrammarTask and used by several other tasks.
  *
  * Patterns, if precalculated, are also available in this struct.
@@ -43,6 +48,7 @@ struct GrammarData {
 
   ///GrammarData constructor. Initializes GrammarData with empty information.
   GrammarData() :
+    contents ( NULL ),
     vpos ( NULL ),
     sizeofvpos ( 0 ),
     ct ( NULL ) {
@@ -50,11 +56,13 @@ struct GrammarData {
 
   ///Destructor
   ~GrammarData() {
-    if ( vpos != NULL ) delete [] vpos;
+    if ( vpos != NULL && compiled.get() == NULL ) delete [] vpos;
   }
 
-  /// The whole grammar.
+  /// The whole grammar, if loaded from a text file.
   std::string filecontents;
+  /// Rule text, pointing either to filecontents or to the compiled grammar.
+  const char *contents;
   /// Sorted Indices.
   posindex *vpos;
   /// Number of rules
@@ -63,6 +71,12 @@ struct GrammarData {
   std::unordered_set<std::string> patterns;
   /// Pointer to a Comparison object, assumed no ownership
   CompareTool *ct;
+  /// Memory-mapped compiled grammar, if available. Owns vpos and contents.
+  boost::scoped_ptr<CompiledGrammar> compiled;
+  /// Rule targets as lattice labels, see compileTargets.
+  RuleTargets targets;
+  /// Rules indexed by source side, see indexSources.
+  RuleSourceIndex sources;
 
   ///Ordered list of non-terminals (listed in hierarchical order according to identity rules)
   grammar_categories_t categories;
@@ -71,7 +85,12 @@ struct GrammarData {
   ///Reset object
   inline void reset() {
     filecontents = "";
-    if ( vpos != NULL ) delete [] vpos;
+    if ( vpos != NULL && compiled.get() == NULL ) delete [] vpos;
+    vpos = NULL;
+    contents = NULL;
+    targets.clear();
+    sources.clear();
+    compiled.reset();
     patterns.clear();
     categories.clear();
     vcat.clear();
@@ -79,41 +98,61 @@ struct GrammarData {
     ct = NULL;
   }
 
+  /**
+   * \brief Uses a compiled grammar instead of the text grammar.
+   * \param cg Compiled grammar, ownership is transferred.
+   */
+  inline void setCompiled ( CompiledGrammar *cg ) {
+    reset();
+    compiled.reset ( cg );
+    contents = cg->text;
+    vpos = const_cast<posindex *> ( cg->vpos );
+    sizeofvpos = cg->numrules();
+    patterns.insert ( cg->patterns.begin(), cg->patterns.end() );
+  }
+
   ///Gets a rule indexed by idx. Rule format: LHS RHSSource RHSTarget weight
   inline const std::string getRule ( std::size_t idx ) const {
-    std::size_t rpos = vpos[idx].p - vpos[idx].o;
-    std::size_t pos = filecontents.find_first_of ( "\n", rpos );
-    return filecontents.substr ( rpos, pos - rpos );
+    const char *r = contents + vpos[idx].p - vpos[idx].o;
+    return std::string ( r, strcspn ( r, "\n" ) );
   }
 
   ///Gets left-hand-side of the rule indexed by idx
   inline const std::string getLHS ( std::size_t idx ) const {
-    std::size_t rpos = vpos[idx].p - vpos[idx].o;
-    return filecontents.substr ( rpos, vpos[idx].p - rpos - 1 );
+    return std::string ( contents + vpos[idx].p - vpos[idx].o,
+                         vpos[idx].o - 1 );
   }
 
   ///Gets right-hand-side source for a rule using rule index idx
   inline const std::string getRHSSource ( std::size_t idx ) const {
-    std::size_t pos = filecontents.find_first_of ( " ", vpos[idx].p );
-    return filecontents.substr ( vpos[idx].p, pos - vpos[idx].p );
+    const char *s = contents + vpos[idx].p;
+    return std::string ( s, strcspn ( s, " " ) );
   }
 
   ///Gets element at position rulepos from the right-hand-side source for a rule indexed by idx.
   inline const std::string getRHSSource ( std::size_t idx, uint rulepos ) const {
-    std::size_t pos = filecontents.find_first_of ( " ", vpos[idx].p );
-    std::size_t j = vpos[idx].p - 1, jold;
-    for ( uint k = 0; k <= rulepos; ++k ) {
-      jold = j;
-      j = filecontents.find_first_of ( "_ ", jold + 1 );
-      if ( j == std::string::npos )
-        if ( rulepos ) return "";
+    if ( compiled.get() != NULL && rulepos < compiled->rules[idx].srcsize )
+      return compiled->element ( compiled->tokens[compiled->rules[idx].srcbegin +
+                                 rulepos] );
+    const char *s = contents + vpos[idx].p;
+    for ( uint k = 0; k < rulepos; ++k ) {
+      s += strcspn ( s, "_ " );
+      if ( *s == '\0' ) return "";
+      ++s;
     }
-    return filecontents.substr ( jold + 1, j - jold - 1 );
+    return std::string ( s, strcspn ( s, "_ " ) );
   }
 
   ///Gets a splitted version of RHS (source)
   inline const std::vector<std::string> getRHSSplitSource (std::size_t idx ) const {
     std::vector<std::string> splitsource;
+    if ( compiled.get() != NULL ) {
+      const CompiledRule& r = compiled->rules[idx];
+      splitsource.reserve ( r.srcsize );
+      for ( uint k = 0; k < r.srcsize; ++k )
+        splitsource.push_back ( compiled->element ( compiled->tokens[r.srcbegin + k] ) );
+      return splitsource;
+    }
     boost::algorithm::split ( splitsource, getRHSSource ( idx )
                               , boost::algorithm::is_any_of ( "_" ) );
     return splitsource;
@@ -121,40 +160,75 @@ struct GrammarData {
 
   ///Gets number of elements in the RHS source
   inline const uint getRHSSourceSize ( std::size_t idx ) const {
-    std::size_t pos = filecontents.find_first_of ( " ", vpos[idx].p );
-    return ucam::util::count_needles ( filecontents, '_', vpos[idx].p, pos ) + 1;
+    if ( compiled.get() != NULL ) return compiled->rules[idx].srcsize;
+    const char *s = contents + vpos[idx].p;
+    return std::count ( s, s + strcspn ( s, " " ), '_' ) + 1;
   }
 
   ///Returns RHS translation part of a rule accessed by index idx
   inline const std::string getRHSTranslation ( std::size_t idx ) const {
-    std::size_t pos = filecontents.find_first_of ( " ", vpos[idx].p ) + 1;
-    std::size_t pos2 = filecontents.find_first_of ( " ", pos );
-    return filecontents.substr ( pos, pos2 - pos );
+    const char *s = contents + vpos[idx].p;
+    s += strcspn ( s, " " ) + 1;
+    return std::string ( s, strcspn ( s, " " ) );
   }
 
   ///Returns the translation as a vector of elements
   inline const std::vector<std::string> getRHSSplitTranslation (
     std::size_t idx ) const {
     std::vector<std::string> splittranslation;
+    if ( compiled.get() != NULL ) {
+      const CompiledRule& r = compiled->rules[idx];
+      splittranslation.reserve ( r.trgsize );
+      for ( uint k = 0; k < r.trgsize; ++k )
+        splittranslation.push_back ( compiled->element (
+                                       compiled->tokens[r.trgbegin + k] ) );
+      return splittranslation;
+    }
     boost::algorithm::split ( splittranslation, getRHSTranslation ( idx ),
                               boost::algorithm::is_any_of ( "_" ) );
     return splittranslation;
   }
 
+  /**
+   * \brief Compiles the targets of all the rules into lattice labels.
+   * Should be called once all the rules are loaded.
+   */
+  inline void compileTargets() {
+    targets.clear();
+    if ( compiled.get() != NULL ) {
+      targets.setCompiled ( *compiled );
+      return;
+    }
+    targets.reserve ( sizeofvpos );
+    for ( std::size_t k = 0; k < sizeofvpos; ++k )
+      targets.add ( getRHSSplitTranslation ( k ) );
+  }
+
+  /**
+   * \brief Indexes rules by source side, so that rules for an instance-pattern
+   * are found without searching the grammar. Should be called once all the rules are loaded and sorted.
+   */
+  inline void indexSources() {
+    sources.build ( contents, vpos, sizeofvpos );
+    LINFO ( sources.size() << " distinct rule source sides" );
+  }
+
   ///Returns the number of elements in translation for a given rule
   inline const uint getRHSTranslationSize ( std::size_t idx ) const {
-    std::size_t pos = filecontents.find_first_of ( " ", vpos[idx].p ) + 1;
-    std::size_t pos2 = filecontents.find_first_of ( " ", pos );
-    return ucam::util::count_needles ( filecontents, '_', pos, pos2 ) + 1;
+    if ( compiled.get() != NULL ) return compiled->rules[idx].trgsize;
+    const char *s = contents + vpos[idx].p;
+    s += strcspn ( s, " " ) + 1;
+    return std::count ( s, s + strcspn ( s, " " ), '_' ) + 1;
   }
 
   ///Returns weight of a rule accessed by index idx
   inline const float getWeight ( std::size_t idx ) const {
-    std::size_t pos1 = filecontents.find_first_of ( " ", vpos[idx].p );
-    std::size_t pos2 = filecontents.find_first_of ( " ", pos1 + 1 );
-    std::size_t pos3 = filecontents.find_first_of ( " \t\n\0", pos2 + 1 );
-    return ucam::util::toNumber<float> ( filecontents.substr ( pos2,
-                                         pos3 - pos2 ) );
+    if ( compiled.get() != NULL ) return compiled->rules[idx].weight;
+    const char *s = contents + vpos[idx].p;
+    s += strcspn ( s, " " ) + 1;
+    s += strcspn ( s, " " );
+    return ucam::util::toNumber<float> ( std::string ( s,
+                                         strcspn ( s + 1, " \t\n" ) + 1 ) );
   }
 
   // Affiliation or alignments go physically after the weight, so that
@@ -163,12 +237,12 @@ struct GrammarData {
                 , std::vector<unsigned> &links ) const {
     using namespace std;
     using namespace boost::algorithm;
-    size_t pos1 = filecontents.find_first_of ( " ", vpos[idx].p );
-    size_t pos2 = filecontents.find_first_of ( " ", pos1 + 1 );
-    size_t pos3 = filecontents.find_first_of ( "\t\n\0", pos2 + 1 );
-    if (filecontents[pos3] == '\t') {
-      size_t pos4 = filecontents.find_first_of ( " \t\n\0", pos3 + 1 );
-      string y = filecontents.substr ( pos3 + 1, pos4 - pos3 - 1);
+    const char *s = contents + vpos[idx].p;
+    s += strcspn ( s, " " ) + 1;
+    s += strcspn ( s, " " ) + 1;
+    s += strcspn ( s, "\t\n" );
+    if (*s == '\t') {
+      string y ( s + 1, strcspn ( s + 1, " \t\n" ) );
       LDEBUG("Links=[" << y << "]");
       vector<string> x;
       split(x, y, is_any_of("_"));
@@ -178,8 +252,6 @@ struct GrammarData {
       }
       for (unsigned k = 0; k < x.size(); ++k) {
         LDEBUG("x at " << k << "=" << x[k] << ";");
-        ucam::util::toNumber<unsigned>("0");
-        ucam::util::toNumber<unsigned>("1");
         links[k] = ucam::util::toNumber<unsigned>(x[k]);
       }
     }
@@ -187,9 +259,8 @@ struct GrammarData {
 
   ///Checks whether the rule is a phrase or not (i.e. is hierarchical)
   inline const bool isPhrase ( std::size_t idx ) const {
-    std::size_t pos = filecontents.find_first_of ( " ", vpos[idx].p );
-    for ( const char *c = filecontents.c_str() + vpos[idx].p;
-          c <= filecontents.c_str() + pos; ++c )
+    if ( compiled.get() != NULL ) return compiled->rules[idx].isphrase;
+    for ( const char *c = contents + vpos[idx].p; *c != ' ' && *c != '\0'; ++c )
       if ( *c >= 'A' && *c <= 'Z' ) return false; //has non-terminals.
     return true; //pure phrase.
   }
@@ -207,6 +278,12 @@ struct GrammarData {
   void getMappings ( std::size_t idx,
                      unordered_map<uint, uint> *mappings ) const {
     if ( isPhrase ( idx ) ) return;
+    if ( compiled.get() != NULL ) {
+      const CompiledRule& r = compiled->rules[idx];
+      for ( uint k = 0; k < r.numnt; ++k )
+        ( *mappings ) [k] = compiled->mappings[r.mapbegin + k];
+      return;
+    }
     const std::vector<std::string> source = getRHSSplitSource ( idx );
     const std::vector<std::string> translation = getRHSSplitTranslation ( idx );
     getRuleMappings ( source, translation, mappings );
@@ -0,0 +1,153 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use these files except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copyright 2012 - Gonzalo Iglesias, Adrià de Gispert, William Byrne
+
+#ifndef DATA_GRAMMAR_RULETARGETS_HPP
+#define DATA_GRAMMAR_RULETARGETS_HPP
+
+/**
+ * \file
+ * \brief Rule targets compiled into lattice labels, so that rule fsts
+ * can be built without any string processing.
+ */
+
+namespace ucam {
+namespace hifst {
+
+/// Label of non-terminals in compiled rule targets.
+const int kRuleTargetNonTerminal = -1;
+
+/**
+ * \brief Converts a target element into the label used in translation lattices.
+ * Special tokens (\<s\>, \</s\>, \<dr\>, \<oov\>, \<sep\>) are mapped to their reserved labels.
+ * \returns kRuleTargetNonTerminal for non-terminals.
+ */
+inline int ruleTargetLabel ( const std::string& element ) {
+  if ( !isTerminal ( element ) ) return kRuleTargetNonTerminal;
+  if ( element == "<s>" ) return 1;
+  if ( element == "</s>" ) return 2;
+  if ( element == "<dr>" ) return DR;
+  if ( element == "<oov>" ) return OOV;
+  if ( element == "<sep>" ) return SEP;
+  int label = 0;
+  std::istringstream buffer ( element );
+  buffer >> label;
+  return label;
+};
+
+/// Compiles a split rule target into labels.
+inline void compileRuleTarget ( const std::vector<std::string>& translation,
+                                std::vector<int>& labels ) {
+  labels.resize ( translation.size() );
+  for ( unsigned k = 0; k < translation.size(); ++k )
+    labels[k] = ruleTargetLabel ( translation[k] );
+};
+
+/**
+ * \brief Read-only view of a compiled rule target.
+ * Negative elements are looked up in a symbol table, if any.
+ */
+class RuleTarget {
+ private:
+  const int *labels_;
+  const int *symbollabels_;
+  unsigned size_;
+
+ public:
+  RuleTarget ( const int *labels, const int *symbollabels, unsigned size )
+    : labels_ ( labels )
+    , symbollabels_ ( symbollabels )
+    , size_ ( size ) {
+  };
+
+  inline unsigned size() const {
+    return size_;
+  };
+
+  inline int operator[] ( unsigned k ) const {
+    int label = labels_[k];
+    if ( label >= 0 || symbollabels_ == NULL ) return label;
+    return symbollabels_[-label - 1];
+  };
+};
+
+/**
+ * \brief Targets of all the rules in a grammar, compiled once at loading time.
+ * Text grammars are compiled into one flat array of labels.
+ * Compiled (memory-mapped) grammars already have pre-tokenized targets,
+ * so only their symbol table is compiled.
+ * Once compiled, this object is read-only and can be shared across threads.
+ */
+class RuleTargets {
+ private:
+  std::vector<int> labels_;
+  /// Start of each rule in labels_, plus the end of the last one
+  std::vector<std::size_t> offsets_;
+  /// Labels of the symbol table of the compiled grammar
+  std::vector<int> symbollabels_;
+  const CompiledGrammar *compiled_;
+
+ public:
+  RuleTargets() : compiled_ ( NULL ) {};
+
+  inline void clear() {
+    labels_.clear();
+    offsets_.clear();
+    symbollabels_.clear();
+    compiled_ = NULL;
+  };
+
+  /// Number of rules compiled
+  inline std::size_t size() const {
+    if ( compiled_ != NULL ) return compiled_->numrules();
+    return offsets_.size() ? offsets_.size() - 1 : 0;
+  };
+
+  /// Uses targets of a compiled grammar (no ownership).
+  inline void setCompiled ( const CompiledGrammar& cg ) {
+    clear();
+    compiled_ = &cg;
+    symbollabels_.resize ( cg.symbols.size() );
+    for ( unsigned k = 0; k < cg.symbols.size(); ++k )
+      symbollabels_[k] = ruleTargetLabel ( cg.symbols[k] );
+  };
+
+  /// Adds the target of the next rule.
+  inline void add ( const std::vector<std::string>& translation ) {
+    if ( offsets_.empty() ) offsets_.push_back ( 0 );
+    for ( unsigned k = 0; k < translation.size(); ++k )
+      labels_.push_back ( ruleTargetLabel ( translation[k] ) );
+    offsets_.push_back ( labels_.size() );
+  };
+
+  inline void reserve ( std::size_t numrules ) {
+    offsets_.reserve ( numrules + 1 );
+  };
+
+  inline RuleTarget operator() ( std::size_t idx ) const {
+    if ( compiled_ != NULL ) {
+      const CompiledRule& r = compiled_->rules[idx];
+      return RuleTarget ( compiled_->tokens + r.trgbegin
+                          , symbollabels_.empty() ? NULL : &symbollabels_[0]
+                          , r.trgsize );
+    }
+    return RuleTarget ( labels_.empty() ? NULL : &labels_[offsets_[idx]]
+                        , NULL
+                        , offsets_[idx + 1] - offsets_[idx] );
+  };
+};
+
+}
+} // end namespaces
+
+#endif
@@ -0,0 +1,124 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use these files except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copyright 2012 - Gonzalo Iglesias, Adrià de Gispert, William Byrne
+
+#ifndef DATA_GRAMMAR_SOURCEINDEX_HPP
+#define DATA_GRAMMAR_SOURCEINDEX_HPP
+
+/**
+ * \file
+ * \brief Index from rule source sides to the rules that have them.
+ */
+
+namespace ucam {
+namespace hifst {
+
+const uint64_t kSourceHashSeed = 0xcbf29ce484222325ULL;
+
+///Adds a character to a source hash, so that hashes can be built incrementally.
+inline uint64_t sourceHashStep ( uint64_t h, unsigned char c ) {
+  return ( h ^ c ) * 0x100000001b3ULL;
+};
+
+/**
+ * \brief Hashes a rule source side as an instance-pattern, i.e. with any non-terminal
+ * (and its index) abstracted to X: 3_V1_5 and 3_X_5 have the same hash.
+ * Reads up to the first space or end of string.
+ * \param h Hash of a previous part of the source side, if any
+ */
+inline uint64_t sourceHash ( const char *s, uint64_t h = kSourceHashSeed ) {
+  for ( ; *s != ' ' && *s != '\0'; ++s ) {
+    unsigned char c = *s;
+    if ( c >= 'A' && c <= 'Z' ) {
+      c = 'X';
+      while ( s[1] != '_' && s[1] != ' ' && s[1] != '\0' ) ++s;
+    }
+    h = sourceHashStep ( h, c );
+  }
+  return h;
+};
+
+/**
+ * \brief Maps each rule source side to the range of rules with that source side.
+ * Rules are pattern-sorted (see PatternCompareTool), so rules sharing
+ * a source side are contiguous. Built once when the grammar is loaded, read-only afterwards.
+ * Only hashes are kept: callers should check the first rule of the range actually matches,
+ * as different sources might (very rarely) share a hash. In that case
+ * only the first of them is indexed.
+ */
+class RuleSourceIndex {
+ private:
+  ///Hash of the source side -> first rule and number of rules.
+  unordered_map<uint64_t, std::pair<std::size_t, std::size_t> > ranges_;
+
+ public:
+  inline void clear() {
+    ranges_.clear();
+  };
+
+  ///Number of distinct source sides
+  inline std::size_t size() const {
+    return ranges_.size();
+  };
+
+  /**
+   * \brief Indexes pattern-sorted rules.
+   * \param contents  Rule text
+   * \param vpos      Sorted positions of the source side of each rule in contents
+   * \param numrules  Number of rules
+   */
+  void build ( const char *contents, const posindex *vpos, std::size_t numrules ) {
+    clear();
+    std::size_t begin = 0;
+    uint64_t h = 0;
+    for ( std::size_t k = 0; k < numrules; ++k ) {
+      uint64_t hk = sourceHash ( contents + vpos[k].p );
+      if ( k && hk == h ) continue;
+      if ( k ) add ( h, begin, k );
+      begin = k;
+      h = hk;
+    }
+    if ( numrules ) add ( h, begin, numrules );
+  };
+
+  ///False if no rule has a source side with this hash (see sourceHash).
+  inline bool contains ( uint64_t h ) const {
+    return ranges_.find ( h ) != ranges_.end();
+  };
+
+  /**
+   * \brief Finds the candidate rules for an instance-pattern, e.g. 3_X_5.
+   * \returns false if no rule has this source side. Otherwise, rules begin ... end-1.
+   */
+  inline bool find ( const std::string& instance, std::size_t& begin
+                     , std::size_t& end ) const {
+    unordered_map<uint64_t, std::pair<std::size_t, std::size_t> >::const_iterator itx
+      = ranges_.find ( sourceHash ( instance.c_str() ) );
+    if ( itx == ranges_.end() ) return false;
+    begin = itx->second.first;
+    end = begin + itx->second.second;
+    return true;
+  };
+
+ private:
+  inline void add ( uint64_t h, std::size_t begin, std::size_t end ) {
+    if ( !ranges_.insert ( std::make_pair ( h, std::make_pair ( begin
+                                            , end - begin ) ) ).second )
+      LDEBUG ( "Source hash collision at rule " << begin );
+  };
+};
+
+}
+} // end namespaces
+
+#endif
@@ -142,6 +142,18 @@ struct SentenceSpecificGrammarData {
     return splittranslation;
   };
 
+  /**
+   * \brief Returns the translation of a rule as lattice labels.
+   * Extra rules, or rules of a grammar without compiled targets, are compiled into buffer.
+   */
+  inline RuleTarget getRuleTarget ( std::size_t idx, std::vector<int>& buffer ) {
+    if ( extrarules.find ( idx ) == extrarules.end()
+         && idx < grammar->targets.size() )
+      return grammar->targets ( idx );
+    compileRuleTarget ( getRHSSplitTranslation ( idx ), buffer );
+    return RuleTarget ( buffer.empty() ? NULL : &buffer[0], NULL, buffer.size() );
+  };
+
   /// Returns size of RHS (translation) of a rule
   inline const uint getRHSTranslationSize ( std::size_t idx ) {
     if ( extrarules.find ( idx ) == extrarules.end() )
@@ -28,6 +28,8 @@ typedef std::basic_string<uint> cykparser_sentence_t;
 typedef std::basic_string<uint> cykparser_rulebpcoordinates_t;
 typedef std::vector< cykparser_rulebpcoordinates_t  >
 cykparser_ruledependencies_t;
+///Offsets of the rule backpointers of a cell into the backpointer pool.
+typedef std::basic_string<uint> cykparser_rulebpoffsets_t;
 
 }
 } // end namespaces
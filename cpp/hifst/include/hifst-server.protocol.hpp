@@ -0,0 +1,83 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use these files except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copyright 2012 - Gonzalo Iglesias, Adrià de Gispert, William Byrne
+
+#ifndef HIFST_SERVER_PROTOCOL_HPP
+#define HIFST_SERVER_PROTOCOL_HPP
+
+/**
+ * \file
+ * \brief Framing shared by hifst in server mode and hifst-client.
+ * \remarks All integers are 32-bit unsigned, in network byte order.
+ * Connections are kept open; the client may send any number of requests:
+ *   request := count (id length bytes){count}
+ * The server replies with one frame per sentence, as soon as it is translated,
+ * so replies may come in any order:
+ *   reply := id length bytes
+ * The client signals it is done by shutting down its sending side.
+ */
+
+namespace ucam {
+namespace hifst {
+
+///Longest sentence or reply accepted in a frame. Larger frames close the connection
+const uint32_t kMaxSentenceBytes = 1 << 20;
+
+inline void appendUint32 ( std::string& o, uint32_t v ) {
+  o.push_back ( ( char ) ( ( v >> 24 ) & 0xff ) );
+  o.push_back ( ( char ) ( ( v >> 16 ) & 0xff ) );
+  o.push_back ( ( char ) ( ( v >> 8 ) & 0xff ) );
+  o.push_back ( ( char ) ( v & 0xff ) );
+};
+
+inline uint32_t readUint32 ( unsigned char const *p ) {
+  return ( ( uint32_t ) p[0] << 24 ) | ( ( uint32_t ) p[1] << 16 )
+         | ( ( uint32_t ) p[2] << 8 ) | ( uint32_t ) p[3];
+};
+
+///Appends to o a frame with id and text
+inline void appendFrame ( std::string& o, uint32_t id, std::string const& text ) {
+  appendUint32 ( o, id );
+  appendUint32 ( o, text.size() );
+  o += text;
+};
+
+/**
+ * \brief Reads a frame from a socket (blocking).
+ * \return false if the connection has been closed, or closed here
+ * because the frame is longer than kMaxSentenceBytes.
+ */
+template<class SocketT>
+bool readFrame ( SocketT& s, uint32_t& id, std::string *text ) {
+  unsigned char header[8];
+  boost::system::error_code e;
+  boost::asio::read ( s, boost::asio::buffer ( header, 8 ), e );
+  if ( e ) return false;
+  id = readUint32 ( header );
+  uint32_t length = readUint32 ( header + 4 );
+  if ( length > kMaxSentenceBytes ) {
+    LERROR ( "Frame " << id << " has " << length << " bytes, more than "
+             << kMaxSentenceBytes << ". Closing connection" );
+    s.close ( e );
+    return false;
+  }
+  text->resize ( length );
+  if ( text->empty() ) return true;
+  boost::asio::read ( s, boost::asio::buffer ( &( *text ) [0], text->size() ), e );
+  return !e;
+};
+
+}
+}  // end namespaces
+
+#endif
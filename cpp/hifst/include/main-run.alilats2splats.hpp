@@ -44,8 +44,8 @@ void setScales ( const ucam::util::RegistryPO& rg,
                ) {
   if (rg.get<std::string> (featureweights) != "" ) {
     // overrides separate grammar feature weights + lm feature weights
-    fst::TropicalSparseTupleWeight<float>::Params()
-      = ucam::util::ParseParamString<float> (rg.getString (featureweights) );
+    fst::TropicalSparseTupleWeight<float>::SetParams (
+      ucam::util::ParseParamString<float> (rg.getString (featureweights) ) );
     *offset = rg.getVectorString (lmload).size();
     LWARN ( HifstConstants::kFeatureweights << " overrides program options " <<
             HifstConstants::kRuleflowerlatticeFeatureweights << " and " <<
@@ -60,14 +60,13 @@ void setScales ( const ucam::util::RegistryPO& rg,
   if ( rg.exists ( lmscales ) )
     if ( rg.get<std::string> ( lmscales ) != "" )
       fscales1 = ucam::util::ParseParamString<float> ( rg.getString ( lmscales ) );
-  std::vector<float>& fscales = fst::TropicalSparseTupleWeight<float>::Params();
   *offset = fscales1.size();
   if ( fscales1.size() + fscales2.size() ) {
     LWARN ( "env parameter is overriden by " << lmscales << "," << grammarscales );
-    fscales.clear();
-    fscales = fscales1;
-    copy ( fscales2.begin(), fscales2.end(), std::back_inserter ( fscales ) );
+    copy ( fscales2.begin(), fscales2.end(), std::back_inserter ( fscales1 ) );
+    fst::TropicalSparseTupleWeight<float>::SetParams ( fscales1 );
   }
+  std::vector<float> const& fscales = fst::TropicalSparseTupleWeight<float>::Params();
   USER_CHECK ( fscales.size(),
                "Number of scaling factors  must be greater than 0" );
   ///Dump scales
@@ -26,11 +26,10 @@ namespace ucam {
 namespace hifst {
 
 using boost::asio::ip::tcp;
-const int max_length = 1024;
-typedef boost::shared_ptr<tcp::socket> socket_ptr;
 
 /**
- * \brief Full single-threaded Translation system
+ * \brief Translation client. Keeps one connection open to the server
+ * and pipelines batches of sentences, writing translations in order as they arrive.
  */
 
 template <class Data = HifstClientTaskData>
@@ -38,6 +37,7 @@ class SingleThreadedHifstClientTask: public ucam::util::TaskInterface<Data> {
  private:
   typedef ucam::util::iszfstream iszfstream;
   typedef ucam::util::oszfstream oszfstream;
+  typedef ucam::util::ReorderBuffer<oszfstream> ReorderBuffer;
 
   ///Object reading appropriately file according to range specificed by user
   ucam::util::FastForwardRead<iszfstream> fastforwardread_;
@@ -52,6 +52,37 @@ class SingleThreadedHifstClientTask: public ucam::util::TaskInterface<Data> {
   ///Server is listening at port port_...
   const std::string port_;
 
+  ///Number of sentences per request
+  unsigned batch_;
+  ///Maximum number of sentences sent and not yet translated
+  unsigned window_;
+
+  ///Ids sent and not yet translated, shared with the receiving thread
+  std::set<uint32_t> pending_;
+  ///False once the receiving thread has stopped
+  bool receiving_;
+  boost::mutex mutex_;
+
+  /**
+   * \brief Stops the receiving thread, unless it has been joined already.
+   * Declared after the socket and the thread, so that it runs first on any exit,
+   * e.g. if sending fails, and the thread never outlives them nor the reorder buffer.
+   */
+  struct ReceiverGuard {
+    tcp::socket& s_;
+    boost::thread& receiver_;
+    ReceiverGuard ( tcp::socket& s, boost::thread& receiver )
+      : s_ ( s )
+      , receiver_ ( receiver ) {
+    };
+    ~ReceiverGuard() {
+      if ( !receiver_.joinable() ) return;
+      boost::system::error_code e;
+      s_.shutdown ( tcp::socket::shutdown_both, e );
+      receiver_.join();
+    };
+  };
+
  public:
   /**
    *\brief Constructor
@@ -61,49 +92,25 @@ class SingleThreadedHifstClientTask: public ucam::util::TaskInterface<Data> {
     fastforwardread_ ( new iszfstream ( rg.get<std::string>
                                         ( HifstConstants::kSourceLoad ) ) ),
     textoutput_ ( rg.get<std::string> ( HifstConstants::kTargetStore ) ),
+    rg_ ( rg ),
     host_ ( rg.get<std::string> ( HifstConstants::kHifstHost ) ),
     port_ ( rg.get<std::string> ( HifstConstants::kHifstPort ) ),
-    rg_ ( rg ) {
+    batch_ ( rg.get<unsigned> ( HifstConstants::kHifstClientBatch ) ),
+    window_ ( rg.get<unsigned> ( HifstConstants::kTargetWindow ) ),
+    receiving_ ( false ) {
+    USER_CHECK ( batch_ > 0, "Batch size has to be greater than 0!" );
+    // Sentences of the batch being filled are not sent yet,
+    // so the window must hold at least a full batch.
+    if ( window_ < batch_ ) window_ = batch_;
   };
 
-  ///Sends request, retrieves server reply, prints translation to file
-  inline bool operator() () {
-    Data d;
-    bool finished = false;
-    oszfstream *fileoutput = NULL;
-    if ( textoutput_ != "" ) {
-      fileoutput = new oszfstream ( textoutput_ );
-    }
-    for ( ucam::util::IntRangePtr ir (ucam::util::IntRangeFactory ( rg_ ) );
-          !ir->done ();
-          ir->next () ) {
-      d.sidx = ir->get ();
-      boost::scoped_ptr<std::string> aux ( new std::string ( "" ) );
-      d.translation = aux.get();
-      finished = fastforwardread_ ( d.sidx ,
-                                    &d.sentence ); //Move to whichever next sentence and read
-      boost::algorithm::trim (d.sentence);
-      if (finished && d.sentence == "" ) break;
-      FORCELINFO ( "Translating sentence " << d.sidx << ":" << d.sentence );
-      ///Do actual translation!
-      run ( d );
-      FORCELINFO ( *d.translation );
-      if ( fileoutput != NULL )
-        *fileoutput << *d.translation << std::endl;
-      if ( finished ) break;
-    }
-    delete fileoutput;
-    return false;
-  }
-
- private:
-
   /**
-   * \brief Uses boost asio library to connect to a server. Sends size of source text and source text itself.
-   * Receives size of translation and translation itself.
-   * \param d     Data object, translation will be added to it once received the server reply
+   * \brief Reads sentences and sends them in batches, while a second thread receives translations.
    */
-  bool run ( Data& d ) {
+  inline bool operator() () {
+    boost::scoped_ptr<oszfstream> fileoutput;
+    if ( textoutput_ != "" ) fileoutput.reset ( new oszfstream ( textoutput_ ) );
+    ReorderBuffer rb ( fileoutput.get(), window_ );
     try {
       LINFO ( "Attempting connection to host=" << host_  << ",port=" << port_ );
       boost::asio::io_service io_service;
@@ -112,29 +119,102 @@ class SingleThreadedHifstClientTask: public ucam::util::TaskInterface<Data> {
       tcp::resolver::iterator iterator = resolver.resolve ( query );
       tcp::socket s ( io_service );
       boost::asio::connect ( s, iterator );
-      {
-        char request[max_length + 1];
-        strcpy ( request, ( char * ) d.sentence.c_str() );
-        std::size_t request_length = strlen ( request );
-        boost::asio::write ( s, boost::asio::buffer ( &request_length,
-                             sizeof ( std::size_t ) ) );
-        boost::asio::write ( s, boost::asio::buffer ( request, request_length ) );
+      receiving_ = true;
+      boost::thread receiver ( boost::bind ( &SingleThreadedHifstClientTask::receive
+                                             , this, boost::ref ( s ), boost::ref ( rb ) ) );
+      ReceiverGuard guard ( s, receiver );
+      Data d;
+      bool finished = false;
+      std::vector<uint32_t> ids;
+      std::vector<std::string> sentences;
+      for ( ucam::util::IntRangePtr ir (ucam::util::IntRangeFactory ( rg_ ) );
+            !ir->done ();
+            ir->next () ) {
+        d.sidx = ir->get ();
+        finished = fastforwardread_ ( d.sidx ,
+                                      &d.sentence ); //Move to whichever next sentence and read
+        boost::algorithm::trim (d.sentence);
+        if (finished && d.sentence == "" ) break;
+        FORCELINFO ( "Translating sentence " << d.sidx << ":" << d.sentence );
+        ids.push_back ( rb.reserve() );
+        sentences.push_back ( d.sentence );
+        if ( sentences.size() == batch_ ) send ( s, ids, sentences, rb );
+        if ( finished ) break;
       }
-      char *reply = new char[max_length + 1];
-      std::size_t reply_length = 0;
-      std::size_t reply_length1 = boost::asio::read ( s,
-                                  boost::asio::buffer ( &reply_length, sizeof ( std::size_t ) ) );
-      LDEBUG ("Expected reply Length=" << reply_length);
-      std::size_t reply_length2 = boost::asio::read ( s, boost::asio::buffer ( reply,
-                                  reply_length ) );
-      LINFO ("Reply Length=" << reply_length2);
-      reply[reply_length2] = 0;
-      *d.translation = reply;
-      delete reply;
+      send ( s, ids, sentences, rb );
+      //Server closes the connection once all translations are sent.
+      s.shutdown ( tcp::socket::shutdown_send );
+      receiver.join();
       s.close();
     } catch ( std::exception& e ) {
       std::cerr << "Exception: " << e.what() << "\n";
     }
+    return false;
+  }
+
+ private:
+
+  /**
+   * \brief Sends a request with all sentences, then empties them.
+   * If translations are no longer received, sentences are not sent
+   * and their translations are left empty.
+   */
+  void send ( tcp::socket& s, std::vector<uint32_t>& ids
+              , std::vector<std::string>& sentences, ReorderBuffer& rb ) {
+    if ( sentences.empty() ) return;
+    bool receiving;
+    {
+      boost::lock_guard<boost::mutex> lock ( mutex_ );
+      receiving = receiving_;
+      if ( receiving ) pending_.insert ( ids.begin(), ids.end() );
+    }
+    if ( !receiving ) {
+      LERROR ( "Connection lost: " << sentences.size() << " sentences not translated" );
+      for ( unsigned k = 0; k < ids.size(); ++k ) rb.push ( ids[k], "" );
+      ids.clear();
+      sentences.clear();
+      return;
+    }
+    std::string request;
+    appendUint32 ( request, sentences.size() );
+    for ( unsigned k = 0; k < sentences.size(); ++k )
+      appendFrame ( request, ids[k], sentences[k] );
+    LINFO ( "Sending " << sentences.size() << " sentences" );
+    boost::asio::write ( s, boost::asio::buffer ( request ) );
+    ids.clear();
+    sentences.clear();
+  };
+
+  /**
+   * \brief Receives translations until the server closes the connection.
+   * Replies for ids not sent, or already translated, are discarded.
+   * Sentences left without translation are then written empty.
+   */
+  void receive ( tcp::socket& s, ReorderBuffer& rb ) {
+    uint32_t id;
+    std::string translation;
+    while ( readFrame ( s, id, &translation ) ) {
+      {
+        boost::lock_guard<boost::mutex> lock ( mutex_ );
+        if ( !pending_.erase ( id ) ) {
+          LERROR ( "Discarding translation with unexpected id " << id );
+          continue;
+        }
+      }
+      FORCELINFO ( id << ":" << translation );
+      rb.push ( id, translation );
+    }
+    std::set<uint32_t> missing;
+    {
+      boost::lock_guard<boost::mutex> lock ( mutex_ );
+      receiving_ = false;
+      missing.swap ( pending_ );
+    }
+    if ( !missing.empty() )
+      LERROR ( "Connection closed: " << missing.size() << " sentences not translated" );
+    for ( std::set<uint32_t>::const_iterator itx = missing.begin();
+          itx != missing.end(); ++itx )
+      rb.push ( *itx, "" );
   };
 
   DISALLOW_COPY_AND_ASSIGN ( SingleThreadedHifstClientTask );
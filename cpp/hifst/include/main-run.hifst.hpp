@@ -26,8 +26,6 @@ namespace ucam {
 namespace hifst {
 
 using boost::asio::ip::tcp;
-const int max_length = 1024;
-typedef boost::shared_ptr<tcp::socket> socket_ptr;
 
 /**
  * \brief Full single-threaded Translation system
@@ -84,7 +82,7 @@ class SingleThreadedHifstTask: public ucam::util::TaskInterface<DataT<ArcT>  > {
     std::string params = rg.get<std::string>(HifstConstants::kLmFeatureweights);
     params += ",1,1";
     FORCELINFO("fake tuple params=" << params);
-    TupleW32::Params() = ucam::util::ParseParamString<float> (params);
+    TupleW32::SetParams ( ucam::util::ParseParamString<float> (params) );
   };
 
   /**
@@ -225,7 +223,111 @@ class MultiThreadedHifstTask: public ucam::util::TaskInterface<DataT<ArcT> > {
 
   ///Number of threads requested by user
   unsigned threadcount_;
+  ///Maximum number of sentences in flight. The longest ones amongst these are translated first
+  unsigned window_;
   bool usingTupleArc_;
+  ///Key to language model feature weights
+  std::string lmFeatureweights_;
+  ///Sentence-specific language models, shared by all worker threads
+  boost::scoped_ptr<ucam::fsttools::LanguageModelRegistry> lmregistry_;
+
+  typedef ucam::util::ReorderBuffer<oszfstream> ReorderBuffer;
+  typedef ucam::util::TaskInterface<Data> Task;
+  typedef boost::thread_specific_ptr<Task> WorkerChain;
+
+  /**
+   * \brief Runs the sentence through the translation chain of the current worker thread
+   * and hands over the translation to the reorder buffer.
+   * The chain is built the first time the worker thread needs it,
+   * and deleted when the thread exits.
+   */
+  struct OrderedTaskFunctor {
+    MultiThreadedHifstTask const *owner_;
+    WorkerChain *chain_;
+    boost::shared_ptr<Data> d_;
+    ReorderBuffer *rb_;
+    std::size_t position_;
+    boost::shared_ptr<std::string> translation_;
+    OrderedTaskFunctor ( MultiThreadedHifstTask const *owner
+                         , WorkerChain *chain
+                         , boost::shared_ptr<Data> d
+                         , ReorderBuffer *rb
+                         , std::size_t position
+                         , boost::shared_ptr<std::string> translation )
+      : owner_ ( owner )
+      , chain_ ( chain )
+      , d_ ( d )
+      , rb_ ( rb )
+      , position_ ( position )
+      , translation_ ( translation ) {
+    };
+    void operator() () {
+      if ( chain_->get() == NULL ) chain_->reset ( owner_->createChain() );
+      ( *chain_ )->chainreset();
+      ( *chain_ )->chainrun ( *d_ );
+      d_.reset();
+      rb_->push ( position_, *translation_ );
+    };
+  };
+
+  /// True if the language models of this key are sentence-specific, e.g. --lm.load=lm.?.gz
+  bool isSentenceSpecific ( std::string const& lmload ) const {
+    return rg_.exists ( lmload )
+           && rg_.get<std::string> ( lmload ).find ( "?" ) != std::string::npos;
+  };
+
+  /**
+   * \brief Creates the loader for the language models of a key, or NULL.
+   * Models shared by all sentences are loaded once before translating;
+   * sentence-specific models are loaded by each worker thread, through the registry.
+   * \param sentencespecific Creates the loader only if models of lmload are (not) sentence-specific.
+   */
+  LoadLanguageModel *createLanguageModelLoader ( std::string const& lmload
+      , bool sentencespecific ) const {
+    using namespace HifstConstants;
+    if ( isSentenceSpecific ( lmload ) != sentencespecific ) return NULL;
+    ucam::fsttools::LanguageModelRegistry *registry = sentencespecific
+        ? lmregistry_.get() : NULL;
+    if ( lmload == kHifstLocalpruneLmLoad )
+      return new LoadLanguageModel ( rg_, lmload
+                                     , kHifstLocalpruneLmFeatureweights
+                                     , kHifstLocalpruneLmWordpenalty
+                                     , kLmWordmap, false, registry );
+    if ( lmload == kRecaserLmLoad )
+      return new LoadLanguageModel ( rg_, lmload
+                                     , kRecaserLmFeatureweight
+                                     , kRecaserLmWps
+                                     , kRecaserLmWordmap, false, registry );
+    return new LoadLanguageModel ( rg_, lmload, lmFeatureweights_
+                                   , kLmWordPenalty, kLmWordmap, false, registry );
+  };
+
+  ///Creates the chain of tasks that translates one sentence.
+  Task *createChain() const {
+    using namespace HifstConstants;
+    PrePro *p = new PrePro ( rg_ );
+    p->appendTask
+    ( createLanguageModelLoader ( kLmLoad, true ) )
+    ( createLanguageModelLoader ( kHifstLocalpruneLmLoad, true ) )
+    ( createLanguageModelLoader ( kRecaserLmLoad, true ) )
+    ( new PatternsToInstances ( rg_ ) )
+    ( ReferenceFilter::init ( rg_ ) )
+    ( new SentenceSpecificGrammar ( rg_ ) )
+    ( new Parse ( rg_ ) )
+    ( new HiFST ( rg_ ) )
+    ( OptimizeFst::init(rg_, kHifstLatticeOptimize, kHifstLatticeStore , kHifstStripSpecialEpsilonLabels) )
+    ( WriteFst::init ( rg_, kHifstLatticeStore )  )
+    ( new Recase ( rg_  ,
+                   kHifstLatticeStore,
+                   kPostproInput,
+                   kRecaserLmLoad,
+                   kRecaserUnimapLoad ) )
+    ( WriteFst::init ( rg_ , kRecaserOutput, kPostproInput ) )
+    ( new PostPro ( rg_ ) )
+    ( new HifstStats ( rg_ ) )
+    ;
+    return p;
+  };
  public:
   /**
    *\brief Constructor
@@ -236,6 +338,7 @@ class MultiThreadedHifstTask: public ucam::util::TaskInterface<DataT<ArcT> > {
                                         ( HifstConstants::kSourceLoad ) ) )
       , textoutput_ ( rg.get<std::string> ( HifstConstants::kTargetStore ) )
       , threadcount_ ( rg.get<unsigned> ( HifstConstants::kNThreads ) )
+      , window_ ( rg.get<unsigned> ( HifstConstants::kTargetWindow ) )
       , usingTupleArc_(rg.get<std::string>(HifstConstants::kHifstSemiring) == HifstConstants::kHifstSemiringTupleArc )
       , rg_ ( rg ) {
 
@@ -248,7 +351,7 @@ class MultiThreadedHifstTask: public ucam::util::TaskInterface<DataT<ArcT> > {
     std::string params = rg.get<std::string>(HifstConstants::kLmFeatureweights);
     params += ",1,1";
     FORCELINFO("fake tuple params=" << params);
-    TupleW32::Params() = ucam::util::ParseParamString<float> (params);
+    TupleW32::SetParams ( ucam::util::ParseParamString<float> (params) );
   };
 
   /**
@@ -267,41 +370,45 @@ class MultiThreadedHifstTask: public ucam::util::TaskInterface<DataT<ArcT> > {
       grammarFeatureweightOffset = rg_.getVectorString (
                                      kLmLoad).size();
     }
+    lmFeatureweights_ = lmFeatureweights;
+    if ( isSentenceSpecific ( kLmLoad )
+         || isSentenceSpecific ( kHifstLocalpruneLmLoad )
+         || isSentenceSpecific ( kRecaserLmLoad ) ) {
+      FORCELINFO ( "Sentence-specific language models: loading them as needed" );
+      lmregistry_.reset ( new ucam::fsttools::LanguageModelRegistry
+                          ( ( std::size_t ) rg_.get<unsigned> ( kLmMaxMemory ) << 20
+                            , rg_.get<unsigned> ( kLmPrefetch ) ? 1 : 0 ) );
+    }
     boost::scoped_ptr < LoadGrammar > grammartask
     ( new LoadGrammar ( rg_, grammarFeatureweights, grammarFeatureweightOffset ) );
     grammartask->appendTask
-    ( new LoadLanguageModel ( rg_
-                              , kLmLoad
-                              , lmFeatureweights ) )
-    ( new LoadLanguageModel ( rg_
-                              , kHifstLocalpruneLmLoad
-                              , kHifstLocalpruneLmFeatureweights
-                              , kHifstLocalpruneLmWordpenalty) )
-    ( new LoadLanguageModel ( rg_
-                              , kRecaserLmLoad
-                              , kRecaserLmFeatureweight
-                              , kRecaserLmWps
-                              , kRecaserLmWordmap) )
+    ( createLanguageModelLoader ( kLmLoad, false ) )
+    ( createLanguageModelLoader ( kHifstLocalpruneLmLoad, false ) )
+    ( createLanguageModelLoader ( kRecaserLmLoad, false ) )
     ( new LoadUnimap ( rg_  , kRecaserUnimapLoad ) )
     ( LoadWordMap::init ( rg_  , kPreproWordmapLoad , true ) )
     ( LoadWordMap::init ( rg_  , kPostproWordmapLoad ) )
     ;
     //Load grammar and language model
     grammartask->chainrun ( original_data );
-    std::vector < boost::shared_ptr<std::string> >translations;
+    boost::scoped_ptr<oszfstream> fileoutput;
+    if ( textoutput_ != "" ) fileoutput.reset ( new oszfstream ( textoutput_ ) );
+    ReorderBuffer rb ( fileoutput.get(), window_ );
     {
-      ucam::util::TrivialThreadPool tp ( threadcount_ );
+      // Worker chains are deleted as threads exit, i.e. when tp is destroyed.
+      WorkerChain chain;
+      // Longest sentences first, so that none of them is left for the end of a batch.
+      ucam::util::PriorityThreadPool<OrderedTaskFunctor> tp ( threadcount_ );
       bool finished = false;
       for ( ucam::util::IntRangePtr ir (ucam::util::IntRangeFactory ( rg_ ) );
             !ir->done();
             ir->next() ) {
-        Data *d = new Data; //( original_data ); // reset.
+        boost::shared_ptr<Data> d ( new Data );
         d->grammar = original_data.grammar;
         d->sidx = ir->get();
         d->klm = original_data.klm;
-        translations.push_back ( boost::shared_ptr<std::string>
-                                 ( new std::string ( "" ) ) );
-        d->translation = translations[translations.size() - 1].get();
+        boost::shared_ptr<std::string> translation ( new std::string ( "" ) );
+        d->translation = translation.get();
         if ( original_data.fsts.find ( kRecaserUnimapLoad ) !=
              original_data.fsts.end() )
           d->fsts[kRecaserUnimapLoad] =
@@ -311,35 +418,17 @@ class MultiThreadedHifstTask: public ucam::util::TaskInterface<DataT<ArcT> > {
         finished = fastforwardread_ ( d->sidx ,
                                       & ( d->originalsentence ) ); //Move to whichever next sentence and read
         if (finished && d->originalsentence == "") break;
+        //Waits here if too many sentences are still in flight
+        std::size_t position = rb.reserve();
         FORCELINFO ( "=====Translate sentence " << d->sidx << ":" <<
                      d->originalsentence );
-        PrePro *p = new PrePro ( rg_ );
-        p->appendTask
-        ( new PatternsToInstances ( rg_ ) )
-        ( ReferenceFilter::init ( rg_ ) )
-        ( new SentenceSpecificGrammar ( rg_ ) )
-        ( new Parse ( rg_ ) )
-        ( new HiFST ( rg_ ) )
-        ( OptimizeFst::init(rg_, kHifstLatticeOptimize, kHifstLatticeStore , kHifstStripSpecialEpsilonLabels) )
-        ( WriteFst::init ( rg_, kHifstLatticeStore )  )
-        ( new Recase ( rg_  ,
-                       kHifstLatticeStore,
-                       kPostproInput,
-                       kRecaserLmLoad,
-                       kRecaserUnimapLoad ) )
-        ( WriteFst::init ( rg_ , kRecaserOutput, kPostproInput ) )
-        ( new PostPro ( rg_ ) )
-        ( new HifstStats ( rg_ ) )
-        ;
-        tp ( ucam::util::TaskFunctor<Data> ( p, d ) );
+        tp ( OrderedTaskFunctor ( this, &chain, d, &rb, position, translation )
+             , estimateTranslationCost ( d->originalsentence ) );
         if ( finished ) break;
       }
     }
-    ///Todo here... Traverse translations and write text output
-    if ( textoutput_ == "" ) return false;
-    boost::scoped_ptr<oszfstream> fileoutput ( new oszfstream ( textoutput_ ) );
-    for ( unsigned k = 0; k < translations.size(); ++k )
-      *fileoutput << *translations[k] << std::endl;
+    rb.wait();
+    lmregistry_.reset();
     return false;
   };
 
@@ -380,86 +469,192 @@ class HifstServerTask: public ucam::util::TaskInterface<DataT<ArcT>  > {
   typedef ucam::hifst::PostProTask < Data , ArcT > PostPro;
   typedef ucam::hifst::HifstStatsTask < Data > HifstStats;
 
+  typedef ucam::util::TaskInterface<Data> Task;
+  typedef boost::thread_specific_ptr<Task> WorkerChain;
+
   ///Registry object
   const ucam::util::RegistryPO& rg_;
 
   ///Port at which hifst is listening
   short port_;
 
+  ///Number of translation threads
+  unsigned threadcount_;
+
   ///Data object
   Data d_;
 
   ///Translation task
   boost::scoped_ptr < GrammarTask < Data > >ttask_;
 
-  ///Core internal class doing the actual translation
-  class translation {
+  ///Handles all socket operations
+  boost::asio::io_service io_service_;
+
+  ///Translation chain of each worker thread
+  WorkerChain chain_;
+
+  ///Worker pool translating sentences
+  boost::scoped_ptr<ucam::util::TrivialThreadPool> pool_;
+
+  class Connection;
+  typedef boost::shared_ptr<Connection> ConnectionPtr;
+
+  /**
+   * \brief A client connection. Reads requests and writes replies asynchronously
+   * (see hifst-server.protocol.hpp); sentences are translated by the worker pool.
+   * All methods run in the io_service thread.
+   */
+  class Connection: public boost::enable_shared_from_this<Connection> {
    private:
-    ///Registry object
-    const ucam::util::RegistryPO& rg_;
+    HifstServerTask& server_;
+    tcp::socket socket_;
+    unsigned char header_[8];
+    ///Sentences left in current request
+    uint32_t remaining_;
+    uint32_t id_;
+    std::string sentence_;
+    ///Replies waiting to be written
+    std::deque<std::string> outbox_;
 
    public:
-    ///constructor
-    translation ( const ucam::util::RegistryPO& rg ) : rg_ ( rg ) {};
-
-    /**
-     * \brief Assuming a request has arrived, it generates the translation and sends it back to the client.
-     * Reads source sentence size (bytes) and sentence itself, translates and then writes translation size
-     * and translation itself into the socket.
-     * \param sock      Socket object
-     * \param d         Data object
-     */
-    bool operator () ( socket_ptr sock, Data& d ) {
-      using namespace HifstConstants;
-      ///Make a copy of d, and go for it.
-      LINFO ( "Init new taskdata..." );
-      boost::scoped_ptr<Data> mydata ( new Data );
-      mydata->grammar = d.grammar;
-      mydata->klm = d.klm;
-      mydata->filters.clear();
-      if ( d.fsts.find ( kRecaserUnimapLoad ) != d.fsts.end() )
-        mydata->fsts[kRecaserUnimapLoad] =
-          d.fsts[kRecaserUnimapLoad];
-      mydata->recasingvcblm = d.recasingvcblm;
-      mydata->wm = d.wm;
-      LINFO ("Number of wordmaps... " << mydata->wm.size() );
+    Connection ( HifstServerTask& server, boost::asio::io_service& io )
+      : server_ ( server )
+      , socket_ ( io )
+      , remaining_ ( 0 )
+      , id_ ( 0 ) {
+    };
+
+    tcp::socket& socket() {
+      return socket_;
+    };
+
+    inline void start() {
+      readCount();
+    };
+
+    ///Queues a reply frame
+    void deliver ( std::string const& frame ) {
+      bool writing = !outbox_.empty();
+      outbox_.push_back ( frame );
+      if ( !writing ) write();
+    };
+
+   private:
+    void readCount() {
+      boost::asio::async_read ( socket_, boost::asio::buffer ( header_, 4 )
+                                , boost::bind ( &Connection::onCount, this->shared_from_this()
+                                                , boost::asio::placeholders::error ) );
+    };
+
+    void onCount ( boost::system::error_code const& e ) {
+      if ( e ) return; // Client is done
+      remaining_ = readUint32 ( header_ );
+      LINFO ( "Request with " << remaining_ << " sentences" );
+      if ( remaining_ ) readHeader();
+      else readCount();
+    };
+
+    void readHeader() {
+      boost::asio::async_read ( socket_, boost::asio::buffer ( header_, 8 )
+                                , boost::bind ( &Connection::onHeader, this->shared_from_this()
+                                                , boost::asio::placeholders::error ) );
+    };
+
+    void onHeader ( boost::system::error_code const& e ) {
+      if ( e ) return;
+      id_ = readUint32 ( header_ );
+      uint32_t length = readUint32 ( header_ + 4 );
+      if ( length > kMaxSentenceBytes ) {
+        LERROR ( "Sentence " << id_ << " has " << length << " bytes, more than "
+                 << kMaxSentenceBytes << ". Closing connection" );
+        boost::system::error_code ignored;
+        socket_.close ( ignored );
+        return;
+      }
+      sentence_.resize ( length );
+      boost::asio::async_read ( socket_, boost::asio::buffer ( &sentence_[0], sentence_.size() )
+                                , boost::bind ( &Connection::onSentence, this->shared_from_this()
+                                                , boost::asio::placeholders::error ) );
+    };
+
+    void onSentence ( boost::system::error_code const& e ) {
+      if ( e ) return;
+      server_.submit ( this->shared_from_this(), id_, sentence_ );
+      if ( --remaining_ ) readHeader();
+      else readCount();
+    };
+
+    void write() {
+      boost::asio::async_write ( socket_, boost::asio::buffer ( outbox_.front() )
+                                 , boost::bind ( &Connection::onWrite, this->shared_from_this()
+                                                 , boost::asio::placeholders::error ) );
+    };
+
+    void onWrite ( boost::system::error_code const& e ) {
+      if ( e ) {
+        LWARN ( "Could not send reply: " << e.message() );
+        outbox_.clear();
+        return;
+      }
+      outbox_.pop_front();
+      if ( !outbox_.empty() ) write();
+    };
+  };
+
+  /**
+   * \brief Translates a sentence in a worker thread and hands over
+   * the reply to the io_service thread.
+   */
+  struct TranslationFunctor {
+    HifstServerTask *server_;
+    ConnectionPtr connection_;
+    uint32_t id_;
+    std::string sentence_;
+    TranslationFunctor ( HifstServerTask *server, ConnectionPtr connection
+                         , uint32_t id, std::string const& sentence )
+      : server_ ( server )
+      , connection_ ( connection )
+      , id_ ( id )
+      , sentence_ ( sentence ) {
+    };
+    void operator() () {
+      std::string translation;
       try {
-        char data[max_length + 1];
-        std::size_t query_length = 0;
-        std::size_t query_length1 = boost::asio::read ( *sock,
-                                    boost::asio::buffer ( &query_length, sizeof ( std::size_t ) ) );
-        std::size_t query_length2 = boost::asio::read ( *sock,
-                                    boost::asio::buffer ( data, query_length ) );
-        data[query_length2] = 0;
-        mydata->originalsentence = data;
-        FORCELINFO ( "Query to translate: " << mydata->originalsentence );
-        boost::scoped_ptr<std::string> translation ( new std::string );
-        mydata->translation = translation.get();
-        this->operator() ( *mydata );
-        char datasend[max_length + 1];
-        //Send data
-        strcpy ( datasend, ( char * ) translation.get()->c_str() );
-        std::size_t length = strlen ( datasend );
-        boost::asio::write ( *sock, boost::asio::buffer ( &length,
-                             sizeof ( std::size_t ) ) );
-        FORCELINFO ( "Sending:" << datasend );
-        boost::asio::write ( *sock, boost::asio::buffer ( datasend, length ) );
-        sock->close();
+        server_->translate ( sentence_, &translation );
       } catch ( std::exception& e ) {
-        std::cerr << "Exception in thread! " << e.what() << "\n";
+        LERROR ( "Exception translating sentence " << id_ << ": " << e.what() );
+        translation = "";
       }
-      return true;
+      std::string frame;
+      appendFrame ( frame, id_, translation );
+      server_->io_service_.post ( boost::bind ( &Connection::deliver, connection_, frame ) );
     };
+  };
 
-   private:
+  ///Queues a sentence for translation
+  inline void submit ( ConnectionPtr connection, uint32_t id, std::string const& sentence ) {
+    ( *pool_ ) ( TranslationFunctor ( this, connection, id, sentence ) );
+  };
 
-    /**
-     * \brief Runs actual translation tasks using models in data object
-     */
-    bool operator () ( Data& d ) {
-      using namespace HifstConstants;
-      PrePro p ( rg_ );
-      p.appendTask
+  /**
+   * \brief Runs actual translation tasks using models in data object.
+   * Each worker thread builds its translation chain once.
+   */
+  void translate ( std::string const& sentence, std::string *translation ) {
+    using namespace HifstConstants;
+    Data mydata;
+    mydata.grammar = d_.grammar;
+    mydata.klm = d_.klm;
+    if ( d_.fsts.find ( kRecaserUnimapLoad ) != d_.fsts.end() )
+      mydata.fsts[kRecaserUnimapLoad] = d_.fsts.find ( kRecaserUnimapLoad )->second;
+    mydata.recasingvcblm = d_.recasingvcblm;
+    mydata.wm = d_.wm;
+    mydata.originalsentence = sentence;
+    mydata.translation = translation;
+    FORCELINFO ( "Query to translate: " << mydata.originalsentence );
+    if ( chain_.get() == NULL ) {
+      PrePro *p = new PrePro ( rg_ );
+      p->appendTask
       ( new PatternsToInstances ( rg_ ) )
       ( new SentenceSpecificGrammar ( rg_ ) )
       ( new Parse ( rg_ ) )
@@ -472,9 +667,11 @@ class HifstServerTask: public ucam::util::TaskInterface<DataT<ArcT>  > {
                      kRecaserUnimapLoad ) )
       ( new PostPro ( rg_ ) )
       ;
-      p.chainrun ( d );        //Run translation!
+      chain_.reset ( p );
     }
-
+    chain_->chainreset();
+    chain_->chainrun ( mydata );        //Run translation!
+    FORCELINFO ( "Sending:" << *translation );
   };
 
  public:
@@ -484,7 +681,9 @@ class HifstServerTask: public ucam::util::TaskInterface<DataT<ArcT>  > {
    */
   HifstServerTask ( const ucam::util::RegistryPO& rg ) :
     rg_ ( rg ),
-    port_ ( rg.get<short> ( HifstConstants::kServerPort ) ) {
+    port_ ( rg.get<short> ( HifstConstants::kServerPort ) ),
+    threadcount_ ( rg.exists ( HifstConstants::kNThreads )
+                   ? rg.get<unsigned> ( HifstConstants::kNThreads ) : 1 ) {
   };
 
   ///Loads all full models once (grammar, language models, wordmap files).
@@ -529,19 +728,31 @@ class HifstServerTask: public ucam::util::TaskInterface<DataT<ArcT>  > {
 
  private:
 
-  ///Kicks off server, waits for incoming request, when it arrives
-  ///it generates a thread to attend request and keeps listening for more requests.
+  ///Kicks off server: connections are accepted and served asynchronously by this thread,
+  ///while sentences are translated by a pool of threadcount_ workers.
   bool run ( Data& d ) {
-    boost::asio::io_service io_service;
-    tcp::acceptor a ( io_service, tcp::endpoint ( tcp::v4(), port_ ) );
-    for ( ;; ) {
-      LINFO ( "Waiting for a connection at port=" << port_ );
-      socket_ptr sock ( new tcp::socket ( io_service ) );
-      a.accept ( *sock );
-      translation tr ( rg_ );
-      boost::thread t ( boost::bind<void> ( tr, sock, d ) );
-      LINFO ( "Connection accepted... Thread created..." );
+    pool_.reset ( new ucam::util::TrivialThreadPool ( threadcount_ ) );
+    tcp::acceptor a ( io_service_, tcp::endpoint ( tcp::v4(), port_ ) );
+    accept ( a );
+    LINFO ( "Waiting for connections at port=" << port_ );
+    io_service_.run();
+    return false;
+  };
+
+  void accept ( tcp::acceptor& a ) {
+    ConnectionPtr connection ( new Connection ( *this, io_service_ ) );
+    a.async_accept ( connection->socket()
+                     , boost::bind ( &HifstServerTask::onAccept, this, boost::ref ( a )
+                                     , connection, boost::asio::placeholders::error ) );
+  };
+
+  void onAccept ( tcp::acceptor& a, ConnectionPtr connection
+                  , boost::system::error_code const& e ) {
+    if ( !e ) {
+      LINFO ( "Connection accepted..." );
+      connection->start();
     }
+    accept ( a );
   };
 
   DISALLOW_COPY_AND_ASSIGN ( HifstServerTask );
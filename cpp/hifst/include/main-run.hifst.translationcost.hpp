@@ -0,0 +1,42 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use these files except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copyright 2012 - Gonzalo Iglesias, Adrià de Gispert, William Byrne
+
+#ifndef MAIN_RUN_HIFST_TRANSLATIONCOST_HPP
+#define MAIN_RUN_HIFST_TRANSLATIONCOST_HPP
+
+/**
+ * \file
+ * \brief Cost estimate used to schedule sentences in multithreaded hifst
+ */
+
+namespace ucam {
+namespace hifst {
+
+/**
+ * \brief Estimates how expensive a sentence is to translate, in arbitrary units.
+ * Cyk parsing and lattice construction grow roughly with the cube of the number of words,
+ * so a few long sentences dominate the decoding time of a batch.
+ */
+inline double estimateTranslationCost ( std::string const& sentence ) {
+  std::istringstream words ( sentence );
+  std::string w;
+  double n = 0;
+  while ( words >> w ) ++n;
+  return n * n * n;
+};
+
+}
+} // end namespaces
+
+#endif
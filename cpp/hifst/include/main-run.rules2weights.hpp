@@ -31,6 +31,7 @@ struct RulesToWeightsMapperObject {
   typedef ToArc::Weight Weight;
   ucam::hifst::RuleIdsToSparseWeightLatsData<> *d_;
   unsigned lmOffset_;
+  mutable fst::SparseFeatureMerger<float> merger_;
   typedef ucam::hifst::RuleIdsToSparseWeightLatsData<>::WeightsTableIt WeightsTableIt;
   explicit RulesToWeightsMapperObject(ucam::hifst::RuleIdsToSparseWeightLatsData<> &d
                                       , unsigned lmOffset )
@@ -43,7 +44,7 @@ struct RulesToWeightsMapperObject {
       return ToArc ( arc.ilabel, arc.olabel, ToArc::Weight::Zero(), arc.nextstate );
 
     // minimize weight list (this semiring allows for repeated indices!
-    std::map<int, float> wm;
+    merger_.Clear();
     for (fst::SparseTupleWeightIterator<FeatureWeight32, int> it ( arc.weight )
              ; !it.Done()
              ; it.Next() ) {
@@ -56,23 +57,19 @@ struct RulesToWeightsMapperObject {
           std::cerr << "RULE NOT FOUND:" << -it.Value().first  << "," << d_->weights->size() << std::endl;
           exit(EXIT_FAILURE);
         }
-        Weight aux = itx->second;
+        Weight const& aux = itx->second;
         for (fst::SparseTupleWeightIterator<FeatureWeight32, int> auxit ( aux )
                  ; !auxit.Done()
                  ; auxit.Next() ) {
-	  wm[auxit.Value().first] += auxit.Value().second.Value() * it.Value().second.Value();
+	  merger_.Add ( auxit.Value().first, auxit.Value().second.Value() * it.Value().second.Value() );
         }
         continue;
       }
-      wm[it.Value().first] += it.Value().second.Value();
+      merger_.Add ( it.Value().first, it.Value().second.Value() );
     }
     // finally create the weights ...
     Weight nw;
-    for (std::map<int, float>::const_iterator itx = wm.begin()
-	   ; itx != wm.end()
-	   ; ++itx ) {
-      nw.Push(itx->first, itx->second);	  
-    }
+    merger_.Flush ( &nw );
     return ToArc ( arc.ilabel, arc.olabel, nw, arc.nextstate );
   }
 };
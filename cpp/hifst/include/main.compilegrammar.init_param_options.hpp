@@ -0,0 +1,76 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use these files except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copyright 2012 - Gonzalo Iglesias, Adrià de Gispert, William Byrne
+
+/** \file
+ *    \brief To initialize boost parameter options for compilegrammar tool
+ */
+
+namespace ucam {
+namespace util {
+
+namespace po = boost::program_options;
+
+/**
+ *\brief Function to initialize boost program_options module with command-line and config file options.
+ * \param argc number of command-line options, as generated for the main function
+ * \param argv standard command-line options, as generated for the main function
+ * \param vm boost variable containing all parsed options.
+ * \return void
+ */
+
+inline void init_param_options ( int argc, const char* argv[],
+                                 po::variables_map *vm ) {
+  using namespace HifstConstants;
+  try {
+    po::options_description desc ( "Command-line/configuration file options" );
+    desc.add_options()
+    ( kGrammarLoad.c_str(), po::value<std::string>(),
+      "Load a synchronous context-free grammar file" )
+    ( kGrammarFeatureweights.c_str(),
+      po::value<std::string>()->default_value ( "1" ),
+      "One or more scales. Must match the number of features in the grammar. "
+      "The compiled grammar can only be used with these same scales" )
+    ( kGrammarStorepatterns.c_str(),
+      po::value<std::string>()->default_value ( "" ),
+      "Store a file containing patterns" )
+    ( kGrammarStorentorder.c_str(),
+      po::value<std::string>()->default_value ( "" ),
+      "Store a file containing non-terminal table" )
+    ( kGrammarLoadthreads.c_str(),
+      po::value<unsigned>()->default_value ( 1 ),
+      "Number of threads parsing the text grammar (trimmed to number of cpus in the machine)" )
+    ( kOutputExtended.c_str(), po::value<std::string>(),
+      "Write compiled grammar to [file]" )
+    ;
+    parseOptionsGeneric (desc, vm, argc, argv);
+    if ( !vm->count ( kGrammarLoad.c_str() ) ) {
+      LERROR ( kGrammarLoad << " not defined" );
+      exit ( EXIT_FAILURE );
+    }
+    if ( !vm->count ( kOutput.c_str() ) ) {
+      LERROR ( kOutput << " not defined" );
+      exit ( EXIT_FAILURE );
+    }
+  } catch ( std::exception& e ) {
+    std::cerr << "error: " << e.what() << "\n";
+    exit ( EXIT_FAILURE );
+  } catch ( ... ) {
+    std::cerr << "Exception of unknown type!\n";
+    exit ( EXIT_FAILURE );
+  }
+  LINFO ( "Configuration loaded" );
+};
+
+}
+} // end namespaces
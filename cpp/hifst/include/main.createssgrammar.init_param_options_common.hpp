@@ -30,7 +30,7 @@ inline void initAllCreateSSGrammarOptions (po::options_description& desc) {
   ( HifstConstants::kNThreads.c_str(), po::value<unsigned>(),
     "Number of threads (trimmed to number of cpus in the machine) " )
   ( HifstConstants::kGrammarLoad.c_str(), po::value<std::string>(),
-    "Load a synchronous context-free grammar file" )
+    "Load a synchronous context-free grammar file, either text or compiled with compilegrammar" )
   ( HifstConstants::kGrammarFeatureweights.c_str(),
     po::value<std::string>()->default_value ( "1" ),
     "One or more scales. Must match the number of features in the grammar" )
@@ -40,6 +40,10 @@ inline void initAllCreateSSGrammarOptions (po::options_description& desc) {
   ( HifstConstants::kGrammarStorentorder.c_str(),
     po::value<std::string>()->default_value ( "" ),
     "Store a file containing non-terminal table" )
+  ( HifstConstants::kGrammarLoadthreads.c_str(),
+    po::value<unsigned>()->default_value ( 1 ),
+    "Number of threads parsing a text grammar (trimmed to number of cpus in the machine). "
+    "With more than 1, rules with the same source side keep the order of the grammar file" )
   ( HifstConstants::kSourceLoad.c_str(),
     po::value<std::string>()->default_value ( "-" ),
     "Source text file -- this option is ignored in server mode" )
@@ -50,5 +50,6 @@ extern const bool detailed;
 
 #include "main.hifst-client.init_param_options.hpp"
 #include <data-main.hifst-client.hpp>
+#include <hifst-server.protocol.hpp>
 
 #endif
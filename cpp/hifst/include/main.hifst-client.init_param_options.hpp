@@ -51,6 +51,10 @@ inline void init_param_options ( int argc, const char* argv[],
       "Source text file " )
     ( HifstConstants::kTargetStore.c_str(), po::value<std::string>(),
       "Target text file " )
+    ( HifstConstants::kTargetWindow.c_str(), po::value<unsigned>()->default_value ( 100 ),
+      "Maximum number of sentences sent to the server and not yet translated" )
+    ( HifstConstants::kHifstClientBatch.c_str(), po::value<unsigned>()->default_value ( 1 ),
+      "Number of sentences sent to the server in each request" )
     ;
     parseOptionsGeneric (desc, vm, argc, argv);
   } catch ( std::exception& e ) {
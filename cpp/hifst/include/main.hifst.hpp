@@ -93,6 +93,7 @@ extern const bool detailed;
 
 #include <data-main.rules2weights.hpp>
 #include <data-main.hifst.hpp>
+#include <hifst-server.protocol.hpp>
 
 #include <task.readfst.hpp>
 #include <task.writefst.hpp>
@@ -58,6 +58,9 @@ inline void init_param_options ( int argc, const char* argv[],
     ( kTargetStore.c_str()
       , po::value<std::string>()->default_value ( "-" )
       , "Source text file -- this option is ignored in server mode" )
+    ( kTargetWindow.c_str()
+      , po::value<unsigned>()->default_value ( 100 )
+      , "Multithreaded mode: maximum number of sentences in flight. The longest pending sentences are translated first; translations are still written in order as soon as all previous ones are available" )
     ( kFeatureweights.c_str()
       , po::value<std::string>()->default_value ( "" )
       , "Feature weights applied in hifst. This is a comma-separated sequence "
@@ -122,6 +125,9 @@ inline void init_param_options ( int argc, const char* argv[],
     ( kHifstOptimizecells.c_str()
       , po::value<std::string>()->default_value ( "yes" )
       , "Determinize/minimize any FSA component of the RTN (yes|no)"  )
+    ( kHifstCellthreads.c_str()
+      , po::value<unsigned>()->default_value ( 1 )
+      , "Number of threads building cells of the same sentence. Independent cells are built concurrently. Local pruning is still applied by one thread, in the same order as with one thread, so results do not change. With a memory budget, fewer cells can be built concurrently"  )
     ( kHifstReplacefstbyarcNonterminals.c_str()
       , po::value<std::string>()->default_value ( "" )
       , "Determine which cell fsts are always replaced by single arc according to its non-terminals, e.g: replacefstbyarc=X,V" )
@@ -146,12 +152,27 @@ inline void init_param_options ( int argc, const char* argv[],
     ( kHifstLocalpruneNumstates.c_str()
       , po::value<unsigned>()->default_value ( 10000000 )
       , "Maximum number of states threshold after cell pruning an FSA, If beneath the threshold, determinization/minimization is applied to pruned lattice. Also applicable in alignment mode when filtering against substring acceptor. Use a big value for HiFST and small value for HiPDT.")
+    ( kHifstLocalpruneMemorybudget.c_str()
+      , po::value<unsigned>()->default_value ( 0 )
+      , "Memory budget for the lattices of a sentence, in MB (0 for none): cell lattices, the expanded lattice and the lattice after applying the language model. Requires local pruning. Once half of it is used, every cell lattice is pruned, with beams tightening as the budget runs out; cell lattices that would not fit are pruned harder. Sentences that still do not fit are abandoned with an empty lattice." )
+    ( kHifstLocalpruneMemorybudgetWeight.c_str()
+      , po::value<float>()->default_value ( 9.0f )
+      , "Likelihood beam for cell pruning forced by the memory budget, when half of the budget is used" )
     ( kHifstLocalpruneConditions.c_str()
       , po::value<std::string>()->default_value ( "" )
       , "Local pruning conditions. These are sequences of 4-tuples separated by commas: category,span,number_of_states,weight. The three first are actual thresholds that trigger local pruning, whereas the weight is the likelihood beam for pruning, IF a language model has been applied." )
     ( kHifstPrune.c_str()
       , po::value<float>()->default_value ( std::numeric_limits<float>::max() )
       , "Likelihood beam to prune the translation lattice. Only applied IF a language model is available." )
+    ( kHifstPruneComposition.c_str()
+      , po::value<std::string>()->default_value ( "no" )
+      , "Prune while composing with the language model, using the same beams as --hifst.prune and local pruning conditions (yes|no). Not applied to pdts. Results are the same as composing and then pruning (after each language model), unless --hifst.prune.composition.numstates or --hifst.prune.composition.heuristic are changed" )
+    ( kHifstPruneCompositionNumstates.c_str()
+      , po::value<unsigned>()->default_value ( 0 )
+      , "Maximum number of states expanded per topological layer when pruning during composition (0 means no limit). Any limit may remove paths within the beam" )
+    ( kHifstPruneCompositionHeuristic.c_str()
+      , po::value<float>()->default_value ( 1.0 )
+      , "Scale applied to the future cost estimate (shortest distance to final states before language model, plus word penalties) when pruning during composition. Values other than 1 may remove paths within the beam" )
     ( kHifstWritertn.c_str()
       , po::value<std::string>()->default_value ( "")
       , "Write the rtn to disk -- long list of FSAs. Use %%rtn_label%% and ? to format file names appropriately, e.g. --hifst.writertn=rtn/?/%%rtn_label%%.fst" )
@@ -170,6 +191,9 @@ inline void init_param_options ( int argc, const char* argv[],
     ( kRecaserPrune.c_str()
       , po::value<std::string>()->default_value ( "byshortestpath,1" )
       , "Choose between byshortestpath,numpaths or byweight,weight" )
+    ( kRecaserLmCacheSize.c_str()
+      , po::value<unsigned>()->default_value ( 4 )
+      , "Memory (MB) for a score cache owned by each recasing task. 0 disables it" )
     ( kRecaserOutput.c_str()
       , po::value<std::string>()->default_value ("")
       , "Output true cased lattice" )
@@ -76,6 +76,9 @@ inline void init_param_options ( int argc, const char* argv[],
     ( HifstConstants::kLmbrPreprune.c_str(),
       po::value<float>()->default_value ( std::numeric_limits<float>::max() ),
       "Preprune evidence space" )
+    ( HifstConstants::kLmbrGridthreads.c_str(),
+      po::value<unsigned>()->default_value ( 1 ),
+      "Number of threads decoding the alpha values of each sentence at once (trimmed to number of cpus in the machine)" )
     ;
     ucam::util::parseOptionsGeneric (desc, vm, argc, argv);
   } catch ( std::exception& e ) {
@@ -53,6 +53,9 @@ class CYKParserTask : public ucam::util::TaskInterface<Data> {
   ///Pointer to a data structure.
   Data *d_;
 
+  ///Categories of each element of the rule being examined.
+  std::vector<unsigned> rulecats_;
+
  public:
 
   /**
@@ -98,6 +101,8 @@ class CYKParserTask : public ucam::util::TaskInterface<Data> {
     std::vector<std::string> aux;
     boost::algorithm::split ( aux, d.sentence,
                               boost::algorithm::is_any_of ( " " ) );
+    cykdata_.cykgrid.resize ( nnt, aux.size() );
+    cykdata_.bp.resize ( nnt, aux.size() );
     for ( unsigned k = 0; k < aux.size(); ++k ) {
       sentence.push_back ( ucam::util::toNumber<unsigned> ( aux[k] ) );
       if ( categories.find ( aux[k] ) == categories.end() ) {
@@ -156,51 +161,61 @@ class CYKParserTask : public ucam::util::TaskInterface<Data> {
    * \brief       Recursive function that determines if a rule candidate is valid or not.
    * \param       unsigned x:    Position of the grid through the horizontal axis.
    * \param       unsigned ymax: maximum height (vertical axis) that can be examined for x.
-   * \param       unsigned rule_idx: index of the rule we are examining.
    * \param       unsigned rule_pos: index of the element within the rule we have to examine (think of it as an Earley dot)
-   * \param       vector<unsigned> coord: Coordinates required by that rule to backpoint. If empty, the rule is rejected.
+   * \param       vector<unsigned> coord: Coordinates required by that rule to backpoint, used as a stack.
    * \remarks     Recursive function that examines all the possible candidate rules beneath the triangle determined
    *              by a cell (x,ymax) and the string of words it spans. Every recursive call makes the triangle smaller, so ymax
    *              actually represents the diagonal of the triangle.
    *              The function will exit when a rule has been rejected/proved or the rightmost x of the original
-   *              span has been reached.
+   *              span has been reached. Categories of the rule elements are looked up beforehand (see setRuleCategories),
+   *              so only complete derivations are copied into the rule dependencies.
    */
 
-  void examineRule ( unsigned x, unsigned ymax, unsigned rule_idx,
-                     unsigned rule_pos, cykparser_rulebpcoordinates_t coord ) {
+  void examineRule ( unsigned x, unsigned ymax, unsigned rule_pos,
+                     cykparser_rulebpcoordinates_t& coord ) {
     cykparser_ruledependencies_t& rd = cykdata_.rd;
-    cykparser_rulebpcoordinates_t coord2;
-    SentenceSpecificGrammarData& ssgd = *d_->ssgd;
-    std::string cat =     ssgd.getRHSSource ( rule_idx, rule_pos );
-    getFilteredNonTerminal ( cat );
-    unsigned regla_tam = ssgd.getRHSSourceSize ( rule_idx );
-    int x2;
-    unsigned z = ( cykdata_.categories[cat] == 0 ) ? 0 : 1;
+    unsigned cc = rulecats_[rule_pos];
+    if ( !ymax ) return;
+    if ( rule_pos == rulecats_.size() - 1 ) { //last element of the rule
+      //Only valid in the diagonal, i.e. span is complete -- full span verified.
+      if ( cykdata_.cykgrid ( cc, x, ymax - 1 ).empty() ) return;
+      coord.push_back ( cc );
+      coord.push_back ( x );
+      coord.push_back ( ymax - 1 );
+      rd.push_back ( coord );
+      coord.resize ( coord.size() - 3 );
+      return;
+    }
+    if ( ymax < 2 ) return;
     for ( unsigned n = 0; n < ymax; n++ ) {
-      if ( cykdata_.cykgrid ( cykdata_.categories[cat], x, n ).size() > 0 ) {
-        coord2 = coord; //copy coord, we will need to reuse later.
-        coord2.push_back ( cykdata_.categories[cat] );
-        coord2.push_back ( x );
-        coord2.push_back ( n );
-        if ( rule_pos == regla_tam - 1 ) { //last element of the rule
-          if ( n == ymax -
-               1 ) { //We are in the diagonal, therefore span is complete -- full span verified.
-            rd.push_back ( coord2 );
-            //                    LDEBUG("span completely verified!, n="<<n<<",ymax="<<ymax);
-          } else {
-            //                    LDEBUG("span not verified, rule not valid, n="<<n<<",ymax="<<ymax);
-          }
-        } else {
-          if ( ymax > 1 ) {
-            x2 = n + x + 1; //next x.
-            //This element verified, now look next one.
-            examineRule ( x2, ymax - n - 1, rule_idx, rule_pos + 1, coord2 );
-          }
-        }
-      }
-      z = 0;
+      if ( cykdata_.cykgrid ( cc, x, n ).empty() ) continue;
+      coord.push_back ( cc );
+      coord.push_back ( x );
+      coord.push_back ( n );
+      //This element verified, now look next one.
+      examineRule ( n + x + 1, ymax - n - 1, rule_pos + 1, coord );
+      coord.resize ( coord.size() - 3 );
+    }
+  };
+
+  /**
+   * \brief       Looks up the categories of all the source elements of a rule into rulecats_.
+   *              Elements that are not categories of this sentence get 0 (an empty row of the grid).
+   * \param       cc: category of the first element.
+   * \param       idx: rule index.
+   */
+  void setRuleCategories ( unsigned cc, unsigned idx ) {
+    SentenceSpecificGrammarData& ssgd = *d_->ssgd;
+    const grammar_categories_t& categories = cykdata_.categories;
+    unsigned size = ssgd.getRHSSourceSize ( idx );
+    rulecats_.resize ( size );
+    rulecats_[0] = cc;
+    for ( unsigned k = 1; k < size; ++k ) {
+      std::string cat = ssgd.getRHSSource ( idx, k );
+      getFilteredNonTerminal ( cat );
+      grammar_categories_t::const_iterator itx = categories.find ( cat );
+      rulecats_[k] = ( itx == categories.end() ) ? 0 : itx->second;
     }
-    return;
   };
 
   /**
@@ -315,9 +330,9 @@ class CYKParserTask : public ucam::util::TaskInterface<Data> {
     cykparser_rulebpcoordinates_t coord;
     const GrammarData& gd = *d_->grammar;
     SentenceSpecificGrammarData& ssgd = *d_->ssgd;
-    ssgrammar_listofrules_t rules;
     for ( unsigned y = 1; y < sentence.size(); ++y ) {
       for ( unsigned x = 0; x < sentence.size() - y; ++x ) {
+        const ssgrammar_firstelementmap_t& firsts = ssgd.rulesWithRhsSpan2OrMore[x];
         for ( unsigned n = 0; n < y; n++ ) {
           //just an alias.
           unsigned& x1 = x;
@@ -325,12 +340,14 @@ class CYKParserTask : public ucam::util::TaskInterface<Data> {
           unsigned x2 = y1 + x1 + 1;
           for ( unsigned cc = 1; cc <= nnt + sentence.size();
                 ++cc ) { //Only in this case we have to make sure it exists.
-            std::string cat = vcat[cc];
             // prevent non terminals other than the top nonterminals (e.g. S) to have a span greater or equal to hrmaxheight
-            if ( cykdata_.cykgrid ( cc, x1, y1 ).size() == 0 ) continue;
+            if ( cykdata_.cykgrid ( cc, x1, y1 ).empty() ) continue;
+            const std::string& cat = vcat[cc];
+            ssgrammar_firstelementmap_t::const_iterator itr = firsts.find ( cat );
+            if ( itr == firsts.end() ) continue;
+            const ssgrammar_listofrules_t& rules = itr->second;
             //Keep caching at the same position for identical rules with different translations
             minicache.clear();
-            rules = ssgd.rulesWithRhsSpan2OrMore[x][cat];
             LDEBUG ( vcat[cc] << "," << x << "," << y << ":" << " Obtained " << ucam::util::toString (
                        rules.size() ) << " rules." );
             for ( unsigned i = 0; i < rules.size(); i++ ) {
@@ -376,7 +393,8 @@ class CYKParserTask : public ucam::util::TaskInterface<Data> {
                 coord.push_back ( cc );
                 coord.push_back ( x1 );
                 coord.push_back ( y1 );
-                examineRule ( x2 - 0, y - ( x2 - x1 - 1 ), idx, 1, coord );
+                setRuleCategories ( cc, idx );
+                examineRule ( x2, y - ( x2 - x1 - 1 ), 1, coord );
                 minicache[rhs] = rd; ///Memoization: keep track of this RHS
               }
               if ( rd.size() == 0 ) {
@@ -41,7 +41,7 @@ class DumpNbestFeaturesTask: public ucam::util::TaskInterface<Data> {
   ucam::util::WordMapper *wm_;
 
   ///Scales used with the sparse tuple weight
-  std::vector<float>& scales_;
+  std::vector<float> const& scales_;
 
   ///Key to access in registry object the
   const std::string sparseweightlatticekey_;
@@ -26,10 +26,14 @@
 namespace ucam {
 namespace hifst {
 
+/// Text grammars loaded with several threads are read in chunks of about this size, in bytes.
+const std::size_t kGrammarChunkBytes = 1 << 22;
+
 /**
  *\brief Task class that loads a grammar into memory.
  *
  * It provides methods to take as input a [file], and read the contents, sort and populate GrammarData.
+ * If the file is a compiled grammar (see CompiledGrammar), it is memory-mapped instead.
  * Optionally it can also store grammar-specific patterns.
  * \remark Inherits properties from TaskInterface and is templated over a data class, in which relevant data is stored.
  */
@@ -57,6 +61,69 @@ class GrammarTask: public ucam::util::TaskInterface<Data> {
   std::vector<float> grammarscales_;
   std::string ntorderfile_;
 
+  /// Number of threads parsing text grammars. With 1, rules are parsed and sorted as they are read.
+  unsigned loadthreads_;
+  /// Size of the chunks of rules parsed by each thread.
+  std::size_t loadchunkbytes_;
+  /// Timings of the last parallel load
+  ucam::fsttools::SpeedStatsData loadstats_;
+
+  /**
+   * \brief Consecutive rules of a text grammar, parsed and sorted by one thread.
+   * Positions and orders are relative to this chunk until it is appended to the grammar.
+   */
+  struct GrammarChunk {
+    std::vector<std::string> lines;
+    std::string text;
+    std::vector<posindex> vpos;
+    std::unordered_set<std::string> patterns;
+    std::unordered_set<std::string> identityrules;
+    std::unordered_set<std::string> lhs;
+    ucam::util::JobCounter pending;
+  };
+
+  struct ParseChunkFunctor {
+    GrammarTask *gt_;
+    GrammarChunk *c_;
+    ParseChunkFunctor ( GrammarTask *gt, GrammarChunk *c ) : gt_ ( gt ), c_ ( c ) {};
+    void operator() () {
+      gt_->parseChunk ( *c_ );
+      c_->pending.done();
+    };
+  };
+
+  /// Sorts positions in the same order as the priority queue, i.e. descending pattern order.
+  class PosIndexDescending {
+   private:
+    const char *s_;
+    PatternCompareTool *ct_;
+   public:
+    PosIndexDescending ( const char *s, PatternCompareTool *ct ) : s_ ( s ), ct_ ( ct ) {};
+    inline bool operator() ( const posindex& lhs, const posindex& rhs ) const {
+      return ct_->compare ( s_ + lhs.p, s_ + rhs.p ) > 0;
+    };
+  };
+
+  /// Orders sorted runs by their next position, so that the top run goes next. Ties go to the earliest run.
+  class RunHeadCompare {
+   private:
+    const char *s_;
+    PatternCompareTool *ct_;
+    const std::vector<posindex> *runs_;
+    const std::vector<std::size_t> *heads_;
+   public:
+    RunHeadCompare ( const char *s, PatternCompareTool *ct
+                     , const std::vector<posindex> *runs
+                     , const std::vector<std::size_t> *heads )
+      : s_ ( s ), ct_ ( ct ), runs_ ( runs ), heads_ ( heads ) {};
+    inline bool operator() ( unsigned a, unsigned b ) const {
+      int c = ct_->compare ( s_ + ( *runs_ ) [ ( *heads_ ) [a]].p
+                             , s_ + ( *runs_ ) [ ( *heads_ ) [b]].p );
+      if ( c ) return c < 0;
+      return a > b;
+    };
+  };
+
  public:
   /**
    *\brief Constructor
@@ -72,7 +139,10 @@ class GrammarTask: public ucam::util::TaskInterface<Data> {
     patternfile_ ( rg.get<std::string> ( HifstConstants::kGrammarStorepatterns ) ) ,
     ntorderfile_ (rg.get<std::string> ( HifstConstants::kGrammarStorentorder) ),
     grammarscales_ ( ucam::util::ParseParamString<float> ( rg.get<std::string>
-                     ( featureweightskey ) ) ) {
+                     ( featureweightskey ) ) ),
+    loadthreads_ ( rg.exists ( HifstConstants::kGrammarLoadthreads )
+                   ? rg.get<unsigned> ( HifstConstants::kGrammarLoadthreads ) : 1 ),
+    loadchunkbytes_ ( kGrammarChunkBytes ) {
     gd_.ct = &pct_;
     if (featureoffset ) {
       std::vector<float> aux (grammarscales_.size() - featureoffset);
@@ -89,14 +159,20 @@ class GrammarTask: public ucam::util::TaskInterface<Data> {
    *
    * \param grammarfilekey       Registry key accessing file name to load the grammar from.
    * \param patternfilekey       Registry key accessing  file name to dump the patterns.
+   * \param loadthreads          Number of threads parsing text grammars.
+   * \param loadchunkbytes       Size of the chunks parsed by each thread.
    */
 
   GrammarTask ( const std::string& grammarfilekey = HifstConstants::kGrammarLoad,
-                const std::string& patternfilekey = HifstConstants::kGrammarStorepatterns ) :
+                const std::string& patternfilekey = HifstConstants::kGrammarStorepatterns,
+                unsigned loadthreads = 1,
+                std::size_t loadchunkbytes = kGrammarChunkBytes ) :
     previous_ ( "" ),
     grammarfile_ ( grammarfilekey ),
     patternfile_ ( patternfilekey ) ,
-    grammarscales_ ( ucam::util::ParseParamString<float> ( "1" ) ) {
+    grammarscales_ ( ucam::util::ParseParamString<float> ( "1" ) ),
+    loadthreads_ ( loadthreads ),
+    loadchunkbytes_ ( loadchunkbytes ) {
   };
 
   /**
@@ -121,8 +197,17 @@ class GrammarTask: public ucam::util::TaskInterface<Data> {
       USER_CHECK ( ucam::util::fileExists ( thisgrammarfile ),
                    "This grammar does not exist" );
       d.stats->setTimeStart ( "load-grammar-patterns" );
-      load ( thisgrammarfile );
+      if ( CompiledGrammar::isCompiled ( thisgrammarfile ) )
+        loadCompiled ( thisgrammarfile );
+      else
+        load ( thisgrammarfile );
       d.stats->setTimeEnd ( "load-grammar-patterns" );
+      for ( unordered_map<std::string, std::vector<timeb> >::const_iterator itx =
+              loadstats_.time2.begin(); itx != loadstats_.time2.end(); ++itx ) {
+        d.stats->time1[itx->first].push_back ( loadstats_.time1[itx->first].back() );
+        d.stats->time2[itx->first].push_back ( itx->second.back() );
+      }
+      loadstats_ = ucam::fsttools::SpeedStatsData();
       std::string patternfile = patternfile_ ( d.sidx );
       if ( patternfile != "" ) {
         ucam::util::oszfstream o ( patternfile );
@@ -146,12 +231,20 @@ class GrammarTask: public ucam::util::TaskInterface<Data> {
    */
 
   inline void load ( const std::string& file ) {
-    load_init();
     LINFO ( "=> Loading..." << file );
-    ucam::util::readtextfile<GrammarTask> ( file, *this );
-    load_sort();
+    if ( loadthreads_ > 1 ) {
+      ucam::util::iszfstream iszf ( file );
+      load_parallel ( iszf );
+      iszf.close();
+    } else {
+      load_init();
+      ucam::util::readtextfile<GrammarTask> ( file, *this );
+      load_sort();
+    }
     LINFO ( "Done! ****" );
     generate_ntorder();
+    gd_.compileTargets();
+    gd_.indexSources();
   };
 
   /**
@@ -162,14 +255,138 @@ class GrammarTask: public ucam::util::TaskInterface<Data> {
    */
 
   inline void load ( std::stringstream& s ) {
-    load_init();
-    std::string myline;
-    while ( getline ( s, myline ) ) {
-      parse ( myline );
+    if ( loadthreads_ > 1 ) load_parallel ( s );
+    else {
+      load_init();
+      std::string myline;
+      while ( getline ( s, myline ) ) {
+        parse ( myline );
+      }
+      load_sort();
     }
-    load_sort();
     LINFO ( "Done!" );
     generate_ntorder();
+    gd_.compileTargets();
+    gd_.indexSources();
+  };
+
+  /**
+   *\brief Memory-maps a compiled grammar, see CompiledGrammar.
+   * Weights have already been collapsed with the scales used to compile the grammar,
+   * so these must match the current grammar feature weights.
+   * \param file Full pathname to the compiled grammar file.
+   * \return void
+   */
+
+  inline void loadCompiled ( const std::string& file ) {
+    LINFO ( "=> Mapping compiled grammar..." << file );
+    CompiledGrammar *cg = new CompiledGrammar ( file );
+    if ( cg->scales != grammarscales_ ) {
+      LERROR ( "Grammar " << file <<
+               " was compiled with different feature weights. Please recompile." );
+      exit ( EXIT_FAILURE );
+    }
+    gd_.setCompiled ( cg );
+    gd_.ct = &pct_;
+    LINFO ( gd_.sizeofvpos << " indices" );
+    set_ntorder ( cg->ntorder );
+    gd_.compileTargets();
+    gd_.indexSources();
+  };
+
+  /**
+   *\brief Writes the grammar currently loaded as a compiled grammar.
+   * Rules are written already sorted, with pre-computed weights, tokens and
+   * non-terminal mappings so that loadCompiled can simply map the file.
+   * \param file Full pathname to the output file.
+   * \return void
+   */
+
+  void writeCompiled ( const std::string& file ) {
+    using namespace ucam::util;
+    USER_CHECK ( gd_.compiled.get() == NULL,
+                 "Grammar is already compiled!" );
+    std::size_t numrules = gd_.sizeofvpos;
+    std::vector<CompiledRule> rules ( numrules );
+    std::vector<int> tokens;
+    std::vector<unsigned char> mappings;
+    std::vector<std::string> symbols;
+    unordered_map<std::string, int> symbolids;
+    for ( std::size_t idx = 0; idx < numrules; ++idx ) {
+      CompiledRule& r = rules[idx];
+      memset ( &r, 0, sizeof ( CompiledRule ) );
+      std::vector<std::string> source = gd_.getRHSSplitSource ( idx );
+      std::vector<std::string> translation = gd_.getRHSSplitTranslation ( idx );
+      USER_CHECK ( source.size() <= std::numeric_limits<uint16_t>::max()
+                   && translation.size() <= std::numeric_limits<uint16_t>::max()
+                   , "Rule too long to be compiled" );
+      r.srcbegin = tokens.size();
+      r.srcsize = source.size();
+      for ( unsigned k = 0; k < source.size(); ++k )
+        tokens.push_back ( compileElement ( source[k], symbols, symbolids ) );
+      r.trgbegin = tokens.size();
+      r.trgsize = translation.size();
+      for ( unsigned k = 0; k < translation.size(); ++k )
+        tokens.push_back ( compileElement ( translation[k], symbols, symbolids ) );
+      r.weight = gd_.getWeight ( idx );
+      r.isphrase = gd_.isPhrase ( idx );
+      r.mapbegin = mappings.size();
+      if ( !r.isphrase ) {
+        unordered_map<uint, uint> m;
+        gd_.getMappings ( idx, &m );
+        r.numnt = m.size();
+        for ( uint k = 0; k < m.size(); ++k ) mappings.push_back ( m[k] );
+      }
+    }
+    std::ostringstream meta;
+    writeList ( meta, symbols );
+    writeList ( meta, std::vector<std::string> ( gd_.patterns.begin(),
+                gd_.patterns.end() ) );
+    std::string ntorder;
+    for ( uint k = 0; k < gd_.vcat.size(); ++k )
+      ntorder += ( k ? "," : "" ) + gd_.vcat[k + 1];
+    writeList ( meta, std::vector<std::string> ( 1, ntorder ) );
+    std::vector<std::string> scales;
+    for ( uint k = 0; k < grammarscales_.size(); ++k ) {
+      std::ostringstream aux;  // enough digits to recover the same float
+      aux << std::setprecision ( std::numeric_limits<float>::digits10 + 3 )
+          << grammarscales_[k];
+      scales.push_back ( aux.str() );
+    }
+    writeList ( meta, scales );
+    std::string metastr = meta.str();
+    CompiledGrammarHeader h;
+    memset ( &h, 0, sizeof ( CompiledGrammarHeader ) );
+    memcpy ( h.magic, kCompiledGrammarMagic, 8 );
+    h.version = kCompiledGrammarVersion;
+    h.sizeofposindex = sizeof ( posindex );
+    h.numrules = numrules;
+    h.posoffset = alignCompiledGrammarOffset ( sizeof ( CompiledGrammarHeader ) );
+    h.ruleoffset = alignCompiledGrammarOffset ( h.posoffset + numrules * sizeof (
+                     posindex ) );
+    h.tokenoffset = alignCompiledGrammarOffset ( h.ruleoffset + numrules * sizeof (
+                      CompiledRule ) );
+    h.numtokens = tokens.size();
+    h.mappingoffset = alignCompiledGrammarOffset ( h.tokenoffset + tokens.size() *
+                      sizeof ( int ) );
+    h.nummappings = mappings.size();
+    h.metaoffset = alignCompiledGrammarOffset ( h.mappingoffset + mappings.size() );
+    h.metasize = metastr.size();
+    h.textoffset = alignCompiledGrammarOffset ( h.metaoffset + metastr.size() );
+    h.textsize = gd_.filecontents.size() + 1;
+    std::ofstream o ( file.c_str(), std::ios::out | std::ios::binary );
+    USER_CHECK ( o.is_open(), "Could not open file to write compiled grammar" );
+    writeSection ( o, &h, sizeof ( CompiledGrammarHeader ), 0 );
+    writeSection ( o, gd_.vpos, numrules * sizeof ( posindex ), h.posoffset );
+    writeSection ( o, rules.data(), numrules * sizeof ( CompiledRule ),
+                   h.ruleoffset );
+    writeSection ( o, tokens.data(), tokens.size() * sizeof ( int ), h.tokenoffset );
+    writeSection ( o, mappings.data(), mappings.size(), h.mappingoffset );
+    writeSection ( o, metastr.c_str(), metastr.size(), h.metaoffset );
+    writeSection ( o, gd_.filecontents.c_str(), h.textsize, h.textoffset );
+    o.close();
+    FORCELINFO ( "Compiled grammar written to " << file << ": " << numrules <<
+                 " rules, " << tokens.size() << " tokens, " << symbols.size() << " symbols" );
   };
 
   virtual ~GrammarTask() {};
@@ -183,6 +400,14 @@ class GrammarTask: public ucam::util::TaskInterface<Data> {
   void generate_ntorder() {
     std::string ntorder;
     nth_ ( ntorder );
+    set_ntorder ( ntorder );
+  }
+
+  /**
+   * \brief Sets categories from an ordered list of non-terminals
+   * \param ntorder Comma-separated list of non-terminals
+   */
+  void set_ntorder ( const std::string& ntorder ) {
     LINFO ( "ntorder=" << ntorder );
     std::vector<std::string> aux;
     boost::algorithm::split ( aux, ntorder, boost::algorithm::is_any_of ( " ," ) );
@@ -229,6 +454,36 @@ class GrammarTask: public ucam::util::TaskInterface<Data> {
       LDEBUG2 ( gd_.getRule ( newidx - 1 ) << " at " << gd_.vpos[newidx - 1].order );
     }
     delete vpq_;
+    gd_.contents = gd_.filecontents.c_str();
+  };
+
+  /// Word ids are stored as they are, anything else goes to the symbol table.
+  static int compileElement ( const std::string& element
+                              , std::vector<std::string>& symbols
+                              , unordered_map<std::string, int>& symbolids ) {
+    if ( element != "" && element.size() < 10
+         && element.find_first_not_of ( "0123456789" ) == std::string::npos
+         && ( element == "0" || element[0] != '0' ) )
+      return ucam::util::toNumber<int> ( element );
+    unordered_map<std::string, int>::iterator itx = symbolids.find ( element );
+    if ( itx != symbolids.end() ) return itx->second;
+    int token = compiledSymbolToken ( symbols.size() );
+    symbols.push_back ( element );
+    symbolids[element] = token;
+    return token;
+  };
+
+  static void writeList ( std::ostream& o, const std::vector<std::string>& list ) {
+    uint64_t n = list.size();
+    o.write ( reinterpret_cast<const char *> ( &n ), sizeof ( uint64_t ) );
+    for ( unsigned k = 0; k < list.size(); ++k )
+      o.write ( list[k].c_str(), list[k].size() + 1 );
+  };
+
+  static void writeSection ( std::ofstream& o, const void *data,
+                             std::size_t size, uint64_t offset ) {
+    while ( ( uint64_t ) o.tellp() < offset ) o.put ( 0 );
+    o.write ( reinterpret_cast<const char *> ( data ), size );
   };
 
   /**
@@ -238,11 +493,43 @@ class GrammarTask: public ucam::util::TaskInterface<Data> {
    */
 
   __always_inline void parse ( std::string& line ) {
+    posindex pi;
+    std::string pattern;
+    if ( !scoreRule ( line, pi, pattern ) ) return;
+    LDEBUG("Adding line=[" << line  << "]");
+    gd_.filecontents += line + '\n';
+    pi.p = pos_ + pi.o;
+    if ( gd_.patterns.find ( pattern ) == gd_.patterns.end() ) {
+      gd_.patterns.insert ( pattern );
+    }
+    pi.order = vpq_->size();
+    vpq_->push ( pi );
+    pos_ += line.size() + 1;
+    LDEBUG2 ( "reading rule " << line << ", at line " << pi.order << ", pattern=" <<
+              pattern );
+    if ( pattern == "X" ) {
+      LINFO ( "Identity rule detected:" << line << "===" );
+      nth_.insertIdentityRule ( line );
+    } else {
+      nth_.insertLHS ( line.substr ( 0, pi.o - 1 ) );
+    }
+  };
+
+  /**
+   *\brief Collapses the features of a rule with the grammar scales and finds the pattern of its source side.
+   * Only reads grammar scales, so it can be used by several threads at once.
+   * \param line     Rule to parse. On completion, the rule as stored in the grammar.
+   * \param pi       On completion, pi.o holds the offset of the source side.
+   * \param pattern  On completion, pattern of the source side, e.g. wXw.
+   * \return false if the line is empty.
+   */
+  __always_inline bool scoreRule ( std::string& line, posindex& pi,
+                                   std::string& pattern ) const {
     using namespace std;
     using namespace ucam::util;
 
     boost::algorithm::trim ( line );
-    if ( line == "" ) return;
+    if ( line == "" ) return false;
     size_t pos1 = line.find_first_of ( " " ); // src
     size_t pos2 = line.find_first_of ( " ", pos1 + 1 ); // trg
     size_t pos3 = line.find_first_of ( " ", pos2 + 1 ); // weight
@@ -264,11 +551,6 @@ class GrammarTask: public ucam::util::TaskInterface<Data> {
         ? line.substr ( 0, pos3 + 1 ) + sweight + line.substr(pos4)
         : line.substr ( 0, pos3 + 1 ) + sweight;
 
-
-    LDEBUG("Adding line=[" << line  << "]");
-    gd_.filecontents += line + '\n';
-    posindex pi;
-    bool waitingfornextfield = false;
     unsigned cf = 2; //Second field
     char previous = ' ';
     for ( unsigned k = 0; k < line.size(); ++k ) {
@@ -279,8 +561,7 @@ class GrammarTask: public ucam::util::TaskInterface<Data> {
       }
       previous = line[k];
     }
-    pi.p = pos_ + pi.o;
-    string pattern;
+    pattern.clear();
     bool word = false;
     bool nt = false;
     for ( unsigned k = pi.o; k < line.size(); ++k ) {
@@ -302,20 +583,142 @@ class GrammarTask: public ucam::util::TaskInterface<Data> {
         nt = word = false;
       }
     }
-    if ( gd_.patterns.find ( pattern ) == gd_.patterns.end() ) {
-      gd_.patterns.insert ( pattern );
+    return true;
+  };
+
+  /**
+   *\brief Loads a text grammar with several threads.
+   * Chunks of rules are parsed, scored and sorted concurrently, then appended
+   * to the grammar in file order. At most two chunks per thread are in flight, so on top of
+   * the grammar itself memory only grows with the index, as with the priority queue.
+   * Finally, sorted runs are merged into the index. Rules with the same source side
+   * keep the order of the grammar file. Timings of both phases are kept in loadstats_.
+   * \param in stream with rules.
+   */
+  template<class StreamT>
+  void load_parallel ( StreamT& in ) {
+    loadstats_ = ucam::fsttools::SpeedStatsData();
+    loadstats_.setTimeStart ( "load-grammar-parse" );
+    pos_ = 0;
+    gd_.reset();
+    gd_.ct = &pct_;
+    std::vector<posindex> runs;
+    std::vector<std::size_t> runbegin;
+    {
+      ucam::util::TrivialThreadPool tp ( loadthreads_ );
+      std::deque<GrammarChunk *> inflight;
+      std::string line;
+      bool more = true;
+      while ( more ) {
+        GrammarChunk *c = new GrammarChunk;
+        std::size_t bytes = 0;
+        while ( bytes < loadchunkbytes_ ) {
+          if ( !getline ( in, line ) ) {
+            more = false;
+            break;
+          }
+          bytes += line.size() + 1;
+          c->lines.push_back ( line );
+        }
+        if ( c->lines.empty() ) {
+          delete c;
+          break;
+        }
+        c->pending.add();
+        tp ( ParseChunkFunctor ( this, c ) );
+        inflight.push_back ( c );
+        while ( inflight.size() >= 2 * loadthreads_ ) {
+          appendChunk ( inflight.front(), runs, runbegin );
+          inflight.pop_front();
+        }
+      }
+      while ( !inflight.empty() ) {
+        appendChunk ( inflight.front(), runs, runbegin );
+        inflight.pop_front();
+      }
     }
-    pi.order = vpq_->size();
-    vpq_->push ( pi );
-    pos_ += line.size() + 1;
-    LDEBUG2 ( "reading rule " << line << ", at line " << pi.order << ", pattern=" <<
-              pattern );
-    if ( pattern == "X" ) {
-      LINFO ( "Identity rule detected:" << line << "===" );
-      nth_.insertIdentityRule ( line );
-    } else {
-      nth_.insertLHS ( line.substr ( 0, pi.o - 1 ) );
+    loadstats_.setTimeEnd ( "load-grammar-parse" );
+    loadstats_.setTimeStart ( "load-grammar-merge" );
+    mergeRuns ( runs, runbegin );
+    loadstats_.setTimeEnd ( "load-grammar-merge" );
+    std::ostringstream o;
+    loadstats_.write ( o );
+    LINFO ( "Grammar loaded with " << loadthreads_ << " threads, "
+            << runbegin.size() << " sorted runs. Times (ms):\n" << o.str() );
+  };
+
+  /// Parses and sorts the rules of a chunk. Called by worker threads.
+  void parseChunk ( GrammarChunk& c ) const {
+    PatternCompareTool ct;
+    std::string pattern;
+    for ( std::size_t k = 0; k < c.lines.size(); ++k ) {
+      std::string& line = c.lines[k];
+      posindex pi;
+      if ( !scoreRule ( line, pi, pattern ) ) continue;
+      pi.p = c.text.size() + pi.o;
+      pi.order = c.vpos.size();
+      c.text += line + '\n';
+      c.vpos.push_back ( pi );
+      c.patterns.insert ( pattern );
+      if ( pattern == "X" ) c.identityrules.insert ( line );
+      else c.lhs.insert ( line.substr ( 0, pi.o - 1 ) );
+    }
+    std::vector<std::string>().swap ( c.lines );
+    std::stable_sort ( c.vpos.begin(), c.vpos.end(),
+                       PosIndexDescending ( c.text.c_str(), &ct ) );
+  };
+
+  /// Waits for a chunk to be parsed and appends it to the grammar as a new sorted run.
+  void appendChunk ( GrammarChunk *c, std::vector<posindex>& runs,
+                     std::vector<std::size_t>& runbegin ) {
+    c->pending.wait();
+    if ( !c->vpos.empty() ) {
+      std::size_t order = runs.size();
+      runbegin.push_back ( runs.size() );
+      for ( std::size_t k = 0; k < c->vpos.size(); ++k ) {
+        posindex pi = c->vpos[k];
+        pi.p += pos_;
+        pi.order += order;
+        runs.push_back ( pi );
+      }
+    }
+    gd_.filecontents += c->text;
+    pos_ += c->text.size();
+    gd_.patterns.insert ( c->patterns.begin(), c->patterns.end() );
+    for ( std::unordered_set<std::string>::const_iterator itx =
+            c->identityrules.begin(); itx != c->identityrules.end(); ++itx ) {
+      LINFO ( "Identity rule detected:" << *itx << "===" );
+      nth_.insertIdentityRule ( *itx );
+    }
+    for ( std::unordered_set<std::string>::const_iterator itx = c->lhs.begin();
+          itx != c->lhs.end(); ++itx )
+      nth_.insertLHS ( *itx );
+    delete c;
+  };
+
+  /// Merges sorted runs into the grammar index, as load_sort would have sorted them.
+  void mergeRuns ( std::vector<posindex>& runs,
+                   const std::vector<std::size_t>& runbegin ) {
+    gd_.sizeofvpos = runs.size();
+    gd_.vpos = new posindex[gd_.sizeofvpos];
+    LINFO ( gd_.sizeofvpos << " indices" );
+    std::vector<std::size_t> heads ( runbegin );
+    std::vector<std::size_t> ends ( runbegin.begin() + ( runbegin.empty() ? 0 : 1 ),
+                                    runbegin.end() );
+    ends.push_back ( runs.size() );
+    const char *s = gd_.filecontents.c_str();
+    std::priority_queue<unsigned, std::vector<unsigned>, RunHeadCompare> q (
+      RunHeadCompare ( s, &pct_, &runs, &heads ) );
+    for ( unsigned k = 0; k < heads.size(); ++k ) q.push ( k );
+    std::size_t newidx = 0;
+    while ( !q.empty() ) {
+      unsigned k = q.top();
+      q.pop();
+      gd_.vpos[newidx++] = runs[heads[k]++];
+      if ( heads[k] < ends[k] ) q.push ( k );
     }
+    std::vector<posindex>().swap ( runs );
+    gd_.contents = s;
   };
 
   ///Friendship with readtextfile function.
@@ -118,12 +118,26 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
   /// checks whether it qualifies or not for local pruning
   LocalPruningConditions lpc_;
 
+  /// Memory budget for the cell lattices of the sentence, tightens local pruning
+  LocalPruningBudget budget_;
+  /// Number of times local pruning has been forced or tightened by the budget
+  unsigned budgetcount_;
+  /// The sentence does not fit in the memory budget: it yields an empty lattice
+  bool overbudget_;
+
   /// Defines a weight in the appropriate semiring (Lex, Std , or TupleArc)
   MakeWeightHifst<Arc> mw_;
 
   /// Likelihood weight
   float pruneweight_;
 
+  /// Prune during composition with the language model
+  bool prunecomposition_;
+  /// Maximum number of states per layer when pruning during composition
+  unsigned prunecompositionnumstates_;
+  /// Scale of the future cost estimate when pruning during composition
+  float prunecompositionheuristic_;
+
   //where to store rtn files
   ucam::util::IntegerPatternAddress rtnfiles_;
 
@@ -143,6 +157,13 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
   //If false, no determinization/minimization will be applied anywhere to any of the components of the RTN, expanded or not.
   bool optimize_;
   const ucam::util::RegistryPO& rg_;
+
+  ///Number of threads building cells of one sentence
+  unsigned cellthreads_;
+  ///Threadpool building cells, only if cellthreads_ > 1
+  boost::scoped_ptr<ucam::util::TrivialThreadPool> cellpool_;
+  ///Openfst (<1.5) reference counting is not thread-safe: guards copies of lower cell lattices
+  boost::mutex fstmutex_;
   //  const int localLmPos_;
   enum AlignmentType {RULES, AFFILIATION};
   AlignmentType at_;
@@ -178,19 +199,31 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
                                ( HifstConstants::kHifstReplacefstbyarcNumstates ) ),
       localprune_ ( rg.getBool ( HifstConstants::kHifstLocalpruneEnable ) ),
       pruneweight_ ( rg.get<float> ( HifstConstants::kHifstPrune ) ),
+      prunecomposition_ ( rg.getBool ( HifstConstants::kHifstPruneComposition ) ),
+      prunecompositionnumstates_ ( rg.get<unsigned>
+                                   ( HifstConstants::kHifstPruneCompositionNumstates ) ),
+      prunecompositionheuristic_ ( rg.get<float>
+                                   ( HifstConstants::kHifstPruneCompositionHeuristic ) ),
       numstatesthreshold_ ( rg.get<unsigned>
                             ( HifstConstants::kHifstLocalpruneNumstates ) ),
       lpctuples_ ( rg.getVectorString (
                        HifstConstants::kHifstLocalpruneConditions ) ),
+      budget_ ( ( std::size_t ) rg.get<unsigned>
+                ( HifstConstants::kHifstLocalpruneMemorybudget ) << 20
+                , rg.get<float> ( HifstConstants::kHifstLocalpruneMemorybudgetWeight ) ),
+      budgetcount_ ( 0 ),
+      overbudget_ ( false ),
       mw_(rg),
       at_(RULES),
-      rg_(rg)
+      rg_(rg),
+      cellthreads_ ( rg.get<unsigned> ( HifstConstants::kHifstCellthreads ) )
       //      localLmPos_(rg.getVectorString(HifstConstants::kLmFeatureweights).size() + 1 + 1)
   {
 
     LINFO ("Number of local language models=" << numlocallm_);
     LINFO ("aligner mode=" << aligner_);
     LINFO ("localprune mode=" << localprune_);
+    LINFO ("prune during composition=" << prunecomposition_);
     LINFO("reference filtering with: " << rg_.get<std::string> (HifstConstants::kReferencefilterLoad));
     USER_CHECK ( ! ( lpc_.size() % 4 ),
                  "local pruning conditions are defined by tuples of 4 elements: category,x,y,Number-of-states. Category is a string and x,y are int. Number of states is unsigned" );
@@ -199,7 +232,10 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
                  || (!localprune_) ,
                  "If you want to do cell pruning in translation, you should  normally use a language model for local pruning. Check --hifst.localprune.lm.load and --hifst.localprune.enable.\n");
     optimize.setAlignMode (aligner_);
-
+    USER_CHECK ( !budget_.enabled() || localprune_,
+                 "A memory budget requires local pruning. Check --hifst.localprune.memorybudget and --hifst.localprune.enable." );
+    if ( budget_.enabled() )
+      LINFO ( "Memory budget for lattices=" << ( budget_.budget() >> 20 ) << "MB" );
 
 
     if (hipdtmode_) {
@@ -208,6 +244,10 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
     if (!rtnopt_) {
       LINFO ("RTN openfst optimizations will not be applied");
     }
+    if ( cellthreads_ > 1 ) {
+      LINFO ( "Building cells with " << cellthreads_ << " threads" );
+      cellpool_.reset ( new ucam::util::TrivialThreadPool ( cellthreads_ ) );
+    }
 
     if (rg.get<std::string>(HifstConstants::kHifstAlilatsmodeLinks) == "affiliation") {
       at_ = AFFILIATION;
@@ -250,11 +290,17 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
     rfba_ = new ReplaceFstByArcT ( cykdata_->vcat, replacefstbyarc_,
                                    replacefstbyarcexceptions_, aligner_, replacefstbynumstates_ );
     piscount_ = 0; //reset pruning-in-search count to 0
+    budget_.clear();
+    budgetcount_ = 0;
+    overbudget_ = false;
     LINFO ( "Second Pass: FST-building!" );
     d.stats->setTimeStart ( "lattice-construction" );
     //Owned by rtn_;
-    fst::Fst<Arc> *sfst = buildRTN ( cykdata_->categories["S"], 0,
-                                     cykdata_->sentence.size() - 1 ).ptr_;
+    unsigned scc = cykdata_->categories["S"];
+    unsigned sy = cykdata_->sentence.size() - 1;
+    fst::Fst<Arc> *sfst = ( cellpool_.get() != NULL
+                            ? buildRTNByLevels ( scc, 0, sy )
+                            : buildRTN ( scc, 0, sy ) ).ptr_;
     d.stats->setTimeEnd ( "lattice-construction" );
     cykfstresult_ = (*sfst);
     LINFO ( "Final - RTN head optimizations !" );
@@ -264,6 +310,11 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
              );
     FORCELINFO ("Stats for Sentence " << d.sidx <<
                 ": local pruning, number of times=" << piscount_);
+    if ( localprune_ && budget_.enabled() )
+      FORCELINFO ( "Stats for Sentence " << d.sidx <<
+                   ": memory budget, interventions=" << budgetcount_
+                   << ", cell lattices=" << budget_.used() << " bytes"
+                   << ( overbudget_ ? ", exceeded" : "" ) );
     d.stats->lpcount = piscount_; //store local pruning counts in stats
     LINFO ("RTN expansion starts now!");
     //Expand...
@@ -299,7 +350,10 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
       //After optimizations, we can write RTN if required by user
       writeRTN();
       boost::scoped_ptr< fst::VectorFst<Arc> > efst (new fst::VectorFst<Arc>);
-      if (!hipdtmode_ ) {
+      if ( overbudget_ ) {
+        LERROR ( "Sentence " << d.sidx << ": cell lattices do not fit in the memory budget."
+                 << " Abandoning translation" );
+      } else if (!hipdtmode_ ) {
         LINFO ("Final Replace (RTN->FSA), main index=" << hieroindex);
         d_->stats->setTimeStart ("replace-rtn-final");
         Replace (pairlabelfsts_, &*efst, hieroindex, !aligner_);
@@ -311,6 +365,7 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
         d_->stats->setTimeEnd ("replace-pdt-final");
         LINFO ("Number of pdtparens=" << pdtparens_.size() );
       }
+      chargeMemoryBudget ( &*efst, "expanded lattice" );
       LDBG_EXECUTE ( efst->Write ( "fsts/FINAL-e.fst" ) );
       // Currently no need to call this applyFilters: it will do the same
       // and it is more efficient to compose with the normal lattice
@@ -340,10 +395,15 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
       //Apply language model
       fst::VectorFst<Arc> *res = NULL;
       if (efst->NumStates() )
-        res = applyLanguageModel ( *efst  );
+        res = applyLanguageModel ( *efst, pruneweight_ );
       else {
         LWARN ("Empty lattice -- skipping LM application");
       }
+      if ( res != NULL && !chargeMemoryBudget ( res, "lattice with language model" ) ) {
+        delete res;
+        res = NULL;
+        efst->DeleteStates();
+      }
       if ( res != NULL ) {
         boost::shared_ptr<fst::VectorFst<Arc> >latlm ( res );
         if ( latlm.get() == efst.get() ) {
@@ -489,19 +549,151 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
     FSAPlusInfo fpi( ( *rtn_ ) ( cc, x, y ), cc, x, y);
     //    fst::Fst<Arc> *ptr = ( *rtn_ ) ( cc, x, y );
     if ( fpi.ptr_ != NULL ) return fpi;
+    boost::shared_ptr< fst::VectorFst<Arc> >  mdfst ( buildCell ( cc, x, y ) );
+    return addCell ( cc, x, y, mdfst );
+  };
+
+  ///A cell scheduled by buildRTNByLevels
+  struct CellJob {
+    unsigned cc_;
+    unsigned x_;
+    unsigned y_;
+    Label hieroindex_;
+    ///Positions of the cells it depends on
+    std::vector<unsigned> deps_;
+    boost::shared_ptr< fst::VectorFst<Arc> > fst_;
+    CellJob ( unsigned cc, unsigned x, unsigned y, Label hieroindex )
+      : cc_ ( cc )
+      , x_ ( x )
+      , y_ ( y )
+      , hieroindex_ ( hieroindex ) {
+    };
+  };
+
+  ///Builds a cell in the threadpool
+  struct CellFunctor {
+    HiFSTTask *hifst_;
+    CellJob *cell_;
+    ucam::util::JobCounter *jc_;
+    CellFunctor ( HiFSTTask *hifst, CellJob *cell, ucam::util::JobCounter *jc )
+      : hifst_ ( hifst )
+      , cell_ ( cell )
+      , jc_ ( jc ) {
+    };
+    void operator() () {
+      cell_->fst_.reset ( hifst_->buildCell ( cell_->cc_, cell_->x_, cell_->y_ ) );
+      jc_->done();
+    };
+  };
+
+  ///Sorts rtn components by the position of their cells in the recursive traversal
+  struct CompareByTraversal {
+    unordered_map<Label, unsigned> const *order_;
+    explicit CompareByTraversal ( unordered_map<Label, unsigned> const *order )
+      : order_ ( order ) {
+    };
+    bool operator() ( std::pair< Label, const fst::Fst<Arc> * > const& a
+                      , std::pair< Label, const fst::Fst<Arc> * > const& b ) const {
+      return order_->find ( a.first )->second < order_->find ( b.first )->second;
+    };
+  };
+
+  /**
+   * \brief Builds the same rtn as buildRTN, using the threadpool.
+   * Cells reachable from cc,x,y are built in rounds: all the cells whose dependencies
+   * are already in the rtn are independent, so they are built concurrently (buildCell).
+   * Then, one by one, they go through local pruning and are added to the rtn (addCell).
+   * With a memory budget, local pruning depends on the cells added before, so cells
+   * are only added in the order buildRTN would add them (post-order). Cells built out
+   * of order wait for the following rounds, which limits concurrency.
+   */
+  FSAPlusInfo buildRTNByLevels ( unsigned cc, unsigned x, unsigned y ) {
+    std::vector<CellJob> cells;
+    unordered_map<Label, unsigned> order;
+    scheduleCell ( cc, x, y, order, cells );
+    bool inorder = localprune_ && budget_.enabled();
+    std::vector<bool> built ( cells.size(), false ), added ( cells.size(), false );
+    //First cell not added yet, in post-order
+    std::size_t next = 0;
+    unsigned rounds = 0;
+    while ( next < cells.size() ) {
+      std::vector<CellJob *> ready;
+      for ( std::size_t k = next; k < cells.size(); ++k ) {
+        if ( built[k] ) continue;
+        bool independent = true;
+        for ( unsigned j = 0; j < cells[k].deps_.size() && independent; ++j )
+          independent = added[cells[k].deps_[j]];
+        if ( !independent ) continue;
+        ready.push_back ( &cells[k] );
+        built[k] = true;
+      }
+      ++rounds;
+      ucam::util::JobCounter jc;
+      jc.add ( ready.size() );
+      for ( unsigned k = 0; k < ready.size(); ++k )
+        ( *cellpool_ ) ( CellFunctor ( this, ready[k], &jc ) );
+      jc.wait();
+      for ( std::size_t k = inorder ? next : 0; k < cells.size(); ++k ) {
+        if ( added[k] || !built[k] ) {
+          if ( inorder ) break;
+          continue;
+        }
+        addCell ( cells[k].cc_, cells[k].x_, cells[k].y_, cells[k].fst_ );
+        cells[k].fst_.reset();
+        added[k] = true;
+      }
+      while ( next < cells.size() && added[next] ) ++next;
+    }
+    LINFO ( "Built " << cells.size() << " cells in " << rounds << " rounds" );
+    std::stable_sort ( pairlabelfsts_.begin(), pairlabelfsts_.end()
+                       , CompareByTraversal ( &order ) );
+    return FSAPlusInfo ( ( *rtn_ ) ( cc, x, y ), cc, x, y );
+  };
+
+  /**
+   * \brief Finds all cells required to build cc,x,y and what they depend on.
+   * \param order: positions of cells visited so far, indexed by hieroindex.
+   * \param cells: cells visited so far, in post-order.
+   * \returns position of cc,x,y
+   */
+  unsigned scheduleCell ( unsigned cc, unsigned x, unsigned y
+                          , unordered_map<Label, unsigned>& order
+                          , std::vector<CellJob>& cells ) {
+    Label hieroindex = APBASETAG + cc * APCCTAG + x * APXTAG + y * APYTAG;
+    typename unordered_map<Label, unsigned>::const_iterator itx = order.find (
+          hieroindex );
+    if ( itx != order.end() ) return itx->second;
+    SentenceSpecificGrammarData& g = *d_->ssgd;
+    const CYKbpCell mybp = cykdata_->bp ( cc, x, y );
+    std::vector<unsigned> deps;
+    for ( unsigned i = 0; i < mybp.size(); i++ ) {
+      if ( g.isPhrase ( cykdata_->cykgrid ( cc, x, y, i ) ) ) continue;
+      for ( unsigned j = 0; j < mybp[i].size(); j += 3 ) {
+        if ( mybp[i][j] > cykdata_->nnt ) continue;
+        deps.push_back ( scheduleCell ( mybp[i][j], mybp[i][j + 1], mybp[i][j + 2]
+                                        , order, cells ) );
+      }
+    }
+    order[hieroindex] = cells.size();
+    cells.push_back ( CellJob ( cc, x, y, hieroindex ) );
+    cells.back().deps_.swap ( deps );
+    return cells.size() - 1;
+  };
+
+  /**
+   * \brief Builds the union of all the rules of a cell, and optimizes it.
+   * Lower cells are obtained with buildRTN.
+   * \remarks If lower cells have been built already, it does not modify the state
+   * of this object, so it is safe to call it concurrently for independent cells.
+   */
+  fst::VectorFst<Arc> *buildCell ( unsigned int cc, unsigned int x, unsigned int y ) {
 #ifdef PRINTDEBUG
     std::ostringstream o;
     o << cc << "." << x << "." << y;
 #endif
     unsigned& nnt = cykdata_->nnt;
-    grammar_inversecategories_t& vcat = cykdata_->vcat;
-    std::stringstream ostr;
-    ostr << vcat[cc] << "." << x << "." << y;
-    std::string filename;
-    ostr >> filename;
     SentenceSpecificGrammarData& g = *d_->ssgd;
     MultiUnionT mur;
-    Label hieroindex = APBASETAG + cc * APCCTAG + x * APXTAG + y * APYTAG;
     LDEBUG ( "bp> " << cc << "," << x << "," << y << ":" <<
              ( unsigned ) cykdata_->bp ( cc, x, y ).size() );
     for ( unsigned i = 0; i < cykdata_->bp ( cc, x, y ).size(); i++ ) {
@@ -514,7 +706,7 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
                  ":adding phrase-based rule index " << idx );
         continue;
       }
-      const cykparser_ruledependencies_t& mybp = cykdata_->bp ( cc, x, y );
+      const CYKbpCell mybp = cykdata_->bp ( cc, x, y );
       for ( unsigned j = 0; j < mybp[i].size(); j += 3 ) {
         if ( mybp[i][j] > nnt ) {
           continue;
@@ -529,20 +721,38 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
                idx );
       mur.Add ( addRule ( idx, requiredfsts , x + 1) );
     }
-    boost::shared_ptr< fst::VectorFst<Arc> >  mdfst ( mur() );
+    fst::VectorFst<Arc> *mdfst = mur();
     LDBG_EXECUTE ( mdfst->Write ( "fsts/" + o.str() + ".fst" ) );
     //Optimize
-    optimize ( &*mdfst ,
+    optimize ( mdfst ,
                std::numeric_limits<unsigned>::max(),
                optimize_ );
     LDEBUG ( "AT " << cc << "," << x << "," << y << ": FST built!" );
     LDBG_EXECUTE ( mdfst->Write ( "fsts/" + o.str() + "redm.fst" ) );
+    return mdfst;
+  };
+
+  /**
+   * \brief Applies local pruning to the fst of a cell if conditions apply, and adds it to the rtn.
+   * \retval      Pointer to the Fst stored for this cell.
+   */
+  FSAPlusInfo addCell ( unsigned int cc, unsigned int x, unsigned int y
+                        , boost::shared_ptr< fst::VectorFst<Arc> > mdfst ) {
+#ifdef PRINTDEBUG
+    std::ostringstream o;
+    o << cc << "." << x << "." << y;
+#endif
+    grammar_inversecategories_t& vcat = cykdata_->vcat;
+    Label hieroindex = APBASETAG + cc * APCCTAG + x * APXTAG + y * APYTAG;
     d_->stats->numstates[ cc * 1000000 + y * 1000 + x  ] =
       mdfst->NumStates();  //Just store the number of states of the not-expanded FSA.
     //Calculate expanded number of states of the partial rtn.
     if ( localprune_ )
       rtnnumstates_->update ( cc, x, y, &*mdfst );
-    boost::scoped_ptr< fst::VectorFst<Arc> > pruned ( localPruning ( *mdfst, cc, x, y ) );
+    float weight = budget_.weight();
+    boost::scoped_ptr< fst::VectorFst<Arc> > pruned;
+    if ( qualifiesForLocalPruning ( cc, x, y, weight ) )
+      pruned.reset ( localPruning ( *mdfst, cc, x, y, weight ) );
     //We now might have a pruned lattice!
     if ( pruned.get() != NULL ) {
       LDBG_EXECUTE ( pruned->Write ( "fsts/" + o.str() + "redmp.fst" ) );
@@ -559,6 +769,7 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
     } else {
       LDEBUG ( "AT " << cc << "," << x << "," << y << ":No pruning" );
     }
+    fitMemoryBudget ( *mdfst, cc, x, y, weight );
     boost::shared_ptr< fst::VectorFst<Arc> > outfst ( ( *rfba_ ) ( *mdfst,
         hieroindex ) );
     if ( outfst.get() != NULL ) {
@@ -591,33 +802,10 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
                                  std::vector<FSAPlusInfo>& lowerfsts 
                                  , unsigned offset ) {
     SentenceSpecificGrammarData& gd = *d_->ssgd;
-    std::vector<std::string> translation = gd.getRHSSplitTranslation ( rule_idx );
+    std::vector<int> buffer;
+    RuleTarget translation = gd.getRuleTarget ( rule_idx, buffer );
     if ( !translation.size() ) {
       LERROR ( gd.getRule ( rule_idx ) );
-      translation.push_back ( 0 );
-    }
-    for (unsigned k = 0; k < translation.size(); ++k) {
-      if ( translation[k] == "<s>" ) {
-        translation[k] = "1";
-      } else if ( translation[k] == "</s>" ) translation[k] = "2";
-      else if ( translation[k] == "<dr>" ) {
-        std::stringstream dr;
-        dr << DR;
-        translation[k] = dr.str();
-        LDEBUG ( "Deletion rule: " << gd.getRule ( rule_idx ) << "," <<
-                 translation[k] );
-      } else if ( translation[k] == "<oov>" ) {
-        std::stringstream oov;
-        oov << OOV;
-        translation[k] = oov.str();
-        LDEBUG ( "oov rule: " << gd.getRule ( rule_idx ) << "," << translation[k] );
-      } else if ( translation[k] == "<sep>" ) {
-        std::stringstream sep;
-        sep << SEP;
-        translation[k] = sep.str();
-        LDEBUG ( "separator rule: " << gd.getRule ( rule_idx ) << "," <<
-                 translation[k] );
-      }
     }
     LDEBUG ( "Starting to build!" );
     fst::VectorFst<Arc> *rulefst = new fst::VectorFst<Arc>;
@@ -641,8 +829,8 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
     }
     for ( unsigned k = 0; k < kmax; ++k ) {
       //if non-terminal... just place special arc and expand later...
-      Label ow;
-      bool isnonterminal = !isTerminal ( translation[k] );
+      Label ow = translation[k];
+      bool isnonterminal = ( ow == kRuleTargetNonTerminal );
       if ( isnonterminal) {
         ow = APRULETAG + nonterminal;
         USER_CHECK ( lowerfsts.size() > nonterminal,
@@ -651,9 +839,6 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
         pairlabelfsts.push_back ( std::pair< Label, const fst::Fst<Arc> * >
                                   ( ow, lowerfsts[nonterminal++].ptr_ ) );
 
-      } else {
-        std::istringstream buffer ( translation[k] );
-        buffer >> ow;
       }
       rulefst->AddState();
       Label iw;
@@ -679,7 +864,7 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
       pairlabelfsts.push_back ( std::pair< Label, const fst::Fst<Arc> * >
                                 ( APRULETAG + nonterminal, rulefst ) );
       fst::VectorFst<Arc> *aux = new fst::VectorFst<Arc>;
-      Replace (pairlabelfsts, aux, APRULETAG + nonterminal, !aligner_);
+      replaceRule ( pairlabelfsts, aux, APRULETAG + nonterminal );
       delete rulefst;
       rulefst = aux;
     }
@@ -687,6 +872,31 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
     return rulefst;
   }
 
+  /**
+   * \brief Replace for rules with non-terminals. Lower cell lattices may be
+   * shared with cells built concurrently, so if there is a threadpool, they are
+   * copied and released under a lock. Expansion itself runs unlocked.
+   */
+  inline void replaceRule ( std::vector< std::pair< Label, const fst::Fst<Arc> * > >&
+                            pairlabelfsts
+                            , fst::VectorFst<Arc> *ofst
+                            , Label root ) {
+    if ( cellpool_.get() == NULL ) {
+      Replace ( pairlabelfsts, ofst, root, !aligner_ );
+      return;
+    }
+    fst::ReplaceFstOptions<Arc> opts ( root, !aligner_ );
+    opts.gc_limit = 0;
+    boost::scoped_ptr< fst::ReplaceFst<Arc> > rfst;
+    {
+      boost::lock_guard<boost::mutex> lock ( fstmutex_ );
+      rfst.reset ( new fst::ReplaceFst<Arc> ( pairlabelfsts, opts ) );
+    }
+    *ofst = *rfst;
+    boost::lock_guard<boost::mutex> lock ( fstmutex_ );
+    rfst.reset();
+  };
+
   //Note that local conditions can be sentence-specific
   void initLocalConditions() {
     if ( !localprune_ ) return;
@@ -749,6 +959,9 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
   typedef boost::shared_ptr<ApplyLanguageModelOnTheFlyInterfaceType> ApplyLanguageModelOnTheFlyInterfacePtrType;
   std::vector<ApplyLanguageModelOnTheFlyInterfacePtrType> almotfLocal_;
   std::vector<ApplyLanguageModelOnTheFlyInterfacePtrType> almotf_;
+  /// Ids of the models used by each set of handlers
+  std::vector<uint64_t> almotfLocalIds_;
+  std::vector<uint64_t> almotfIds_;
 
   // Prepares language model application handlers for each kenlm type.
   // i.e. an array of templated instances of ApplyLanguageModelOnTheFly
@@ -757,11 +970,16 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
   template< template<class> class MakeWeightT>
   void initializeLanguageModelHandlers(const std::string& lmkey
 				       , MakeWeightT<Arc> &mw
-				       , std::vector<ApplyLanguageModelOnTheFlyInterfacePtrType> &almotf) {
-    if (almotf.size()) {
+				       , std::vector<ApplyLanguageModelOnTheFlyInterfacePtrType> &almotf
+				       , std::vector<uint64_t> &ids) {
+    // Handlers are rebuilt if models have changed (sentence-specific language models)
+    std::vector<uint64_t> current = fsttools::languageModelIds ( d_->klm[lmkey] );
+    if (almotf.size() && ids == current) {
       LINFO("Skipping!");
       return; // already done
     }
+    ids = current;
+    almotf.clear();
     almotf.resize(d_->klm[lmkey].size());
     std::unordered_set<Label> epsilons;
     for ( unsigned k = 0; k < d_->klm[lmkey].size(); ++k ) {
@@ -781,6 +999,7 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
                                                    , const std::string& lmkey
                                                    , MakeWeightT<Arc> &mw
 						   , std::vector<ApplyLanguageModelOnTheFlyInterfacePtrType> &almo
+                                                   , float beam
                                                    ) {
     if ( d_->klm.find ( lmkey ) == d_->klm.end() ) {
       if (!warned_) {
@@ -807,8 +1026,15 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
       epsilons.insert (pdtparens_[j].second);
     }
 
+    // Pruning during composition does not handle pdt parentheses.
+    // With several models, each composition is pruned as soon as it is done
+    bool prune = prunecomposition_ && ( !hipdtmode_ || pdtparens_.empty() );
     for ( unsigned k = 0; k < d_->klm[lmkey].size(); ++k ) {
       LINFO ( "Composing with " << k << "-th language model" );
+      if ( prune )
+        almo[k]->setPruning ( beam, prunecompositionnumstates_, prunecompositionheuristic_ );
+      else
+        almo[k]->setPruning ( std::numeric_limits<float>::max(), 0, 1.0f );
       d_->stats->setTimeStart ( "on-the-fly-composition "
                                 +  ucam::util::toString ( k ) );
       fst::VectorFst<Arc> *aux = almo[k]->run(*output, epsilons);
@@ -819,6 +1045,10 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
       delete output; output = aux;
       d_->stats->setTimeEnd ( "on-the-fly-composition "
                               + ucam::util::toString ( k ) );
+      if ( d_->klm[lmkey][k]->cache.get() != NULL )
+        d_->stats->setLmCacheStats ( lmkey + " " + ucam::util::toString ( k )
+                                     , d_->klm[lmkey][k]->cache->hits()
+                                     , d_->klm[lmkey][k]->cache->misses() );
       LDEBUG ( "After applying language model, NS=" <<  output->NumStates() );
     }
     LINFO ( "Connect!" );
@@ -830,21 +1060,23 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
   /**
    * \brief Applies the language model (Full translation lattice!). Currently applies on-the-fly the language model using kenlm.
    * \param localfst: lattice to score with the language model.
+   * \param beam: likelihood beam used if pruning during composition.
    */
   inline fst::VectorFst<Arc> *applyLanguageModel ( const fst::Fst<Arc>& localfst
+                                                   , float beam
                                                    , bool local = false ) {
     if ( local ) {
       MakeWeightHifstLocalLm<Arc> mw(rg_);
-      initializeLanguageModelHandlers(locallmkey_, mw, almotfLocal_);
+      initializeLanguageModelHandlers(locallmkey_, mw, almotfLocal_, almotfLocalIds_);
       if (!almotfLocal_.size()) return NULL;
       LINFO ( "Composing with local lm for inadmissible pruning (unless on top cell)" );
-      return applyLanguageModel (localfst, locallmkey_, mw, almotfLocal_);
+      return applyLanguageModel (localfst, locallmkey_, mw, almotfLocal_, beam);
     } else {
       fst::MakeWeight<Arc> mw;
-      initializeLanguageModelHandlers(lmkey_, mw, almotf_);
+      initializeLanguageModelHandlers(lmkey_, mw, almotf_, almotfIds_);
       if (!almotf_.size()) return NULL;
       LINFO ( "Composing with full lm for admissible pruning" );
-      return applyLanguageModel (localfst, lmkey_, mw, almotf_);
+      return applyLanguageModel (localfst, lmkey_, mw, almotf_, beam);
     }
   };
 
@@ -876,74 +1108,149 @@ class HiFSTTask: public ucam::util::TaskInterface<Data> {
   }
 
   /**
-   * \remarks     Performs local pruning. It depends on the category (cc), the span (y+1) and number of states of the expanded fst.
-   *              If it qualifies for local pruning, then compose fst with grammar, prune and remove grammar.
+   * \brief Checks whether a cell lattice qualifies for local pruning. It depends on the category (cc),
+   * the span (y+1) and number of states of the expanded fst, and on the memory used so far by the sentence.
+   * \param       weight: pruning weight, if it qualifies.
+   */
+  bool qualifiesForLocalPruning ( unsigned cc, unsigned x, unsigned y
+                                  , float& weight ) {
+    if ( !localprune_ ) return false;
+    LDEBUG ( "AT " << cc << "," << x << "," << y <<
+             ": Testing conditions; expected lattice size=" <<  ( *rtnnumstates_ ) ( cc, x,
+                 y ) );
+    bool qualifies = lpc_ ( cc, y + 1, ( *rtnnumstates_ ) ( cc, x, y ), weight );
+    float staticweight = weight;
+    if ( !budget_ ( qualifies, weight ) ) {
+      LINFO ( "AT " << cc << "," << x << "," << y <<
+              ": Does not qualify for local pruning. " );
+      return false;
+    }
+    if ( !qualifies || weight != staticweight ) {
+      ++budgetcount_;
+      LINFO ( "AT " << cc << "," << x << "," << y << ": memory budget, "
+              << budget_.used() << " of " << budget_.budget()
+              << " bytes used. Pruning with weight=" << weight );
+    }
+    return true;
+  };
+
+  /**
+   * \brief Prunes the cell lattice harder until it fits in the memory budget, halving the weight each time.
+   * The cell lattice is then accounted for in the budget.
+   * If it still does not fit after pruning with weight 0, i.e. keeping only the best paths,
+   * the sentence is abandoned: this and later cell lattices are emptied.
+   */
+  void fitMemoryBudget ( fst::VectorFst<Arc>& mdfst, unsigned cc, unsigned x
+                         , unsigned y, float weight ) {
+    if ( !localprune_ || !budget_.enabled() ) return;
+    if ( overbudget_ ) {
+      mdfst.DeleteStates();
+      return;
+    }
+    std::size_t bytes = latticeBytes ( mdfst );
+    while ( !budget_.fits ( bytes ) && weight > 0 ) {
+      weight = weight > 0.1f ? weight / 2 : 0;
+      ++budgetcount_;
+      LINFO ( "AT " << cc << "," << x << "," << y << ": memory budget, cell lattice of "
+              << bytes << " bytes does not fit (" << budget_.used() << " of "
+              << budget_.budget() << " bytes used). Pruning with weight=" << weight );
+      boost::scoped_ptr< fst::VectorFst<Arc> > pruned ( localPruning ( mdfst, cc, x, y
+          , weight ) );
+      optimize (&*pruned , numstatesthreshold_ , !hipdtmode_  && optimize_ );
+      mdfst = *pruned;
+      rtnnumstates_->update ( cc, x, y, &mdfst );
+      d_->stats->numprunedstates[ cc * 1000000 + y * 1000 + x ]
+        = ( *rtnnumstates_ ) (cc, x, y );
+      bytes = latticeBytes ( mdfst );
+    }
+    if ( !budget_.fits ( bytes ) ) {
+      LERROR ( "AT " << cc << "," << x << "," << y << ": cell lattice of " << bytes
+               << " bytes exceeds the memory budget" );
+      overbudget_ = true;
+      mdfst.DeleteStates();
+      return;
+    }
+    budget_.add ( bytes );
+  };
+
+  /**
+   * \brief Accounts for a lattice of the whole sentence in the memory budget.
+   * If it does not fit, the lattice is emptied and the sentence abandoned.
+   * \returns false if the lattice did not fit.
+   */
+  bool chargeMemoryBudget ( fst::VectorFst<Arc> *fst, std::string const& what ) {
+    if ( !localprune_ || !budget_.enabled() || overbudget_ ) return !overbudget_;
+    std::size_t bytes = latticeBytes ( *fst );
+    if ( !budget_.fits ( bytes ) ) {
+      LERROR ( "Sentence " << d_->sidx << ": " << what << " of " << bytes
+               << " bytes does not fit in the memory budget (" << budget_.used() << " of "
+               << budget_.budget() << " bytes used). Abandoning translation" );
+      overbudget_ = true;
+      fst->DeleteStates();
+      return false;
+    }
+    budget_.add ( bytes );
+    return true;
+  };
+
+  /**
+   * \remarks     Performs local pruning on a cell lattice that qualifies for it:
+   *              compose fst with grammar, prune and remove grammar.
    *              Finally, lattice is reduced with standard fst operations.
    * \param       localfst: fst to be pruned.
    * \param       cc: category axis of the grid.
    * \param       x: horizontal axis of the grid
    * \param       y: vertical axis of the grid
-   * \param       numstates: Estimated number of states of the expanded RTN.
-   * \retval      Pointer to the pruned fst, or NULL.
+   * \param       weight: likelihood beam
+   * \retval      Pointer to the pruned fst.
    */
 
   fst::VectorFst<Arc> *localPruning ( const fst::VectorFst<Arc>& fst, unsigned cc,
-                                      unsigned x, unsigned y ) {
+                                      unsigned x, unsigned y, float weight ) {
 #ifdef PRINTDEBUG
     std::ostringstream o;
     o << cc << "." << x << "." << y;
 #endif
-    if ( !localprune_ ) return NULL;
-    float weight;
-    unsigned referenceminstates;
-    LDEBUG ( "AT " << cc << "," << x << "," << y <<
-             ": Testing conditions; expected lattice size=" <<  ( *rtnnumstates_ ) ( cc, x,
-                 y ) );
-    if ( lpc_ ( cc, y + 1, ( *rtnnumstates_ ) ( cc, x, y ), weight ) ) {
-      LINFO ( "AT " << cc << "," << x << "," << y <<
-              ": Qualifies for local pruning. Making it so!" );
-      LDEBUG ( "AT " << cc << "," << x << "," << y << ": expanding RTN/RmEpsilon" );
-      fst::VectorFst<Arc> *efst = expand ( fst, cc, x, y );
-      fst::RmEpsilon<Arc> ( efst );
-      LINFO ( "AT " << cc << "," << x << "," << y << ": NS=" << efst->NumStates() );
-      ++piscount_;
-      LINFO("Apply filtering");
-      applyFilters ( efst );
-      LINFO ( "Apply LM" );
-      fst::VectorFst<Arc> * latlm = applyLanguageModel ( *efst , true );
-
-      if ( latlm != NULL ) {
-        delete efst;
-        //\todo Include union with shortest path...
-        if (!hipdtmode_ || pdtparens_.empty() ) {
-          LINFO ( "Prune with weight=" << weight );
-          fst::Prune<Arc> ( latlm, mw_ ( weight ) );
-        } else {
-          LINFO ( "PDT expanding with weight=" << weight );
-          fst::PdtExpandOptions<Arc> eopts (true, false, mw_ ( weight ) );
-          fst::VectorFst<Arc> latlmaux;
-          Expand ( *latlm, pdtparens_, &latlmaux, eopts);
-          *latlm = latlmaux;
-          pdtparens_.clear();
-        }
-        LINFO ( "Delete LM scores" );
-        //Deletes LM scores if using lexstdarc or tuplearc
-        //        fst::MakeWeight2<Arc> mwcopy;
-        MakeWeightHifstLocalLm<Arc > mwcopy(rg_);
-        fst::Map<Arc> ( latlm,
-                        fst::GenericWeightAutoMapper<Arc, MakeWeightHifstLocalLm<Arc> > ( mwcopy ) );
-        LINFO ( "AT " << cc << "," << x << "," << y << ": pruned with weight=" << weight
-                << ",NS=" << latlm->NumStates() );
-        return latlm;
+    LINFO ( "AT " << cc << "," << x << "," << y <<
+            ": Qualifies for local pruning. Making it so!" );
+    LDEBUG ( "AT " << cc << "," << x << "," << y << ": expanding RTN/RmEpsilon" );
+    fst::VectorFst<Arc> *efst = expand ( fst, cc, x, y );
+    fst::RmEpsilon<Arc> ( efst );
+    LINFO ( "AT " << cc << "," << x << "," << y << ": NS=" << efst->NumStates() );
+    ++piscount_;
+    LINFO("Apply filtering");
+    applyFilters ( efst );
+    LINFO ( "Apply LM" );
+    fst::VectorFst<Arc> * latlm = applyLanguageModel ( *efst , weight, true );
+
+    if ( latlm != NULL ) {
+      delete efst;
+      //\todo Include union with shortest path...
+      if (!hipdtmode_ || pdtparens_.empty() ) {
+        LINFO ( "Prune with weight=" << weight );
+        fst::Prune<Arc> ( latlm, mw_ ( weight ) );
+      } else {
+        LINFO ( "PDT expanding with weight=" << weight );
+        fst::PdtExpandOptions<Arc> eopts (true, false, mw_ ( weight ) );
+        fst::VectorFst<Arc> latlmaux;
+        Expand ( *latlm, pdtparens_, &latlmaux, eopts);
+        *latlm = latlmaux;
+        pdtparens_.clear();
       }
-      LINFO ( "AT " << cc << "," << x << "," << y <<
-              "Local LM not applied, filtered with " << d_->filters.size() <<
-              " filter(s) ,NS=" << efst->NumStates() );
-      return efst;
+      LINFO ( "Delete LM scores" );
+      //Deletes LM scores if using lexstdarc or tuplearc
+      //        fst::MakeWeight2<Arc> mwcopy;
+      MakeWeightHifstLocalLm<Arc > mwcopy(rg_);
+      fst::Map<Arc> ( latlm,
+                      fst::GenericWeightAutoMapper<Arc, MakeWeightHifstLocalLm<Arc> > ( mwcopy ) );
+      LINFO ( "AT " << cc << "," << x << "," << y << ": pruned with weight=" << weight
+              << ",NS=" << latlm->NumStates() );
+      return latlm;
     }
     LINFO ( "AT " << cc << "," << x << "," << y <<
-            ": Does not qualify for local pruning. " );
-    return NULL;
+            "Local LM not applied, filtered with " << d_->filters.size() <<
+            " filter(s) ,NS=" << efst->NumStates() );
+    return efst;
   };
 
   ZDISALLOW_COPY_AND_ASSIGN ( HiFSTTask );
@@ -114,6 +114,89 @@ class LocalPruningConditions {
 
 };
 
+///Approximate memory overhead of a state in a VectorFst, besides its arcs.
+const std::size_t kLatticeStateBytes = 48;
+
+///Approximate memory used by a lattice.
+template<class Arc>
+inline std::size_t latticeBytes ( const fst::VectorFst<Arc>& fst ) {
+  std::size_t numarcs = 0;
+  for ( fst::StateIterator< fst::VectorFst<Arc> > si ( fst ); !si.Done(); si.Next() )
+    numarcs += fst.NumArcs ( si.Value() );
+  return fst.NumStates() * kLatticeStateBytes + numarcs * sizeof ( Arc );
+};
+
+/**
+ * \brief Keeps track of the memory used by the cell lattices of a sentence against a budget.
+ * Once a fraction (threshold) of the budget is used, every cell lattice qualifies for local pruning,
+ * and beams get tighter as the budget runs out: from weight at the threshold down to 0 at the budget.
+ * Static conditions still apply if they prune harder.
+ */
+class LocalPruningBudget {
+ private:
+  ///Budget in bytes. 0 means no budget.
+  std::size_t budget_;
+  ///Beam when pruning is first forced
+  float weight_;
+  ///Fraction of the budget from which every cell lattice is pruned
+  float threshold_;
+  std::size_t used_;
+
+ public:
+  LocalPruningBudget ( std::size_t budget = 0, float weight = 0.0f
+                       , float threshold = 0.5f )
+    : budget_ ( budget )
+    , weight_ ( weight )
+    , threshold_ ( threshold )
+    , used_ ( 0 ) {
+  };
+
+  inline bool enabled() const {
+    return budget_ > 0;
+  };
+
+  ///Forgets all lattices, e.g. for a new sentence.
+  inline void clear() {
+    used_ = 0;
+  };
+
+  ///Accounts for a lattice kept until the end of the sentence.
+  inline void add ( std::size_t bytes ) {
+    used_ += bytes;
+  };
+
+  inline bool fits ( std::size_t bytes ) const {
+    return !budget_ || used_ + bytes <= budget_;
+  };
+
+  inline std::size_t used() const {
+    return used_;
+  };
+
+  inline std::size_t budget() const {
+    return budget_;
+  };
+
+  inline float weight() const {
+    return weight_;
+  };
+
+  /**
+   * \brief Adjusts the decision of static conditions to the memory used so far.
+   * \param qualifies  Whether static conditions apply
+   * \param w          Beam of static conditions if they apply. Replaced by the tightened beam if smaller.
+   * \returns true if the cell lattice should be pruned.
+   */
+  bool operator() ( bool qualifies, float& w ) const {
+    if ( !budget_ ) return qualifies;
+    float usage = ( float ) used_ / budget_;
+    if ( usage < threshold_ ) return qualifies;
+    float tight = weight_ * std::max ( 0.0f, ( 1.0f - usage ) / ( 1.0f - threshold_ ) );
+    if ( !qualifies || tight < w ) w = tight;
+    return true;
+  };
+};
+
 }
 } // end namespaces
 
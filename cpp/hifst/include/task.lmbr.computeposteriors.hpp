@@ -25,6 +25,116 @@
 namespace ucam {
 namespace lmbr {
 
+/**
+ * \brief Forward pass over an acyclic lattice accumulating, for each label, the mass of all paths
+ * with at least one arc with that label. Masses of each state are kept in a flat vector sorted by label,
+ * built through a dense scratch array indexed by label, and released once all arcs leaving the state have been visited.
+ * Contributions are added in the same order as a forward traversal of the arcs would, so results
+ * are the same as with any other container.
+ * \param fst        Topologically sorted lattice.
+ * \param finalmass  On completion, pairs of label and mass over all paths to final states, sorted by label.
+ */
+template<class Arc>
+void forwardLabelPosteriors ( const fst::VectorFst<Arc>& fst
+                              , std::vector<std::pair<typename Arc::Label, typename Arc::Weight> >& finalmass ) {
+  typedef typename Arc::StateId StateId;
+  typedef typename Arc::Label Label;
+  typedef typename Arc::Weight Weight;
+  typedef std::pair<Label, Weight> LabelWeight;
+  struct InArc {
+    StateId source;
+    Label label;
+    Weight weight;
+  };
+  finalmass.clear();
+  if ( fst.Start() == fst::kNoStateId ) return;
+  StateId numstates = fst.NumStates();
+  // Incoming arcs of each state, in the order a forward traversal visits them
+  std::vector<std::size_t> inbegin ( numstates + 1, 0 );
+  std::vector<std::size_t> pendingout ( numstates, 0 );
+  Label maxlabel = 0;
+  for ( StateId q = 0; q < numstates; ++q ) {
+    for ( fst::ArcIterator< fst::VectorFst<Arc> > ai ( fst, q ); !ai.Done();
+          ai.Next() ) {
+      ++inbegin[ai.Value().nextstate + 1];
+      if ( ai.Value().ilabel > maxlabel ) maxlabel = ai.Value().ilabel;
+    }
+    pendingout[q] = fst.NumArcs ( q );
+  }
+  for ( StateId q = 0; q < numstates; ++q ) inbegin[q + 1] += inbegin[q];
+  std::vector<InArc> in ( inbegin[numstates] );
+  {
+    std::vector<std::size_t> next ( inbegin.begin(), inbegin.end() - 1 );
+    for ( StateId q = 0; q < numstates; ++q ) {
+      for ( fst::ArcIterator< fst::VectorFst<Arc> > ai ( fst, q ); !ai.Done();
+            ai.Next() ) {
+        const Arc& a = ai.Value();
+        InArc& x = in[next[a.nextstate]++];
+        x.source = q;
+        x.label = a.ilabel;
+        x.weight = a.weight;
+      }
+    }
+  }
+  std::vector<Weight> alpha ( numstates, Weight::Zero() );
+  alpha[fst.Start()] = Weight::One();
+  std::vector<std::vector<LabelWeight> > mass ( numstates );
+  std::vector<Weight> acc ( maxlabel + 1, Weight::Zero() );
+  std::vector<char> used ( maxlabel + 1, 0 );
+  std::vector<Label> touched;
+  std::vector<Weight> accfinal ( maxlabel + 1, Weight::Zero() );
+  std::vector<char> usedfinal ( maxlabel + 1, 0 );
+  std::vector<Label> touchedfinal;
+  for ( StateId s = 0; s < numstates; ++s ) {
+    for ( std::size_t k = inbegin[s]; k < inbegin[s + 1]; ++k ) {
+      const InArc& a = in[k];
+      Weight w = Times ( alpha[a.source], a.weight );
+      alpha[s] = Plus ( alpha[s], w );
+      if ( !used[a.label] ) {
+        used[a.label] = 1;
+        touched.push_back ( a.label );
+      }
+      acc[a.label] = Plus ( acc[a.label], w );
+      const std::vector<LabelWeight>& sm = mass[a.source];
+      for ( typename std::vector<LabelWeight>::const_iterator it = sm.begin();
+            it != sm.end(); ++it ) {
+        if ( it->first == a.label ) continue;
+        if ( !used[it->first] ) {
+          used[it->first] = 1;
+          touched.push_back ( it->first );
+        }
+        acc[it->first] = Plus ( acc[it->first], Times ( it->second, a.weight ) );
+      }
+      if ( !--pendingout[a.source] ) std::vector<LabelWeight>().swap ( mass[a.source] );
+    }
+    std::sort ( touched.begin(), touched.end() );
+    std::vector<LabelWeight>& m = mass[s];
+    m.reserve ( touched.size() );
+    for ( std::size_t k = 0; k < touched.size(); ++k ) {
+      m.push_back ( LabelWeight ( touched[k], acc[touched[k]] ) );
+      acc[touched[k]] = Weight::Zero();
+      used[touched[k]] = 0;
+    }
+    touched.clear();
+    Weight f = fst.Final ( s );
+    if ( f != Weight::Zero() ) {
+      for ( typename std::vector<LabelWeight>::const_iterator it = m.begin();
+            it != m.end(); ++it ) {
+        if ( !usedfinal[it->first] ) {
+          usedfinal[it->first] = 1;
+          touchedfinal.push_back ( it->first );
+        }
+        accfinal[it->first] = Plus ( accfinal[it->first], Times ( it->second, f ) );
+      }
+    }
+    if ( !pendingout[s] ) std::vector<LabelWeight>().swap ( m );
+  }
+  std::sort ( touchedfinal.begin(), touchedfinal.end() );
+  finalmass.reserve ( touchedfinal.size() );
+  for ( std::size_t k = 0; k < touchedfinal.size(); ++k )
+    finalmass.push_back ( LabelWeight ( touchedfinal[k], accfinal[touchedfinal[k]] ) );
+};
+
 //Functor that computes posteriors over an evidence space
 class ComputePosteriors {
   //Private variables
@@ -119,12 +229,14 @@ class ComputePosteriors {
   void fastComputePosteriors (const fst::VectorFst<fst::StdArc>* fstlat) {
     LINFO ("computing posteriors: fast mode (vector-based)" );
     fst::VectorFst<fst::StdArc>* fsttmp = ConvertToPosteriors (fstlat);
+    fst::VectorFst<fst::LogArc>* fstlog = StdToLog (fsttmp);
+    delete fsttmp;
     initializeStateMap();
     initializePosteriorsTable();
     for (uint n = minorder_; n <= maxorder_; ++n) {
-      FastComputePosteriorsVectorForward (fsttmp, n);
+      FastComputePosteriorsVectorForward (fstlog, n);
     }
-    delete fsttmp;
+    delete fstlog;
   }
 
   ///Initialize state hash
@@ -145,7 +257,7 @@ class ComputePosteriors {
   }
 
   ///Wrapper around posterior computing forward method
-  void FastComputePosteriorsVectorForward (const fst::VectorFst<fst::StdArc>*
+  void FastComputePosteriorsVectorForward (const fst::VectorFst<fst::LogArc>*
       fstlat, const uint n) {
     LINFO ("fast compute posteriors: order=" << n );
     //  NGramVector ngs(1, 0);
@@ -157,68 +269,24 @@ class ComputePosteriors {
     if (ngs.size() == 1) {
       return;
     }
-    fst::LogArc::Label kSpecialLabel = ngs.size();
-    fst::VectorFst<fst::LogArc>* fsttmp1 = StdToLog (fstlat);
     LINFO ("map lattice to order " << n );
-    fst::VectorFst<fst::LogArc>* fsttmp2 = MapToHigherOrderLattice (fsttmp1, ngs,
+    fst::VectorFst<fst::LogArc>* fsttmp2 = MapToHigherOrderLattice (fstlat, ngs,
                                            n);
-    delete fsttmp1;
     LINFO ("Number of states=" << fsttmp2->NumStates() );
     ForwardComputePosteriors (fsttmp2, ngs);
     delete fsttmp2;
   }
 
   ///Key method to posterior computing. Lattice is traversed in a forward procedure and ngram list is updated with path log weights. Once you reach final states you have calculated the posterior weight.
-  ///Note that ngrams of higher orders than 1 have been encoded as unigrams.
+  ///Note that ngrams of higher orders than 1 have been encoded as unigrams, so labels index ngs.
   void ForwardComputePosteriors (fst::VectorFst<fst::LogArc>* fst,
                                  const NGramVector& ngs) {
-    typedef std::map<fst::LogArc::Label, fst::LogArc::Weight> LabelToWeightMapper;
-    std::vector<fst::LogArc::Weight> fwdAlpha;
-    std::vector<LabelToWeightMapper> ngmAlpha;
-    LabelToWeightMapper ngmAlphaFinal;
+    std::vector<std::pair<fst::LogArc::Label, fst::LogArc::Weight> > finalmass;
     TopSort (fst);
-    ngmAlpha.resize (fst->NumStates() );
-    fwdAlpha.resize (fst->NumStates(), fst::LogArc::Weight::Zero() );
-    fwdAlpha[fst->Start()] = fst::LogArc::Weight::One();
-    for (fst::StateIterator< fst::VectorFst<fst::LogArc> > si (*fst); !si.Done();
-         si.Next() ) {
-      fst::LogArc::StateId q = si.Value();
-      for (fst::ArcIterator< fst::VectorFst<fst::LogArc> > ai (*fst, q); !ai.Done();
-           ai.Next() ) {
-        fst::LogArc a = ai.Value();
-        fwdAlpha[a.nextstate] = Plus (fwdAlpha[a.nextstate], Times (fwdAlpha[q],
-                                      a.weight) );
-        if (ngmAlpha[a.nextstate].find (a.ilabel) == ngmAlpha[a.nextstate].end() ) {
-          ngmAlpha[a.nextstate][a.ilabel] = fst::LogArc::Weight::Zero();
-        }
-        ngmAlpha[a.nextstate][a.ilabel] = Plus (ngmAlpha[a.nextstate][a.ilabel],
-                                                Times (fwdAlpha[q], a.weight) );
-        for (LabelToWeightMapper::const_iterator it = ngmAlpha[q].begin();
-             it != ngmAlpha[q].end(); ++it) {
-          if (it->first != a.ilabel) {
-            if (ngmAlpha[a.nextstate].find (it->first) == ngmAlpha[a.nextstate].end() ) {
-              ngmAlpha[a.nextstate][it->first] = fst::LogArc::Weight::Zero();
-            }
-            ngmAlpha[a.nextstate][it->first] = Plus (ngmAlpha[a.nextstate][it->first],
-                                               Times (it->second, a.weight) );
-          }
-        }
-      }
-      if (fst->Final (q) != fst::LogArc::Weight::Zero() ) {
-        for (LabelToWeightMapper::const_iterator it = ngmAlpha[q].begin();
-             it != ngmAlpha[q].end(); ++it) {
-          if (ngmAlphaFinal.find (it->first) == ngmAlphaFinal.end() ) {
-            ngmAlphaFinal[it->first] = fst::LogArc::Weight::Zero();
-          }
-          ngmAlphaFinal[it->first] = Plus (ngmAlphaFinal[it->first],
-                                           Times (ngmAlpha[q][it->first], fst->Final (q) ) );
-        }
-      }
-      ngmAlpha[q].clear();
-    }
-    for (LabelToWeightMapper::const_iterator it = ngmAlphaFinal.begin();
-         it != ngmAlphaFinal.end(); ++it) {
-      posteriors[ngs[it->first]][0][0] = exp (-1.0f * it->second.Value() );
+    forwardLabelPosteriors (*fst, finalmass);
+    for (unsigned k = 0; k < finalmass.size(); ++k) {
+      posteriors[ngs[finalmass[k].first]][0][0] = exp (-1.0f *
+          finalmass[k].second.Value() );
     }
   }
 
@@ -226,11 +294,9 @@ class ComputePosteriors {
   template <class Arc>
   fst::VectorFst<Arc>* MapToHigherOrderLattice (const fst::VectorFst<Arc>* fstlat,
       const NGramVector& ngs, const uint order) {
-    fst::VectorFst<Arc>* fsttmp1 = new fst::VectorFst<Arc> (*fstlat);
     fst::VectorFst<Arc>* fsttmp2 = MakeOrderMappingTransducer<Arc> (ngs, order);
     fst::VectorFst<Arc>* fsttmp3 = new fst::VectorFst<Arc>;
-    Compose (*fsttmp1, *fsttmp2, fsttmp3);
-    delete fsttmp1;
+    Compose (*fstlat, *fsttmp2, fsttmp3);
     delete fsttmp2;
     fst::Project (fsttmp3, fst::PROJECT_OUTPUT);
     fst::RmEpsilon (fsttmp3);
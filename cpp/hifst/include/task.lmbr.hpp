@@ -63,6 +63,38 @@ class LmbrTask: public ucam::util::TaskInterface<Data> {
 
   bool loadlexstdarc_;
 
+  ///Number of threads decoding alpha values at once
+  unsigned gridthreads_;
+
+  ///Fst copies share their data until modified, and the reference count is not thread-safe
+  boost::mutex scalemutex_;
+
+  ///Lmbr decoding of one alpha value, for all word penalties
+  struct AlphaDecoding {
+    std::vector<std::string> hyps;
+    ///Lmbr lattice with the last word penalty, only kept if requested
+    fst::VectorFst<fst::StdArc> lattice;
+    bool keeplattice;
+  };
+
+  struct DecodeAlphaFunctor {
+    LmbrTask *task_;
+    fst::VectorFst<fst::StdArc> *fstevd_;
+    const fst::VectorFst<fst::StdArc> *hyp_;
+    const std::vector<float> *wps_;
+    float alpha_;
+    AlphaDecoding *out_;
+    DecodeAlphaFunctor ( LmbrTask *task, fst::VectorFst<fst::StdArc> *fstevd
+                         , const fst::VectorFst<fst::StdArc> *hyp
+                         , const std::vector<float> *wps, float alpha
+                         , AlphaDecoding *out )
+      : task_ ( task ), fstevd_ ( fstevd ), hyp_ ( hyp ), wps_ ( wps )
+      , alpha_ ( alpha ), out_ ( out ) {};
+    void operator() () {
+      task_->decodeAlpha ( fstevd_, *hyp_, *wps_, alpha_, *out_ );
+    };
+  };
+
 //public methods
  public:
   ///Constructor using multiple keys that can be arranged so to use different parameter names
@@ -80,7 +112,8 @@ class LmbrTask: public ucam::util::TaskInterface<Data> {
             const std::string& precisionratiokey = HifstConstants::kLmbrR,
             const std::string& numberunigramtokenskey = HifstConstants::kLmbrT,
             const std::string& preprunekey = HifstConstants::kLmbrPreprune,
-            const std::string& lexstdarckey = HifstConstants::kLmbrLexstdarc
+            const std::string& lexstdarckey = HifstConstants::kLmbrLexstdarc,
+            const std::string& gridthreadskey = HifstConstants::kLmbrGridthreads
            ) :
     evidencespacekey_ (evidencespacekey),
     hypothesesspacekey_ (hypothesesspacekey),
@@ -92,6 +125,7 @@ class LmbrTask: public ucam::util::TaskInterface<Data> {
     ppweight_ (rg.get<float> (preprunekey) ),
     onebest_ (rg.exists (writeonebestkey) ),
     loadlexstdarc_ (rg.exists (lexstdarckey) ),
+    gridthreads_ (rg.exists (gridthreadskey) ? rg.get<unsigned> (gridthreadskey) : 1),
     theta_ (rg.get<float> (unigramprecisionkey),
             rg.get<float> (precisionratiokey),
             rg.get<float> (numberunigramtokenskey),
@@ -183,30 +217,34 @@ class LmbrTask: public ucam::util::TaskInterface<Data> {
     //Lattice vocabulary...
     extractSourceVocabulary (*fstevd, &vocab);
     LINFO ("Fast posterior computing");
-    ComputePosteriors cp (ngrams);
-    for ( alpha_.start(); !alpha_.done (); alpha_.next() ) {
-      LINFO ( "scaling weights by " << std::fixed << std::setprecision (
-                4) << alpha_() );
-      boost::scoped_ptr< fst::VectorFst<fst::StdArc> > scaledfst (FstScaleWeights (
-            fstevd, alpha_() ) );
-      cp (scaledfst.get() );
-      NGramToPosteriorsMapper& pst = cp.getPosteriors();
-      ApplyPosteriors ap (ngrams, pst, theta_);
-      //Print posteriors
-      ap.printNgramPosteriors();
-      fst::Map (*fsthyp, &lmbroutput_, fst::RmWeightMapper<fst::StdArc>() );
-      boost::scoped_ptr<fst::VectorFst<fst::StdArc> > lmbrlat (ap (lmbroutput_) );
-      fst::VectorFst<fst::StdArc> original (*lmbrlat);
-      for ( wps_.start(); !wps_.done (); wps_.next() ) {
-        fst::Map (original, &lmbroutput_, fst::TimesMapper<fst::StdArc> (wps_() ) );
-				std::string hyp;
-				FstGetBestStringHypothesis(lmbroutput_, hyp);
-        LINFO ("wps=" << wps_() << ":" << hyp);
-        if (onebest_) {
-          //    *d.lmbronebest+="alpha=" + toString(alpha_())+ " wps=" + toString(wps_()) + " " + toString(d.sidx)+ ":" + hyp + "\n";
-          d.lmbronebest->alpha.push_back (alpha_() );
-          d.lmbronebest->wps.push_back (wps_() );
-          d.lmbronebest->hyp.push_back (hyp);
+    std::vector<float> alphas, wps;
+    for ( alpha_.start(); !alpha_.done (); alpha_.next() ) alphas.push_back (alpha_() );
+    for ( wps_.start(); !wps_.done (); wps_.next() ) wps.push_back (wps_() );
+    fst::VectorFst<fst::StdArc> hyp;
+    fst::Map (*fsthyp, &hyp, fst::RmWeightMapper<fst::StdArc>() );
+    std::vector<AlphaDecoding> decodings (alphas.size() );
+    for (unsigned k = 0; k < alphas.size(); ++k)
+      decodings[k].keeplattice = (k + 1 == alphas.size() );
+    if (gridthreads_ > 1 && alphas.size() > 1) {
+      ucam::util::TrivialThreadPool tp (std::min<std::size_t> (gridthreads_,
+                                        alphas.size() ) );
+      for (unsigned k = 0; k < alphas.size(); ++k)
+        tp (DecodeAlphaFunctor (this, fstevd, &hyp, &wps, alphas[k],
+                                &decodings[k]) );
+    } else {
+      for (unsigned k = 0; k < alphas.size(); ++k)
+        decodeAlpha (fstevd, hyp, wps, alphas[k], decodings[k]);
+    }
+    if (!alphas.empty() ) {
+      if (wps.empty() ) lmbroutput_ = hyp;
+      else lmbroutput_ = decodings.back().lattice;
+    }
+    if (onebest_) {
+      for (unsigned k = 0; k < alphas.size(); ++k) {
+        for (unsigned j = 0; j < wps.size(); ++j) {
+          d.lmbronebest->alpha.push_back (alphas[k]);
+          d.lmbronebest->wps.push_back (wps[j]);
+          d.lmbronebest->hyp.push_back (decodings[k].hyps[j]);
         }
       }
     }
@@ -222,6 +260,40 @@ class LmbrTask: public ucam::util::TaskInterface<Data> {
 
  private:
 
+  /**
+   * \brief Computes posteriors over the scaled evidence space of one alpha value and decodes
+   * the hypotheses space with each word penalty. Only reads shared data, so several alpha values
+   * can be decoded at once.
+   */
+  void decodeAlpha (fst::VectorFst<fst::StdArc>* fstevd,
+                    const fst::VectorFst<fst::StdArc>& hyp,
+                    const std::vector<float>& wps, float alpha, AlphaDecoding& out) {
+    LINFO ( "scaling weights by " << std::fixed << std::setprecision (
+              4) << alpha );
+    ComputePosteriors cp (ngrams);
+    {
+      boost::scoped_ptr< fst::VectorFst<fst::StdArc> > scaledfst;
+      {
+        boost::mutex::scoped_lock lock (scalemutex_);
+        scaledfst.reset (FstScaleWeights (fstevd, alpha) );
+      }
+      cp (scaledfst.get() );
+    }
+    NGramToPosteriorsMapper& pst = cp.getPosteriors();
+    ApplyPosteriors ap (ngrams, pst, theta_);
+    //Print posteriors
+    ap.printNgramPosteriors();
+    boost::scoped_ptr<fst::VectorFst<fst::StdArc> > lmbrlat (ap (hyp) );
+    fst::VectorFst<fst::StdArc> lattice;
+    out.hyps.resize (wps.size() );
+    for (unsigned k = 0; k < wps.size(); ++k) {
+      fst::Map (*lmbrlat, &lattice, fst::TimesMapper<fst::StdArc> (wps[k]) );
+      FstGetBestStringHypothesis (lattice, out.hyps[k]);
+      LINFO ("alpha=" << alpha << " wps=" << wps[k] << ":" << out.hyps[k]);
+    }
+    if (out.keeplattice) out.lattice = lattice;
+  };
+
 };
 
 }
@@ -36,7 +36,7 @@ class LoadSparseWeightFlowerLatticeTask: public ucam::util::TaskInterface<DataT>
   fst::VectorFst<TupleArc32> flowerlattice_;
 
   ///sparse tuple-weight scales
-  std::vector<float>& fscales_;
+  std::vector<float> const& fscales_;
 
   ///Alignment lattices file names
   ucam::util::IntegerPatternAddress alilats_;
@@ -29,7 +29,8 @@ namespace hifst {
 /**
  * \brief Converts patterns to instanced patterns.
  * \remark Given a set of grammar-specific source patterns and a source sentence, generate instances of these patterns.
- * Example, given pattern w_X_w and sentence "1 3 4 5 2", generate 1_X_2, 1_3_X_2 , 1_3_4_X_2 , 1_3_X_5_2 ,...
+ * Example, given pattern w_X_w and sentence "1 3 4 5 2", generate 1_X_4, 1_X_5, 3_X_5, 3_X_2, ...
+ * Instances for which the grammar has no rule are discarded.
  */
 
 template <class Data>
@@ -45,6 +46,25 @@ class PatternsToInstancesTask: public ucam::util::TaskInterface<Data> {
   ///filename with wildcards.
   ucam::util::IntegerPatternAddress instancefile_;
 
+  typedef unordered_map<std::string, std::vector< std::pair <unsigned, unsigned> > >
+  InstanceMap;
+
+  ///Node of the trie of patterns. Children are indexed by element: 0 for w, 1 for X.
+  struct PatternNode {
+    int child[2];
+    ///A pattern ends here
+    bool final;
+    PatternNode() : final ( false ) {
+      child[0] = child[1] = -1;
+    };
+  };
+  std::vector<PatternNode> trie_;
+
+  ///Instance being built: sentence index of each word, -1 for X.
+  std::vector<int> instance_;
+  std::size_t numinstances_;
+  std::size_t numdropped_;
+
  public:
   /**
    * \brief Constructor
@@ -82,6 +102,10 @@ class PatternsToInstancesTask: public ucam::util::TaskInterface<Data> {
 
   /**
    * \brief Instantiates patterns and stores position/span.
+   * Patterns are walked as a trie from each position of the sentence, so patterns sharing a prefix
+   * share the work. Instances are kept as word positions, and only turned into strings if
+   * some rule has them as source side, according to the source index of the grammar.
+   * Single words are always kept, as they might need oov rules.
    * \param d: Templated Data object.
    */
 
@@ -90,80 +114,101 @@ class PatternsToInstancesTask: public ucam::util::TaskInterface<Data> {
     LINFO ( "maxspan_=" << maxspan_ << ",gapmaxspan=" << gapmaxspan_ );
     std::vector<std::string> ss;
     boost::algorithm::split ( ss, d.sentence, boost::algorithm::is_any_of ( " " ) );
-    const std::unordered_set<std::string>& patterns = d.grammar->patterns;
-    for ( std::unordered_set<std::string>::const_iterator itx = patterns.begin();
-          itx != patterns.end(); ++itx ) { /// for each grammar-specific pattern.
+    buildTrie ( *d.grammar );
+    numinstances_ = numdropped_ = 0;
+    for ( unsigned j = 0; j < ss.size(); ++j ) { // for each word in the sentence
+      LDEBUG ( "starting word:" << ss[j] );
+      instance_.clear();
+      walk ( 0, j, j, kSourceHashSeed, ss, *d.grammar, d.hpinstances );
+    }
+    LINFO ( numinstances_ << " instances, " << numdropped_ <<
+            " dropped (no rule for them)" );
+  }
+
+  /**
+   * \brief Builds the trie of grammar patterns.
+   * Patterns are few, so this is cheap compared to instantiating them.
+   */
+  void buildTrie ( const GrammarData& g ) {
+    trie_.assign ( 1, PatternNode() );
+    for ( std::unordered_set<std::string>::const_iterator itx = g.patterns.begin();
+          itx != g.patterns.end(); ++itx ) { /// for each grammar-specific pattern.
       LDEBUG ( "pattern:" << *itx );
       std::vector<std::string> spattern;
       boost::algorithm::split ( spattern, *itx, boost::algorithm::is_any_of ( "_" ) );
-      for ( unsigned j = 0; j < ss.size(); ++j ) { // for each word in the sentence
-        std::vector< std::vector<std::string> > pinstances;
-        LDEBUG ( "starting word:" << ss[j] );
-        //Map each pattern into words.
-        //If there are gaps, then expand them from 1 to given threshold gapmaxspan
-        if ( spattern.size() <= maxspan_ && j + spattern.size() - 1 < ss.size() ) {
-          std::vector<std::string> empty;
-          pinstances.push_back ( empty ); //add empty one.
-          //Create all instances that apply to this particular pattern.
-          buildNextElementFromPattern ( spattern, ss, pinstances, j, 0 );
-        }
-        for ( unsigned k = 0; k < pinstances.size(); ++k )  {
-          LDEBUG ( "pattern:" << *itx << ":" << "Inserting in " <<
-                   boost::algorithm::join ( pinstances[k],
-                                            "_" ) << "values=(" << j << "," << spattern.size() - 1 );
-          d.hpinstances[boost::algorithm::join ( pinstances[k],
-                                                 "_" )].push_back ( std::pair<unsigned, unsigned> ( j, spattern.size() - 1 ) );
+      unsigned node = 0;
+      for ( unsigned k = 0; k < spattern.size(); ++k ) {
+        ///Bad news if you get here... Expliciting failed condition to provide enough user information...
+        USER_CHECK ( spattern[k] == "X" || spattern[k] == "w", "Incorrect pattern!" );
+        unsigned e = ( spattern[k] == "X" );
+        if ( trie_[node].child[e] < 0 ) {
+          trie_[node].child[e] = trie_.size();
+          trie_.push_back ( PatternNode() );
         }
+        node = trie_[node].child[e];
       }
+      trie_[node].final = true;
     }
-  }
+    LINFO ( "Trie of " << g.patterns.size() << " patterns has " << trie_.size() << " nodes" );
+  };
 
   /**
-   * \brief Recursive function used to instantiate patterns on the source sentence. Meant to be called from instantiatePatterns.
-   * \param spattern              Pattern being scrutinized
-   * \param ss                    Sentence
-   * \param pinstances            Pattern instances found
-   * \param ps                    Sentence index
-   * \param pp                    Pattern  index
-   * \param gaphistory            gap size we are currently working with
+   * \brief Recursive walk of the trie over the sentence, from one starting word.
+   * Each word is matched by w, whereas X may cover from 1 to gapmaxspan_ words
+   * (just one if the pattern ends with X). The instance is never longer than maxspan_ words.
+   * \param node                  Trie node
+   * \param start                 Sentence index of the starting word
+   * \param ps                    Sentence index of the next word
+   * \param h                     Source hash of the instance so far
    */
+  void walk ( unsigned node, unsigned start, unsigned ps, uint64_t h
+              , const std::vector<std::string>& ss, const GrammarData& g
+              , InstanceMap& hpinstances ) {
+    if ( instance_.size() ) h = sourceHashStep ( h, '_' );
+    int w = trie_[node].child[0];
+    if ( w >= 0 && ps < ss.size() && ps + 1 - start <= maxspan_ ) {
+      uint64_t hw = sourceHash ( ss[ps].c_str(), h );
+      instance_.push_back ( ps );
+      if ( trie_[w].final ) emit ( start, hw, ss, g, hpinstances );
+      walk ( w, start, ps + 1, hw, ss, g, hpinstances );
+      instance_.pop_back();
+    }
+    int x = trie_[node].child[1];
+    if ( x >= 0 ) {
+      uint64_t hx = sourceHashStep ( h, 'X' );
+      instance_.push_back ( -1 );
+      if ( trie_[x].final && ps < ss.size() && ps + 1 - start <= maxspan_ )
+        emit ( start, hx, ss, g, hpinstances );
+      if ( trie_[x].child[0] >= 0 || trie_[x].child[1] >= 0 )
+        for ( unsigned k = 1;
+              k <= gapmaxspan_ && ps + k <= ss.size() && ps + k - start <= maxspan_;
+              ++k ) {
+          LDEBUG ( "GAPSPAN=" << k );
+          walk ( x, start, ps + k, hx, ss, g, hpinstances );
+        }
+      instance_.pop_back();
+    }
+  };
 
-  void buildNextElementFromPattern ( std::vector<std::string>& spattern,
-                                     std::vector<std::string>& ss,
-                                     std::vector< std::vector<std::string> >& pinstances,
-                                     unsigned ps,
-                                     unsigned pp,
-                                     unsigned gaphistory = 0 ) {
-    LDEBUG ( "startingword:" << ss[ps] << ",thisword:" <<   ss[ps + pp +
-             gaphistory ] << ",thiselement:" << spattern[pp] << ",ps=" << ps << ",pp=" << pp
-             << ",spatternsize=" << spattern.size() << ",gaphistory=" << gaphistory );
-    if ( spattern[pp] == "w" ) {
-      pinstances[pinstances.size() - 1].push_back ( ucam::util::toString (
-            ss[ps + pp + gaphistory] ) );
-      if ( ( pp + 1 < spattern.size() )
-           && ( ps + spattern.size() + gaphistory  <= ss.size() ) )
-        buildNextElementFromPattern ( spattern, ss, pinstances, ps, pp + 1,
-                                      gaphistory );
-    } else if ( spattern[pp] == "X" ) {
-      LDEBUG ( "X,with gapmaxspan=" << gapmaxspan_ );
-      pinstances[pinstances.size() - 1].push_back ( "X" );
-      std::vector<std::string> replicate = pinstances[pinstances.size() - 1];
-      for ( unsigned k = 1;
-            ( k <= gapmaxspan_ )
-            && ( pp + 1 < spattern.size() )
-            && ( ps + spattern.size() - 1 + gaphistory + k - 1 < ss.size() )
-            && ( spattern.size() + gaphistory + k - 1 <= maxspan_ );
-            ++k ) {
-        LDEBUG ( "GAPSPAN=" << k );
-        if ( k > 1 ) pinstances.push_back (
-            replicate ); //clone previous one and run recursively.
-        buildNextElementFromPattern ( spattern, ss, pinstances, ps, pp + 1,
-                                      gaphistory + k - 1 );
-      }
-    } else {
-      ///Bad news if you get here... Expliciting failed condition to provide enough user information...
-      USER_CHECK ( spattern[pp] == "X" || spattern[pp] == "w", "Incorrect pattern!" );
+  ///Stores the current instance, unless no rule can match it.
+  void emit ( unsigned start, uint64_t h, const std::vector<std::string>& ss
+              , const GrammarData& g, InstanceMap& hpinstances ) {
+    bool singleword = ( instance_.size() == 1 && instance_[0] >= 0 );
+    if ( g.sources.size() && !singleword && !g.sources.contains ( h ) ) {
+      ++numdropped_;
+      return;
+    }
+    std::string instance;
+    for ( unsigned k = 0; k < instance_.size(); ++k ) {
+      if ( k ) instance += "_";
+      if ( instance_[k] < 0 ) instance += "X";
+      else instance += ss[instance_[k]];
     }
+    LDEBUG ( "Inserting in " << instance << "values=(" << start << "," <<
+             instance_.size() - 1 );
+    hpinstances[instance].push_back ( std::pair<unsigned, unsigned> ( start,
+                                      instance_.size() - 1 ) );
+    ++numinstances_;
   };
 
   /**
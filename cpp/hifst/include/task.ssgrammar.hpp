@@ -88,6 +88,11 @@ class SentenceSpecificGrammarTask: public ucam::util::TaskInterface<Data> {
     return false;
   };
 
+  ///Oov rule ids start again from the end of the grammar
+  void reset() {
+    rule_id_offset_ = 0;
+  };
+
  private:
 
   ///Create sentence-specific oov rules.
@@ -142,22 +147,22 @@ class SentenceSpecificGrammarTask: public ucam::util::TaskInterface<Data> {
   /**
    * \brief Given the instance-patterns, looks up for rules and generates hashes.
    * \param d: Data structure containing all necessary objects (grammar, patterns, etc).
-   * \remark The grammar is pattern-sorted. For each instance-pattern, the binary search will
-   * find one particular rule of a sequence of valid ones (i.e. with different translations, or
-   * even different non-terminals in the sources). From this particular rule we just
-   * inspect backward and forward through the grammar until the instance-pattern changes.
+   * \remark The grammar is pattern-sorted, so all the rules of an instance-pattern are contiguous
+   * (i.e. with different translations, or even different non-terminals in the sources).
+   * They are found through the source index of the grammar, filtered once, and then shared
+   * by all the positions at which the instance-pattern was found.
    */
 
   void get ( Data& d ) {
     ssgrammar_instancemap_t& hpinstances = d.hpinstances;
     ssgd_.reset();
     ssgd_.grammar = d.grammar;
+    std::vector< std::pair<std::string, unsigned> > candidates;
     for ( ssgrammar_instancemap_t::iterator itx = hpinstances.begin();
           itx != hpinstances.end(); ++itx ) {
       LDEBUG ( "Search for [" << itx->first << "]" );
-      std::string needle = itx->first + " ";
-      int pos = exists ( needle );
-      if ( -1 == pos ) {
+      std::size_t begin, end;
+      if ( !findRules ( itx->first, begin, end ) ) {
         if ( addoovs_ )
           if ( phraseIsTerminalWord ( itx->first ) ) {
             std::size_t ruleid = createOOVRule ( itx->first );
@@ -171,37 +176,26 @@ class SentenceSpecificGrammarTask: public ucam::util::TaskInterface<Data> {
         LDEBUG ( "Pattern not found!" );
         continue;
       }
-      USER_CHECK ( pos >= 0, "positive value required!" );
       LDEBUG ( "Extracting indices for =>" << itx->first << ",size of pattern=" <<
                getSize ( itx->first ) <<
                ", number of instances at which this was found: (x,span): " <<
                itx->second.size() );
+      getRuleIndicesRHS ( itx->first + " ", begin, end, candidates, d.tvcb );
+      ssgrammar_rulesmap_t& rules = getSize ( itx->first ) == 1
+                                    ? ssgd_.rulesWithRhsSpan1
+                                    : ssgd_.rulesWithRhsSpan2OrMore;
       ///Note that we are not using span, therefore we discard repeated ones here
       std::unordered_set<unsigned> seenx;
-      if ( getSize ( itx->first ) == 1 ) {
-        for ( unsigned k = 0; k < itx->second.size(); ++k ) {
-          unsigned& x = itx->second[k].first;
-          if ( seenx.find ( x ) != seenx.end() ) {
-            LDEBUG ( "Repeated:" << itx->first << " at x=" << x );
-            continue;
-          }
-          seenx.insert ( x );
-          LDEBUG ( "*calling addRuleIndicesRHS (1) at x=" << x );
-          addRuleIndicesRHS ( needle, pos, ssgd_.rulesWithRhsSpan1[x] , d.tvcb );
-          LDEBUG ( "*Done!" );
-        }
-      } else {
-        for ( unsigned k = 0; k < itx->second.size(); ++k ) {
-          unsigned& x = itx->second[k].first;
-          if ( seenx.find ( x ) != seenx.end() ) {
-            LDEBUG ( "Repeated:" << itx->first << " at x=" << x );
-            continue;
-          }
-          seenx.insert ( x );
-          LDEBUG ( "*calling addRuleIndicesRHS (2) at x=" << x );
-          addRuleIndicesRHS ( needle, pos, ssgd_.rulesWithRhsSpan2OrMore[x] , d.tvcb );
-          LDEBUG ( "*Done" );
+      for ( unsigned k = 0; k < itx->second.size(); ++k ) {
+        unsigned& x = itx->second[k].first;
+        if ( !seenx.insert ( x ).second ) {
+          LDEBUG ( "Repeated:" << itx->first << " at x=" << x );
+          continue;
         }
+        LDEBUG ( "*Adding " << candidates.size() << " rules at x=" << x );
+        ssgrammar_firstelementmap_t& rulesatx = rules[x];
+        for ( unsigned j = 0; j < candidates.size(); ++j )
+          rulesatx[candidates[j].first].push_back ( candidates[j].second );
       }
       LDEBUG ( "Finished extracting indices for " << itx->first );
     }
@@ -209,22 +203,53 @@ class SentenceSpecificGrammarTask: public ucam::util::TaskInterface<Data> {
   };
 
   /**
-   * \brief For a given instance-pattern and a position indexing a rule found for this instance-pattern,
-   * store all surrounding rule indices and hash them by the first element of the source side.
-   * \param needle: the instance-pattern we have queried for the grammar.
-   * \param pos: the position in the grammar object indexing a rule generalizing to an instance-pattern.
-   * \param &rules: rule indices hashed by first element of the source side of the rule.
+   * \brief Finds all the rules matching an instance-pattern.
+   * Uses the source index of the grammar if available, otherwise a binary search.
+   * \param instance: instance-pattern, e.g. 3_X_5
+   * \param begin, end: on success, rules begin ... end-1 are candidates
+   * \returns false if not found
+   */
+  bool findRules ( const std::string& instance, std::size_t& begin
+                   , std::size_t& end ) {
+    const GrammarData& g = *ssgd_.grammar;
+    std::string needle = instance + " ";
+    bool indexed = g.sources.find ( instance, begin, end );
+    if ( indexed && !g.ct->ncompare ( needle.c_str(), g.contents + g.vpos[begin].p,
+                                      needle.size() ) )
+      return true;
+    //If the index misses it, it is not in the grammar.
+    //If the index returns other rules, another source side has the same hash.
+    if ( g.sources.size() && !indexed ) return false;
+    int pos = exists ( needle );
+    if ( -1 == pos ) return false;
+    begin = pos;
+    end = pos + 1;
+    while ( begin > 0 && !g.ct->ncompare ( needle.c_str()
+                                           , g.contents + g.vpos[begin - 1].p, needle.size() ) )
+      --begin;
+    while ( end < g.sizeofvpos && !g.ct->ncompare ( needle.c_str()
+            , g.contents + g.vpos[end].p, needle.size() ) )
+      ++end;
+    return true;
+  };
+
+  /**
+   * \brief Collects rule indices for an instance-pattern, along with the first element of the source side of each rule.
+   * \param needle: the instance-pattern we have queried for the grammar, followed by a space.
+   * \param begin, end: range of rules found for this instance-pattern.
+   * \param &candidates: rule indices and their first elements.
    * \param &vcb: vocabulary to filter out rules
    */
 
-  void addRuleIndicesRHS ( const std::string& needle
-                           , const int pos, ssgrammar_firstelementmap_t& rules
+  void getRuleIndicesRHS ( const std::string& needle
+                           , std::size_t begin, std::size_t end
+                           , std::vector< std::pair<std::string, unsigned> >& candidates
                            , const std::unordered_set<std::string>& vcb ) {
-    USER_CHECK ( pos >= 0, "pos needs to be positive" );
     LDEBUG ( "**Adding indices for rules" );
     const GrammarData& g = *ssgd_.grammar;
-    for ( unsigned j = pos; j < g.sizeofvpos ; ++j ) {
-      if ( g.ct->ncompare ( needle.c_str(), g.filecontents.c_str() + g.vpos[j].p,
+    candidates.clear();
+    for ( std::size_t j = begin; j < end ; ++j ) {
+      if ( g.ct->ncompare ( needle.c_str(), g.contents + g.vpos[j].p,
                             needle.size() ) ) break;
       if ( !g.isAcceptedByVocabulary ( j, vcb ) ) {
         LDEBUG ( "skipping rule (rejected by vcb):" << g.getRule ( j ) );
@@ -233,17 +258,7 @@ class SentenceSpecificGrammarTask: public ucam::util::TaskInterface<Data> {
       std::string firstelement = g.getRHSSource ( j , 0 );
       getFilteredNonTerminal ( firstelement );
       LDEBUG ( "***Adding rule #" << j << ":" << g.getRule ( j ) );
-      rules[firstelement].push_back ( j );
-    }
-    if ( pos == 0 )  return;
-    for ( int j = pos - 1; j >= 0 ; --j ) {
-      if ( g.ct->ncompare ( needle.c_str(), g.filecontents.c_str() + g.vpos[j].p,
-                            needle.size() ) ) break;
-      if ( !g.isAcceptedByVocabulary ( j, vcb ) ) continue;
-      std::string firstelement = g.getRHSSource ( j , 0 );
-      getFilteredNonTerminal ( firstelement );
-      LDEBUG ( "***Adding rules # " << j << ":" << g.getRule ( j ) );
-      rules[firstelement].push_back ( j );
+      candidates.push_back ( std::make_pair ( firstelement, ( unsigned ) j ) );
     }
   };
 
@@ -264,13 +279,13 @@ class SentenceSpecificGrammarTask: public ucam::util::TaskInterface<Data> {
       mid = ( first + last ) / 2;
       if ( mid == oldmid ) break;
       int res = g.ct->ncompare ( needle.c_str(),
-                                 g.filecontents.c_str() + g.vpos[mid].p, needle.size() );
+                                 g.contents + g.vpos[mid].p, needle.size() );
       if ( res < 0 ) first = mid + 1;
       else if ( res > 0 ) last = mid - 1;
       else first = last + 1;
       oldmid = mid;
     }
-    if ( !g.ct->ncompare ( needle.c_str(), g.filecontents.c_str() + g.vpos[mid].p,
+    if ( !g.ct->ncompare ( needle.c_str(), g.contents + g.vpos[mid].p,
                            needle.size() ) ) {
       return mid;
     }
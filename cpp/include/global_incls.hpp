@@ -88,6 +88,7 @@
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 
 #ifdef USE_BOOSTLOG
 
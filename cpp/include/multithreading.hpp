@@ -64,6 +64,192 @@ class TrivialThreadPool {
 
 };
 
+/**
+ * \brief Threadpool that always runs the most expensive job pending first,
+ * i.e. longest processing time first. Jobs of equal cost run in submission order.
+ * This only makes a difference if more jobs than threads are pending, so the submitting
+ * thread should keep a window of jobs ahead (see ReorderBuffer).
+ * As TrivialThreadPool, creates n threads (n <= number of cpus)
+ * and waits for all pending jobs to finish when deleted.
+ */
+template<class TaskT>
+class PriorityThreadPool {
+
+ private:
+  struct Job {
+    double cost;
+    std::size_t order;
+    TaskT task;
+    Job ( double c, std::size_t o, TaskT const& t )
+      : cost ( c ), order ( o ), task ( t ) {};
+  };
+  /// Top of the queue is the most expensive job, and the oldest one amongst equals
+  struct CheaperThan {
+    bool operator() ( Job const& a, Job const& b ) const {
+      if ( a.cost != b.cost ) return a.cost < b.cost;
+      return a.order > b.order;
+    };
+  };
+
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  std::priority_queue<Job, std::vector<Job>, CheaperThan> queue_;
+  std::size_t submitted_;
+  bool done_;
+  std::size_t numthreads_;
+  boost::thread_group pool_;
+
+  void work() {
+    for ( ;; ) {
+      boost::unique_lock<boost::mutex> lock ( mutex_ );
+      while ( queue_.empty() && !done_ ) cond_.wait ( lock );
+      if ( queue_.empty() ) return;
+      TaskT task = queue_.top().task;
+      queue_.pop();
+      lock.unlock();
+      task();
+    }
+  };
+
+ public:
+  PriorityThreadPool ( std::size_t n )
+    : submitted_ ( 0 )
+    , done_ ( false )
+    , numthreads_ ( n > boost::thread::hardware_concurrency()
+                    ? boost::thread::hardware_concurrency() : n ) {
+    USER_CHECK ( numthreads_ > 0
+                 , "Number of threads has to be greater than 0!" );
+    for ( std::size_t i = 0; i < numthreads_; i++ )
+      pool_.create_thread ( boost::bind ( &PriorityThreadPool::work, this ) );
+  }
+
+  ~PriorityThreadPool() {
+    {
+      boost::lock_guard<boost::mutex> lock ( mutex_ );
+      done_ = true;
+    }
+    cond_.notify_all();
+    pool_.join_all();
+  }
+
+  ///Submits a job with an estimated cost, in any unit.
+  void operator() ( TaskT const& task, double cost ) {
+    {
+      boost::lock_guard<boost::mutex> lock ( mutex_ );
+      queue_.push ( Job ( cost, submitted_++, task ) );
+    }
+    cond_.notify_one();
+  }
+
+  ///Number of threads actually running jobs
+  std::size_t size() const {
+    return numthreads_;
+  }
+
+};
+
+/**
+ * \brief Counts jobs submitted to a threadpool, so that a thread
+ * can wait until all of them have finished.
+ */
+class JobCounter {
+ private:
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  std::size_t pending_;
+
+ public:
+  JobCounter() : pending_ ( 0 ) {}
+
+  ///Call before submitting n jobs
+  void add ( std::size_t n = 1 ) {
+    boost::lock_guard<boost::mutex> lock ( mutex_ );
+    pending_ += n;
+  }
+
+  ///Call from each job once it has finished
+  void done() {
+    boost::lock_guard<boost::mutex> lock ( mutex_ );
+    if ( --pending_ == 0 ) cond_.notify_all();
+  }
+
+  ///Blocks until all jobs have finished.
+  void wait() {
+    boost::unique_lock<boost::mutex> lock ( mutex_ );
+    while ( pending_ ) cond_.wait ( lock );
+  }
+};
+
+/**
+ * \brief Writes strings to a stream in submission order, as soon as all the previous ones have been written.
+ * Positions are obtained with reserve(), which blocks while window strings are in flight.
+ * This applies back-pressure on the submitting thread, so memory does not grow with the input size.
+ * If the stream is NULL strings are discarded, but the window is still enforced.
+ * Each string is written as a line, unless the buffer is created with newline=false,
+ * in which case strings are written as they are (e.g. several lines, or none).
+ */
+template<class StreamT>
+class ReorderBuffer {
+ private:
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  StreamT *o_;
+  std::size_t window_;
+  bool newline_;
+  /// Next position to write
+  std::size_t next_;
+  /// Next position to reserve
+  std::size_t reserved_;
+  /// Circular buffers indexed by position modulo window
+  std::vector<std::string> pending_;
+  std::vector<bool> ready_;
+
+ public:
+  ReorderBuffer ( StreamT *o, std::size_t window, bool newline = true )
+    : o_ ( o )
+    , window_ ( window )
+    , newline_ ( newline )
+    , next_ ( 0 )
+    , reserved_ ( 0 )
+    , pending_ ( window )
+    , ready_ ( window, false ) {
+    USER_CHECK ( window_ > 0, "Window has to be greater than 0!" );
+  }
+
+  ///Returns next position. Blocks until it fits in the window.
+  std::size_t reserve() {
+    boost::unique_lock<boost::mutex> lock ( mutex_ );
+    while ( reserved_ - next_ >= window_ ) cond_.wait ( lock );
+    return reserved_++;
+  }
+
+  ///Stores string for a reserved position and writes all consecutive strings available.
+  void push ( std::size_t position, std::string const &s ) {
+    boost::unique_lock<boost::mutex> lock ( mutex_ );
+    std::size_t k = position % window_;
+    pending_[k] = s;
+    ready_[k] = true;
+    if ( position != next_ ) return;
+    while ( ready_[next_ % window_] ) {
+      k = next_ % window_;
+      if ( o_ != NULL ) {
+        *o_ << pending_[k];
+        if ( newline_ ) *o_ << std::endl;
+      }
+      pending_[k].clear();
+      ready_[k] = false;
+      ++next_;
+    }
+    cond_.notify_all();
+  }
+
+  ///Blocks until all reserved positions have been written.
+  void wait() {
+    boost::unique_lock<boost::mutex> lock ( mutex_ );
+    while ( next_ != reserved_ ) cond_.wait ( lock );
+  }
+};
+
 /**
  * \brief Trivial struct that can
  * replace seamlessly the threadpool
@@ -70,6 +70,20 @@ class TaskInterface {
     return r;
   };
 
+  /**
+   * \brief Clears any state kept from previous data objects.
+   * Long-lived chains call it before each new data object (e.g. sentence),
+   * so that running a task repeatedly behaves as running a freshly constructed one.
+   * Caches that do not change the output (e.g. loaded models) may be kept.
+   */
+  virtual void reset() {};
+
+  ///Resets this task and all appended tasks.
+  inline void chainreset() {
+    reset();
+    if ( next_ ) next_->chainreset();
+  };
+
   /**
    * \brief Appends a task class.
    * If there is no task, append here, otherwise delegate in next task.
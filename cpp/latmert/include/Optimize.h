@@ -16,6 +16,7 @@
 #include "ParamsConfig.h"
 #include "Score.h"
 #include <utility>
+#include <functional>
 #include <BleuStats.h>
 #include <tr1/unordered_map>
 #include <tr1/unordered_set>
@@ -86,14 +87,14 @@ class OptimizeTask {
     if (opts.verbose) {
       tracer << "lattice line optimization: sentence s=" << sid << '\n';
     }
-    TupleArcFst* fst = lats->GetVectorLattice (sid, opts.useCache);
+    TuneSet::TupleArcFstPtr fst = lats->GetVectorLattice (sid);
     if (!fst) {
       std::cerr << "ERROR: invalid vector lattice for sentence s=" << sid
                 << '\n';
       exit (1);
     }
     //PruneStats pruneStats;
-    const typename Algo::Lines lines = Algo::ComputeLatticeEnvelope (fst,
+    const typename Algo::Lines lines = Algo::ComputeLatticeEnvelope (fst.get(),
                                        *lambda, *direction);
     /*
      if (opts.verbose) {
@@ -123,23 +124,22 @@ class OptimizeTask {
       prevScore = line->score;
       prevExpScore = expScore;
     }
-    if (!opts.useCache) {
-      delete fst;
-    }
   }
 
 };
 
 int GetNoOfThreads();
 
+// Tasks are dispatched by reference: they must outlive the threadpool,
+// which waits for all of them before returning.
 template<class Algo, class ErrorSurface>
-void execute_with_threadpool (std::vector<OptimizeTask<Algo, ErrorSurface> >
+void execute_with_threadpool (std::vector<OptimizeTask<Algo, ErrorSurface> >&
                               tasks) {
   ucam::util::TrivialThreadPool tp (GetNoOfThreads() );
-  for (typename std::vector<OptimizeTask<Algo, ErrorSurface> >::const_iterator it
+  for (typename std::vector<OptimizeTask<Algo, ErrorSurface> >::iterator it
        =
          tasks.begin(); it != tasks.end(); ++it) {
-    tp (*it);
+    tp (std::ref (*it) );
   }
 }
 
@@ -167,6 +167,7 @@ class OptimizerImpl: public Optimizer {
   void LineOptimize (const PARAMS& lambda, const PARAMS& direction,
                      ErrorSurface& surface, const std::vector<Sid>& lattices) {
     std::vector<OptimizeTask<Algo, ErrorSurface> > tasks;
+    tasks.reserve (lattices.size() );
     for (std::vector<Sid>::const_iterator sit = lattices.begin();
          sit != lattices.end(); ++sit) {
       OptimizeTask<Algo, ErrorSurface> task (*sit, &lambda, &direction,
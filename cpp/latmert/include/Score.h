@@ -27,21 +27,18 @@ typename RefData::ErrorStats::Error ComputeError (RefData& refData,
     if (opts.verbose) {
       tracer << "sentence s=" << *sit << '\n';
     }
-    TupleArcFst* fst = lats.GetVectorLattice (*sit, opts.useCache);
+    TuneSet::TupleArcFstPtr fst = lats.GetVectorLattice (*sit);
     if (!fst) {
       std::cerr << "ERROR: invalid vector lattice for sentence s=" << *sit
            << '\n';
       exit (1);
     }
-    Sentence h = GetBestHypothesis (fst, lambda);
+    Sentence h = GetBestHypothesis (fst.get(), lambda);
     typename RefData::ErrorStats es = refData.ComputeErrorStats (*sit, h);
     if (opts.verbose) {
       tracer << "best hypothesis=" << h << " " << es << '\n';
     }
     aggregate = aggregate + es;
-    if (!opts.useCache) {
-      delete fst;
-    }
   }
   return aggregate.ComputeError();
 }
@@ -14,8 +14,13 @@
 
 #include <vector>
 #include <map>
+#include <list>
+#include <set>
 
 #include <fst/fstlib.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include "MertCommon.h"
 
@@ -25,17 +30,43 @@ using std::map;
 typedef map<Sid, TupleArcFst*> SidToVecArcFstMap;
 typedef vector<Sid> SentenceList;
 
+/*
+ * Vector lattices of the tuning set. Lattices are either loaded on every request,
+ * or kept in a cache shared by all threads. The cache keeps every lattice, or if
+ * it has a memory budget, releases the least recently used lattices not in use.
+ * Optionally, expanded lattices are written to disk the first time they are
+ * loaded, so that later loads skip decompressing, sorting and expanding them.
+ */
 class TuneSet {
  public:
+  typedef boost::shared_ptr<TupleArcFst> TupleArcFstPtr;
   TuneSet();
   ~TuneSet();
   void Initialize (const bool use_cache);
-  TupleArcFst* GetVectorLattice (const Sid s, const bool use_cache) const;
+  TupleArcFstPtr GetVectorLattice (const Sid s) const;
   SentenceList ids; // List of sentence IDs to process
  private:
+  struct CachedLattice {
+    Sid sid;
+    TupleArcFstPtr fst;
+    std::size_t bytes;
+  };
+  typedef std::list<CachedLattice> LruList;
   std::string m_pattern;
-  vector<TupleArcFst *> cachedLattices;
+  std::string m_expandedPattern;
+  bool m_useCache;
+  std::size_t m_capacity; // Cache budget in bytes, 0 for no limit
+  mutable boost::mutex m_mutex;
+  mutable boost::condition_variable m_loaded;
+  mutable LruList m_lru; // Cached lattices, least recently used first
+  mutable map<Sid, LruList::iterator> m_cache;
+  mutable std::set<Sid> m_loading; // Lattices being loaded by some thread
+  mutable std::size_t m_size; // Bytes used by the cached lattices
   TupleArcFst* LoadLattice (const Sid s) const;
+  void Evict (std::vector<TupleArcFstPtr>& released) const;
 };
 
+// Estimated memory used by a lattice
+std::size_t LatticeBytes (const TupleArcFst& fst);
+
 #endif /* TUNESET_H_ */
@@ -101,10 +101,10 @@ void Directions::Resize (unsigned int dim, TuneSet& lats) {
   for (std::vector<Sid>::const_iterator sit = lats.ids.begin();
        sit != lats.ids.end(); ++sit) {
     //sparse_hash_set<unsigned int> features;
-    TupleArcFst* fst = lats.GetVectorLattice (*sit, opts.useCache);
+    TuneSet::TupleArcFstPtr fst = lats.GetVectorLattice (*sit);
     for (fst::StateIterator<TupleArcFst> si (*fst); !si.Done(); si.Next() ) {
       TupleArcFst::StateId state_id = si.Value();
-      for (fst::MutableArcIterator<TupleArcFst> ai (fst, si.Value() );
+      for (fst::ArcIterator<TupleArcFst> ai (*fst, si.Value() );
            !ai.Done(); ai.Next() ) {
         const TupleW w = ai.Value().weight;
         for (fst::SparseTupleWeightIterator<FeatureWeight, int> it (w);
@@ -113,9 +113,6 @@ void Directions::Resize (unsigned int dim, TuneSet& lats) {
         }
       }
     }
-    if (!opts.useCache) {
-      delete fst;
-    }
   }
   for (unordered_map<unsigned int, std::vector<Sid> >::const_iterator it =
          latticesByFeature.begin(); it != latticesByFeature.end(); ++it) {
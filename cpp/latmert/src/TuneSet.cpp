@@ -14,35 +14,67 @@
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/device/array.hpp>
 #include <boost/iostreams/device/file.hpp>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 
 DEFINE_string (lats, "", "path to vector lattices");
 DEFINE_string (idxlimits, "", "sentence index limits 'min:max'");
 DEFINE_string (idxscript, "", "script containing a list of sentence ids");
+DEFINE_int32 (lattice_cache_mb, 0,
+              "memory budget (MB) for lattices kept in memory; least recently used lattices are released first. 0 keeps none, or all with cache_lattices");
+DEFINE_string (expanded_lats, "",
+               "path to expanded vector lattices (e.g. expanded/%idx%.fst), written the first time each lattice is loaded and read instead afterwards");
 
-TuneSet::TuneSet() {
+TuneSet::TuneSet() :
+  m_useCache (false), m_capacity (0), m_size (0) {
 }
 
 TuneSet::~TuneSet() {
-  for (std::vector<TupleArcFst *>::iterator it = cachedLattices.begin();
-       it != cachedLattices.end(); ++it) {
-    delete *it;
+}
+
+std::size_t LatticeBytes (const TupleArcFst& fst) {
+  std::size_t bytes = fst.NumStates() * (sizeof (fst::VectorState<TupleArc>)
+                                         + sizeof (void*) );
+  for (fst::StateIterator<TupleArcFst> si (fst); !si.Done(); si.Next() ) {
+    bytes += fst.NumArcs (si.Value() ) * sizeof (TupleArc);
+    for (fst::ArcIterator<TupleArcFst> ai (fst, si.Value() ); !ai.Done();
+         ai.Next() ) {
+      // Features beyond the first one are kept in list nodes
+      for (fst::SparseTupleWeightIterator<FeatureWeight, int> it (
+             ai.Value().weight); !it.Done(); it.Next() ) {
+        bytes += sizeof (std::pair<int, FeatureWeight>) + 2 * sizeof (void*);
+      }
+    }
   }
+  return bytes;
 }
 
 TupleArcFst* TuneSet::LoadLattice (const Sid s) const {
+  std::string expanded;
+  if (!m_expandedPattern.empty() ) {
+    expanded = ExpandPath (m_expandedPattern, s);
+    std::ifstream ifs (expanded.c_str(), std::ios::in | std::ios::binary);
+    if (ifs) {
+      TupleArcFst* fst = TupleArcFst::Read (ifs, fst::FstReadOptions (expanded) );
+      if (fst) {
+        return fst;
+      }
+      std::cerr << "WARNING: unable to read expanded vector lattice: " << expanded
+                << '\n';
+    }
+  }
   boost::iostreams::filtering_streambuf<boost::iostreams::input> in;
   in.push (boost::iostreams::gzip_decompressor() );
   in.push (boost::iostreams::file_source (ExpandPath (m_pattern, s) ) );
   std::istream is (&in);
   TupleArcFst32* fst32 = TupleArcFst32::Read (is, fst::FstReadOptions() );
-  TopSort (fst32);
   if (!fst32) {
     std::cerr << "ERROR: unable to load vector lattice: " << ExpandPath (m_pattern,
          s) << '\n';
     exit (1);
   }
+  TopSort (fst32);
   if (fst32->Properties (fst::kNotTopSorted, true) ) {
     std::cerr << "ERROR: Input lattices are not topologically sorted: " << '\n';
     exit (1);
@@ -51,6 +83,14 @@ TupleArcFst* TuneSet::LoadLattice (const Sid s) const {
   fst::Expand m;
   fst::Map (*fst32, fst, fst::ExpandMapper (m) );
   delete fst32;
+  if (!expanded.empty() ) {
+    // Written under another name first, so that readers never see half a lattice
+    std::string tmp = expanded + ".tmp";
+    if (!fst->Write (tmp) || std::rename (tmp.c_str(), expanded.c_str() ) ) {
+      std::cerr << "WARNING: unable to write expanded vector lattice: " << expanded
+                << '\n';
+    }
+  }
   return fst;
 }
 
@@ -74,20 +114,65 @@ void TuneSet::Initialize (const bool use_cache) {
   tracer << "idx min=" << ids.front() << '\n';
   tracer << "idx max=" << ids.back() << '\n';
   m_pattern = FLAGS_lats;
+  m_expandedPattern = FLAGS_expanded_lats;
+  m_capacity = (std::size_t) FLAGS_lattice_cache_mb << 20;
+  m_useCache = use_cache || m_capacity > 0;
+  if (m_capacity > 0) {
+    tracer << "lattice cache budget=" << FLAGS_lattice_cache_mb << "MB\n";
+  }
   if (use_cache) {
-    cachedLattices.push_back (0);
     for (std::vector<Sid>::const_iterator sit = ids.begin(); sit != ids.end();
          ++sit) {
-      cachedLattices.push_back (LoadLattice (*sit) );
+      GetVectorLattice (*sit);
     }
     tracer << ids.size() << " vector lattices loaded\n";
   }
 }
 
-TupleArcFst* TuneSet::GetVectorLattice (const Sid s,
-                                        const bool use_cache) const {
-  if (use_cache) {
-    return cachedLattices[s];
+void TuneSet::Evict (std::vector<TupleArcFstPtr>& released) const {
+  // Only lattices in use are skipped, at most one per thread
+  LruList::iterator it = m_lru.begin();
+  while (m_capacity && m_size > m_capacity && it != m_lru.end() ) {
+    if (!it->fst.unique() ) {
+      ++it;
+      continue;
+    }
+    m_size -= it->bytes;
+    released.push_back (it->fst);
+    m_cache.erase (it->sid);
+    it = m_lru.erase (it);
+  }
+}
+
+TuneSet::TupleArcFstPtr TuneSet::GetVectorLattice (const Sid s) const {
+  if (!m_useCache) {
+    return TupleArcFstPtr (LoadLattice (s) );
   }
-  return LoadLattice (s);
+  boost::unique_lock<boost::mutex> lock (m_mutex);
+  for (;;) {
+    map<Sid, LruList::iterator>::iterator it = m_cache.find (s);
+    if (it != m_cache.end() ) {
+      m_lru.splice (m_lru.end(), m_lru, it->second);
+      return it->second->fst;
+    }
+    if (m_loading.find (s) == m_loading.end() ) {
+      break;
+    }
+    m_loaded.wait (lock);
+  }
+  m_loading.insert (s);
+  lock.unlock();
+  TupleArcFstPtr fst (LoadLattice (s) );
+  std::size_t bytes = LatticeBytes (*fst);
+  // Lattices released are only deleted once the lock is released
+  std::vector<TupleArcFstPtr> released;
+  lock.lock();
+  m_loading.erase (s);
+  CachedLattice c = { s, fst, bytes };
+  m_cache[s] = m_lru.insert (m_lru.end(), c);
+  m_size += bytes;
+  Evict (released);
+  m_loaded.notify_all();
+  lock.unlock();
+  return fst;
 }
@@ -46,55 +46,68 @@ public:
     lambda_ ( lambda ),
     direction_ ( direction ),
     nthreads_ ( rg.get<int> ( HifstConstants::kNThreads.c_str()) ) {
-    envelopes_.clear();
-    envelopes_.resize ( ts.sidMax );
+    prev.resize ( ts.sidMax );
+    initials.resize ( ts.sidMax );
+    sentenceBoundaries_.resize ( ts.sidMax );
     {
 #ifdef NO_MULTI_THREADING
 
       for ( Sid sidx = 0; sidx < ts.sidMax; sidx++ ) {
-        MertLattice<Arc> env ( sidx, ts.cachedLats[sidx], lambda_, direction_ );
-        envelopes_[sidx] = env.finalEnvelope;
+        ProcessSentence ( sidx, &*(ts.cachedLats[sidx]), bs );
       }
 
 #else
       ucam::util::TrivialThreadPool tp ( nthreads_ );
 
       for ( Sid sidx = 0; sidx < ts.sidMax; sidx++ ) {
-        MertLatticeWrap<Arc> envw ( sidx, &*(ts.cachedLats[sidx]), lambda_, direction_,
-                                    envelopes_ );
-        tp ( envw );
+        SentenceFunctor sf ( this, sidx, &*(ts.cachedLats[sidx]), bs );
+        tp ( sf );
       }
 
 #endif
     }
-    prev.resize ( envelopes_.size() );
-    initials.resize ( envelopes_.size() );
-    for ( Sid sidx = 0; sidx < envelopes_.size(); sidx++ ) {
-      MertEnvelope<Arc> env = envelopes_[sidx];
-      // iterate over lines
-      typename std::vector<MertLine<Arc> >::size_type i = 0;
-      // Trim sentence start and end markers from hypothesis
-      int offset = ( env.lines[i].t.size() < 2 ? 0 : 1 );
-      SentenceIdx h ( env.lines[i].t.begin() + offset,
-                      env.lines[i].t.end() - offset );
-      // CreateInitial()
-      prev[sidx] = bs.SentenceBleuStats ( sidx, h );
-      IntervalBoundary bd1 ( sidx, env.lines[i].x, prev[sidx] );
-      initials[sidx] = bd1;
-      // CreateInterval()
-      for ( i = 1; i < env.lines.size(); ++i ) {
-        offset = ( env.lines[i].t.size() < 2 ? 0 : 1 );
-        h.assign ( env.lines[i].t.begin() + offset, env.lines[i].t.end() - offset );
-	ucam::fsttools::BleuStats next = bs.SentenceBleuStats ( sidx, h );
-        IntervalBoundary bd ( sidx, env.lines[i].x, next - prev[sidx] );
-        //	std::cerr << bd << std::endl;
-        boundaries.push_back ( bd );
-        prev[sidx] = next;
-      }
+    // Same order as scoring sentences one after the other
+    for ( Sid sidx = 0; sidx < sentenceBoundaries_.size(); sidx++ ) {
+      boundaries.insert ( boundaries.end(), sentenceBoundaries_[sidx].begin(),
+                          sentenceBoundaries_[sidx].end() );
     }
+    std::vector<std::vector<IntervalBoundary> >().swap ( sentenceBoundaries_ );
     Surface ( bs );
   }
 
+  /**
+   * \brief Computes the envelope of a sentence and the bleu stats of its lines.
+   * Each sentence only writes its own entries, so sentences can run concurrently.
+   */
+  void ProcessSentence ( Sid sidx, fst::VectorFst<Arc>* fst,
+                         ucam::fsttools::BleuScorer& bs ) {
+    MertLattice<Arc> ml ( fst, lambda_, direction_ );
+    const MertEnvelope<Arc>& env = ml.finalEnvelope;
+    // consecutive lines often share a prefix, which is only counted once
+    ucam::fsttools::IncrementalBleuHits hits ( bs.RefNGrams ( sidx ) );
+    // iterate over lines
+    typename std::vector<MertLine<Arc> >::size_type i = 0;
+    SentenceIdx t;
+    env.Hypothesis ( i, t );
+    // Trim sentence start and end markers from hypothesis
+    int offset = ( t.size() < 2 ? 0 : 1 );
+    SentenceIdx h ( t.begin() + offset, t.end() - offset );
+    // CreateInitial()
+    prev[sidx] = bs.SentenceBleuStats ( sidx, h, hits );
+    IntervalBoundary bd1 ( sidx, env.lines[i].x, prev[sidx] );
+    initials[sidx] = bd1;
+    // CreateInterval()
+    for ( i = 1; i < env.lines.size(); ++i ) {
+      env.Hypothesis ( i, t );
+      offset = ( t.size() < 2 ? 0 : 1 );
+      h.assign ( t.begin() + offset, t.end() - offset );
+      ucam::fsttools::BleuStats next = bs.SentenceBleuStats ( sidx, h, hits );
+      IntervalBoundary bd ( sidx, env.lines[i].x, next - prev[sidx] );
+      sentenceBoundaries_[sidx].push_back ( bd );
+      prev[sidx] = next;
+    }
+  }
+
   // Compute Surface()
   void Surface ( ucam::fsttools::BleuScorer& bs ) {
     std::vector<IntervalBoundary> currentIBs ( initials );
@@ -141,10 +154,23 @@ public:
   }
 
 private:
+  struct SentenceFunctor {
+    SentenceFunctor ( LineOptimize *lo, Sid sidx, fst::VectorFst<Arc>* fst,
+                      ucam::fsttools::BleuScorer& bs ) :
+      lo_ ( lo ), sidx_ ( sidx ), fst_ ( fst ), bs_ ( &bs ) {}
+    void operator() () {
+      lo_->ProcessSentence ( sidx_, fst_, *bs_ );
+    }
+    LineOptimize *lo_;
+    Sid sidx_;
+    fst::VectorFst<Arc>* fst_;
+    ucam::fsttools::BleuScorer *bs_;
+  };
+
   int nthreads_;
   PARAMS32 lambda_;
   PARAMS32 direction_;
-  std::vector< MertEnvelope<Arc> > envelopes_;
+  std::vector< std::vector<IntervalBoundary> > sentenceBoundaries_;
   std::vector<ucam::fsttools::BleuStats> prev;
   std::vector<IntervalBoundary> initials;
   std::vector<IntervalBoundary> boundaries;
@@ -12,6 +12,8 @@
 #include <limits>
 #include <cstdlib>
 #include <unordered_map>
+#include <algorithm>
+#include <boost/shared_ptr.hpp>
 #include <bleu.hpp>
 
 namespace ucam {
@@ -22,21 +24,130 @@ typedef ucam::fsttools::Sid Sid;
 typedef ucam::fsttools::SentenceIdx SentenceIdx;
 typedef ucam::fsttools::PARAMS32 PARAMS32;
 
+/// Arc position of the back-pointers that record final weights
+const int kMertFinalArc = -1;
+
+/// Back-pointers added before the arena of a lattice is first compacted
+const std::size_t kMertMinCompaction = 1 << 16;
+
+/**
+ * \brief Arena of back-pointers shared by all the lines of one lattice.
+ * Each node records the arc (state and position) a line was propagated through,
+ * and the node of the line it was propagated from. Hypotheses and feature
+ * vectors are only recovered on demand, so propagating a line does not copy them.
+ * Nodes of discarded lines are only released by Compact.
+ * The lattice must outlive the arena.
+ */
+template <class Arc>
+class MertPaths {
+ public:
+  typedef typename Arc::StateId StateId;
+  typedef typename Arc::Weight Weight;
+
+  explicit MertPaths ( const fst::VectorFst<Arc>* fst ) : fst_ ( fst ) {}
+
+  /// Adds a node and returns its index. Parent -1 is the start state.
+  inline int Add ( int parent, StateId s, int arc ) {
+    Node n = { parent, s, arc };
+    nodes_.push_back ( n );
+    return nodes_.size() - 1;
+  }
+
+  /// Words (epsilons excluded) of the path ending at node
+  void Hypothesis ( int node, SentenceIdx& h ) const {
+    h.clear();
+    for ( ; node >= 0; node = nodes_[node].parent ) {
+      const Node& n = nodes_[node];
+      if ( n.arc == kMertFinalArc ) continue;
+      fst::ArcIterator< fst::VectorFst<Arc> > ai ( *fst_, n.state );
+      ai.Seek ( n.arc );
+      if ( ai.Value().ilabel != 0 ) h.push_back ( ai.Value().ilabel );
+    }
+    std::reverse ( h.begin(), h.end() );
+  }
+
+  /// Feature vector of the path ending at node
+  Weight PathWeight ( int node ) const {
+    std::vector<int> path;
+    for ( ; node >= 0; node = nodes_[node].parent ) path.push_back ( node );
+    Weight w = Weight::One();
+    for ( std::vector<int>::reverse_iterator it = path.rbegin();
+          it != path.rend(); ++it ) {
+      const Node& n = nodes_[*it];
+      if ( n.arc == kMertFinalArc ) {
+        w = fst::Times<float> ( fst_->Final ( n.state ), w );
+        continue;
+      }
+      fst::ArcIterator< fst::VectorFst<Arc> > ai ( *fst_, n.state );
+      ai.Seek ( n.arc );
+      w = fst::Times<float> ( ai.Value().weight, w );
+    }
+    return w;
+  }
+
+  inline std::size_t Size() const {
+    return nodes_.size();
+  }
+
+  /**
+   * \brief Releases the nodes that no live line goes back to.
+   * Nodes keep their relative order, so parents still come before their children.
+   * \param live Nodes of the lines still in use, replaced by their new index.
+   */
+  void Compact ( std::vector<int*> const& live ) {
+    std::vector<int> index ( nodes_.size(), -1 );
+    // Marks every node on the way back from a live one, until one already marked
+    for ( std::size_t k = 0; k < live.size(); ++k )
+      for ( int n = *live[k]; n >= 0 && index[n] < 0; n = nodes_[n].parent )
+        index[n] = 0;
+    int size = 0;
+    for ( std::size_t n = 0; n < nodes_.size(); ++n ) {
+      if ( index[n] < 0 ) continue;
+      index[n] = size;
+      Node node = nodes_[n];
+      if ( node.parent >= 0 ) node.parent = index[node.parent];
+      nodes_[size++] = node;
+    }
+    nodes_.resize ( size );
+    for ( std::size_t k = 0; k < live.size(); ++k )
+      if ( *live[k] >= 0 ) *live[k] = index[*live[k]];
+  }
+
+  /// Frees the memory not used by the nodes
+  void Shrink() {
+    std::vector<Node> ( nodes_ ).swap ( nodes_ );
+  }
+
+  /// Memory used by the nodes
+  inline std::size_t Bytes() const {
+    return nodes_.capacity() * sizeof ( Node );
+  }
+
+ private:
+  struct Node {
+    int parent;
+    StateId state;
+    int arc;
+  };
+  const fst::VectorFst<Arc>* fst_;
+  std::vector<Node> nodes_;
+};
+
 template <class Arc>
 class MertLine {
  public:
   MertLine() : x ( -std::numeric_limits<double>::infinity() ), y ( 0.0 ),
-    m ( 0.0 ) {}
+    m ( 0.0 ), node ( -1 ) {}
 
   MertLine ( double y, double m, Wid word ) : 
-    x ( -std::numeric_limits<double>::infinity() ), y ( y ), m ( m ) {}
+    x ( -std::numeric_limits<double>::infinity() ), y ( y ), m ( m ),
+    node ( -1 ) {}
 
   double x; // x-intercept of left-adjacent line
   double y; // y-intercept of line
   double m; // slope of line
-  SentenceIdx t; // partial translation hypothesis associated with line
+  int node; // last back-pointer of the partial hypothesis (see MertPaths)
   double score; //translation score (quality)
-  typename Arc::Weight weight;
 };
 
 template <class Arc>
@@ -44,6 +155,8 @@ class MertEnvelope {
  public:
 	// lines that define the envelope / convex hull
   std::vector<MertLine<Arc> > lines; 
+  // back-pointers of the hypotheses of the lines
+  boost::shared_ptr<MertPaths<Arc> > paths;
 
   static bool GradientSortPredicate ( const MertLine<Arc>& line1,
                                       const MertLine<Arc>& line2 ) {
@@ -57,14 +170,15 @@ class MertEnvelope {
     sort ( lines.begin(), lines.end(), GradientSortPredicate );
   }
 
-  // compute upper envelope of lines in array
+  // compute upper envelope of lines in array, in place
   void SweepLine() {
     SortLines();
     int j = 0;
 
     for ( typename std::vector<MertLine<Arc> >::size_type i = 0; i < lines.size(); i++ ) {
-      MertLine<Arc> l = lines[i];
-      l.x = -std::numeric_limits<double>::infinity();
+      // j <= i, so lines[j - 1] is never the line being placed
+      MertLine<Arc>& l = lines[i];
+      double x = -std::numeric_limits<double>::infinity();
       if ( 0 < j ) {
         if ( lines[j - 1].m == l.m ) {
           if ( l.y <= lines[j - 1].y )
@@ -72,24 +186,38 @@ class MertEnvelope {
           --j;
         }
         while ( 0 < j ) {
-          l.x = ( l.y - lines[j - 1].y ) / ( lines[j - 1].m - l.m );
+          x = ( l.y - lines[j - 1].y ) / ( lines[j - 1].m - l.m );
 
-          if ( lines[j - 1].x < l.x )
+          if ( lines[j - 1].x < x )
             break;
 
           --j;
         }
         if ( 0 == j )
-          l.x = -std::numeric_limits<double>::infinity();
-
-        lines[j++] = l;
-      } else {
-        lines[j++] = l;
+          x = -std::numeric_limits<double>::infinity();
       }
+      l.x = x;
+      if ( j != static_cast<int> ( i ) ) lines[j] = l;
+      ++j;
     }
     lines.resize ( j );
   }
 
+  // words of the hypothesis of line i
+  void Hypothesis ( std::size_t i, SentenceIdx& h ) const {
+    paths->Hypothesis ( lines[i].node, h );
+  }
+
+  // feature vector of the hypothesis of line i
+  typename Arc::Weight Weight ( std::size_t i ) const {
+    return paths->PathWeight ( lines[i].node );
+  }
+
+  void swap ( MertEnvelope<Arc>& e ) {
+    lines.swap ( e.lines );
+    paths.swap ( e.paths );
+  }
+
   // returns lines that constitute the envelope as a string
   std::string ToString ( bool show_hypothesis = false ) {
     std::ostringstream oss;
@@ -103,10 +231,15 @@ class MertEnvelope {
           << " m=[" << std::right << std::setw ( 12 ) << lines[i].m << "]";
 
       if ( show_hypothesis ) {
-        oss << " t=[" << lines[i].t << "]";
+        SentenceIdx t;
+        Hypothesis ( i, t );
+        oss << " t=[";
+        for ( std::size_t k = 0; k < t.size(); ++k )
+          oss << ( k ? " " : "" ) << t[k];
+        oss << "]";
       }
 
-      oss << " w=[" << lines[i].weight << "]";
+      oss << " w=[" << Weight ( i ) << "]";
       oss << std::endl;
     }
 
@@ -115,6 +248,12 @@ class MertEnvelope {
 
 };
 
+/**
+ * \brief Computes the envelope of a topologically sorted lattice along
+ * lambda + gamma * direction.
+ * Lines only carry a back-pointer to their hypothesis, and the envelope
+ * of each state is released as soon as it has been propagated.
+ */
 template <class Arc>
 class MertLattice {
  public:
@@ -122,7 +261,9 @@ class MertLattice {
   std::vector<ucam::fsttools::BleuStats> prev;
 
   MertLattice (fst::VectorFst<Arc>* fst, const PARAMS32& lambda, const PARAMS32& direction ) :
-    fst_ ( fst ), lambda_ ( lambda ), direction_ ( direction ) {
+    fst_ ( fst ), lambda_ ( lambda ), direction_ ( direction ),
+    paths_ ( new MertPaths<Arc> ( fst ) ),
+    compactAt_ ( kMertMinCompaction ) {
     finalEnvelope.lines.clear();
     // InializeEnvelopes()
     envelopes_.clear();
@@ -137,32 +278,51 @@ class MertLattice {
       for ( fst::ArcIterator < fst::VectorFst<Arc> > ai ( *fst, si.Value() );
             !ai.Done(); ai.Next() ) {
         const Arc& a = ai.Value();
-        PropagateEnvelope ( s, a.nextstate, a.weight, a.ilabel );
+        PropagateEnvelope ( s, a.nextstate, a.weight, ai.Position() );
       }
       if ( fst->Final ( s ) != Arc::Weight::Zero() ) {
         PropagateEnvelope ( s, fst->NumStates(), fst->Final ( s ) );
       }
-      envelopes_[s].lines.clear();
+      std::vector<MertLine<Arc> >().swap ( envelopes_[s].lines );
+      if ( paths_->Size() >= compactAt_ ) Compact();
     }
     // ComputeFinalEnvelopes()
     envelopes_[fst->NumStates()].SweepLine();
-    //
-    finalEnvelope = envelopes_[fst->NumStates()];
-    envelopes_[fst->NumStates()].lines.clear();
+    // Only the hypotheses of the final lines are kept
+    Compact();
+    paths_->Shrink();
+    finalEnvelope.lines.swap ( envelopes_[fst->NumStates()].lines );
+    finalEnvelope.paths = paths_;
+  }
+
+  /**
+   * \brief Releases the back-pointers of lines discarded so far.
+   * Lines of the states not yet propagated are live.
+   * Compacts again once the arena has doubled.
+   */
+  void Compact() {
+    std::vector<int*> live;
+    for ( std::size_t s = 0; s < envelopes_.size(); ++s ) {
+      std::vector<MertLine<Arc> >& lines = envelopes_[s].lines;
+      for ( std::size_t k = 0; k < lines.size(); ++k ) live.push_back ( &lines[k].node );
+    }
+    paths_->Compact ( live );
+    compactAt_ = std::max ( kMertMinCompaction, 2 * paths_->Size() );
   }
 
   void PropagateEnvelope ( const typename Arc::StateId& src,
                            const typename Arc::StateId& trg, const typename Arc::Weight& weight,
-                           const Wid& w = 0 ) {
-    for ( unsigned int i = 0; i < envelopes_[src].lines.size(); ++i ) {
-      MertLine<Arc> line ( envelopes_[src].lines[i] );
-      line.y += fst::DotProduct<float> ( weight, lambda_ ) * -1;
-      line.m += fst::DotProduct<float> ( weight, direction_ ) * -1;
-      line.weight = fst::Times<float> ( weight, line.weight );
-      if ( w != 0 ) {
-        line.t.push_back ( w );
-      }
-      envelopes_[trg].lines.push_back ( line );
+                           int arc = kMertFinalArc ) {
+    const std::vector<MertLine<Arc> >& in = envelopes_[src].lines;
+    std::vector<MertLine<Arc> >& out = envelopes_[trg].lines;
+    const float dy = fst::DotProduct<float> ( weight, lambda_ ) * -1;
+    const float dm = fst::DotProduct<float> ( weight, direction_ ) * -1;
+    for ( unsigned int i = 0; i < in.size(); ++i ) {
+      out.push_back ( in[i] );
+      MertLine<Arc>& line = out.back();
+      line.y += dy;
+      line.m += dm;
+      line.node = paths_->Add ( in[i].node, src, arc );
     }
   }
 
@@ -171,6 +331,9 @@ class MertLattice {
   std::vector<MertEnvelope<Arc> > envelopes_;
   PARAMS32 lambda_;
   PARAMS32 direction_;
+  boost::shared_ptr<MertPaths<Arc> > paths_;
+  /// Arena size at which it is compacted next
+  std::size_t compactAt_;
 };
 
 
@@ -184,7 +347,7 @@ class MertLatticeWrap {
 
   void operator() () {
     MertLattice<Arc> ml ( fst_, lambda_, direction_ );
-    env_[sid_] = ml.finalEnvelope;
+    env_[sid_].swap ( ml.finalEnvelope );
   };
 
   Sid sid_;
@@ -39,6 +39,15 @@
 #include "fstutils.mapper.hpp"
 #include "fstutils.multiunion.hpp"
 #include "fstio.hpp"
+#include "task.disambig.unimapcache.hpp"
+
+#include "taskinterface.hpp"
+#include "data.stats.hpp"
+#include "data.lm.hpp"
+#include "data-main.disambig.hpp"
+#include "task.loadlm.hpp"
+#include "task.loadunimap.hpp"
+#include "task.disambig.hpp"
 
 #include <idbridge.hpp>
 #include <hifst_enumerate_vocab.hpp>
@@ -155,6 +164,161 @@ TEST ( fstutils, phicompose ) {
   EXPECT_TRUE ( Equivalent ( fst::RPhiCompose ( a, c, PHI ), a ) );
 };
 
+namespace googletesting {
+
+///Unimap expansion as DisambigTask used to do it: rho composition, then OOV tagging.
+fst::VectorFst<fst::StdArc> *composeUnimap ( fst::VectorFst<fst::StdArc> const& a
+    , fst::VectorFst<fst::StdArc> const& unimap
+    , std::unordered_set<std::string> const& vcb ) {
+  fst::VectorFst<fst::StdArc> *output = new fst::VectorFst<fst::StdArc>
+  ( fst::RRhoCompose<fst::StdArc> ( a, unimap ) );
+  for ( fst::StateIterator< fst::VectorFst<fst::StdArc> > si ( *output ); !si.Done();
+        si.Next() ) {
+    for ( fst::MutableArcIterator< fst::VectorFst<fst::StdArc> > ai ( output
+          , si.Value() ); !ai.Done(); ai.Next() ) {
+      fst::StdArc arc = ai.Value();
+      if ( vcb.find ( ucam::util::toString<unsigned> ( arc.olabel ) ) == vcb.end() ) {
+        arc.ilabel = arc.olabel;
+        arc.olabel = OOV;
+        arc.weight = 0;
+        ai.SetValue ( arc );
+      }
+    }
+  }
+  return output;
+};
+
+}
+
+///Cached unimap expansions must build exactly the same fst as the composition
+TEST ( fstutils, unimapexpansioncache ) {
+  fst::VectorFst<fst::StdArc> unimap;
+  unimap.AddState();
+  unimap.SetStart ( 0 );
+  unimap.SetFinal ( 0, fst::StdArc::Weight::One() );
+  unimap.AddArc ( 0, fst::StdArc ( 4, 40, 0.25, 0 ) );
+  unimap.AddArc ( 0, fst::StdArc ( 3, 3, 0.5, 0 ) );
+  unimap.AddArc ( 0, fst::StdArc ( 3, 30, 1, 0 ) );
+  unimap.AddArc ( 0, fst::StdArc ( 3, 31, 2, 0 ) );
+  unimap.AddArc ( 0, fst::StdArc ( RHO, RHO, 0, 0 ) );
+  unimap.AddArc ( 0, fst::StdArc ( OOV, OOV, 0, 0 ) );
+  fst::ArcSort ( &unimap, fst::ILabelCompare<fst::StdArc>() );
+  std::unordered_set<std::string> vcb;
+  vcb.insert ( "3" );
+  vcb.insert ( "30" );
+  vcb.insert ( "40" );
+  vcb.insert ( "5" );
+  vcb.insert ( ucam::util::toString<unsigned> ( OOV ) );
+  // A string with an epsilon, a word only matching rho, an oov and a tagged alternative
+  fst::VectorFst<fst::StdArc> a;
+  for ( unsigned k = 0; k < 7; ++k ) a.AddState();
+  a.SetStart ( 0 );
+  a.AddArc ( 0, fst::StdArc ( 3, 3, 0, 1 ) );
+  a.AddArc ( 1, fst::StdArc ( 0, 0, 0, 2 ) );
+  a.AddArc ( 2, fst::StdArc ( 5, 5, 0, 3 ) );
+  a.AddArc ( 3, fst::StdArc ( 6, 6, 0, 4 ) );
+  a.AddArc ( 4, fst::StdArc ( OOV, OOV, 0, 5 ) );
+  a.AddArc ( 5, fst::StdArc ( 4, 4, 0, 6 ) );
+  a.SetFinal ( 6, fst::StdArc::Weight::One() );
+  // Not a string: states are found in a different order than they were added
+  fst::VectorFst<fst::StdArc> b;
+  for ( unsigned k = 0; k < 4; ++k ) b.AddState();
+  b.SetStart ( 3 );
+  b.AddArc ( 3, fst::StdArc ( 4, 4, 1, 2 ) );
+  b.AddArc ( 3, fst::StdArc ( 3, 3, 2, 1 ) );
+  b.AddArc ( 2, fst::StdArc ( 3, 3, 0, 0 ) );
+  b.AddArc ( 1, fst::StdArc ( 5, 5, 0, 0 ) );
+  b.SetFinal ( 0, 0.5 );
+  ucam::fsttools::UnimapExpansionCache<fst::StdArc> cache;
+  EXPECT_TRUE ( cache.reset ( unimap, vcb ) );
+  fst::VectorFst<fst::StdArc> *inputs[] = { &a, &b, &a };
+  for ( unsigned k = 0; k < 3; ++k ) {
+    boost::scoped_ptr< fst::VectorFst<fst::StdArc> > expected
+    ( googletesting::composeUnimap ( *inputs[k], unimap, vcb ) );
+    fst::VectorFst<fst::StdArc> output;
+    cache.expand ( *inputs[k], &output );
+    EXPECT_TRUE ( fst::Equal ( *expected, output ) );
+  }
+  // 0, 3, 4, 5, 6 and OOV
+  EXPECT_EQ ( cache.size(), 6 );
+  fst::VectorFst<fst::StdArc> empty, output;
+  cache.expand ( empty, &output );
+  EXPECT_EQ ( output.NumStates(), 0 );
+  // Only flowers can be expanded
+  fst::VectorFst<fst::StdArc> c ( unimap );
+  c.AddArc ( 0, fst::StdArc ( 0, 3, 0, 0 ) );
+  EXPECT_FALSE ( cache.reset ( c, vcb ) );
+  EXPECT_EQ ( cache.size(), 0 );
+};
+
+namespace googletesting {
+
+///Bigram model over words 3 and 4 shared by several tests
+const std::string kBigramArpa =
+  "-1\t3\t0\n"
+  "-10\t4\t0\n"
+  "-100\t</s>\t0\n"
+  "0\t<s>\t0\n"
+  "-2\t3 4\t0\n"
+  "-3\t4 3\t0\n";
+
+}
+
+///Recasing sentence after sentence, with unimap expansions and lm scores kept
+///across sentences, must match recasing each sentence with a new task
+TEST ( fstutils, disambig_sharedcaches ) {
+  using namespace HifstConstants;
+  typedef ucam::fsttools::DisambigData Data;
+  googletesting::writeArpa ( "mylm", googletesting::kBigramArpa );
+  {
+    // 3 may be recased as 4, and 5 as 3
+    uu::oszfstream o ( "myunimap" );
+    o << "3 3 0.5 4 0.5" << std::endl;
+    o << "5 5 0.5 3 0.5" << std::endl;
+    o.close();
+  }
+  std::unordered_map<std::string, boost::any> v;
+  v[kRecaserLmLoad] = std::string ( "mylm" );
+  v[kRecaserLmFeatureweight] = std::string ( "1" );
+  v[kRecaserLmWps] = std::string ( "0" );
+  v[kRecaserLmWordmap] = std::string ( "" );
+  v[kRecaserLmCacheSize] = unsigned ( 4 );
+  v[kRecaserUnimapLoad] = std::string ( "myunimap" );
+  v[kRecaserUnimapWeight] = float ( 1.0f );
+  v[kRecaserPrune] = std::string ( "byshortestpath,1" );
+  const uu::RegistryPO rg ( v );
+  v[kRecaserLmCacheSize] = unsigned ( 0 );
+  const uu::RegistryPO nocache ( v );
+  Data d;
+  ucam::fsttools::LoadLanguageModelTask<Data> loadlm ( rg, kRecaserLmLoad
+      , kRecaserLmFeatureweight, kRecaserLmWps, kRecaserLmWordmap );
+  ucam::fsttools::LoadUnimapTask<Data, fst::LexStdArc> loadunimap ( rg
+      , kRecaserUnimapLoad, kRecaserLmLoad );
+  loadlm.run ( d );
+  loadunimap.run ( d );
+  ucam::fsttools::DisambigTask<Data, fst::LexStdArc> recaser ( rg
+      , kRecaserInput, kRecaserOutput, kRecaserLmLoad, kRecaserUnimapLoad );
+  std::string sentences[] = {"1 3 3 5 2", "1 5 4 2", "1 3 5 2", "1 3 3 5 2"};
+  for ( unsigned k = 0; k < 4; ++k ) {
+    fst::VectorFst<fst::LexStdArc> input;
+    fst::string2fst<fst::LexStdArc> ( sentences[k], &input );
+    d.fsts[kRecaserInput] = &input;
+    recaser.run ( d );
+    fst::VectorFst<fst::LexStdArc> output ( * static_cast<fst::VectorFst<fst::LexStdArc> *>
+                                            ( d.fsts[kRecaserOutput] ) );
+    EXPECT_GT ( output.NumStates(), 0 );
+    ucam::fsttools::DisambigTask<Data, fst::LexStdArc> fresh ( nocache
+        , kRecaserInput, kRecaserOutput, kRecaserLmLoad, kRecaserUnimapLoad );
+    fresh.run ( d );
+    EXPECT_TRUE ( fst::Equal ( output
+                               , * static_cast<fst::VectorFst<fst::LexStdArc> *>
+                               ( d.fsts[kRecaserOutput] ) ) );
+  }
+  delete d.stats;
+  bfs::remove ( bfs::path ( "mylm" ) );
+  bfs::remove ( bfs::path ( "myunimap" ) );
+};
+
 ///Trivial testing simple language model application with kenlm
 TEST ( fstutils, applylmonthefly ) {
   {
@@ -216,6 +380,265 @@ TEST ( fstutils, applylmonthefly ) {
   bfs::remove ( bfs::path ( "mylm" ) );
 };
 
+namespace googletesting {
+
+/**
+ * \brief Writes an arpa file with the given n-grams (see writeArpa)
+ * and loads it with kenlm.
+ * Words are mapped into idb. The file is removed once loaded.
+ */
+inline lm::ngram::Model *loadArpa ( std::string const& ngrams
+                                    , ucam::fsttools::IdBridge& idb ) {
+  writeArpa ( "mylm", ngrams );
+  lm::ngram::Config kenlm_config;
+  lm::HifstEnumerateVocab<ucam::util::WordMapper> hev ( idb, NULL );
+  kenlm_config.enumerate_vocab = &hev;
+  lm::ngram::Model *model = new lm::ngram::Model ( "mylm" , kenlm_config );
+  bfs::remove ( bfs::path ( "mylm" ) );
+  return model;
+};
+
+///Collects every path of an acyclic fst as its output labels and total cost
+inline void collectPaths ( fst::VectorFst<fst::StdArc> const& a
+                           , std::map<std::string, float> *paths
+                           , fst::StdArc::StateId s = fst::kNoStateId
+                           , std::string const& prefix = ""
+                           , float cost = 0 ) {
+  if ( s == fst::kNoStateId ) s = a.Start();
+  if ( a.Final ( s ) != fst::StdArc::Weight::Zero() )
+    ( *paths ) [prefix] = cost + a.Final ( s ).Value();
+  for ( fst::ArcIterator<fst::VectorFst<fst::StdArc> > ai ( a, s ); !ai.Done();
+        ai.Next() ) {
+    fst::StdArc const& arc = ai.Value();
+    collectPaths ( a, paths, arc.nextstate
+                   , prefix + ucam::util::toString<unsigned> ( arc.olabel ) + " "
+                   , cost + arc.weight.Value() );
+  }
+};
+
+}
+
+///Pruned composition must match composition followed by pruning
+TEST ( fstutils, applylmonthefly_pruned ) {
+  fst::VectorFst<fst::StdArc> c;
+  for ( unsigned k = 0; k < 5; ++k ) c.AddState();
+  c.SetStart ( 0 );
+  c.AddArc ( 0, fst::StdArc ( 1, 1, 0, 1 ) );
+  c.AddArc ( 1, fst::StdArc ( 3, 3, 0, 2 ) );
+  c.AddArc ( 1, fst::StdArc ( 4, 4, 0, 2 ) );
+  c.AddArc ( 2, fst::StdArc ( 3, 3, 0, 3 ) );
+  c.AddArc ( 2, fst::StdArc ( 4, 4, 0, 3 ) );
+  c.AddArc ( 3, fst::StdArc ( 2, 2, 0, 4 ) );
+  c.SetFinal ( 4, fst::StdArc::Weight::One() );
+  std::unordered_set<fst::StdArc::Label> epsilons;
+  ucam::fsttools::IdBridge idb;
+  lm::ngram::Model *model = googletesting::loadArpa ( googletesting::kBigramArpa
+                            , idb );
+  fst::MakeWeight<fst::StdArc> mw;
+  fst::ApplyLanguageModelOnTheFly<fst::StdArc> f (*model, epsilons, false, 1 , 0
+                                                  , idb, mw);
+  fst::VectorFst<fst::StdArc> *full = f.run ( c );
+  fst::VectorFst<fst::StdArc> best;
+  fst::ShortestPath ( *full, &best );
+  std::map<std::string, float> fullpaths;
+  googletesting::collectPaths ( *full, &fullpaths );
+  EXPECT_EQ ( fullpaths.size(), 4u );
+  // From keeping only the best path to keeping everything
+  float beams[] = {0.5, 5, 15, 1000};
+  unsigned sizes[] = {1, 2, 3, 4};
+  for ( unsigned k = 0; k < 4; ++k ) {
+    fst::VectorFst<fst::StdArc> expected ( *full );
+    fst::Prune<fst::StdArc> ( &expected, beams[k] );
+    f.setPruning ( beams[k], 0, 1 );
+    fst::VectorFst<fst::StdArc> *pruned = f.run ( c );
+    EXPECT_TRUE ( Equivalent ( expected, *pruned ) );
+    std::map<std::string, float> expectedpaths, prunedpaths;
+    googletesting::collectPaths ( expected, &expectedpaths );
+    googletesting::collectPaths ( *pruned, &prunedpaths );
+    EXPECT_EQ ( prunedpaths.size(), sizes[k] );
+    ASSERT_EQ ( prunedpaths.size(), expectedpaths.size() );
+    for ( std::map<std::string, float>::const_iterator itx = prunedpaths.begin();
+          itx != prunedpaths.end(); ++itx ) {
+      ASSERT_TRUE ( expectedpaths.find ( itx->first ) != expectedpaths.end() );
+      EXPECT_NEAR ( itx->second, expectedpaths[itx->first], 1e-3 );
+    }
+    delete pruned;
+  }
+  // Limiting states per layer is not exact, but keeps the best path here
+  f.setPruning ( std::numeric_limits<float>::max(), 1, 0 );
+  fst::VectorFst<fst::StdArc> *pruned = f.run ( c );
+  EXPECT_EQ ( pruned->NumStates(), 5 );
+  EXPECT_TRUE ( Equivalent ( best, *pruned ) );
+  delete model;
+  delete full;
+  delete pruned;
+};
+
+///State tables used by on-the-fly composition, including growth and reuse
+TEST ( fstutils, applylmonthefly_statetables ) {
+  fst::CompactIdTable t ( 4 );
+  fst::LmHistoryTable h ( 3, 4 );
+  for ( unsigned round = 0; round < 2; ++round ) {
+    for ( unsigned k = 0; k < 1000; ++k ) {
+      std::pair<unsigned, bool> r = t.insert ( ( uint64_t ) k << 32 | k % 7, k );
+      EXPECT_FALSE ( r.second );
+      unsigned words[] = {k, k % 7, 0};
+      EXPECT_EQ ( h ( words ), k );
+    }
+    EXPECT_EQ ( t.size(), 1000 );
+    EXPECT_EQ ( h.size(), 1000 );
+    for ( unsigned k = 0; k < 1000; ++k ) {
+      std::pair<unsigned, bool> r = t.insert ( ( uint64_t ) k << 32 | k % 7, 0 );
+      EXPECT_TRUE ( r.second );
+      EXPECT_EQ ( r.first, k );
+      unsigned words[] = {k, k % 7, 0};
+      EXPECT_EQ ( h ( words ), k );
+    }
+    t.clear();
+    h.clear();
+    EXPECT_EQ ( t.size(), 0 );
+    EXPECT_EQ ( h.size(), 0 );
+  }
+};
+
+///Scores through the shared cache must match scores from the model
+TEST ( fstutils, applylmonthefly_scorecache ) {
+  fst::VectorFst<fst::StdArc> c;
+  for ( unsigned k = 0; k < 6; ++k ) c.AddState();
+  c.SetStart ( 0 );
+  c.AddArc ( 0, fst::StdArc ( 1, 1, 0, 1 ) );
+  for ( unsigned k = 1; k < 4; ++k ) {
+    c.AddArc ( k, fst::StdArc ( 3, 3, 0, k + 1 ) );
+    c.AddArc ( k, fst::StdArc ( 4, 4, 0, k + 1 ) );
+  }
+  c.AddArc ( 4, fst::StdArc ( 2, 2, 0, 5 ) );
+  c.SetFinal ( 5, fst::StdArc::Weight::One() );
+  std::unordered_set<fst::StdArc::Label> epsilons;
+  ucam::fsttools::IdBridge idb;
+  // Backoffs so that unseen bigrams are scored differently
+  lm::ngram::Model *model = googletesting::loadArpa ( "-1\t3\t-0.5\n"
+                            "-10\t4\t-0.25\n"
+                            "-100\t</s>\t0\n"
+                            "0\t<s>\t0\n"
+                            "-2\t3 4\t0\n"
+                            "-3\t4 3\t0\n", idb );
+  fst::MakeWeight<fst::StdArc> mw;
+  fst::ApplyLanguageModelOnTheFly<fst::StdArc> f (*model, epsilons, false, 1 , 0
+                                                  , idb, mw);
+  fst::VectorFst<fst::StdArc> *expected = f.run ( c );
+  // Large enough for everything, and so small that entries collide
+  std::size_t budgets[] = { 1 << 20, 0 };
+  for ( unsigned k = 0; k < 2; ++k ) {
+    fst::LmScoreCache<lm::ngram::State> cache ( budgets[k], 2 );
+    f.setScoreCache ( &cache );
+    uint64_t hits = 0, misses = 0;
+    for ( unsigned round = 0; round < 2; ++round ) {
+      fst::VectorFst<fst::StdArc> *output = f.run ( c );
+      EXPECT_TRUE ( fst::Equal ( *expected, *output ) );
+      delete output;
+      if ( round == 0 ) {
+        hits = cache.hits();
+        misses = cache.misses();
+        EXPECT_GT ( misses, 0 );
+      }
+    }
+    if ( k == 0 ) {
+      // Second round is fully cached
+      EXPECT_EQ ( cache.misses(), misses );
+      EXPECT_EQ ( cache.hits(), 2 * hits + misses );
+    }
+    cache.clear();
+    misses = cache.misses();
+    fst::VectorFst<fst::StdArc> *output = f.run ( c );
+    EXPECT_TRUE ( fst::Equal ( *expected, *output ) );
+    EXPECT_GT ( cache.misses(), misses );
+    delete output;
+    f.setScoreCache ( NULL );
+  }
+  delete expected;
+  delete model;
+};
+
+///Dense ids, outliers and missing ids
+TEST ( fstutils, idbridge ) {
+  ucam::fsttools::IdBridge idb;
+  idb.add ( 1, 10 );
+  idb.add ( 5000, 11 );
+  idb.add ( 4000000000U, 12 );
+  idb.addOutput ( 3, 13 );
+  EXPECT_EQ ( idb.map ( 1 ), 10 );
+  EXPECT_EQ ( idb.map ( 5000 ), 11 );
+  EXPECT_EQ ( idb.map ( 4000000000U ), 12 );
+  EXPECT_EQ ( idb.map ( 2 ), 0 );
+  EXPECT_EQ ( idb.map ( 70000 ), 0 );
+  EXPECT_EQ ( idb.map ( 3999999999U ), 0 );
+  EXPECT_EQ ( idb.mapOutput ( 3 ), 13 );
+  EXPECT_EQ ( idb.mapOutput ( 1 ), 0 );
+  idb.add ( 1, 14 );
+  EXPECT_EQ ( idb.map ( 1 ), 14 );
+};
+
+namespace googletesting {
+
+///Former hash-based IdBridge, to compare with.
+struct HashIdBridge {
+  std::unordered_map<unsigned, unsigned> mapper;
+  inline unsigned const map ( unsigned idx ) const {
+    std::unordered_map<unsigned, unsigned>::const_iterator itx = mapper.find ( idx );
+    if ( itx != mapper.end() ) return itx->second;
+    return 0;
+  };
+};
+
+template<class IdBridgeT>
+fst::VectorFst<fst::StdArc> *timedApplyLm ( lm::ngram::Model& model
+    , fst::VectorFst<fst::StdArc> const& c
+    , IdBridgeT const& idb
+    , std::string const& name ) {
+  fst::MakeWeight<fst::StdArc> mw;
+  fst::ApplyLanguageModelOnTheFly<fst::StdArc, fst::MakeWeight<fst::StdArc>
+  , lm::ngram::Model, IdBridgeT> f ( model, false, 1, 0, idb, mw );
+  clock_t t0 = clock();
+  fst::VectorFst<fst::StdArc> *output = f.run ( c );
+  clock_t t1 = clock();
+  std::size_t numarcs = 0;
+  for ( fst::StateIterator< fst::VectorFst<fst::StdArc> > si ( *output ); !si.Done();
+        si.Next() )
+    numarcs += output->NumArcs ( si.Value() );
+  FORCELINFO ( name << ": " << numarcs << " arcs scored, "
+               << ( t1 - t0 ) * 1e9 / CLOCKS_PER_SEC / ( numarcs ? numarcs : 1 )
+               << " ns/arc" );
+  return output;
+};
+
+}
+
+///Benchmark: per-arc cost of on-the-fly composition with the dense and the hash IdBridge.
+TEST ( fstutils, applylmonthefly_idbridge_benchmark ) {
+  const unsigned numstates = 20000, width = 20;
+  fst::VectorFst<fst::StdArc> c;
+  c.AddState();
+  c.SetStart ( 0 );
+  for ( unsigned k = 1; k <= numstates; ++k ) {
+    c.AddState();
+    for ( unsigned j = 0; j < width; ++j )
+      c.AddArc ( k - 1, fst::StdArc ( 3 + ( j + k ) % 2, 3 + ( j + k ) % 2, 0, k ) );
+  }
+  c.SetFinal ( numstates, fst::StdArc::Weight::One() );
+  ucam::fsttools::IdBridge idb;
+  boost::scoped_ptr<lm::ngram::Model> model ( googletesting::loadArpa (
+        googletesting::kBigramArpa, idb ) );
+  googletesting::HashIdBridge hidb;
+  for ( unsigned k = 0; k < 5; ++k ) hidb.mapper[k] = idb.map ( k );
+  fst::VectorFst<fst::StdArc> *hashed = googletesting::timedApplyLm ( *model, c,
+                                        hidb, "hash idbridge" );
+  fst::VectorFst<fst::StdArc> *dense = googletesting::timedApplyLm ( *model, c, idb,
+                                       "dense idbridge" );
+  EXPECT_TRUE ( fst::Equal ( *hashed, *dense ) );
+  delete hashed;
+  delete dense;
+};
+
 namespace googletesting {
 //Just for test purposes, a functor that would simply delete weights.
 struct RemoveWeight {
@@ -30,6 +30,7 @@
 
 #include "addresshandler.hpp"
 #include "taskinterface.hpp"
+#include "multithreading.hpp"
 
 #include "defs.grammar.hpp"
 #include "defs.ssgrammar.hpp"
@@ -133,11 +134,21 @@ TEST ( HifstCykParserTask, basic_test ) {
   EXPECT_EQ ( d.cykdata->cykgrid ( 2, 1, 2, 0 ), 4 );
   ASSERT_EQ ( d.cykdata->cykgrid ( 2, 1, 1 ).size(), 1 );
   EXPECT_EQ ( d.cykdata->cykgrid ( 2, 1, 1, 0 ), 5 );
-  //test the cyk backpointers?
+  //Testing the cyk backpointers: one set per rule in the cell.
+  ASSERT_EQ ( d.cykdata->bp ( 1, 0, 2 ).size(), 2 );
+  ASSERT_EQ ( d.cykdata->bp ( 2, 1, 1 ).size(), 1 );
+  ASSERT_EQ ( d.cykdata->bp ( 2, 1, 1 ) [0].size(), 6 );
+  //3_4 points to the words 3 at (1,0) and 4 at (2,0)
+  EXPECT_EQ ( d.cykdata->bp ( 2, 1, 1 ) [0][1], 1 );
+  EXPECT_EQ ( d.cykdata->bp ( 2, 1, 1 ) [0][2], 0 );
+  EXPECT_EQ ( d.cykdata->bp ( 2, 1, 1 ) [0][4], 2 );
+  EXPECT_EQ ( d.cykdata->bp ( 2, 1, 1 ) [0][5], 0 );
+  EXPECT_EQ ( d.cykdata->bp ( 2, 4, 1 ).size(), 0 );
 }
 
 TEST ( HifstCykParserTask, cykgridfunctor ) {
   uh::CYKgrid cyk;
+  cyk.resize ( 2, 4 );
   EXPECT_EQ ( cyk.size(), 0 );
   //e.g. Adding rule 1 at cell 1,0,2
   cyk.Add ( 1, 0, 2, 1 );
@@ -156,12 +167,17 @@ TEST ( HifstCykParserTask, cykgridfunctor ) {
   EXPECT_EQ ( cyk ( 0, 0, 0, 0 ), 10 );
   //Any other position should be empty for now, e.g.
   ASSERT_EQ ( cyk ( 2, 0, 3 ).size(), 0 );
+  //... including positions outside the chart
+  ASSERT_EQ ( cyk ( 3, 0, 3 ).size(), 0 );
+  ASSERT_EQ ( cyk ( 1, 2, 2 ).size(), 0 );
+  EXPECT_EQ ( cyk.size(), 2 );
   cyk.reset();
   EXPECT_EQ ( cyk.size(), 0 );
 }
 
 TEST ( HifstCykParserTask, cykbpfunctor ) {
   uh::CYKbackpointers bp;
+  bp.resize ( 1, 3 );
   uh::cykparser_rulebpcoordinates_t aux;
   aux.push_back ( 1 );
   aux.push_back ( 1 );
@@ -189,6 +205,105 @@ TEST ( HifstCykParserTask, cykbpfunctor ) {
   EXPECT_EQ ( bp.size(), 0 );
 }
 
+/// Reference implementation of the cyk grid and backpointers, hashed by cell.
+struct HashedCYKchart {
+  unordered_map<uint, uh::ssgrammar_listofrules_t> cykgrid;
+  unordered_map<uint, uh::cykparser_ruledependencies_t> bp;
+  inline uint key ( uint cc, uint x, uint y ) {
+    return APBASETAG + cc * APCCTAG + x * APXTAG + y * APYTAG;
+  }
+};
+
+/**
+ * \brief Fills the chart as the cyk parser would for a sentence of the given length
+ * (words in the bottom row, a few rules per cell with backpointers to lower cells),
+ * and then reads all the cells as fillChart does. The same rules are added to
+ * the hashed and the dense structures.
+ */
+template<class AddT, class ReadT>
+unsigned fillTestChart ( unsigned nnt, unsigned length, AddT add,
+                         ReadT read ) {
+  for ( unsigned x = 0; x < length; ++x ) add ( nnt + x + 1, x, 0, x, 0 );
+  for ( unsigned y = 0; y < length; ++y )
+    for ( unsigned x = 0; x + y < length; ++x )
+      for ( unsigned cc = 1; cc <= nnt; ++cc )
+        for ( unsigned k = 0; k < ( x * 7 + y * 3 + cc ) % 4; ++k )
+          add ( cc, x, y, x * 1000 + y * 10 + k, y ? ( k % y ) + 1 : 0 );
+  unsigned checksum = 0;
+  for ( unsigned y = 0; y < length; ++y )
+    for ( unsigned x = 0; x + y < length; ++x )
+      for ( unsigned n = 0; n <= y; ++n )
+        for ( unsigned cc = 1; cc <= nnt + length; ++cc )
+          checksum += read ( cc, x, n );
+  return checksum;
+}
+
+TEST ( HifstCykParserTask, densechart ) {
+  const unsigned nnt = 3, length = 80;
+  HashedCYKchart h;
+  uh::CYKgrid grid;
+  uh::CYKbackpointers bp;
+  grid.resize ( nnt, length );
+  bp.resize ( nnt, length );
+  uh::cykparser_rulebpcoordinates_t coord;
+  clock_t t0 = clock();
+  unsigned c1 = fillTestChart ( nnt, length,
+  [&] ( uint cc, uint x, uint y, uint idx, uint n ) {
+    h.cykgrid[h.key ( cc, x, y )].push_back ( idx );
+    if ( !n ) return;
+    coord.clear();
+    for ( unsigned k = 0; k < n; ++k ) {
+      coord.push_back ( 1 );
+      coord.push_back ( x );
+      coord.push_back ( k );
+    }
+    h.bp[h.key ( cc, x, y )].push_back ( coord );
+  }, [&] ( uint cc, uint x, uint y ) {
+    return h.cykgrid[h.key ( cc, x, y )].size();
+  } );
+  clock_t t1 = clock();
+  unsigned c2 = fillTestChart ( nnt, length,
+  [&] ( uint cc, uint x, uint y, uint idx, uint n ) {
+    grid.Add ( cc, x, y, idx );
+    if ( !n ) return;
+    coord.clear();
+    for ( unsigned k = 0; k < n; ++k ) {
+      coord.push_back ( 1 );
+      coord.push_back ( x );
+      coord.push_back ( k );
+    }
+    bp.Add ( cc, x, y, coord );
+  }, [&] ( uint cc, uint x, uint y ) {
+    return grid ( cc, x, y ).size();
+  } );
+  clock_t t2 = clock();
+  LINFO ( "Hashed chart:" << ( t1 - t0 ) * 1000 / CLOCKS_PER_SEC <<
+          "ms; dense chart:" << ( t2 - t1 ) * 1000 / CLOCKS_PER_SEC << "ms" );
+  EXPECT_EQ ( c1, c2 );
+  //Now check all cells are identical.
+  for ( unsigned y = 0; y < length; ++y )
+    for ( unsigned x = 0; x + y < length; ++x )
+      for ( unsigned cc = 0; cc <= nnt + length; ++cc ) {
+        uint key = h.key ( cc, x, y );
+        ASSERT_TRUE ( h.cykgrid[key] == grid ( cc, x, y ) );
+        uh::CYKbpCell cell = bp ( cc, x, y );
+        ASSERT_EQ ( h.bp[key].size(), cell.size() );
+        for ( unsigned i = 0; i < cell.size(); ++i ) {
+          ASSERT_EQ ( h.bp[key][i].size(), cell[i].size() );
+          for ( unsigned j = 0; j < cell[i].size(); ++j )
+            EXPECT_EQ ( h.bp[key][i][j], cell[i][j] );
+        }
+        EXPECT_TRUE ( h.bp[key] == uh::cykparser_ruledependencies_t ( cell ) );
+      }
+  //Resizing clears the chart but keeps it usable.
+  grid.resize ( nnt, 5 );
+  bp.resize ( nnt, 5 );
+  EXPECT_EQ ( grid.size(), 0 );
+  EXPECT_EQ ( bp.size(), 0 );
+  EXPECT_EQ ( grid ( 1, 0, 4 ).size(), 0 );
+  EXPECT_EQ ( bp ( 1, 0, 4 ).size(), 0 );
+}
+
 #ifndef GMAINTEST
 
 int main ( int argc, char **argv ) {
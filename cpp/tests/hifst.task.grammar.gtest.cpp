@@ -30,12 +30,14 @@
 
 #include "addresshandler.hpp"
 #include "taskinterface.hpp"
+#include "multithreading.hpp"
 #include "data.stats.hpp"
 #include "data.grammar.hpp"
 #include "task.grammar.hpp"
 
 namespace uf = ucam::fsttools;
 namespace uh = ucam::hifst;
+namespace bfs = boost::filesystem;
 
 ///Trivial Data class with necessary variables for correct compilation
 struct TaskData {
@@ -57,6 +59,38 @@ TEST ( HifstGrammar, task ) {
   EXPECT_EQ ( grammar->vpos[0].p, 12 );
 }
 
+/// Loads a grammar with several threads in small chunks, so that sorted runs have to be merged,
+/// and checks it matches the grammar loaded with one thread.
+TEST ( HifstGrammar, parallelload ) {
+  std::stringstream rules;
+  for ( unsigned k = 0; k < 500; ++k )
+    rules << ( k % 3 ? "X " : "S " ) << k % 17 << ( k % 5 ? "_X1 " : " " )
+          << k << ( k % 5 ? "_X1 " : " " ) << k % 7 << std::endl;
+  rules << "X X1 X1 0" << std::endl;
+  std::stringstream ss1 ( rules.str() ), ss2 ( rules.str() );
+  uh::GrammarTask<TaskData> serial ( "", "" );
+  serial.load ( ss1 );
+  uh::GrammarTask<TaskData> parallel ( "", "", 4, 256 );
+  parallel.load ( ss2 );
+  uh::GrammarData *g1 = serial.getGrammarData();
+  uh::GrammarData *g2 = parallel.getGrammarData();
+  ASSERT_EQ ( g1->sizeofvpos, 501 );
+  ASSERT_EQ ( g2->sizeofvpos, 501 );
+  EXPECT_EQ ( g1->filecontents, g2->filecontents );
+  EXPECT_TRUE ( g1->patterns == g2->patterns );
+  EXPECT_TRUE ( g1->vcat == g2->vcat );
+  std::multiset<std::string> r1, r2;
+  for ( unsigned k = 0; k < g1->sizeofvpos; ++k ) {
+    EXPECT_EQ ( g1->getRHSSource ( k ), g2->getRHSSource ( k ) );
+    r1.insert ( g1->getRule ( k ) );
+    r2.insert ( g2->getRule ( k ) );
+    // Rules with the same source keep the order of the file
+    if ( k && g2->getRHSSource ( k - 1 ) == g2->getRHSSource ( k ) )
+      EXPECT_LT ( g2->vpos[k - 1].order, g2->vpos[k].order );
+  }
+  EXPECT_TRUE ( r1 == r2 );
+}
+
 TEST ( HifstGrammar, data_grammar ) {
   uh::GrammarTask<TaskData> gt ( "", "" );
   std::stringstream ss;
@@ -104,6 +138,78 @@ TEST ( HifstGrammar, data_grammar ) {
   EXPECT_EQ ( mappings.size(), 0 );
 }
 
+/// Compiles a grammar, maps it back and checks all accessors match the text grammar.
+TEST ( HifstGrammar, compiled ) {
+  uh::GrammarTask<TaskData> gt ( "", "" );
+  std::stringstream ss;
+  ss << "X 35_47 43_55_58 0.45" << std::endl << "S S_X S_X 0.37" << std::endl;
+  ss << "X 3_X1_5_X2 X2_<dr>_X1_4 -1.5" << std::endl << "X 7 <oov> 0" << std::endl;
+  ss << "S X1 X1 0" << std::endl;
+  gt.load ( ss );
+  gt.writeCompiled ( "compiled.grammar" );
+  EXPECT_TRUE ( uh::CompiledGrammar::isCompiled ( "compiled.grammar" ) );
+  uh::GrammarTask<TaskData> gtc ( "", "" );
+  gtc.loadCompiled ( "compiled.grammar" );
+  uh::GrammarData *text = gt.getGrammarData();
+  uh::GrammarData *grammar = gtc.getGrammarData();
+  ASSERT_EQ ( grammar->sizeofvpos, text->sizeofvpos );
+  EXPECT_EQ ( grammar->patterns, text->patterns );
+  EXPECT_EQ ( grammar->categories, text->categories );
+  for ( unsigned k = 0; k < text->sizeofvpos; ++k ) {
+    EXPECT_EQ ( grammar->getRule ( k ), text->getRule ( k ) );
+    EXPECT_EQ ( grammar->getLHS ( k ), text->getLHS ( k ) );
+    EXPECT_EQ ( grammar->getRHSSource ( k ), text->getRHSSource ( k ) );
+    EXPECT_EQ ( grammar->getRHSSource ( k, 0 ), text->getRHSSource ( k, 0 ) );
+    EXPECT_EQ ( grammar->getRHSSource ( k, 1 ), text->getRHSSource ( k, 1 ) );
+    EXPECT_EQ ( grammar->getRHSSplitSource ( k ), text->getRHSSplitSource ( k ) );
+    EXPECT_EQ ( grammar->getRHSSourceSize ( k ), text->getRHSSourceSize ( k ) );
+    EXPECT_EQ ( grammar->getRHSTranslation ( k ), text->getRHSTranslation ( k ) );
+    EXPECT_EQ ( grammar->getRHSSplitTranslation ( k ),
+                text->getRHSSplitTranslation ( k ) );
+    EXPECT_EQ ( grammar->getRHSTranslationSize ( k ),
+                text->getRHSTranslationSize ( k ) );
+    EXPECT_EQ ( grammar->getWeight ( k ), text->getWeight ( k ) );
+    EXPECT_EQ ( grammar->isPhrase ( k ), text->isPhrase ( k ) );
+    EXPECT_EQ ( grammar->getIdx ( k ), text->getIdx ( k ) );
+    unordered_map<uint, uint> m1, m2;
+    grammar->getMappings ( k, &m1 );
+    text->getMappings ( k, &m2 );
+    EXPECT_EQ ( m1, m2 );
+    std::vector<int> labels;
+    uh::compileRuleTarget ( text->getRHSSplitTranslation ( k ), labels );
+    uh::RuleTarget t1 = text->targets ( k ), t2 = grammar->targets ( k );
+    ASSERT_EQ ( t1.size(), labels.size() );
+    ASSERT_EQ ( t2.size(), labels.size() );
+    for ( unsigned j = 0; j < labels.size(); ++j ) {
+      EXPECT_EQ ( t1[j], labels[j] );
+      EXPECT_EQ ( t2[j], labels[j] );
+    }
+  }
+  bfs::remove ( bfs::path ( "compiled.grammar" ) );
+}
+
+/// Rule targets as lattice labels
+TEST ( HifstGrammar, ruletargets ) {
+  std::vector<std::string> translation;
+  boost::algorithm::split ( translation, "X2_<dr>_X1_4_<s>_</s>_<oov>_<sep>",
+                            boost::algorithm::is_any_of ( "_" ) );
+  std::vector<int> labels;
+  uh::compileRuleTarget ( translation, labels );
+  int expected[] = {uh::kRuleTargetNonTerminal, DR, uh::kRuleTargetNonTerminal, 4, 1, 2, OOV, SEP};
+  ASSERT_EQ ( labels.size(), 8 );
+  for ( unsigned k = 0; k < labels.size(); ++k ) EXPECT_EQ ( labels[k], expected[k] );
+  uh::RuleTargets targets;
+  EXPECT_EQ ( targets.size(), 0 );
+  targets.add ( translation );
+  translation.resize ( 1 );
+  targets.add ( translation );
+  ASSERT_EQ ( targets.size(), 2 );
+  EXPECT_EQ ( targets ( 0 ).size(), 8 );
+  EXPECT_EQ ( targets ( 0 ) [3], 4 );
+  EXPECT_EQ ( targets ( 1 ).size(), 1 );
+  EXPECT_EQ ( targets ( 1 ) [0], uh::kRuleTargetNonTerminal );
+}
+
 ///getSize function
 TEST ( HifstGrammar, getSize ) {
   EXPECT_EQ ( uh::getSize ( "" ), 0 );
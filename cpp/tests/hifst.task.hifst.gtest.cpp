@@ -31,6 +31,7 @@
 
 #include "addresshandler.hpp"
 #include "taskinterface.hpp"
+#include "multithreading.hpp"
 
 #include "tropical-sparse-tuple-weight.h"
 #include "tropical-sparse-tuple-weight-decls.h"
@@ -103,13 +104,19 @@ class HifstTest : public testing::Test {
     v_[kHifstLocalpruneLmFeatureweights] = unsigned (1);
     v_[kHifstLocalpruneLmWordpenalty] = unsigned (0);
     v_[kHifstLocalpruneNumstates] = unsigned ( 1000 );
+    v_[kHifstLocalpruneMemorybudget] = unsigned ( 0 );
+    v_[kHifstLocalpruneMemorybudgetWeight] = float ( 9.0 );
     v_[kHifstPrune] = float ( 1.0 );
+    v_[kHifstPruneComposition] = std::string ("no");
+    v_[kHifstPruneCompositionNumstates] = unsigned ( 0 );
+    v_[kHifstPruneCompositionHeuristic] = float ( 1.0 );
     v_[kHifstUsepdt] = std::string ("no");
     v_[kHifstRtnopt] = std::string ("yes");
     v_[kHifstWritertn] = std::string ( "" );
     v_[kHifstAlilatsmode] = std::string ("no");
     v_[kHifstAlilatsmodeLinks] = std::string ("rules");
     v_[kHifstOptimizecells] = std::string ("yes");
+    v_[kHifstCellthreads] = unsigned ( 1 );
     v_[kReferencefilterLoad] = std::string ("");
     const uu::RegistryPO rg ( v_ );
     //We need to generate some rules. It is easy to do so with GrammarTask, so we do it. We need to keep these tasks during all the lifespan of the tests, though.
@@ -216,6 +223,116 @@ TEST_F ( HifstTest, basic_translation2 ) {
               "1 3 4 5 2 || 1 3 4 5 2 || 0,0\n1 3 4 5 2 || 1 3 4 5 2 || 0,0\n1 3 4 5 2 || 1 3 4 5 2 || 0,0\n" );
 };
 
+/**
+ *\brief Cells built concurrently must yield exactly the same lattice
+ */
+
+TEST_F ( HifstTest, cellthreads ) {
+  using namespace HifstConstants;
+  v_[kHifstReplacefstbyarcNumstates] = unsigned (
+        std::numeric_limits<unsigned>::max() );
+  v_[kHifstReplacefstbyarcNonterminals] = std::string ( "X" );
+  v_[kHifstReplacefstbyarcExceptions] = std::string ( "S" );
+  fst::VectorFst<fst::LexStdArc> sequential;
+  {
+    const uu::RegistryPO rg ( v_ );
+    uh::HiFSTTask<uh::HifstTaskData<> > hifst ( rg );
+    hifst.run ( d_ );
+    sequential = * static_cast<fst::VectorFst<fst::LexStdArc> *>
+                 (d_.fsts[kHifstLatticeStore]);
+  }
+  // Parse again, hifst frees cyk data
+  cyk_->run ( d_ );
+  v_[kHifstCellthreads] = unsigned ( 3 );
+  const uu::RegistryPO rg ( v_ );
+  uh::HiFSTTask<uh::HifstTaskData<> > hifst ( rg );
+  hifst.run ( d_ );
+  EXPECT_TRUE ( d_.fsts[kHifstLatticeStore] != NULL );
+  fst::VectorFst<fst::LexStdArc> *parallel =
+    static_cast<fst::VectorFst<fst::LexStdArc> *> (d_.fsts[kHifstLatticeStore]);
+  EXPECT_EQ ( parallel->NumStates(), sequential.NumStates() );
+  EXPECT_TRUE ( fst::Equal ( *parallel, sequential ) );
+  std::stringstream ss;
+  fst::printstrings ( *parallel, &ss );
+  EXPECT_EQ ( ss.str(),
+              "1 3 4 5 2 || 1 3 4 5 2 || 0,0\n1 3 4 5 2 || 1 3 4 5 2 || 0,0\n1 3 4 5 2 || 1 3 4 5 2 || 0,0\n" );
+};
+
+namespace googletesting {
+
+///Trigram model over words 3, 4 and 5, as in basic_translation3
+const std::string kTrigramArpa =
+  "-1\t3\t0\n"
+  "-10\t4\t0\n"
+  "-100\t5\t0\n"
+  "-1000\t</s>\t0\n"
+  "0\t<s>\t0\n"
+  "-10000\t3 4\t0\n"
+  "-100000\t4 </s>\t0\n"
+  "-1000000\t3 4 </s>\n";
+
+}
+
+/**
+ *\brief With a memory budget, cells built concurrently must be pruned as if built one by one
+ */
+
+TEST_F ( HifstTest, cellthreads_memorybudget ) {
+  using namespace HifstConstants;
+  googletesting::writeArpa ( "mylm", googletesting::kTrigramArpa );
+  v_[kLmWordmap] = std::string ( "" );
+  v_[kHifstLocalpruneEnable] = std::string ( "yes" );
+  v_[kHifstLocalpruneConditions] = std::string ( "X,1,1,9" );
+  v_[kHifstLocalpruneLmLoad] = std::string ( "mylm" );
+  v_[kHifstLocalpruneLmFeatureweights] = std::string ( "1" );
+  v_[kHifstLocalpruneLmWordpenalty] = std::string ( "0" );
+  v_[kHifstLocalpruneMemorybudget] = unsigned ( 1 );
+  v_[kHifstReplacefstbyarcNumstates] = unsigned (
+        std::numeric_limits<unsigned>::max() );
+  v_[kHifstReplacefstbyarcNonterminals] = std::string ( "X" );
+  v_[kHifstReplacefstbyarcExceptions] = std::string ( "S" );
+  fst::VectorFst<fst::LexStdArc> sequential;
+  {
+    const uu::RegistryPO rg ( v_ );
+    uf::LoadLanguageModelTask<uh::HifstTaskData<> > loadlm ( rg
+        , kHifstLocalpruneLmLoad, kHifstLocalpruneLmFeatureweights
+        , kHifstLocalpruneLmWordpenalty );
+    uh::HiFSTTask<uh::HifstTaskData<> > hifst ( rg );
+    loadlm.run ( d_ );
+    hifst.run ( d_ );
+    sequential = * static_cast<fst::VectorFst<fst::LexStdArc> *>
+                 (d_.fsts[kHifstLatticeStore]);
+  }
+  EXPECT_GT ( sequential.NumStates(), 0 );
+  cyk_->run ( d_ );
+  v_[kHifstCellthreads] = unsigned ( 3 );
+  const uu::RegistryPO rg ( v_ );
+  uf::LoadLanguageModelTask<uh::HifstTaskData<> > loadlm ( rg
+      , kHifstLocalpruneLmLoad, kHifstLocalpruneLmFeatureweights
+      , kHifstLocalpruneLmWordpenalty );
+  uh::HiFSTTask<uh::HifstTaskData<> > hifst ( rg );
+  loadlm.run ( d_ );
+  hifst.run ( d_ );
+  EXPECT_TRUE ( d_.fsts[kHifstLatticeStore] != NULL );
+  EXPECT_TRUE ( fst::Equal ( * static_cast<fst::VectorFst<fst::LexStdArc> *>
+                             (d_.fsts[kHifstLatticeStore]), sequential ) );
+  bfs::remove ( bfs::path ( "mylm" ) );
+};
+
+/**
+ *\brief A memory budget only works together with local pruning
+ */
+
+TEST_F ( HifstTest, memorybudget_withoutlocalprune ) {
+  using namespace HifstConstants;
+  v_[kHifstLocalpruneMemorybudget] = unsigned ( 1 );
+  const uu::RegistryPO rg ( v_ );
+  ucam::util::user_check_ok = true;
+  uh::HiFSTTask<uh::HifstTaskData<> > hifst ( rg );
+  EXPECT_EQ ( ucam::util::user_check_ok, false );
+  ucam::util::user_check_ok = true;
+};
+
 /**
  *\brief Basic test for HifstTask
  */
@@ -388,6 +505,57 @@ TEST ( HifstTest2, localconditions ) {
   EXPECT_EQ ( lpc2 ( 3, 5, 49, w ), false );
 };
 
+///Pruning is forced and tightened as the memory used by cell lattices gets closer to the budget.
+TEST ( HifstTest2, localpruningbudget ) {
+  float w = 3.0f;
+  uh::LocalPruningBudget none;
+  EXPECT_FALSE ( none.enabled() );
+  EXPECT_FALSE ( none ( false, w ) );
+  EXPECT_TRUE ( none ( true, w ) );
+  EXPECT_EQ ( w, 3.0f );
+  EXPECT_TRUE ( none.fits ( std::numeric_limits<std::size_t>::max() ) );
+  // 1000 bytes, weight 8 at half the budget.
+  uh::LocalPruningBudget b ( 1000, 8.0f );
+  EXPECT_TRUE ( b.enabled() );
+  b.add ( 400 );
+  // Under the threshold, static conditions decide.
+  EXPECT_FALSE ( b ( false, w ) );
+  EXPECT_TRUE ( b ( true, w ) );
+  EXPECT_EQ ( w, 3.0f );
+  b.add ( 100 );
+  // At the threshold, every lattice is pruned...
+  EXPECT_TRUE ( b ( false, w ) );
+  EXPECT_EQ ( w, 8.0f );
+  // ... unless static conditions prune harder.
+  w = 3.0f;
+  EXPECT_TRUE ( b ( true, w ) );
+  EXPECT_EQ ( w, 3.0f );
+  b.add ( 250 );
+  EXPECT_TRUE ( b ( false, w ) );
+  EXPECT_EQ ( w, 4.0f );
+  EXPECT_TRUE ( b.fits ( 250 ) );
+  EXPECT_FALSE ( b.fits ( 251 ) );
+  b.add ( 500 );
+  EXPECT_TRUE ( b ( true, w ) );
+  EXPECT_EQ ( w, 0.0f );
+  b.clear();
+  EXPECT_EQ ( b.used(), 0u );
+  EXPECT_FALSE ( b ( false, w ) );
+};
+
+TEST ( HifstTest2, latticebytes ) {
+  fst::VectorFst<fst::StdArc> a;
+  EXPECT_EQ ( uh::latticeBytes ( a ), 0u );
+  a.AddState();
+  a.AddState();
+  a.SetStart ( 0 );
+  a.SetFinal ( 1, fst::StdArc::Weight::One() );
+  a.AddArc ( 0, fst::StdArc ( 3, 3, 0, 1 ) );
+  a.AddArc ( 0, fst::StdArc ( 4, 4, 0, 1 ) );
+  EXPECT_EQ ( uh::latticeBytes ( a ), 2 * uh::kLatticeStateBytes
+              + 2 * sizeof ( fst::StdArc ) );
+};
+
 ///Testing the class ExpandedNumStatesRTN. Given a list of FSAs, it estimates the number of states of the equivalent expanded FSA.
 TEST ( HifstTest2, expandednumstatesrtn ) {
   uh::ExpandedNumStatesRTN<fst::StdArc> test;
@@ -518,6 +686,98 @@ TEST ( HifstTest2, optimize ) {
   EXPECT_EQ (c.NumStates(), 2);
 }
 
+/// Counts loads instead of loading actual language models
+struct FakeKenLMDataLoader {
+  unsigned *count;
+  uf::KenLMData *operator() () const {
+    ++*count;
+    uf::KenLMData *kld = new uf::KenLMData;
+    kld->id = uf::newLanguageModelId();
+    return kld;
+  };
+};
+
+/// Throws as kenlm does for missing files, until told to load
+struct FailingKenLMDataLoader {
+  unsigned *count;
+  bool *fail;
+  uf::KenLMData *operator() () const {
+    ++*count;
+    if ( *fail ) throw std::runtime_error ( "no such file" );
+    uf::KenLMData *kld = new uf::KenLMData;
+    kld->id = uf::newLanguageModelId();
+    return kld;
+  };
+};
+
+///Models are shared while in use, and released least recently used first
+TEST ( HifstTest2, lmregistry ) {
+  unsigned count = 0;
+  FakeKenLMDataLoader loader = { &count };
+  uf::LanguageModelRegistry r ( 20, 1 );
+  uf::LanguageModelRegistry::KenLMDataPtr a = r.get ( "a", 10, loader );
+  EXPECT_EQ ( r.get ( "a", 10, loader ), a );
+  EXPECT_EQ ( count, 1 );
+  uf::LanguageModelRegistry::KenLMDataPtr b = r.get ( "b", 10, loader );
+  EXPECT_NE ( a->id, b->id );
+  // Over the cap, but a and b are in use
+  uf::LanguageModelRegistry::KenLMDataPtr c = r.get ( "c", 10, loader );
+  EXPECT_EQ ( r.size(), 3 );
+  EXPECT_EQ ( r.memory(), 30 );
+  a.reset();
+  b.reset();
+  r.get ( "b", 10, loader );
+  // Models not in use are released, least recently used first, until under the cap
+  uf::LanguageModelRegistry::KenLMDataPtr d = r.get ( "d", 10, loader );
+  EXPECT_EQ ( count, 4 );
+  EXPECT_EQ ( r.size(), 2 );
+  EXPECT_EQ ( r.memory(), 20 );
+  r.get ( "c", 10, loader );
+  EXPECT_EQ ( count, 4 );
+  // Background loading
+  r.prefetch ( "e", 0, loader );
+  r.get ( "e", 0, loader );
+  EXPECT_EQ ( count, 5 );
+  EXPECT_EQ ( r.numLoads(), 5 );
+}
+
+///A failed load is forgotten, so that the model can be requested again
+TEST ( HifstTest2, lmregistry_failedload ) {
+  unsigned count = 0;
+  bool fail = true;
+  FailingKenLMDataLoader loader = { &count, &fail };
+  {
+    uf::LanguageModelRegistry r ( 0, 1 );
+    EXPECT_THROW ( r.get ( "a", 10, loader ), std::runtime_error );
+    EXPECT_EQ ( r.size(), 0 );
+    EXPECT_EQ ( r.memory(), 0 );
+    // Failures in the background are not fatal either
+    r.prefetch ( "b", 10, loader );
+  }
+  EXPECT_EQ ( count, 2 );
+  fail = false;
+  uf::LanguageModelRegistry r ( 0, 1 );
+  r.prefetch ( "b", 10, loader );
+  EXPECT_TRUE ( r.get ( "b", 10, loader ).get() != NULL );
+  EXPECT_TRUE ( r.get ( "a", 10, loader ).get() != NULL );
+  EXPECT_EQ ( r.numLoads(), 2 );
+}
+
+///Models are charged to the registry with their score cache
+TEST ( HifstTest2, lmregistry_bytes ) {
+  googletesting::writeArpa ( "mylm", googletesting::kTrigramArpa );
+  uf::KenLMDataLoader loader;
+  loader.file = "mylm";
+  loader.cachesize = 0;
+  std::size_t filesize = bfs::file_size ( "mylm" );
+  EXPECT_GT ( filesize, 0 );
+  EXPECT_EQ ( loader.bytes(), filesize );
+  loader.cachesize = 2;
+  EXPECT_EQ ( loader.bytes(), filesize + ( std::size_t ( 2 ) << 20 ) );
+  bfs::remove ( bfs::path ( "mylm" ) );
+  EXPECT_EQ ( loader.bytes(), std::size_t ( 2 ) << 20 );
+}
+
 #ifndef GMAINTEST
 
 int main ( int argc, char **argv ) {
@@ -53,6 +53,44 @@ class DataForPatternsToInstancesTask {
   boost::shared_ptr<uf::StatsData> stats;
 };
 
+namespace googletesting {
+
+typedef unordered_map<std::string, std::vector< std::pair <unsigned, unsigned> > >
+InstanceMap;
+
+/**
+ * \brief Instantiates one pattern at one position, as a reference.
+ * Every non-final X covers 1 to gapmaxspan words, final ones just one.
+ */
+inline void instantiate ( const std::vector<std::string>& pattern
+                          , const std::vector<std::string>& ss
+                          , unsigned maxspan, unsigned gapmaxspan
+                          , unsigned start, unsigned pp, unsigned ps
+                          , std::vector<std::string> instance, InstanceMap& out ) {
+  if ( pp == pattern.size() ) {
+    out[boost::algorithm::join ( instance, "_" )].push_back
+    ( std::pair<unsigned, unsigned> ( start, pattern.size() - 1 ) );
+    return;
+  }
+  bool final = ( pp + 1 == pattern.size() );
+  unsigned maxgap = ( pattern[pp] == "X" && !final ) ? gapmaxspan : 1;
+  instance.push_back ( pattern[pp] == "X" ? "X" : "" );
+  for ( unsigned k = 1; k <= maxgap; ++k ) {
+    if ( ps + k > ss.size() || ps + k - start > maxspan ) break;
+    if ( pattern[pp] == "w" ) instance.back() = ss[ps];
+    instantiate ( pattern, ss, maxspan, gapmaxspan, start, pp + 1, ps + k
+                  , instance, out );
+  }
+};
+
+///Sorts positions, so that instance maps can be compared.
+inline void sortInstances ( InstanceMap& m ) {
+  for ( InstanceMap::iterator itx = m.begin(); itx != m.end(); ++itx )
+    std::sort ( itx->second.begin(), itx->second.end() );
+};
+
+};
+
 ///Basic test for PatternsToInstancesTask class.
 TEST ( HifstPatternsToInstances, basic_test ) {
   uh::GrammarData gd;
@@ -77,6 +115,83 @@ TEST ( HifstPatternsToInstances, basic_test ) {
   EXPECT_TRUE ( d.hpinstances.find ( "4_X_2" ) != d.hpinstances.end() );
 }
 
+///The trie walk must produce the same instances as instantiating each pattern on its own.
+TEST ( HifstPatternsToInstances, trie ) {
+  uh::GrammarData gd;
+  DataForPatternsToInstancesTask d;
+  d.grammar = &gd;
+  unordered_map<std::string, boost::any> v;
+  v[HifstConstants::kPatternstoinstancesMaxspan] = unsigned ( 5 );
+  v[HifstConstants::kPatternstoinstancesGapmaxspan] = unsigned ( 2 );
+  v[HifstConstants::kPatternstoinstancesStore] = std::string ( "" );
+  const uu::RegistryPO rg ( v );
+  uh::PatternsToInstancesTask<DataForPatternsToInstancesTask> ptask ( rg );
+  const char *patterns[] = {"w", "X", "w_w", "w_X", "X_w", "X_X", "w_X_w"
+                            , "w_w_X", "X_w_X", "w_X_w_X_w", "X_w_X_w", "w_w_w_w_w_w"
+                           };
+  for ( unsigned k = 0; k < sizeof ( patterns ) / sizeof ( patterns[0] ); ++k )
+    gd.patterns.insert ( patterns[k] );
+  d.sentence = "1 3 4 5 2 3 4 3";
+  ptask.instantiatePatternsHash ( d );
+  std::vector<std::string> ss;
+  boost::algorithm::split ( ss, d.sentence, boost::algorithm::is_any_of ( " " ) );
+  googletesting::InstanceMap expected;
+  for ( std::unordered_set<std::string>::iterator itx = gd.patterns.begin();
+        itx != gd.patterns.end(); ++itx ) {
+    std::vector<std::string> pattern;
+    boost::algorithm::split ( pattern, *itx, boost::algorithm::is_any_of ( "_" ) );
+    for ( unsigned j = 0; j < ss.size(); ++j )
+      googletesting::instantiate ( pattern, ss, 5, 2, j, 0, j
+                                   , std::vector<std::string>(), expected );
+  }
+  googletesting::sortInstances ( expected );
+  googletesting::sortInstances ( d.hpinstances );
+  EXPECT_EQ ( d.hpinstances.size(), expected.size() );
+  EXPECT_TRUE ( d.hpinstances == expected );
+  //Pattern ending with a non-terminal covers just one more word.
+  EXPECT_TRUE ( d.hpinstances.find ( "5_2_X" ) != d.hpinstances.end() );
+  EXPECT_TRUE ( d.hpinstances.find ( "4_X" ) != d.hpinstances.end() );
+  EXPECT_TRUE ( d.hpinstances.find ( "3_4_3_X" ) == d.hpinstances.end() );
+  //Longer than maxspan.
+  EXPECT_TRUE ( d.hpinstances.find ( "1_3_4_5_2_3" ) == d.hpinstances.end() );
+}
+
+///Instances that no rule has as source side are dropped, except for single words.
+TEST ( HifstPatternsToInstances, filter ) {
+  uh::GrammarData gd;
+  std::string rules = "X 1_X1_4 1_X1_4 0\nS S1_X2 S1_X2 0\nX 7 7 0\n";
+  const char *sources[] = {"1_X1_4", "S1_X2", "7"};
+  uh::posindex vpos[3];
+  for ( unsigned k = 0; k < 3; ++k ) {
+    vpos[k].p = rules.find ( std::string ( " " ) + sources[k] + " " ) + 1;
+    vpos[k].o = 2;
+    vpos[k].order = k;
+  }
+  gd.sources.build ( rules.c_str(), vpos, 3 );
+  EXPECT_EQ ( gd.sources.size(), 3 );
+  DataForPatternsToInstancesTask d;
+  d.grammar = &gd;
+  unordered_map<std::string, boost::any> v;
+  v[HifstConstants::kPatternstoinstancesMaxspan] = unsigned ( 5 );
+  v[HifstConstants::kPatternstoinstancesGapmaxspan] = unsigned ( 2 );
+  v[HifstConstants::kPatternstoinstancesStore] = std::string ( "" );
+  const uu::RegistryPO rg ( v );
+  uh::PatternsToInstancesTask<DataForPatternsToInstancesTask> ptask ( rg );
+  gd.patterns.insert ( "w" );
+  gd.patterns.insert ( "w_X_w" );
+  gd.patterns.insert ( "X_X" );
+  gd.patterns.insert ( "w_w" );
+  d.sentence = "1 3 4 5 2";
+  ptask.instantiatePatternsHash ( d );
+  // 5 words, 1_X_4 and X_X
+  EXPECT_EQ ( d.hpinstances.size(), 7 );
+  EXPECT_TRUE ( d.hpinstances.find ( "1_X_4" ) != d.hpinstances.end() );
+  EXPECT_TRUE ( d.hpinstances.find ( "1_X_5" ) == d.hpinstances.end() );
+  EXPECT_TRUE ( d.hpinstances.find ( "1_3" ) == d.hpinstances.end() );
+  EXPECT_TRUE ( d.hpinstances.find ( "2" ) != d.hpinstances.end() );
+  EXPECT_EQ ( d.hpinstances["X_X"].size(), 7 );
+}
+
 #ifndef GMAINTEST
 
 int main ( int argc, char **argv ) {
@@ -28,6 +28,7 @@
 #include "params.hpp"
 #include "addresshandler.hpp"
 #include "taskinterface.hpp"
+#include "multithreading.hpp"
 
 #include "defs.grammar.hpp"
 #include "defs.ssgrammar.hpp"
@@ -175,6 +176,84 @@ TEST ( HifstSentenceSpecificGrammarTask, basic_test ) {
   EXPECT_TRUE ( aux.find ( "X 3_4 3_4 0" ) != aux.end() );
 }
 
+///Rules are found through the source index, with the same results as a binary search over the grammar.
+TEST ( HifstSentenceSpecificGrammarTask, sourceindex ) {
+  EXPECT_EQ ( uh::sourceHash ( "3_V12_5 3_V12_5 0" ), uh::sourceHash ( "3_X_5" ) );
+  EXPECT_EQ ( uh::sourceHash ( "S1_X2" ), uh::sourceHash ( "X_X" ) );
+  EXPECT_NE ( uh::sourceHash ( "3_X_5" ), uh::sourceHash ( "3_X" ) );
+  EXPECT_NE ( uh::sourceHash ( "3_4" ), uh::sourceHash ( "34" ) );
+  unordered_map<std::string, boost::any> v;
+  v[HifstConstants::kGrammarFeatureweights] = std::string ( "1" );
+  v[HifstConstants::kGrammarLoad] = std::string ( "" );
+  v[HifstConstants::kGrammarStorepatterns] = std::string ( "" );
+  v[HifstConstants::kGrammarStorentorder] = std::string ("");
+  v[HifstConstants::kSsgrammarStore] = std::string ( "" );
+  v[HifstConstants::kSsgrammarAddoovsEnable] = std::string ("no");
+  v[HifstConstants::kSsgrammarAddoovsSourcedeletions] = std::string ("no");
+  const uu::RegistryPO rg ( v );
+  uh::GrammarTask<DataForSentenceSpecificGrammarTask> gt ( rg );
+  std::stringstream ss;
+  ss << "X 3 3 0" << std::endl << "S S_X S_X 0" << std::endl;
+  ss << "X 3 30 0" << std::endl << "X 4 4 0" << std::endl;
+  ss << "X 3_X1_5 3_X1_5 0" << std::endl << "X 3_V1_5 5_V1 0" << std::endl;
+  ss << "S X1 X1 0" << std::endl << "S M1 M1 0" << std::endl;
+  gt.load ( ss );
+  uh::GrammarData& g = *gt.getGrammarData();
+  EXPECT_EQ ( g.sources.size(), 5 );
+  std::size_t begin, end;
+  ASSERT_TRUE ( g.sources.find ( "3_X_5", begin, end ) );
+  EXPECT_EQ ( end - begin, 2 );
+  ASSERT_TRUE ( g.sources.find ( "3", begin, end ) );
+  EXPECT_EQ ( end - begin, 2 );
+  for ( std::size_t k = begin; k < end; ++k )
+    EXPECT_EQ ( g.getRHSSource ( k ), "3" );
+  ASSERT_TRUE ( g.sources.find ( "X", begin, end ) );
+  EXPECT_EQ ( end - begin, 2 );
+  EXPECT_FALSE ( g.sources.find ( "5", begin, end ) );
+  EXPECT_FALSE ( g.sources.find ( "3_X", begin, end ) );
+  std::vector<uh::ssgrammar_rulesmap_t> results;
+  for ( unsigned round = 0; round < 2; ++round ) {
+    //Second round without index, i.e. binary search
+    if ( round ) g.sources.clear();
+    DataForSentenceSpecificGrammarTask d;
+    d.grammar = &g;
+    d.hpinstances["3"].push_back ( std::pair<unsigned, unsigned> ( 0, 0 ) );
+    d.hpinstances["3"].push_back ( std::pair<unsigned, unsigned> ( 2, 0 ) );
+    d.hpinstances["4"].push_back ( std::pair<unsigned, unsigned> ( 1, 0 ) );
+    d.hpinstances["5"].push_back ( std::pair<unsigned, unsigned> ( 3, 0 ) );
+    d.hpinstances["3_X_5"].push_back ( std::pair<unsigned, unsigned> ( 0, 3 ) );
+    d.hpinstances["3_X_5"].push_back ( std::pair<unsigned, unsigned> ( 0, 3 ) );
+    d.hpinstances["X_X"].push_back ( std::pair<unsigned, unsigned> ( 0, 1 ) );
+    d.hpinstances["X"].push_back ( std::pair<unsigned, unsigned> ( 1, 0 ) );
+    uh::SentenceSpecificGrammarTask<DataForSentenceSpecificGrammarTask> ssgt ( rg );
+    ssgt.run ( d );
+    results.push_back ( d.ssgd->rulesWithRhsSpan1 );
+    results.push_back ( d.ssgd->rulesWithRhsSpan2OrMore );
+  }
+  EXPECT_EQ ( results[0][0]["3"].size(), 2 );
+  EXPECT_EQ ( results[0][2]["3"].size(), 2 );
+  EXPECT_EQ ( results[0][1]["4"].size(), 1 );
+  EXPECT_EQ ( results[0][1]["X"].size(), 1 );
+  EXPECT_EQ ( results[0][1]["M"].size(), 1 );
+  EXPECT_EQ ( results[0].find ( 3 ), results[0].end() );
+  EXPECT_EQ ( results[1][0]["3"].size(), 2 );
+  EXPECT_EQ ( results[1][0]["S"].size(), 1 );
+  for ( unsigned k = 0; k < 2; ++k ) {
+    EXPECT_EQ ( results[k].size(), results[k + 2].size() );
+    for ( uh::ssgrammar_rulesmap_t::iterator itx = results[k].begin();
+          itx != results[k].end(); ++itx ) {
+      for ( uh::ssgrammar_firstelementmap_t::iterator itx2 = itx->second.begin();
+            itx2 != itx->second.end(); ++itx2 ) {
+        uh::ssgrammar_listofrules_t a = itx2->second;
+        uh::ssgrammar_listofrules_t b = results[k + 2][itx->first][itx2->first];
+        std::sort ( a.begin(), a.end() );
+        std::sort ( b.begin(), b.end() );
+        EXPECT_TRUE ( a == b );
+      }
+    }
+  }
+}
+
 TEST ( HifstSentenceSpecificGrammarTask, data ) {
   uh::SentenceSpecificGrammarData gd ;
   uh::GrammarTask<DataForSentenceSpecificGrammarTask> gt ( "", "" );
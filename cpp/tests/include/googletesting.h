@@ -54,4 +54,38 @@ inline void ucam::util::init_param_options ( int argc, const char* argv[],
 
 namespace uu = ucam::util;
 
+namespace googletesting {
+
+/**
+ * \brief Writes an arpa file with the given n-grams, one per line
+ * ("logprob<TAB>words[<TAB>backoff]"), in any order.
+ */
+inline void writeArpa ( std::string const& file, std::string const& ngrams ) {
+  std::vector<std::vector<std::string> > byorder;
+  std::istringstream ss ( ngrams );
+  std::string line;
+  while ( std::getline ( ss, line ) ) {
+    std::size_t begin = line.find ( '\t' ) + 1;
+    std::size_t end = std::min ( line.find ( '\t', begin ), line.size() );
+    std::size_t order = std::count ( line.begin() + begin, line.begin() + end, ' ' ) + 1;
+    if ( byorder.size() < order ) byorder.resize ( order );
+    byorder[order - 1].push_back ( line );
+  }
+  uu::oszfstream o ( file );
+  o << std::endl;
+  o << "\\data\\" << std::endl;
+  for ( unsigned k = 0; k < byorder.size(); ++k )
+    o << "ngram " << k + 1 << "=" << byorder[k].size() << std::endl;
+  for ( unsigned k = 0; k < byorder.size(); ++k ) {
+    o << std::endl;
+    o << "\\" << k + 1 << "-grams:" << std::endl;
+    for ( unsigned j = 0; j < byorder[k].size(); ++j ) o << byorder[k][j] << std::endl;
+  }
+  o << std::endl;
+  o << "\\end\\" << std::endl;
+  o.close();
+};
+
+}
+
 #endif
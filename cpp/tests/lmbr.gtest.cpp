@@ -37,9 +37,11 @@
 #include "fstutils.extractngrams.hpp"
 
 #include "taskinterface.hpp"
+#include "multithreading.hpp"
 
 #include "data.lmbr.hpp"
 #include "task.lmbr.hpp"
+#include "data-main.lmbr.hpp"
 
 namespace bfs = boost::filesystem;
 
@@ -152,6 +154,132 @@ TEST (lmbr, computeapplyposteriors) {
   delete output;
 }
 
+/// Decoding the alpha values at once must give the same hypotheses, in the same order, as one by one.
+TEST (lmbr, gridthreads) {
+  std::vector<std::string> hyps[2];
+  std::basic_string<float> alphas[2];
+  fst::VectorFst<fst::StdArc> lattices[2];
+  for (unsigned t = 0; t < 2; ++t) {
+    fst::VectorFst<fst::StdArc> myfst;
+    for (unsigned k = 0; k < 8; ++k) myfst.AddState();
+    myfst.SetStart (0);
+    myfst.AddArc (0, fst::StdArc (1, 1, 37.6542969, 1) );
+    myfst.AddArc (1, fst::StdArc (933, 933, 0, 2) );
+    myfst.AddArc (2, fst::StdArc (18, 18, 4.73828125, 3) );
+    myfst.AddArc (2, fst::StdArc (150, 150, 0, 4) );
+    myfst.AddArc (2, fst::StdArc (226, 226, 5.52148438, 5) );
+    myfst.AddArc (2, fst::StdArc (508, 508, 8.22265625, 5) );
+    myfst.AddArc (3, fst::StdArc (24, 24, 0, 5) );
+    myfst.AddArc (5, fst::StdArc (150, 150, 0, 6) );
+    myfst.AddArc (4, fst::StdArc (2, 2, 0, 7) );
+    myfst.AddArc (4, fst::StdArc (23, 23, 5.90625, 7) );
+    myfst.AddArc (6, fst::StdArc (2, 2, 0, 7) );
+    myfst.SetFinal (7, fst::StdArc::Weight::One() );
+    unordered_map<std::string, boost::any> v;
+    v[HifstConstants::kLmbrMinorder] = unsigned (1);
+    v[HifstConstants::kLmbrMaxorder] = unsigned (4);
+    v[HifstConstants::kLmbrAlpha] = std::string ("0.1,0.2,0.3,0.4,0.5,0.6,0.7,0.8,0.9,1");
+    v[HifstConstants::kLmbrWps] = std::string ("-0.5,-0.25,0,0.25,0.5");
+    v[HifstConstants::kLmbrP] = float (0.4);
+    v[HifstConstants::kLmbrR] = float (0.6);
+    v[HifstConstants::kLmbrT] = float (10);
+    v[HifstConstants::kLmbrPreprune] = std::numeric_limits<float>::max();
+    v[HifstConstants::kLmbrWriteonebest] = std::string ("");
+    v[HifstConstants::kLmbrGridthreads] = unsigned (t ? 4 : 1);
+    const uu::RegistryPO rg (v);
+    ul::LmbrTask<ul::LmbrTaskData> lmbr (rg);
+    ul::lmbrtunedata onebest;
+    ul::LmbrTaskData d;
+    d.lmbronebest = &onebest;
+    d.fsts[HifstConstants::kLmbrLoadEvidencespace] = &myfst;
+    lmbr.run (d);
+    ASSERT_EQ (onebest.hyp.size(), 50);
+    hyps[t] = onebest.hyp;
+    alphas[t] = onebest.alpha;
+    lattices[t] = *static_cast<fst::VectorFst<fst::StdArc> *>
+                  (d.fsts[HifstConstants::kLmbrWritedecoder]);
+  }
+  EXPECT_TRUE (alphas[0] == alphas[1]);
+  EXPECT_TRUE (hyps[0] == hyps[1]);
+  EXPECT_TRUE (fst::Equal (lattices[0], lattices[1]) );
+}
+
+namespace googletesting {
+
+///Former map-based forward pass of ComputePosteriors, to compare with.
+inline void mapLabelPosteriors ( fst::VectorFst<fst::LogArc> const& fst
+                                 , std::map<fst::LogArc::Label, fst::LogArc::Weight>& ngmAlphaFinal ) {
+  typedef std::map<fst::LogArc::Label, fst::LogArc::Weight> LabelToWeightMapper;
+  std::vector<fst::LogArc::Weight> fwdAlpha ( fst.NumStates(), fst::LogArc::Weight::Zero() );
+  std::vector<LabelToWeightMapper> ngmAlpha ( fst.NumStates() );
+  fwdAlpha[fst.Start()] = fst::LogArc::Weight::One();
+  for ( fst::StateIterator< fst::VectorFst<fst::LogArc> > si ( fst ); !si.Done();
+        si.Next() ) {
+    fst::LogArc::StateId q = si.Value();
+    for ( fst::ArcIterator< fst::VectorFst<fst::LogArc> > ai ( fst, q ); !ai.Done();
+          ai.Next() ) {
+      fst::LogArc a = ai.Value();
+      fwdAlpha[a.nextstate] = Plus ( fwdAlpha[a.nextstate], Times ( fwdAlpha[q], a.weight ) );
+      if ( ngmAlpha[a.nextstate].find ( a.ilabel ) == ngmAlpha[a.nextstate].end() )
+        ngmAlpha[a.nextstate][a.ilabel] = fst::LogArc::Weight::Zero();
+      ngmAlpha[a.nextstate][a.ilabel] = Plus ( ngmAlpha[a.nextstate][a.ilabel],
+                                        Times ( fwdAlpha[q], a.weight ) );
+      for ( LabelToWeightMapper::const_iterator it = ngmAlpha[q].begin();
+            it != ngmAlpha[q].end(); ++it ) {
+        if ( it->first == a.ilabel ) continue;
+        if ( ngmAlpha[a.nextstate].find ( it->first ) == ngmAlpha[a.nextstate].end() )
+          ngmAlpha[a.nextstate][it->first] = fst::LogArc::Weight::Zero();
+        ngmAlpha[a.nextstate][it->first] = Plus ( ngmAlpha[a.nextstate][it->first],
+                                           Times ( it->second, a.weight ) );
+      }
+    }
+    if ( fst.Final ( q ) != fst::LogArc::Weight::Zero() ) {
+      for ( LabelToWeightMapper::const_iterator it = ngmAlpha[q].begin();
+            it != ngmAlpha[q].end(); ++it ) {
+        if ( ngmAlphaFinal.find ( it->first ) == ngmAlphaFinal.end() )
+          ngmAlphaFinal[it->first] = fst::LogArc::Weight::Zero();
+        ngmAlphaFinal[it->first] = Plus ( ngmAlphaFinal[it->first],
+                                          Times ( it->second, fst.Final ( q ) ) );
+      }
+    }
+    ngmAlpha[q].clear();
+  }
+};
+
+}
+
+///Benchmark: flat and map-based posterior forward pass on a large lattice must match exactly.
+TEST ( lmbr, forwardlabelposteriors_benchmark ) {
+  const unsigned numstates = 2000, width = 4, numlabels = 800;
+  fst::VectorFst<fst::LogArc> lat;
+  for ( unsigned k = 0; k < numstates; ++k ) lat.AddState();
+  lat.SetStart ( 0 );
+  for ( unsigned k = 0; k + 1 < numstates; ++k )
+    for ( unsigned j = 1; j <= width && k + j < numstates; ++j ) {
+      unsigned label = ( k * 7 + j * 13 ) % numlabels + 1;
+      lat.AddArc ( k, fst::LogArc ( label, label, 0.5f * j + ( k % 3 ) * 0.25f, k + j ) );
+    }
+  lat.SetFinal ( numstates - 1, fst::LogArc::Weight::One() );
+  lat.SetFinal ( numstates - 2, 1.5f );
+  clock_t t0 = clock();
+  std::map<fst::LogArc::Label, fst::LogArc::Weight> expected;
+  googletesting::mapLabelPosteriors ( lat, expected );
+  clock_t t1 = clock();
+  std::vector<std::pair<fst::LogArc::Label, fst::LogArc::Weight> > finalmass;
+  ul::forwardLabelPosteriors ( lat, finalmass );
+  clock_t t2 = clock();
+  FORCELINFO ( "Posteriors of " << numlabels << " labels over " << numstates
+               << " states: map-based=" << ( t1 - t0 ) * 1000.0 / CLOCKS_PER_SEC
+               << "ms, flat=" << ( t2 - t1 ) * 1000.0 / CLOCKS_PER_SEC << "ms" );
+  ASSERT_EQ ( finalmass.size(), expected.size() );
+  std::map<fst::LogArc::Label, fst::LogArc::Weight>::const_iterator itx =
+    expected.begin();
+  for ( unsigned k = 0; k < finalmass.size(); ++k, ++itx ) {
+    EXPECT_EQ ( finalmass[k].first, itx->first );
+    EXPECT_EQ ( finalmass[k].second.Value(), itx->second.Value() );
+  }
+}
+
 #ifndef GMAINTEST
 
 int main ( int argc, char **argv ) {
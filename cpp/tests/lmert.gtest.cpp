@@ -0,0 +1,320 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use these files except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Copyright 2012 - Gonzalo Iglesias, Adrià de Gispert, William Byrne
+
+/** \file
+ * \brief Unit testing: lattice MERT envelopes
+ */
+
+#include <openfst.h>
+#include <googletesting.h>
+
+#ifndef GMAINTEST
+#include "main.custom_assert.hpp"
+#include "main.logger.hpp"
+#endif
+
+#include "params.hpp"
+#include "tropical-sparse-tuple-weight.h"
+#include "tropical-sparse-tuple-weight-decls.h"
+#include "tropical-sparse-tuple-weight-funcs.h"
+
+#include "addresshandler.hpp"
+#include "fstio.hpp"
+
+#include "lmert.hpp"
+
+namespace bfs = boost::filesystem;
+
+namespace googletesting {
+
+///Former envelope computation, copying hypotheses and feature vectors along with each line.
+class CopyMertLattice {
+ public:
+  struct Line {
+    Line() : x ( -std::numeric_limits<double>::infinity() ), y ( 0.0 ),
+      m ( 0.0 ) {}
+    double x;
+    double y;
+    double m;
+    ucam::lmert::SentenceIdx t;
+    TupleArc32::Weight weight;
+  };
+
+  std::vector<Line> finalLines;
+  ///Bytes allocated for the lines propagated
+  std::size_t bytes;
+
+  CopyMertLattice ( fst::VectorFst<TupleArc32> const& fst
+                    , ucam::lmert::PARAMS32 const& lambda
+                    , ucam::lmert::PARAMS32 const& direction )
+    : bytes ( 0 )
+    , lambda_ ( lambda )
+    , direction_ ( direction ) {
+    envelopes_.resize ( fst.NumStates() + 1 );
+    envelopes_[fst.Start()].push_back ( Line() );
+    for ( fst::StateIterator< fst::VectorFst<TupleArc32> > si ( fst ); !si.Done();
+          si.Next() ) {
+      TupleArc32::StateId s = si.Value();
+      sweepLine ( envelopes_[s] );
+      for ( fst::ArcIterator< fst::VectorFst<TupleArc32> > ai ( fst, s ); !ai.Done();
+            ai.Next() )
+        propagate ( s, ai.Value().nextstate, ai.Value().weight, ai.Value().ilabel );
+      if ( fst.Final ( s ) != TupleArc32::Weight::Zero() )
+        propagate ( s, fst.NumStates(), fst.Final ( s ) );
+      envelopes_[s].clear();
+    }
+    sweepLine ( envelopes_[fst.NumStates()] );
+    finalLines = envelopes_[fst.NumStates()];
+  }
+
+ private:
+  std::vector<std::vector<Line> > envelopes_;
+  ucam::lmert::PARAMS32 lambda_;
+  ucam::lmert::PARAMS32 direction_;
+
+  static bool bySlope ( Line const& a, Line const& b ) {
+    return a.m < b.m;
+  }
+
+  void sweepLine ( std::vector<Line>& lines ) {
+    sort ( lines.begin(), lines.end(), bySlope );
+    int j = 0;
+    for ( std::size_t i = 0; i < lines.size(); i++ ) {
+      Line l = lines[i];
+      l.x = -std::numeric_limits<double>::infinity();
+      if ( 0 < j ) {
+        if ( lines[j - 1].m == l.m ) {
+          if ( l.y <= lines[j - 1].y ) continue;
+          --j;
+        }
+        while ( 0 < j ) {
+          l.x = ( l.y - lines[j - 1].y ) / ( lines[j - 1].m - l.m );
+          if ( lines[j - 1].x < l.x ) break;
+          --j;
+        }
+        if ( 0 == j ) l.x = -std::numeric_limits<double>::infinity();
+      }
+      lines[j++] = l;
+    }
+    lines.resize ( j );
+  }
+
+  void propagate ( TupleArc32::StateId src, TupleArc32::StateId trg
+                   , TupleArc32::Weight const& weight, ucam::lmert::Wid w = 0 ) {
+    for ( std::size_t i = 0; i < envelopes_[src].size(); ++i ) {
+      Line line ( envelopes_[src][i] );
+      line.y += fst::DotProduct<float> ( weight, lambda_ ) * -1;
+      line.m += fst::DotProduct<float> ( weight, direction_ ) * -1;
+      line.weight = fst::Times<float> ( weight, line.weight );
+      if ( w != 0 ) line.t.push_back ( w );
+      bytes += sizeof ( Line ) + line.t.capacity() * sizeof ( ucam::lmert::Wid );
+      envelopes_[trg].push_back ( line );
+    }
+  }
+};
+
+///Clipped n-gram hits and closest reference length, counting n-grams with maps.
+inline ucam::fsttools::BleuStats naiveBleuStats ( std::vector<ucam::lmert::SentenceIdx> const& refs
+    , ucam::lmert::SentenceIdx const& hyp ) {
+  typedef std::map<ucam::lmert::SentenceIdx, unsigned> Counts;
+  ucam::fsttools::BleuStats bs;
+  unsigned best = 0;
+  for ( unsigned k = 0; k < refs.size(); ++k ) {
+    int d = std::abs ( ( int ) refs[k].size() - ( int ) hyp.size() );
+    int bestd = std::abs ( ( int ) refs[best].size() - ( int ) hyp.size() );
+    if ( d < bestd || ( d == bestd && refs[k].size() < refs[best].size() ) ) best = k;
+  }
+  bs.refLength_ = refs[best].size();
+  for ( unsigned n = 0; n < 4 && n < hyp.size(); ++n ) {
+    Counts h, r;
+    for ( unsigned i = 0; i + n < hyp.size(); ++i )
+      ++h[ucam::lmert::SentenceIdx ( hyp.begin() + i, hyp.begin() + i + n + 1 )];
+    for ( unsigned k = 0; k < refs.size(); ++k ) {
+      Counts rk;
+      for ( unsigned i = 0; i + n < refs[k].size(); ++i )
+        ++rk[ucam::lmert::SentenceIdx ( refs[k].begin() + i, refs[k].begin() + i + n + 1 )];
+      for ( Counts::const_iterator it = rk.begin(); it != rk.end(); ++it )
+        r[it->first] = std::max ( r[it->first], it->second );
+    }
+    bs.tots_[n] = hyp.size() - n;
+    for ( Counts::const_iterator it = h.begin(); it != h.end(); ++it )
+      bs.hits_[n] += std::min ( it->second, r.count ( it->first ) ? r[it->first] : 0 );
+  }
+  return bs;
+}
+
+///Dense lattice: numstates states, each one with width arcs to each of the next two states.
+inline void denseTuningLattice ( fst::VectorFst<TupleArc32>& lat
+                                 , unsigned numstates, unsigned width ) {
+  lat.DeleteStates();
+  for ( unsigned k = 0; k < numstates; ++k ) lat.AddState();
+  lat.SetStart ( 0 );
+  for ( unsigned k = 0; k + 1 < numstates; ++k )
+    for ( unsigned d = 1; d <= 2 && k + d < numstates; ++d )
+      for ( unsigned j = 0; j < width; ++j ) {
+        TupleArc32::Weight w;
+        w.Push ( 1, 0.1f * ( ( k * 7 + j * 3 + d ) % 11 ) );
+        w.Push ( 2, 0.2f * ( ( k * 5 + j * 13 ) % 7 ) );
+        w.Push ( 3, 0.5f * d );
+        unsigned label = ( j == 0 && d == 2 ) ? 0 : ( k * width + j ) % 500 + 3;
+        lat.AddArc ( k, TupleArc32 ( label, label, w, k + d ) );
+      }
+  lat.SetFinal ( numstates - 1, TupleArc32::Weight::One() );
+}
+
+}
+
+namespace ul = ucam::lmert;
+
+///Envelopes must be exactly those computed copying hypotheses along each line.
+inline void checkEnvelope ( fst::VectorFst<TupleArc32>& lat
+                            , ul::PARAMS32 const& lambda
+                            , ul::PARAMS32 const& direction
+                            , std::string const& name ) {
+  clock_t t0 = clock();
+  googletesting::CopyMertLattice expected ( lat, lambda, direction );
+  clock_t t1 = clock();
+  ul::MertLattice<TupleArc32> ml ( &lat, lambda, direction );
+  clock_t t2 = clock();
+  ul::MertEnvelope<TupleArc32> const& env = ml.finalEnvelope;
+  FORCELINFO ( "Envelope of " << name << " (" << lat.NumStates() << " states, "
+               << env.lines.size() << " lines): copying="
+               << ( t1 - t0 ) * 1000.0 / CLOCKS_PER_SEC << "ms, "
+               << expected.bytes / 1024 << "KB; back-pointers="
+               << ( t2 - t1 ) * 1000.0 / CLOCKS_PER_SEC << "ms, "
+               << env.paths->Bytes() / 1024 << "KB, "
+               << env.paths->Size() << " back-pointers kept" );
+  ASSERT_EQ ( env.lines.size(), expected.finalLines.size() );
+  // Only back-pointers on the paths of the final lines are kept
+  EXPECT_LE ( env.paths->Size(), env.lines.size() * ( lat.NumStates() + 1 ) );
+  ul::SentenceIdx h;
+  for ( std::size_t k = 0; k < env.lines.size(); ++k ) {
+    EXPECT_EQ ( env.lines[k].x, expected.finalLines[k].x );
+    EXPECT_EQ ( env.lines[k].y, expected.finalLines[k].y );
+    EXPECT_EQ ( env.lines[k].m, expected.finalLines[k].m );
+    env.Hypothesis ( k, h );
+    EXPECT_EQ ( h, expected.finalLines[k].t );
+    EXPECT_TRUE ( fst::ApproxEqual ( env.Weight ( k ), expected.finalLines[k].weight ) );
+  }
+}
+
+///Compacting keeps the hypotheses of live back-pointers only
+TEST ( lmert, mertpaths_compact ) {
+  fst::VectorFst<TupleArc32> lat;
+  googletesting::denseTuningLattice ( lat, 3, 2 );
+  ul::MertPaths<TupleArc32> paths ( &lat );
+  int a = paths.Add ( -1, 0, 0 );
+  int dead = paths.Add ( a, 1, 0 );
+  int b = paths.Add ( a, 1, 1 );
+  int c = paths.Add ( b, 2, ul::kMertFinalArc );
+  int start = -1;
+  paths.Add ( dead, 2, ul::kMertFinalArc );
+  ul::SentenceIdx hb, hc, h;
+  paths.Hypothesis ( b, hb );
+  paths.Hypothesis ( c, hc );
+  TupleArc32::Weight wc = paths.PathWeight ( c );
+  std::vector<int*> live;
+  live.push_back ( &b );
+  live.push_back ( &c );
+  live.push_back ( &start );
+  paths.Compact ( live );
+  EXPECT_EQ ( paths.Size(), 3 );
+  EXPECT_EQ ( start, -1 );
+  paths.Hypothesis ( b, h );
+  EXPECT_EQ ( h, hb );
+  paths.Hypothesis ( c, h );
+  EXPECT_EQ ( h, hc );
+  EXPECT_TRUE ( fst::ApproxEqual ( paths.PathWeight ( c ), wc ) );
+}
+
+TEST ( lmert, envelope_benchmark ) {
+  ul::PARAMS32 lambda, direction;
+  lambda.push_back ( 1.0f );
+  lambda.push_back ( 0.5f );
+  lambda.push_back ( -0.3f );
+  direction.push_back ( 0.2f );
+  direction.push_back ( -1.0f );
+  direction.push_back ( 0.7f );
+  fst::VectorFst<TupleArc32> lat;
+  googletesting::denseTuningLattice ( lat, 400, 6 );
+  checkEnvelope ( lat, lambda, direction, "dense lattice" );
+  // Tuning lattices of the lmert regression test, if run from scripts/tests
+  ucam::util::PatternAddress<unsigned> input ( "data/lmert/VECFEA/?.fst.gz" );
+  for ( unsigned k = 1; k <= 5 && bfs::exists ( input ( k ) ); ++k ) {
+    boost::scoped_ptr< fst::VectorFst<TupleArc32> > vlat (
+      fst::VectorFstRead<TupleArc32> ( input ( k ) ) );
+    fst::TopSort ( &*vlat );
+    ul::PARAMS32 vlambda ( lambda ), vdirection ( direction );
+    vlambda.resize ( 12, 0.1f );
+    vdirection.resize ( 12, 0.05f );
+    checkEnvelope ( *vlat, vlambda, vdirection, input ( k ) );
+  }
+}
+
+TEST ( lmert, incrementalbleustats ) {
+  {
+    ucam::util::oszfstream o ( "myrefs" );
+    o << "3 4 5 3 4 5 6" << std::endl << "10 11 12" << std::endl;
+    ucam::util::oszfstream o2 ( "myrefs2" );
+    o2 << "3 4 5 6 7 3 4" << std::endl << "12 10 11 12 10 11" << std::endl;
+  }
+  std::vector<std::vector<ul::SentenceIdx> > refs ( 2 );
+  ul::SentenceIdx r;
+  r.push_back ( 3 ); r.push_back ( 4 ); r.push_back ( 5 ); r.push_back ( 3 );
+  r.push_back ( 4 ); r.push_back ( 5 ); r.push_back ( 6 );
+  refs[0].push_back ( r );
+  r.clear();
+  r.push_back ( 3 ); r.push_back ( 4 ); r.push_back ( 5 ); r.push_back ( 6 );
+  r.push_back ( 7 ); r.push_back ( 3 ); r.push_back ( 4 );
+  refs[0].push_back ( r );
+  r.clear();
+  r.push_back ( 10 ); r.push_back ( 11 ); r.push_back ( 12 );
+  refs[1].push_back ( r );
+  r.clear();
+  r.push_back ( 12 ); r.push_back ( 10 ); r.push_back ( 11 ); r.push_back ( 12 );
+  r.push_back ( 10 ); r.push_back ( 11 );
+  refs[1].push_back ( r );
+  ucam::fsttools::BleuScorer bs ( "myrefs,myrefs2", "", 0, true, "" );
+  ucam::fsttools::BleuScorer cached ( "myrefs,myrefs2", "", 3, true, "" );
+  for ( ul::Sid sid = 0; sid < 2; ++sid ) {
+    ucam::fsttools::IncrementalBleuHits hits ( bs.RefNGrams ( sid ) );
+    ucam::fsttools::IncrementalBleuHits hits2 ( cached.RefNGrams ( sid ) );
+    ul::SentenceIdx hyp;
+    // Hypotheses sharing prefixes of varying length, as consecutive envelope lines do
+    for ( unsigned k = 0; k < 200; ++k ) {
+      hyp.resize ( ( k * 7 ) % ( hyp.size() + 1 ) );
+      for ( unsigned j = 0; j < ( k * 3 ) % 5; ++j )
+        hyp.push_back ( ( k * 5 + j * 3 ) % 7 + 3 * ( sid + 1 ) );
+      ucam::fsttools::BleuStats expected = googletesting::naiveBleuStats ( refs[sid], hyp );
+      ucam::fsttools::BleuStats got = bs.SentenceBleuStats ( sid, hyp, hits );
+      ucam::fsttools::BleuStats got2 = cached.SentenceBleuStats ( sid, hyp, hits2 );
+      EXPECT_EQ ( got.tots_, expected.tots_ );
+      EXPECT_EQ ( got.hits_, expected.hits_ );
+      EXPECT_EQ ( got.refLength_, expected.refLength_ );
+      EXPECT_EQ ( got2.hits_, expected.hits_ );
+      EXPECT_EQ ( got2.tots_, expected.tots_ );
+      EXPECT_EQ ( bs.SentenceBleuStats ( sid, hyp ).hits_, expected.hits_ );
+    }
+  }
+  bfs::remove ( bfs::path ( "myrefs" ) );
+  bfs::remove ( bfs::path ( "myrefs2" ) );
+}
+
+#ifndef GMAINTEST
+
+int main ( int argc, char **argv ) {
+  ::testing::InitGoogleTest ( &argc, argv );
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -26,6 +26,7 @@
 #endif
 
 #include "multithreading.hpp"
+#include "main-run.hifst.translationcost.hpp"
 
 extern bool user_check_ok;
 
@@ -50,8 +51,202 @@ struct functor_test2 {
   };
 };
 
+struct functor_reorder {
+  uu::ReorderBuffer<std::stringstream> *rb_;
+  std::size_t position_;
+  functor_reorder ( uu::ReorderBuffer<std::stringstream> *rb, std::size_t position )
+    : rb_ ( rb ), position_ ( position ) {};
+  void operator() () {
+    boost::this_thread::sleep ( boost::posix_time::milliseconds ( ( 7 * position_ ) % 5 ) );
+    rb_->push ( position_, uu::toString ( position_ ) );
+  };
+};
+
+struct functor_counted {
+  uu::JobCounter *jc_;
+  unsigned *out_;
+  functor_counted ( uu::JobCounter *jc, unsigned *out ) : jc_ ( jc ), out_ ( out ) {};
+  void operator() () {
+    boost::this_thread::sleep ( boost::posix_time::milliseconds ( 2 ) );
+    *out_ = 1;
+    jc_->done();
+  };
+};
+
+/// Blocks the thread running it until the gate is opened
+struct Gate {
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  bool open;
+  Gate() : open ( false ) {};
+};
+
+struct functor_ordered {
+  Gate *gate_;
+  boost::mutex *mutex_;
+  std::vector<unsigned> *out_;
+  unsigned id_;
+  functor_ordered ( Gate *gate, boost::mutex *mutex, std::vector<unsigned> *out
+                    , unsigned id )
+    : gate_ ( gate ), mutex_ ( mutex ), out_ ( out ), id_ ( id ) {};
+  void operator() () {
+    if ( gate_ != NULL ) {
+      boost::unique_lock<boost::mutex> lock ( gate_->mutex );
+      while ( !gate_->open ) gate_->cond.wait ( lock );
+    }
+    boost::lock_guard<boost::mutex> lock ( *mutex_ );
+    out_->push_back ( id_ );
+  };
+};
+
+/// Synthetic batch: short sentences of 3 to 9 words, and every tenth one of 40 words.
+inline std::vector<std::string> skewedSentences() {
+  std::vector<std::string> sentences;
+  for ( unsigned k = 0; k < 40; ++k ) {
+    unsigned length = ( k % 10 == 9 ) ? 40 : 3 + k % 7;
+    std::string s = "w";
+    for ( unsigned j = 1; j < length; ++j ) s += " w";
+    sentences.push_back ( s );
+  }
+  return sentences;
+};
+
+/**
+ * \brief Time at which the last job finishes if each of numworkers workers
+ * takes the next job in order as soon as it is free, with no waits between jobs.
+ */
+inline double simulatedMakespan ( std::vector<double> const& costs
+                                  , std::vector<unsigned> const& order
+                                  , unsigned numworkers ) {
+  std::priority_queue<double, std::vector<double>, std::greater<double> >
+  freeat;
+  for ( unsigned k = 0; k < numworkers; ++k ) freeat.push ( 0 );
+  double makespan = 0;
+  for ( unsigned k = 0; k < order.size(); ++k ) {
+    double end = freeat.top() + costs[order[k]];
+    freeat.pop();
+    freeat.push ( end );
+    makespan = std::max ( makespan, end );
+  }
+  return makespan;
+};
+
 };
 
+/// Pending jobs must run most expensive first, and in submission order if equally expensive.
+TEST ( multithreading, prioritythreadpool ) {
+  googletesting::Gate gate;
+  boost::mutex mutex;
+  std::vector<unsigned> out;
+  {
+    uu::PriorityThreadPool<googletesting::functor_ordered> tp ( 1 );
+    // Keeps the only thread busy until all jobs have been submitted
+    tp ( googletesting::functor_ordered ( &gate, &mutex, &out, 0 ), 100 );
+    unsigned costs[] = {1, 5, 3, 5, 2};
+    for ( unsigned k = 0; k < 5; ++k )
+      tp ( googletesting::functor_ordered ( NULL, &mutex, &out, k + 1 ), costs[k] );
+    {
+      boost::lock_guard<boost::mutex> lock ( gate.mutex );
+      gate.open = true;
+    }
+    gate.cond.notify_all();
+  }
+  unsigned expected[] = {0, 2, 4, 3, 5, 1};
+  ASSERT_EQ ( out.size(), 6u );
+  for ( unsigned k = 0; k < 6; ++k ) EXPECT_EQ ( out[k], expected[k] );
+}
+
+/// Makespan of a skewed batch in cost units, in submission order vs in the order the pool runs it.
+TEST ( multithreading, prioritythreadpool_makespan ) {
+  std::vector<std::string> sentences = googletesting::skewedSentences();
+  std::vector<double> costs;
+  std::vector<unsigned> fifo;
+  for ( unsigned k = 0; k < sentences.size(); ++k ) {
+    costs.push_back ( ucam::hifst::estimateTranslationCost ( sentences[k] ) );
+    fifo.push_back ( k );
+  }
+  // Jobs record the order in which the pool dispatches them
+  googletesting::Gate gate;
+  boost::mutex mutex;
+  std::vector<unsigned> out;
+  {
+    uu::PriorityThreadPool<googletesting::functor_ordered> tp ( 1 );
+    tp ( googletesting::functor_ordered ( &gate, &mutex, &out, sentences.size() )
+         , std::numeric_limits<double>::max() );
+    for ( unsigned k = 0; k < sentences.size(); ++k )
+      tp ( googletesting::functor_ordered ( NULL, &mutex, &out, k ), costs[k] );
+    {
+      boost::lock_guard<boost::mutex> lock ( gate.mutex );
+      gate.open = true;
+    }
+    gate.cond.notify_all();
+  }
+  ASSERT_EQ ( out.size(), sentences.size() + 1 );
+  EXPECT_EQ ( out[0], sentences.size() );
+  std::vector<unsigned> ordered ( out.begin() + 1, out.end() );
+  const unsigned numworkers = 4;
+  double fifomakespan = googletesting::simulatedMakespan ( costs, fifo, numworkers );
+  double orderedmakespan = googletesting::simulatedMakespan ( costs, ordered
+                           , numworkers );
+  // No schedule ends before the longest job, nor before the work is evenly shared
+  double total = 0;
+  for ( unsigned k = 0; k < costs.size(); ++k ) total += costs[k];
+  double lowerbound = std::max ( total / numworkers
+                                 , *std::max_element ( costs.begin(), costs.end() ) );
+  // 69444 units in submission order, 66465 longest first, and at least 66452.75
+  EXPECT_EQ ( fifomakespan, 69444 );
+  EXPECT_EQ ( orderedmakespan, 66465 );
+  EXPECT_LT ( orderedmakespan, fifomakespan );
+  EXPECT_LE ( orderedmakespan, lowerbound * 1.001 );
+}
+
+/// wait() must return only once all counted jobs are done, while the pool is still alive.
+TEST ( multithreading, jobcounter ) {
+  uu::TrivialThreadPool tp ( 3 );
+  for ( unsigned round = 0; round < 2; ++round ) {
+    std::vector<unsigned> out ( 20, 0 );
+    uu::JobCounter jc;
+    jc.add ( out.size() );
+    for ( unsigned k = 0; k < out.size(); ++k )
+      tp ( googletesting::functor_counted ( &jc, &out[k] ) );
+    jc.wait();
+    for ( unsigned k = 0; k < out.size(); ++k ) EXPECT_EQ ( out[k], 1 );
+  }
+}
+
+/// Strings must come out in submission order, and never more than window in flight.
+TEST ( multithreading, reorderbuffer ) {
+  std::stringstream o, expected;
+  {
+    uu::ReorderBuffer<std::stringstream> rb ( &o, 3 );
+    uu::TrivialThreadPool tp ( 4 );
+    for ( unsigned k = 0; k < 50; ++k ) {
+      std::size_t position = rb.reserve();
+      EXPECT_EQ ( position, k );
+      tp ( googletesting::functor_reorder ( &rb, position ) );
+      expected << k << std::endl;
+    }
+    rb.wait();
+  }
+  EXPECT_EQ ( o.str(), expected.str() );
+}
+
+/// Without newlines, strings are written as they are, e.g. several lines of a lattice or none at all.
+TEST ( multithreading, reorderbuffer_nonewline ) {
+  std::stringstream o;
+  {
+    uu::ReorderBuffer<std::stringstream> rb ( &o, 2, false );
+    std::size_t p0 = rb.reserve(), p1 = rb.reserve();
+    rb.push ( p1, "b\nc\n" );
+    EXPECT_EQ ( o.str(), "" );
+    rb.push ( p0, "" );
+    EXPECT_EQ ( rb.reserve(), 2u );
+    rb.push ( 2, "d\n" );
+    rb.wait();
+  }
+  EXPECT_EQ ( o.str(), "b\nc\nd\n" );
+}
+
 /// This test shows that functors are actually being passed by value to the threadpool, not per reference.
 /// First time i use these cool asio libraries, so I might be missing something here, but
 /// it initially looks like a limitation of asio::ioservice::post method (cannot pass by reference)
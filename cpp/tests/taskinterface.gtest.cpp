@@ -214,6 +214,36 @@ TEST ( TaskInterface, idx_chainrun ) {
   EXPECT_EQ ( d.v[3], 2 );
 }
 
+///Trivial task class counting runs since last reset
+template<class Data>
+class TaskCount: public uu::TaskInterface<Data> {
+ public:
+  unsigned count_;
+  TaskCount() : count_ ( 0 ) {};
+  bool run ( Data& d ) {
+    ++count_;
+    return false;
+  };
+  void reset() {
+    count_ = 0;
+  };
+};
+
+///Test that chainreset reaches all tasks in the chain.
+TEST ( TaskInterface, chainreset ) {
+  TaskCount<DataTest1> t1;
+  TaskCount<DataTest1> *t2 = new TaskCount<DataTest1>;
+  t1 ( new Task3<DataTest1> ) ( t2 );
+  DataTest1 d;
+  t1.chainrun ( d );
+  t1.chainrun ( d );
+  EXPECT_EQ ( t1.count_, 2 );
+  EXPECT_EQ ( t2->count_, 2 );
+  t1.chainreset();
+  EXPECT_EQ ( t1.count_, 0 );
+  EXPECT_EQ ( t2->count_, 0 );
+}
+
 };
 
 #ifndef GMAINTEST
@@ -289,6 +289,136 @@ TEST(tropicalsparseweight, removeKthWeight) {
 
 
 
+namespace googletesting {
+
+///Plus as it was before scores were cached: two dot products per call.
+inline TupleArc32::Weight uncachedPlus ( TupleArc32::Weight const& w1
+    , TupleArc32::Weight const& w2 ) {
+  std::vector<float> const& params = TupleArc32::Weight::Params();
+  return fst::DotProduct ( w1, params ) < fst::DotProduct ( w2, params ) ? w1 : w2;
+}
+
+///Merges repeated features with a map, as MergeFeatures used to.
+inline TupleArc32::Weight mapMergeFeatures ( TupleArc32::Weight const& w ) {
+  std::map<int, float> ws;
+  for ( fst::SparseTupleWeightIterator<FeatureWeight32, int> it ( w ); !it.Done();
+        it.Next() )
+    ws[it.Value().first] += it.Value().second.Value();
+  TupleArc32::Weight result;
+  for ( std::map<int, float>::const_iterator itx = ws.begin(); itx != ws.end();
+        ++itx )
+    result.Push ( itx->first, itx->second );
+  return result;
+}
+
+///Weight with a few random features amongst the first numfeatures, possibly repeated.
+inline TupleArc32::Weight randomSparseWeight ( unsigned numfeatures ) {
+  TupleArc32::Weight w;
+  unsigned n = 1 + rand() % 4;
+  for ( unsigned k = 0; k < n; ++k )
+    w.Push ( 1 + rand() % numfeatures, ( rand() % 1000 ) / 100.0f );
+  return w;
+}
+
+inline std::string toString ( TupleArc32::Weight const& w ) {
+  std::stringstream ss;
+  ss << w;
+  return ss.str();
+}
+
+}
+
+TEST ( tropicalsparseweight, cachedscore ) {
+  using namespace fst;
+  typedef TupleArc32::Weight Weight;
+  std::vector<float> saved = Weight::Params();
+  std::vector<float> params;
+  params.push_back ( 1.0f );
+  params.push_back ( 2.0f );
+  params.push_back ( 3.0f );
+  Weight::SetParams ( params );
+  Weight w1, w2;
+  w1.Push ( 1, 1.0f );
+  w1.Push ( 2, 1.0f );
+  w2.Push ( 3, 2.0f );
+  EXPECT_EQ ( w1.Score(), 3.0f );
+  Weight w3 = Times ( w1, w2 );
+  EXPECT_EQ ( w3.Score(), 9.0f );
+  EXPECT_EQ ( w3.Score(), DotProduct ( w3, Weight::Params() ) );
+  EXPECT_EQ ( toString ( Plus ( w1, w3 ) ), toString ( w1 ) );
+  // New parameters: cached scores are stale
+  params[2] = -3.0f;
+  Weight::SetParams ( params );
+  EXPECT_EQ ( w3.Score(), -3.0f );
+  EXPECT_EQ ( toString ( Plus ( w1, w3 ) ), toString ( w3 ) );
+  // Modifying a weight drops its score
+  w3.UpdateScore();
+  w3.Push ( 1, 10.0f );
+  EXPECT_EQ ( w3.Score(), 7.0f );
+  // Features beyond the parameters: nothing cached, no failure until actually scored
+  Weight w4;
+  w4.Push ( 5, 1.0f );
+  w4.UpdateScore();
+  Weight::SetParams ( std::vector<float>() ); // flat
+  EXPECT_EQ ( w4.Score(), 1.0f );
+  Weight::SetParams ( saved );
+}
+
+TEST ( tropicalsparseweight, mergefeatures ) {
+  srand ( 7 );
+  fst::SparseFeatureMerger<float> merger;
+  for ( unsigned k = 0; k < 1000; ++k ) {
+    TupleArc32::Weight w = googletesting::randomSparseWeight ( 5 );
+    for ( unsigned j = 0; j < k % 3; ++j )
+      w = Times ( w, googletesting::randomSparseWeight ( 5 ) );
+    for ( fst::SparseTupleWeightIterator<FeatureWeight32, int> it ( w ); !it.Done();
+          it.Next() )
+      merger.Add ( it.Value().first, it.Value().second.Value() );
+    TupleArc32::Weight merged;
+    merger.Flush ( &merged );
+    EXPECT_EQ ( googletesting::toString ( merged )
+                , googletesting::toString ( googletesting::mapMergeFeatures ( w ) ) );
+  }
+}
+
+///Shortest distance-like workload: each Plus compares weights produced by Times.
+TEST ( tropicalsparseweight, plus_benchmark ) {
+  typedef TupleArc32::Weight Weight;
+  std::vector<float> saved = Weight::Params();
+  std::vector<float> params;
+  for ( unsigned k = 0; k < 12; ++k ) params.push_back ( 0.1f * ( k + 1 ) );
+  Weight::SetParams ( params );
+  srand ( 11 );
+  std::vector<Weight> arcs;
+  for ( unsigned k = 0; k < 2000; ++k )
+    arcs.push_back ( googletesting::randomSparseWeight ( params.size() ) );
+  std::vector<Weight> distances;
+  for ( unsigned k = 0; k < 200; ++k )
+    distances.push_back ( Times ( arcs[k], arcs[k + 1] ) );
+  clock_t t0 = clock();
+  std::vector<Weight> expected ( distances );
+  for ( unsigned j = 0; j < arcs.size(); ++j )
+    for ( unsigned k = 0; k < expected.size(); ++k )
+      expected[k] = googletesting::uncachedPlus ( expected[k]
+                    , Times ( distances[k], arcs[j] ) );
+  clock_t t1 = clock();
+  std::vector<Weight> actual ( distances );
+  for ( unsigned j = 0; j < arcs.size(); ++j )
+    for ( unsigned k = 0; k < actual.size(); ++k )
+      actual[k] = Plus ( actual[k], Times ( distances[k], arcs[j] ) );
+  clock_t t2 = clock();
+  FORCELINFO ( "Plus of " << arcs.size() * distances.size()
+               << " sparse weights: two dot products="
+               << ( t1 - t0 ) * 1000.0 / CLOCKS_PER_SEC << "ms, cached="
+               << ( t2 - t1 ) * 1000.0 / CLOCKS_PER_SEC << "ms" );
+  for ( unsigned k = 0; k < actual.size(); ++k )
+    EXPECT_EQ ( googletesting::toString ( actual[k] )
+                , googletesting::toString ( expected[k] ) );
+  Weight::SetParams ( saved );
+}
+
+
+
 
 #ifndef GMAINTEST
 
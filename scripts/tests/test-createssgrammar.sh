@@ -3,6 +3,7 @@
 source runtests.sh
 
 createssgrammar=$CAM_SMT_DIR/bin/createssgrammar.${TGTBINMK}.bin
+compilegrammar=$CAM_SMT_DIR/bin/compilegrammar.${TGTBINMK}.bin
 range=1:4
 
 BASEDIR=TESTFILES/`basename $0 | sed -e 's:.sh::g'`
@@ -44,6 +45,31 @@ test_0002_createssgrammar_execute(){
 }
 
 
+test_0003_createssgrammar_compiledgrammar(){
+
+    mkdir -p $BASEDIR/compiled
+    $compilegrammar \
+	--grammar.load=data/rules/trivial.grammar \
+	--output=$BASEDIR/trivial.grammar.bin &>/dev/null
+
+    $createssgrammar \
+	--range=$range \
+	--grammar.load=$BASEDIR/trivial.grammar.bin \
+	--ssgrammar.store=$BASEDIR/compiled/?.gz \
+	--source.load=data/source.text  &>/dev/null
+
+    seqrange=`echo $range | sed -e 's:\:: :g'`
+    for k in `seq $seqrange`; do
+	b=`zcat $BASEDIR/compiled/$k.gz | sort | md5sum`;
+	r=`zcat $REFDIR/$k.gz | sort | md5sum`;
+	if [ "$b" == "$r" ] ; then echo ; else echo 0; return; fi
+    done
+
+# Ok!
+    echo 1
+}
+
+
 ################### STEP 2
 ################### RUN ALL TESTS AND PRINT MESSAGES
 
@@ -111,6 +111,38 @@ test_0004_translate-wmaps() {
 
 
 
+### Two clients on persistent connections, sending batches of sentences
+### to a server with two workers.
+test_0005_translate-server-client-batches() {
+    mkdir -p $BASEDIR
+    $hifst --server.enable=yes  --server.port=1205 --logger.verbose --nthreads=2 \
+	--grammar.load=$grammar \
+	--lm.load=$languagemodel \
+	&>$BASEDIR/server-batches.log &
+    pid=$!
+
+    echo "hifst server pid=$pid"
+    sleep 1
+    $hifstclient \
+	--host=localhost --port=1205 --batch=2 \
+	--source.load=$tstidx \
+	--target.store=$BASEDIR/translation-batches.1.txt &> /dev/null &
+    cpid=$!
+    $hifstclient \
+	--host=localhost --port=1205 --batch=3 --target.window=3 \
+	--source.load=$tstidx \
+	--target.store=$BASEDIR/translation-batches.2.txt &> /dev/null
+    wait $cpid
+
+    kill -9 $pid
+    wait $pid 2>/dev/null
+
+    if ! diff $BASEDIR/translation-batches.1.txt $REFDIR/translation.txt ; then echo 0; return ; fi;
+    if diff $BASEDIR/translation-batches.2.txt $REFDIR/translation.txt ; then echo 1; return ; fi;
+    echo 0;
+}
+
+
 ################### STEP 2
 ################### RUN ALL TESTS AND PRINT MESSAGES
 
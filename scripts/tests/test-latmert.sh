@@ -50,6 +50,35 @@ test_0002_latmert_run() {
 }
 
 
+test_0003_latmert_boundedcache() {
+    mkdir -p $BASEDIR/expanded
+# Same run as above, keeping at most 1MB of lattices in memory
+# and expanded lattices on disk. The first run writes them, the second one reads them.
+    for k in 1 2; do
+    $latmert \
+	--seed=1366599232 \
+	--search=random \
+	--random_axes \
+	--random_directions=1 \
+	--threads=24 \
+	--lattice_cache_mb=1 \
+	--expanded_lats=$BASEDIR/expanded/%idx%.fst \
+	--algorithm=lmert \
+	--idxlimits=$range \
+	--lambda=file:$paramsfile \
+	--direction=axes \
+	--print_precision=6 \
+	--write_parameters=$BASEDIR/newparams.boundedcache.$k \
+	--lats=$veclatsdir/%idx%.fst.gz \
+	$reffile &>/dev/null
+	if diff $BASEDIR/newparams.boundedcache.$k $REFDIR/newparams ; then echo ; else echo 0; return ; fi
+    done
+    if [ ! -f $BASEDIR/expanded/1.fst ]; then echo 0; return; fi
+
+###Success
+    echo 1
+}
+
 
 ################### STEP 2
 ################### RUN ALL TESTS AND PRINT MESSAGES
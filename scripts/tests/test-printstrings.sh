@@ -92,6 +92,39 @@ test_0006_printstrings_sbleu(){
     echo 1
 }
 
+# Several threads must print exactly the same, in the same order
+test_0008_printstrings_tuplearc_multithreaded(){
+
+    mkdir -p tmp
+    $printstrings \
+	--input=data/fsts/vec/?.fst.gz \
+	--range=1,2 --semiring=tuplearc -u -w -n 1000 --nthreads=2 \
+	--tuplearc.weights=1.0,0.583849,0.980097,2.592360,-0.781944,0.016636,20.602014,-3.373619,-3.064969,0.727553,0.120692,0.331922 \
+	> $BASEDIR/output.0008 2> /dev/null
+
+    if diff $BASEDIR/output.0008 $REFDIR/output.0004 ; then echo ; else echo 0; return ; fi
+
+    echo 1
+}
+
+test_0009_printstrings_sbleu_multiple_files_multithreaded(){
+
+    mkdir -p tmp
+    $printstrings \
+	--input=data/lmert/VECFEA/?.fst.gz \
+	--range=1,2 --semiring=tuplearc -u -n 10 --nthreads=2 \
+	--tuplearc.weights=1,0.697263,0.396540,2.270819,-0.145200,0.038503,29.518480,-3.411896,-3.732196,0.217455,0.041551,0.060136 \
+        --sbleu \
+        --int_refs=data/lmert/refs \
+	--output=$BASEDIR/output.0009.?.gz 2> /dev/null
+
+    zcat $BASEDIR/output.0009.1.gz $BASEDIR/output.0009.2.gz > $BASEDIR/output.0009
+
+    if diff $BASEDIR/output.0009 $REFDIR/output.0006 ; then echo ; else echo 0; return ; fi
+
+    echo 1
+}
+
 
 ################### STEP 2
 ################### RUN ALL TESTS AND PRINT MESSAGES